@@ -15,6 +15,7 @@ CPPSRC += $(TARGET_SRC_PATH)/coap.cpp
 CPPSRC += $(TARGET_SRC_PATH)/handshake.cpp
 CPPSRC += $(TARGET_SRC_PATH)/spark_protocol.cpp
 CPPSRC += $(TARGET_SRC_PATH)/events.cpp
+CPPSRC += $(TARGET_SRC_PATH)/subscriptions.cpp
 CPPSRC += $(TARGET_SRC_PATH)/spark_protocol_functions.cpp
 CPPSRC += $(TARGET_SRC_PATH)/communication_dynalib.cpp
 CPPSRC += $(TARGET_SRC_PATH)/dsakeygen.cpp
@@ -26,8 +27,13 @@ CPPSRC += $(TARGET_SRC_PATH)/lightssl_protocol.cpp
 CPPSRC += $(TARGET_SRC_PATH)/protocol.cpp
 CPPSRC += $(TARGET_SRC_PATH)/messages.cpp
 CPPSRC += $(TARGET_SRC_PATH)/chunked_transfer.cpp
+CPPSRC += $(TARGET_SRC_PATH)/delta_patch.cpp
 CPPSRC += $(TARGET_SRC_PATH)/coap_channel.cpp
 CPPSRC += $(TARGET_SRC_PATH)/publisher.cpp
+CPPSRC += $(TARGET_SRC_PATH)/publish_queue.cpp
+CPPSRC += $(TARGET_SRC_PATH)/event_batch.cpp
+CPPSRC += $(TARGET_SRC_PATH)/publish_throttle.cpp
+CPPSRC += $(TARGET_SRC_PATH)/compression.cpp
 CPPSRC += $(TARGET_SRC_PATH)/protocol_defs.cpp
 CPPSRC += $(TARGET_SRC_PATH)/mbedtls_communication.cpp
 CPPSRC += $(TARGET_SRC_PATH)/communication_diagnostic.cpp
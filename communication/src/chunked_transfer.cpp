@@ -21,6 +21,9 @@
 #include "service_debug.h"
 #include "coap.h"
 
+#include <memory>
+#include <new>
+
 namespace particle { namespace protocol {
 
 ProtocolError ChunkedTransfer::handle_update_begin(
@@ -58,11 +61,55 @@ ProtocolError ChunkedTransfer::handle_update_begin(
         file.file_address = 0;
         file.chunk_address = 0;
     }
+    delta_update = (flags & DELTA_UPDATE);
+    if (delta_update)
+    {
+        // the patch descriptor follows the file descriptor
+        if (actual_len >= 32)
+        {
+            patch.length = decode_uint32(queue + 20);
+            patch.source_length = decode_uint32(queue + 24);
+            patch.source_crc = decode_uint32(queue + 28);
+        }
+        else
+        {
+            memset(&patch, 0, sizeof(patch));
+        }
+    }
+    FileTransfer::Patch* const update_patch = delta_update ? &patch : NULL;
+    // only transfers that request missing chunks can be resumed
+    const int transfer_id_offset = delta_update ? 32 : 20;
+    transfer_state.size = 0;
+    if ((flags & RESUMABLE) && (flags & FAST_OTA) && actual_len >= transfer_id_offset + 4)
+    {
+        // identifies the transfer with the parameters as they were sent by the server
+        memset(&transfer_state, 0, sizeof(transfer_state));
+        transfer_state.size = sizeof(transfer_state);
+        transfer_state.chunk_size = file.chunk_size;
+        transfer_state.transfer_id = decode_uint32(queue + transfer_id_offset);
+        transfer_state.file_length = file.file_length;
+        transfer_state.file_address = file.file_address;
+        transfer_state.store = file.store;
+        transfer_state.delta_update = delta_update;
+        if (delta_update)
+            transfer_state.patch = patch;
+    }
     // check the parameters only
-    bool success = !callbacks->prepare_for_firmware_update(file, 1, NULL);
+    bool success = !callbacks->prepare_for_firmware_update(file, DRY_RUN, update_patch);
+    if (success)
+    {
+        success = transfer_chunk_count(file.chunk_size) < MAX_CHUNKS;
+    }
+    if (success && delta_update)
+    {
+        // a patch chunk has to fit a target offset and at least one record
+        success = patch.length > 0 && file.chunk_size > 4;
+    }
     if (success)
     {
-        success = file.chunk_count(file.chunk_size) < MAX_CHUNKS;
+        // the received chunks are tracked for the whole transfer, so the bitmap can't live in a message buffer
+        bitmap.reset(new (std::nothrow) uint8_t[(transfer_chunk_count(file.chunk_size) + 7) / 8]);
+        success = bool(bitmap);
     }
     Message response;
     channel.response(message, response, 16);
@@ -76,28 +123,37 @@ ProtocolError ChunkedTransfer::handle_update_begin(
 
     if (success)
     {
-        if (!callbacks->prepare_for_firmware_update(file, 0, NULL))
+        chunk_size = file.chunk_size; // save chunk size since the descriptor size is overwritten
+        Message updateReady;
+        error = channel.create(updateReady);
+        if (error)
+            return error;
+
+        // the chunks received before the transfer was interrupted are already stored
+        const bool resumed = is_resumable() && restore_transfer_state();
+        if (!callbacks->prepare_for_firmware_update(file, resumed ? RESUME : 0, update_patch))
         {
-            DEBUG("starting file length %d chunks %d chunk_size %d",
-                    file.file_length, file.chunk_count(file.chunk_size),
-                    file.chunk_size);
+            DEBUG("starting file length %d chunks %d chunk_size %d delta %d resumed %d",
+                    file.file_length, transfer_chunk_count(file.chunk_size),
+                    file.chunk_size, delta_update, resumed);
             last_chunk_millis = callbacks->millis();
             chunk_index = 0;
-            chunk_size = file.chunk_size; // save chunk size since the descriptor size is overwritten
+            chunks_since_save = 0;
+            missed_chunks_pending = 0;
+            missed_chunks_window = 0;
             updating = 1;
-            Message updateReady;
-            channel.create(updateReady);
-            // updateReady will have the maximum capacity
-            int offset = updateReady.capacity() - chunk_bitmap_size();
-            bitmap = queue+offset; // this relies on the fact that we know the channels use a static buffer
 
             // when not in fast OTA mode, the chunk missing buffer is set to 1 since the protocol
             // handles missing chunks one by one. Also we don't know the actual size of the file to
             // know the correct size of the bitmap.
-            set_chunks_received(flags & 1 ? 0 : 0xFF);
+            if (!resumed)
+                set_chunks_received(flags & FAST_OTA ? 0 : 0xFF);
 
             // send update_reaady - use fast OTA if available
-            size_t size = Messages::update_ready(updateReady.buf(), 0, token, (flags & 0x1), channel.is_unreliable());
+            uint8_t ready_flags = (flags & FAST_OTA) ? FAST_OTA_ENABLED : 0;
+            if (resumed)
+                ready_flags |= TRANSFER_RESUMED;
+            size_t size = Messages::update_ready(updateReady.buf(), 0, token, ready_flags, channel.is_unreliable());
             updateReady.set_length(size);
             updateReady.set_confirm_received(true);
             error = channel.send(updateReady);
@@ -116,8 +172,9 @@ ProtocolError ChunkedTransfer::handle_chunk(token_t token, Message& message,
     chunk_count++;
 
     Message response;
-    ProtocolError error;
-    channel.response(message, response, 16);
+    ProtocolError error = channel.response(message, response, 16);
+    if (error)
+        return error;
     uint8_t* queue = message.buf();
 
     DEBUG("chunk");
@@ -162,7 +219,9 @@ ProtocolError ChunkedTransfer::handle_chunk(token_t token, Message& message,
             return error;
     }
 
-    channel.create(response);
+    error = channel.create(response);
+    if (error)
+        return error;
 
     if (0xFF == queue[payload])
     {
@@ -170,7 +229,7 @@ ProtocolError ChunkedTransfer::handle_chunk(token_t token, Message& message,
         const uint8_t* chunk = queue + payload;
         file.chunk_size = message.length() - payload;
         file.chunk_address = file.file_address + (chunk_index * chunk_size);
-        if (chunk_index >= MAX_CHUNKS)
+        if (chunk_index >= MAX_CHUNKS || (delta_update && chunk_index >= transfer_chunk_count(chunk_size)))
         {
             WARN("invalid chunk index %d", chunk_index);
             return NO_ERROR;
@@ -180,16 +239,34 @@ ProtocolError ChunkedTransfer::handle_chunk(token_t token, Message& message,
         bool crc_valid = (crc == given_crc);
         DEBUG("chunk idx=%d crc=%d fast=%d updating=%d", chunk_index,
                 crc_valid, fast_ota, updating);
-        if (crc_valid)
+        if (crc_valid && delta_update && save_patch_chunk(chunk, file.chunk_size) != NO_ERROR)
+        {
+            // handled like a corrupted chunk so that the server can send it again
+            crc_valid = false;
+        }
+        else if (crc_valid && !delta_update)
         {
             callbacks->save_firmware_chunk(file, chunk, NULL);
+        }
+        bool request_missing = false;
+        if (crc_valid)
+        {
             if (!fast_ota)
             {
                 // message is confirmable for regular OTA or when
                 response_size = Messages::chunk_received(response.buf(), 0, token, ChunkReceivedCode::OK, channel.is_unreliable());
             }
+            const bool duplicate = is_chunk_received(chunk_index);
             flag_chunk_received(chunk_index);
             chunk_index++;
+            if (!duplicate)
+            {
+                if (is_resumable() && ++chunks_since_save >= TRANSFER_STATE_SAVE_INTERVAL)
+                    save_transfer_state();
+                // keep the window of requested chunks full rather than waiting for the next UpdateDone
+                if (updating == 2 && missed_chunks_pending > 0)
+                    request_missing = (--missed_chunks_pending <= missed_chunks_window / 2);
+            }
         }
         else
         {
@@ -207,6 +284,12 @@ ProtocolError ChunkedTransfer::handle_chunk(token_t token, Message& message,
             if (error)
                 return error;
         }
+        if (request_missing)
+        {
+            error = send_missing_chunks(channel, missed_chunks_window - missed_chunks_pending, missed_chunk_index + 1);
+            if (error)
+                return error;
+        }
     }
     return NO_ERROR;
 }
@@ -229,11 +312,13 @@ size_t ChunkedTransfer::notify_update_done(Message& msg, Message& response, Mess
 
     if (code) {
         // Send as ACK
-        channel.response(msg, response, msgsz);
+        if (channel.response(msg, response, msgsz))
+            return 0;
         msgsz = Messages::coded_ack(response.buf(), token, code, 0, 0, (uint8_t*)buf, data_len);
     } else {
         // Send as UpdateDone
-        channel.create(response, msgsz);
+        if (channel.create(response, msgsz))
+            return 0;
         msgsz = Messages::update_done(response.buf(), 0, (uint8_t*)buf, data_len, channel.is_unreliable());
     }
 
@@ -257,8 +342,9 @@ ProtocolError ChunkedTransfer::handle_update_done(token_t token, Message& messag
     message_id_t msg_id = CoAP::message_id(queue);
     response.set_id(msg_id);
 
-    notify_update_done(message, response, channel, token,
-                       missing ? ChunkReceivedCode::BAD : ChunkReceivedCode::OK);
+    if (!notify_update_done(message, response, channel, token,
+                            missing ? ChunkReceivedCode::BAD : ChunkReceivedCode::OK))
+        return INVALID_STATE;
     ProtocolError error = channel.send(response);
     // how can we busy wait for the server to ACK this?
     if (error)
@@ -274,6 +360,7 @@ ProtocolError ChunkedTransfer::handle_update_done(token_t token, Message& messag
     {
         DEBUG("update done - all done!");
         reset_updating();
+        discard_transfer_state();
         callbacks->finish_firmware_update(file, UpdateFlag::SUCCESS, NULL);
     }
     else
@@ -283,7 +370,12 @@ ProtocolError ChunkedTransfer::handle_update_done(token_t token, Message& messag
         chunk_index_t increase = std::max(unsigned(chunk_count*0.2), (unsigned)MINIMUM_CHUNK_INCREASE);	// ensure always some growth
         chunk_index_t resend_chunk_count = std::min(unsigned(chunk_count+increase), (unsigned)MISSED_CHUNKS_TO_SEND);
         chunk_count = 0;
+        if (is_resumable())
+            save_transfer_state();
 
+        // the chunks still pending from the previous round were lost
+        missed_chunks_pending = 0;
+        missed_chunks_window = resend_chunk_count;
         error = send_missing_chunks(channel, resend_chunk_count);
         last_chunk_millis = callbacks->millis();
     }
@@ -291,12 +383,14 @@ ProtocolError ChunkedTransfer::handle_update_done(token_t token, Message& messag
 }
 
 ProtocolError ChunkedTransfer::send_missing_chunks(MessageChannel& channel,
-        size_t count)
+        size_t count, chunk_index_t start)
 {
     size_t sent = 0;
-    chunk_index_t idx = 0;
+    chunk_index_t idx = start;
     Message message;
-    channel.create(message, 7+(count*2));
+    ProtocolError error = channel.create(message, 7+(count*2));
+    if (error)
+        return error;
 
     uint8_t* buf = message.buf();
     buf[0] = 0x40; // confirmable, no token
@@ -321,10 +415,11 @@ ProtocolError ChunkedTransfer::send_missing_chunks(MessageChannel& channel,
     if (sent > 0)
     {
         DEBUG("Sent %d missing chunks", sent);
+        missed_chunks_pending += sent;
         size_t message_size = 7 + (sent * 2);
         message.set_length(message_size);
         message.set_confirm_received(true); // send synchronously
-        ProtocolError error = channel.send(message);
+        error = channel.send(message);
         if (error)
             return error;
     }
@@ -344,15 +439,83 @@ void ChunkedTransfer::cancel()
     {
         // was updating but had an error, inform the client
         WARN("handle received message failed - aborting transfer");
+        if (is_resumable())
+            save_transfer_state();
         callbacks->finish_firmware_update(file, 0, NULL);
     }
 }
 
 
+ProtocolError ChunkedTransfer::save_patch_chunk(const uint8_t* chunk, size_t size)
+{
+    struct Target : DeltaPatch::Callbacks
+    {
+        ChunkedTransfer::Callbacks* callbacks;
+        FileTransfer::Descriptor file;
+
+        int read_source(uint32_t offset, uint8_t* data, size_t length) override
+        {
+            return callbacks->read_firmware(offset, data, length, NULL);
+        }
+
+        int write_target(uint32_t offset, const uint8_t* data, size_t length) override
+        {
+            file.chunk_address = file.file_address + offset;
+            file.chunk_size = length;
+            return callbacks->save_firmware_chunk(file, data, NULL);
+        }
+    } target;
+    target.callbacks = callbacks;
+    target.file = file;
+    const DeltaPatch delta(patch.source_length, file.file_length);
+    ProtocolError error = delta.apply(chunk, size, target);
+    if (error)
+        WARN("patch chunk %d failed: %d", chunk_index, error);
+    return error;
+}
+
+bool ChunkedTransfer::restore_transfer_state()
+{
+    const size_t bitmap_size = chunk_bitmap_size();
+    const size_t size = sizeof(TransferState) + bitmap_size;
+    std::unique_ptr<uint8_t[]> buf(new (std::nothrow) uint8_t[size]);
+    if (!buf)
+        return false;
+    const int restored = callbacks->restore_transfer_state(buf.get(), size, NULL);
+    if (restored != int(size) || memcmp(buf.get(), &transfer_state, sizeof(TransferState)))
+        return false;
+    memcpy(chunk_bitmap(), buf.get() + sizeof(TransferState), bitmap_size);
+    LOG(INFO, "Resuming transfer %08x", (unsigned)transfer_state.transfer_id);
+    return true;
+}
+
+void ChunkedTransfer::save_transfer_state()
+{
+    chunks_since_save = 0;
+    const size_t bitmap_size = chunk_bitmap_size();
+    const size_t size = sizeof(TransferState) + bitmap_size;
+    std::unique_ptr<uint8_t[]> buf(new (std::nothrow) uint8_t[size]);
+    if (!buf)
+        return;
+    memcpy(buf.get(), &transfer_state, sizeof(TransferState));
+    memcpy(buf.get() + sizeof(TransferState), chunk_bitmap(), bitmap_size);
+    if (callbacks->save_transfer_state(buf.get(), size, NULL))
+        WARN("unable to save the transfer state");
+}
+
+void ChunkedTransfer::discard_transfer_state()
+{
+    if (is_resumable())
+    {
+        callbacks->save_transfer_state(NULL, 0, NULL);
+        transfer_state.size = 0;
+    }
+}
+
 chunk_index_t ChunkedTransfer::next_chunk_missing(chunk_index_t start)
 {
     chunk_index_t chunk = NO_CHUNKS_MISSING;
-    chunk_index_t chunks = file.chunk_count(chunk_size);
+    chunk_index_t chunks = transfer_chunk_count(chunk_size);
     chunk_index_t idx = start;
     for (; idx < chunks; idx++)
     {
@@ -370,7 +533,7 @@ void ChunkedTransfer::set_chunks_received(uint8_t value)
 {
     size_t bytes = chunk_bitmap_size();
     if (bytes)
-        memset(bitmap, value, bytes);
+        memset(chunk_bitmap(), value, bytes);
 }
 
 
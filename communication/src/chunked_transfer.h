@@ -24,6 +24,8 @@
 #include "message_channel.h"
 #include "system_tick_hal.h"
 #include "messages.h"
+#include "delta_patch.h"
+#include <memory>
 
 namespace particle
 {
@@ -43,7 +45,7 @@ public:
 	struct Callbacks
 	{
 		  /**
-		   * @param flags 1 dry run only.
+		   * @param flags 1 dry run only. 2 resumes an interrupted transfer, keeping the data already stored.
 		   * Return 0 on success.
 		   */
 		  virtual int prepare_for_firmware_update(FileTransfer::Descriptor& data, uint32_t flags, void*)=0;
@@ -64,17 +66,87 @@ public:
 		  virtual uint32_t calculate_crc(const unsigned char *buf, uint32_t buflen)=0;
 
 		  virtual system_tick_t millis()=0;
+
+		  /**
+		   * Reads the installed module that a delta patch applies to. The module is selected by
+		   * prepare_for_firmware_update() given the patch descriptor.
+		   * @return 0 on success
+		   */
+		  virtual int read_firmware(uint32_t offset, uint8_t* data, size_t length, void*)=0;
+
+		  /**
+		   * Persists the state of a transfer so that it can be resumed after a reset.
+		   * A length of 0 discards the persisted state.
+		   * @return 0 on success
+		   */
+		  virtual int save_transfer_state(const void* data, size_t length, void*)=0;
+
+		  /**
+		   * Restores the persisted state of a transfer.
+		   * @return the number of bytes restored
+		   */
+		  virtual int restore_transfer_state(void* data, size_t max_length, void*)=0;
+	};
+
+	enum PrepareFlag
+	{
+		DRY_RUN = 0x01,
+		RESUME = 0x02
 	};
 
+	/**
+	 * Flags of the UpdateBegin request.
+	 */
+	enum UpdateBeginFlag
+	{
+		FAST_OTA = 0x01,
+		/**
+		 * The chunks are a delta patch, see DeltaPatch. The request also carries
+		 * a FileTransfer::Patch descriptor.
+		 */
+		DELTA_UPDATE = 0x02,
+		/**
+		 * The transfer can be resumed if it's interrupted. The request also carries a transfer ID
+		 * that identifies the file, after the other descriptors.
+		 */
+		RESUMABLE = 0x04
+	};
+
+	/**
+	 * Flags of the UpdateReady response.
+	 */
+	enum UpdateReadyFlag
+	{
+		FAST_OTA_ENABLED = 0x01,
+		/**
+		 * An interrupted transfer was resumed. The server may go on with UpdateDone right away
+		 * so that only the missing chunks are requested.
+		 */
+		TRANSFER_RESUMED = 0x02
+	};
+
+	/**
+	 * The number of chunks received between saving the state of a resumable transfer.
+	 */
+	static const unsigned TRANSFER_STATE_SAVE_INTERVAL = 32;
+
 private:
 	uint8_t updating;
 	system_tick_t last_chunk_millis;
 	FileTransfer::Descriptor file;
 
 	/**
-	 * Marks the indices of missed chunks not yet requested.
+	 * The index of the last missed chunk requested.
 	 */
 	chunk_index_t missed_chunk_index;
+	/**
+	 * The number of missed chunks requested and not received yet.
+	 */
+	chunk_index_t missed_chunks_pending;
+	/**
+	 * The number of missed chunks kept in flight while the missing chunks are requested.
+	 */
+	chunk_index_t missed_chunks_window;
 	/**
 	 * Number of chunks received in the current flight of chunks (between UpdateBegin|UpdateDone and UpdateDone)
 	 */
@@ -83,23 +155,73 @@ private:
 	unsigned short chunk_index;
 	unsigned short chunk_size;
 
-	uint8_t* bitmap;
+	std::unique_ptr<uint8_t[]> bitmap;
 
 	Callbacks* callbacks;
 
 	bool fast_ota_override;
 	bool fast_ota_value;
 
+	/**
+	 * Set when the chunks are a delta patch rather than the file itself.
+	 */
+	bool delta_update;
+	FileTransfer::Patch patch;
+
+	/**
+	 * The persisted state of a resumable transfer. The chunk bitmap follows.
+	 */
+	struct __attribute__((packed)) TransferState
+	{
+		uint16_t size;
+		uint16_t chunk_size;
+		uint32_t transfer_id;
+		uint32_t file_length;
+		uint32_t file_address;
+		uint8_t store;
+		uint8_t delta_update;
+		uint16_t reserved;
+		FileTransfer::Patch patch;
+	};
+
+	/**
+	 * Identifies the current transfer when it's resumable. The size is 0 otherwise.
+	 */
+	TransferState transfer_state;
+	unsigned chunks_since_save;
+
+	ProtocolError save_patch_chunk(const uint8_t* chunk, size_t size);
+
+	bool is_resumable() const
+	{
+		return transfer_state.size != 0;
+	}
+
+	bool restore_transfer_state();
+	void save_transfer_state();
+	void discard_transfer_state();
+
 protected:
 
+	/**
+	 * The number of chunks transferred. When the file is sent as a delta patch, this is
+	 * the number of chunks in the patch.
+	 */
+	unsigned transfer_chunk_count(unsigned chunk_size)
+	{
+		if (delta_update)
+			return chunk_size ? (patch.length + chunk_size - 1) / chunk_size : 0;
+		return file.chunk_count(chunk_size);
+	}
+
 	unsigned chunk_bitmap_size()
 	{
-		return (file.chunk_count(chunk_size) + 7) / 8;
+		return (transfer_chunk_count(chunk_size) + 7) / 8;
 	}
 
 	uint8_t* chunk_bitmap()
 	{
-		return bitmap;
+		return bitmap.get();
 	}
 
 	inline void flag_chunk_received(chunk_index_t idx)
@@ -118,8 +240,10 @@ protected:
 public:
 
 	ChunkedTransfer() :
-			updating(false), callbacks(nullptr), fast_ota_override(false), fast_ota_value(true)
+			updating(false), missed_chunks_pending(0), missed_chunks_window(0), callbacks(nullptr),
+			fast_ota_override(false), fast_ota_value(true), delta_update(false), chunks_since_save(0)
 	{
+		transfer_state.size = 0;
 	}
 
 	void init(Callbacks* callbacks)
@@ -130,7 +254,7 @@ public:
 	void reset()
 	{
 		reset_updating();
-		bitmap = nullptr;
+		bitmap.reset();
 		last_chunk_millis = 0;
 	}
 
@@ -140,7 +264,7 @@ public:
 
 	ProtocolError handle_update_done(token_t token, Message& message, MessageChannel& channel);
 
-	ProtocolError send_missing_chunks(MessageChannel& channel, size_t count);
+	ProtocolError send_missing_chunks(MessageChannel& channel, size_t count, chunk_index_t start=0);
 
 	ProtocolError idle(MessageChannel& channel);
 
@@ -163,6 +287,9 @@ public:
 
 	void cancel();
 
+	/**
+	 * Prepares the response to UpdateDone. Returns the size of the response, or 0 if it couldn't be created.
+	 */
 	size_t notify_update_done(Message& msg, Message& response, MessageChannel& channel, token_t token,
 							  uint8_t code);
 
@@ -110,7 +110,10 @@ namespace CoAPOption {
 		NONE = 0,
 		LOCATION_PATH = 8,
 		URI_PATH = 11,
-		URI_QUERY = 15
+		CONTENT_FORMAT = 12,
+		MAX_AGE = 14,
+		URI_QUERY = 15,
+		BLOCK2 = 23
 	};
 }
 
@@ -26,6 +26,145 @@ namespace particle { namespace protocol {
 
 uint16_t CoAPMessage::message_count = 0;
 
+const size_t CoAPMessagePool::SMALL_BLOCK_SIZE;
+const size_t CoAPMessagePool::FULL_BLOCK_SIZE;
+
+CoAPMessagePool* CoAPMessagePool::pools = nullptr;
+
+CoAPMessagePool CoAPMessage::default_pool;
+
+CoAPMessagePool::CoAPMessagePool(uint8_t max_in_flight) :
+		small(COAP_MESSAGE_SMALL_COUNT),
+		full(COAP_MESSAGE_POOL_SIZE(max_in_flight)),
+		failures(0),
+		next(pools)
+{
+	pools = this;
+}
+
+CoAPMessagePool::~CoAPMessagePool()
+{
+	for (CoAPMessagePool** p = &pools; *p; p = &(*p)->next)
+	{
+		if (*p==this)
+		{
+			*p = next;
+			break;
+		}
+	}
+}
+
+void* CoAPMessagePool::allocate(size_t size)
+{
+	void* ptr = nullptr;
+	if (size<=SMALL_BLOCK_SIZE)
+		ptr = small.allocate();
+	if (!ptr && size<=FULL_BLOCK_SIZE)
+		ptr = full.allocate();
+	if (!ptr)
+		failures++;
+	return ptr;
+}
+
+bool CoAPMessagePool::deallocate(void* ptr)
+{
+	if (small.owns(ptr))
+		small.deallocate(ptr);
+	else if (full.owns(ptr))
+		full.deallocate(ptr);
+	else
+		return false;
+	return true;
+}
+
+void CoAPMessagePool::release(void* ptr)
+{
+	for (CoAPMessagePool* pool = pools; pool; pool = pool->next)
+	{
+		if (pool->deallocate(ptr))
+			return;
+	}
+	SPARK_ASSERT(false);	// not allocated from a message pool
+}
+
+void* CoAPMessage::operator new(size_t size) noexcept
+{
+	return default_pool.allocate(size);
+}
+
+void* CoAPMessage::operator new(size_t size, size_t data_len) noexcept
+{
+	return default_pool.allocate(size+data_len);
+}
+
+void* CoAPMessage::operator new(size_t size, CoAPMessagePool& pool, size_t data_len) noexcept
+{
+	return pool.allocate(size+data_len);
+}
+
+void CoAPMessage::operator delete(void* ptr)
+{
+	if (ptr)
+		CoAPMessagePool::release(ptr);
+}
+
+void CoAPMessageStore::remove_slot(size_t slot)
+{
+	if (is_in_flight(messages[slot]))
+		in_flight_count--;
+	messages[slot] = nullptr;
+	count--;
+	// shift back any following messages in the probe sequence that would otherwise be unreachable
+	size_t next = next_slot(slot);
+	while (messages[next])
+	{
+		const size_t home = home_slot(messages[next]->get_id());
+		// the message can move to the empty slot unless its home slot lies cyclically in (slot, next]
+		const bool stays = (slot<=next) ? (slot<home && home<=next) : (slot<home || home<=next);
+		if (!stays)
+		{
+			messages[slot] = messages[next];
+			messages[next] = nullptr;
+			slot = next;
+		}
+		next = next_slot(next);
+	}
+}
+
+bool CoAPMessageStore::evict_oldest()
+{
+	int oldest = -1;
+	for (size_t slot=0; slot<CAPACITY; slot++)
+	{
+		const CoAPMessage* msg = messages[slot];
+		if (msg && (msg->is_expiring() || !msg->is_request()) && (oldest<0 || is_older(msg, messages[oldest])))
+			oldest = slot;
+	}
+	if (oldest<0)
+		return false;
+	DEBUG("evicting message id=%x", messages[oldest]->get_id());
+	CoAPMessage* msg = messages[oldest];
+	remove_slot(oldest);
+	delete msg;
+	return true;
+}
+
+CoAPMessage* CoAPMessageStore::create_message(Message& msg, size_t data_len, bool evict)
+{
+	for (;;)
+	{
+		// a message with the same ID is replaced, so doesn't need a free slot
+		if (count<CAPACITY || from_id(msg.get_id()))
+		{
+			CoAPMessage* coapmsg = CoAPMessage::create(msg, data_len, pool);
+			if (coapmsg)
+				return coapmsg;
+		}
+		if (!evict || !evict_oldest())
+			return nullptr;
+	}
+}
+
 ProtocolError CoAPMessageStore::send_message(CoAPMessage* msg, Channel& channel)
 {
 	Message m((uint8_t*)msg->get_data(), msg->get_data_length(), msg->get_data_length());
@@ -41,6 +180,8 @@ bool CoAPMessageStore::retransmit(CoAPMessage* msg, Channel& channel, system_tic
 	bool retransmit = (msg->prepare_retransmit(now));
 	if (retransmit)
 	{
+		if (msg->get_transmit_count()>1)
+			congestion();
 		send_message(msg, channel);
 	}
 	return retransmit;
@@ -59,31 +200,58 @@ void CoAPMessageStore::message_timeout(CoAPMessage& msg, Channel& channel)
  */
 void CoAPMessageStore::process(system_tick_t time, Channel& channel)
 {
-	CoAPMessage* msg = head;
-	CoAPMessage* prev = nullptr;
-	while (msg!=nullptr)
+	size_t slot = 0;
+	while (slot<CAPACITY)
 	{
-		if (time_has_passed(time, msg->get_timeout()) && !retransmit(msg, channel, time))
+		CoAPMessage* msg = messages[slot];
+		if (msg!=nullptr && (msg->is_sent() || !msg->is_request()) &&	// unsent requests are held back until there is room in the window
+				time_has_passed(time, msg->get_timeout()) && !retransmit(msg, channel, time))
 		{
-			remove(msg, prev);
+			// removing the message may shift another one into this slot, so the slot is examined again.
+			// A message that wraps around from the start of the table may be examined twice, which is harmless
+			// since it's either not yet due or has just been rescheduled.
+			remove_slot(slot);
 			message_timeout(*msg, channel);
 			delete msg;
-			msg = (prev==nullptr) ? head : prev->get_next();
 		}
 		else
 		{
-			prev = msg;
-			msg = msg->get_next();
+			slot++;
 		}
 	}
+	send_unsent(time, channel);
+}
+
+CoAPMessage* CoAPMessageStore::next_unsent() const
+{
+	CoAPMessage* oldest = nullptr;
+	for (size_t slot=0; slot<CAPACITY; slot++)
+	{
+		CoAPMessage* msg = messages[slot];
+		if (msg && !msg->is_sent() && msg->is_request() && (!oldest || is_older(msg, oldest)))
+			oldest = msg;
+	}
+	return oldest;
 }
 
+void CoAPMessageStore::send_unsent(system_tick_t time, Channel& channel)
+{
+	CoAPMessage* msg;
+	while (in_flight()<window && (msg = next_unsent())!=nullptr)
+	{
+		msg->prepare_retransmit(time);
+		in_flight_count++;
+		DEBUG("sending deferred message id=%x", msg->get_id());
+		if (send_message(msg, channel)!=NO_ERROR)
+			break;	// retransmitted when the timeout expires
+	}
+}
 
 /**
  * Registers that this message has been sent from the application.
  * Confirmable messages, and ack/reset responses are cached.
  */
-ProtocolError CoAPMessageStore::send(Message& msg, system_tick_t time)
+ProtocolError CoAPMessageStore::send(Message& msg, system_tick_t time, bool* deferred)
 {
 	if (!msg.has_id())
 		return MISSING_MESSAGE_ID;
@@ -92,15 +260,21 @@ ProtocolError CoAPMessageStore::send(Message& msg, system_tick_t time)
 	CoAPType::Enum coapType = CoAP::type(msg.buf());
 	if (coapType==CoAPType::CON || coapType==CoAPType::ACK || coapType==CoAPType::RESET)
 	{
-		// confirmable message, create a CoAPMessage for this
-		CoAPMessage* coapmsg = CoAPMessage::create(msg);
+		// confirmable message, create a CoAPMessage for this.
+		// Responses may replace older responses kept for deduplication, but requests awaiting acknowledgement are never discarded.
+		CoAPMessage* coapmsg = create_message(msg, 0, coapType!=CoAPType::CON);
 		if (coapmsg==nullptr)
 			return INSUFFICIENT_STORAGE;
-		if (coapType==CoAPType::CON)
+		if (coapType==CoAPType::CON && deferred && in_flight()>=window)
+			*deferred = true;	// sent from process() once a message in flight is acknowledged
+		else if (coapType==CoAPType::CON)
 			coapmsg->prepare_retransmit(time);
 		else
 			coapmsg->set_expiration(time+CoAPMessage::MAX_TRANSMIT_SPAN);
-		add(*coapmsg);
+		const ProtocolError error = add(*coapmsg);
+		if (error)
+			delete coapmsg;
+		return error;
 	}
 	return NO_ERROR;
 }
@@ -128,6 +302,8 @@ ProtocolError CoAPMessageStore::receive(Message& msg, Channel& channel, system_t
 		DEBUG("recieved ACK for message id=%x", id);
 		if (!clear_message(id)) {		// message didn't exist, means it's already been acknoweldged or is unknown.
 			msg.set_length(0);
+		} else if (window<max_in_flight) {
+			window++;
 		}
 	}
 	else if (msgtype==CoAPType::CON)
@@ -145,13 +321,18 @@ ProtocolError CoAPMessageStore::receive(Message& msg, Channel& channel, system_t
 		else
 		{
 			// first time we're seeing this confirmable message, store it in the message store to prevent it from being resent.
-			CoAPMessage* coapmsg = CoAPMessage::create(msg, 5);
+			CoAPMessage* coapmsg = create_message(msg, 5, true);
 			if (coapmsg==nullptr)
 				return INSUFFICIENT_STORAGE;
 			// the timeout here is ideally purely academic since the application will respond immediately with an ACK/RESET
 			// which will be stored in place of this message, with it's own timeout.
 			coapmsg->set_expiration(time+CoAPMessage::MAX_TRANSMIT_SPAN);
-			add(*coapmsg);
+			const ProtocolError error = add(*coapmsg);
+			if (error)
+			{
+				delete coapmsg;
+				return error;
+			}
 		}
 	}
 	// else it's a NON message - pass through
@@ -160,8 +341,10 @@ ProtocolError CoAPMessageStore::receive(Message& msg, Channel& channel, system_t
 
 bool CoAPMessageStore::has_unacknowledged_requests() const
 {
-	for (const CoAPMessage* msg = head; msg != nullptr; msg = msg->get_next()) {
-		if (is_confirmable((uint8_t*)msg->get_data()))
+	for (size_t slot=0; slot<CAPACITY; slot++)
+	{
+		const CoAPMessage* msg = messages[slot];
+		if (msg && is_confirmable((uint8_t*)msg->get_data()))
 			return true;
 	}
 
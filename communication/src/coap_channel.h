@@ -23,6 +23,38 @@
 #include "timer_hal.h"
 #include "stdlib.h"
 #include "service_debug.h"
+#include "slab.h"
+
+/**
+ * The number of full-size messages a CoAPMessageStore can hold, given the number of confirmable
+ * messages allowed in flight. By default, there is room for each message in flight, plus one for
+ * the response to a server request.
+ */
+#ifndef COAP_MESSAGE_POOL_SIZE
+#define COAP_MESSAGE_POOL_SIZE(max_in_flight) ((max_in_flight)+1)
+#endif
+
+/**
+ * The number of small messages, such as empty acknowledgements and resets, a CoAPMessageStore
+ * can hold in addition to the full-size messages.
+ */
+#ifndef COAP_MESSAGE_SMALL_COUNT
+#define COAP_MESSAGE_SMALL_COUNT 8
+#endif
+
+/**
+ * The largest message data stored in a small block.
+ */
+#ifndef COAP_MESSAGE_SMALL_DATA_SIZE
+#define COAP_MESSAGE_SMALL_DATA_SIZE 16
+#endif
+
+/**
+ * The maximum number of messages in a CoAPMessageStore. Must be a power of 2.
+ */
+#ifndef COAP_MESSAGE_STORE_CAPACITY
+#define COAP_MESSAGE_STORE_CAPACITY 32
+#endif
 
 namespace particle
 {
@@ -82,6 +114,8 @@ public:
 	}
 };
 
+class CoAPMessagePool;
+
 /**
  * A CoAP message that is available for (re-)transmission.
  */
@@ -99,10 +133,9 @@ public:
 
 private:
 	/**
-	 * Messages are stored as a singly-linked list.
-	 * This pointer is the next message in the list, or nullptr if this is the last message in the list.
+	 * The order in which this message was added to a message store, used to find the oldest messages.
 	 */
-	CoAPMessage* next;
+	uint16_t seq;
 
 	/**
 	 * The time when the system will resend this message or give up sending
@@ -132,12 +165,17 @@ private:
 	uint16_t data_len;
 
 	/**
-	 * The CoAPMessage is dynamically allocated as a single chunk combining both the fields above and the message data.
+	 * The CoAPMessage is allocated from a message pool as a single block combining both the fields above and the message data.
 	 */
 	uint8_t data[0];
 
 	static uint16_t message_count;
 
+	/**
+	 * The pool for messages that are not created by a message store.
+	 */
+	static CoAPMessagePool default_pool;
+
 	/**
 	 * Notification that the message has been delivered to the server.
 	 */
@@ -157,30 +195,60 @@ public:
 
 
 	/**
-	 * The number of outstanding messages allowed.
+	 * The default number of outstanding confirmable messages allowed, as in RFC 7252.
+	 * A larger window is opt-in per message store, see CoAPMessageStore::set_max_in_flight().
 	 */
 	static const uint8_t NSTART = 1;
 
+	/**
+	 * The largest number of outstanding confirmable messages that can be configured.
+	 */
+	static const uint8_t MAX_NSTART = 32;
+
 
-	CoAPMessage(message_id_t id_) : next(nullptr), timeout(0), id(id_), transmit_count(0), delivered(nullptr), data_len(0) {
+	CoAPMessage(message_id_t id_) : seq(0), timeout(0), id(id_), transmit_count(0), delivered(nullptr), data_len(0) {
 		message_count++;
 	}
 
 	/**
-	 * Create a new CoAPMessage from the given Message instance. The returned CoAPMessage is dynamically allocated
-	 * and has an independent lifetime from the Message
+	 * CoAPMessage instances are allocated from a pool of preallocated blocks rather than the heap.
+	 * Returns nullptr when the pool is full.
+	 */
+	static void* operator new(size_t size) noexcept;
+
+	/**
+	 * Allocates a CoAPMessage followed by `data_len` bytes of message data.
+	 */
+	static void* operator new(size_t size, size_t data_len) noexcept;
+
+	/**
+	 * Allocates a CoAPMessage followed by `data_len` bytes of message data from the given pool.
+	 */
+	static void* operator new(size_t size, CoAPMessagePool& pool, size_t data_len) noexcept;
+
+	/**
+	 * Returns the message to the pool it was allocated from.
+	 */
+	static void operator delete(void* ptr);
+
+	/**
+	 * Create a new CoAPMessage from the given Message instance. The returned CoAPMessage is allocated
+	 * from the given message pool and has an independent lifetime from the Message
 	 * instance. When no longer required, `delete` the CoAPMessage..
 	 */
-	static CoAPMessage* create(Message& msg, size_t data_len = 0)
+	static CoAPMessage* create(Message& msg, size_t data_len, CoAPMessagePool& pool)
 	{
 		size_t len = data_len && data_len<msg.length() ? data_len : msg.length();
-		uint8_t* memory = new uint8_t[sizeof(CoAPMessage)+len];
-		if (memory) {
-			CoAPMessage* coapmsg = new (memory)CoAPMessage(msg.get_id());		// in-place new
+		CoAPMessage* coapmsg = new (pool, len) CoAPMessage(msg.get_id());
+		if (coapmsg) {
 			coapmsg->set_data(msg.buf(), len);
-			return coapmsg;
 		}
-		return nullptr;
+		return coapmsg;
+	}
+
+	static CoAPMessage* create(Message& msg, size_t data_len = 0)
+	{
+		return create(msg, data_len, default_pool);
 	}
 
 	~CoAPMessage()
@@ -190,12 +258,23 @@ public:
 
 	static uint16_t messages() { return message_count; }
 
-	inline CoAPMessage* get_next() const { return next; }
-	inline void set_next(CoAPMessage* next) { this->next = next; }
+	/**
+	 * The pool for messages that are not created by a message store.
+	 */
+	static const CoAPMessagePool& storage() { return default_pool; }
+
+	inline uint16_t get_seq() const { return seq; }
+	inline void set_seq(uint16_t seq) { this->seq = seq; }
 	inline bool matches(message_id_t id) const { return this->id==id; }
 	inline message_id_t get_id() const { return id; }
-	inline void removed() { next = nullptr; }
 	inline system_tick_t get_timeout() const { return timeout; }
+	inline uint8_t get_transmit_count() const { return transmit_count; }
+
+	/**
+	 * Determines if this message has been sent at least once. Confirmable messages
+	 * are held back without being sent while too many messages are in flight.
+	 */
+	inline bool is_sent() const { return transmit_count>0; }
 
 	inline void set_delivered_handler(std::function<void(Delivery)>* handler) { this->delivered = handler; }
 
@@ -263,6 +342,14 @@ public:
 		transmit_count = MAX_RETRANSMIT+2;	// do not send this message.
 	}
 
+	/**
+	 * Determines if this message is only retained until it expires, and is never sent from the store.
+	 */
+	bool is_expiring() const
+	{
+		return transmit_count>MAX_RETRANSMIT+1;
+	}
+
     bool is_request() const
     {
     		switch (get_type()) {
@@ -276,6 +363,87 @@ public:
 
 };
 
+/**
+ * The storage for CoAP messages. Messages are allocated from fixed-size blocks in two pools:
+ * small blocks for empty acknowledgements, resets and other short messages, and full blocks that
+ * hold a message of up to PROTOCOL_BUFFER_SIZE bytes. Allocation and deallocation take constant time.
+ */
+class CoAPMessagePool
+{
+public:
+	/**
+	 * Blocks are a multiple of the pointer size so that each block is suitably aligned.
+	 */
+	static const size_t SMALL_BLOCK_SIZE = (sizeof(CoAPMessage)+COAP_MESSAGE_SMALL_DATA_SIZE+sizeof(void*)-1)/sizeof(void*)*sizeof(void*);
+	static const size_t FULL_BLOCK_SIZE = (sizeof(CoAPMessage)+PROTOCOL_BUFFER_SIZE+sizeof(void*)-1)/sizeof(void*)*sizeof(void*);
+
+	using SmallSlab = Slab<SMALL_BLOCK_SIZE>;
+	using FullSlab = Slab<FULL_BLOCK_SIZE>;
+
+	explicit CoAPMessagePool(uint8_t max_in_flight = CoAPMessage::NSTART);
+	~CoAPMessagePool();
+
+	/**
+	 * Allocates a block of at least `size` bytes. Returns nullptr if there is no free block.
+	 */
+	void* allocate(size_t size);
+
+	/**
+	 * Returns a block to this pool. Returns false if the block was not allocated from this pool.
+	 */
+	bool deallocate(void* ptr);
+
+	/**
+	 * Sizes the pool for the given number of confirmable messages in flight. The full blocks
+	 * are reallocated once the messages currently stored in them have been deleted.
+	 */
+	void reserve(uint8_t max_in_flight)
+	{
+		full.resize(COAP_MESSAGE_POOL_SIZE(max_in_flight));
+	}
+
+	bool owns(const void* ptr) const
+	{
+		return small.owns(ptr) || full.owns(ptr);
+	}
+
+	size_t capacity() const
+	{
+		return small.capacity()+full.capacity();
+	}
+
+	size_t used_bytes() const
+	{
+		return small.used_bytes()+full.used_bytes();
+	}
+
+	size_t peak_bytes() const
+	{
+		return small.peak_bytes()+full.peak_bytes();
+	}
+
+	unsigned failed_allocations() const
+	{
+		return failures;
+	}
+
+	/**
+	 * Returns the block to the pool it was allocated from. Asserts that there is one.
+	 */
+	static void release(void* ptr);
+
+private:
+	SmallSlab small;
+	FullSlab full;
+	unsigned failures;
+
+	/**
+	 * All pools are kept in a list so that a message can be returned to the pool that owns it.
+	 */
+	CoAPMessagePool* next;
+	static CoAPMessagePool* pools;
+};
+
 inline bool time_has_passed(system_tick_t now, system_tick_t tick)
 {
 	static_assert(sizeof(system_tick_t)==4, "system_tick_t should be 4 bytes");
@@ -298,46 +466,127 @@ class CoAPMessageStore
 {
 	LOG_CATEGORY("comm.coap");
 
+	static const size_t CAPACITY = COAP_MESSAGE_STORE_CAPACITY;
+
+	static_assert(CAPACITY>0 && (CAPACITY&(CAPACITY-1))==0, "message store capacity should be a power of 2");
+
+	/**
+	 * The messages, indexed by message ID using open addressing with linear probing.
+	 * Message IDs are allocated sequentially, so they rarely collide.
+	 */
+	CoAPMessage* messages[CAPACITY];
+
+	/**
+	 * The number of messages in the store.
+	 */
+	uint8_t count;
+
+	/**
+	 * The sequence number given to the next message added, used to determine the order messages were added.
+	 */
+	uint16_t next_seq;
+
+	/**
+	 * The configured maximum number of confirmable messages in flight.
+	 */
+	uint8_t max_in_flight;
+
+	/**
+	 * The current number of confirmable messages allowed in flight. This is reduced
+	 * when messages have to be retransmitted and grows back as acknowledgements arrive.
+	 */
+	uint8_t window;
+
 	/**
-	 * The head of the list of messages.
+	 * The number of confirmable messages that have been sent and are waiting for acknowledgement.
 	 */
-	CoAPMessage* head;
+	uint8_t in_flight_count;
 
 	/**
-	 * Retrieves the message with the given ID and the previous message.
-	 * If no message exists with the given id, nullptr is returned.
+	 * The storage for the messages in this store.
 	 */
-	CoAPMessage* for_id(message_id_t id, CoAPMessage*& prev) const
+	CoAPMessagePool pool;
+
+	static inline bool is_in_flight(const CoAPMessage* msg)
+	{
+		return msg->is_sent() && CoAP::type(msg->get_data())==CoAPType::CON;
+	}
+
+	static inline size_t home_slot(message_id_t id)
 	{
-		prev = nullptr;
-		CoAPMessage* next = head;
-		while (next)
+		return id & (CAPACITY-1);
+	}
+
+	static inline size_t next_slot(size_t slot)
+	{
+		return (slot+1) & (CAPACITY-1);
+	}
+
+	/**
+	 * Retrieves the index of the slot holding the message with the given ID.
+	 * Returns -1 if no message exists with the given id.
+	 */
+	int slot_for(message_id_t id) const
+	{
+		size_t slot = home_slot(id);
+		for (size_t i=0; i<CAPACITY && messages[slot]; i++, slot=next_slot(slot))
 		{
-			if (next->matches(id))
-				return next;
-			prev = next;
-			next = next->get_next();
+			if (messages[slot]->matches(id))
+				return slot;
 		}
-		return nullptr;
+		return -1;
 	}
 
 	/**
-	 * Removes a message given the message to remove and the previous entry in the list.
+	 * Removes the message in the given slot. Messages later in the same probe sequence are shifted
+	 * back so that lookups don't need tombstones.
 	 */
-	void remove(CoAPMessage* message, CoAPMessage* previous)
+	void remove_slot(size_t slot);
+
+	/**
+	 * Determines if the given message sorts before another in the order they were added.
+	 */
+	static inline bool is_older(const CoAPMessage* msg, const CoAPMessage* other)
 	{
-		if (previous)
-			previous->set_next(message->get_next());
-		else
-			head = message->get_next();
-		message->removed();
+		return int16_t(msg->get_seq()-other->get_seq())<0;
 	}
 
+	/**
+	 * Removes the oldest message that is only retained for deduplication or as a response
+	 * to the server. Returns false if there is no such message.
+	 */
+	bool evict_oldest();
+
+	/**
+	 * Allocates a CoAPMessage for the given message. When there is no room and `evict` is set,
+	 * messages retained for deduplication are removed to make room.
+	 */
+	CoAPMessage* create_message(Message& msg, size_t data_len, bool evict);
+
 	void message_timeout(CoAPMessage& msg, Channel& channel);
 
+	/**
+	 * Retrieves the oldest confirmable message that has not been sent yet.
+	 */
+	CoAPMessage* next_unsent() const;
+
+	/**
+	 * Sends messages that were held back while the window is not full.
+	 */
+	void send_unsent(system_tick_t time, Channel& channel);
+
+	/**
+	 * Notification that a message is retransmitted. Halves the window.
+	 */
+	void congestion()
+	{
+		window = window > 1 ? window/2 : 1;
+	}
+
 public:
 
-	CoAPMessageStore() : head(nullptr) {}
+	CoAPMessageStore() : messages(), count(0), next_seq(0), max_in_flight(CoAPMessage::NSTART), window(CoAPMessage::NSTART),
+			in_flight_count(0), pool(CoAPMessage::NSTART) {}
 
 	~CoAPMessageStore() {
 		clear();
@@ -345,11 +594,59 @@ public:
 
 	bool has_messages() const
 	{
-		return head!=nullptr;
+		return count>0;
+	}
+
+	/**
+	 * The number of messages in the store.
+	 */
+	size_t size() const
+	{
+		return count;
+	}
+
+	static constexpr size_t capacity()
+	{
+		return CAPACITY;
 	}
 
 	bool has_unacknowledged_requests() const;
 
+	/**
+	 * Sets the maximum number of confirmable messages that are sent without
+	 * waiting for an acknowledgement.
+	 */
+	void set_max_in_flight(uint8_t count)
+	{
+		if (count<1)
+			count = 1;
+		else if (count>CoAPMessage::MAX_NSTART)
+			count = CoAPMessage::MAX_NSTART;
+		max_in_flight = count;
+		window = count;
+		pool.reserve(count);
+	}
+
+	uint8_t get_max_in_flight() const { return max_in_flight; }
+
+	/**
+	 * The storage for the messages in this store.
+	 */
+	const CoAPMessagePool& storage() const { return pool; }
+
+	/**
+	 * The number of confirmable messages currently allowed in flight.
+	 */
+	uint8_t get_window() const { return window; }
+
+	/**
+	 * The number of confirmable messages that have been sent and are waiting for acknowledgement.
+	 */
+	unsigned in_flight() const
+	{
+		return in_flight_count;
+	}
+
 	/**
 	 * Retrieves the current confirmable message that is still
 	 * waiting acknowledgement.
@@ -357,9 +654,8 @@ public:
 	 */
 	CoAPMessage* from_id(message_id_t id) const
 	{
-		CoAPMessage* prev;
-		CoAPMessage* next = for_id(id, prev);
-		return next;
+		const int slot = slot_for(id);
+		return slot<0 ? nullptr : messages[slot];
 	}
 
 	ProtocolError add(CoAPMessage* message)
@@ -369,6 +665,7 @@ public:
 
 	/**
 	 * Adds a message to this message store.
+	 * Returns INSUFFICIENT_STORAGE if the store is full.
 	 */
 	ProtocolError add(CoAPMessage& message)
 	{
@@ -377,10 +674,16 @@ public:
 			return NO_ERROR;
 
 		clear_message(message.get_id());
-		if (message.get_next())
-			return INVALID_STATE;
-		message.set_next(head);
-		head = &message;
+		if (count>=CAPACITY)
+			return INSUFFICIENT_STORAGE;
+		size_t slot = home_slot(message.get_id());
+		while (messages[slot])
+			slot = next_slot(slot);
+		message.set_seq(next_seq++);
+		messages[slot] = &message;
+		count++;
+		if (is_in_flight(&message))
+			in_flight_count++;
 		return NO_ERROR;
 	}
 
@@ -391,11 +694,11 @@ public:
 	 */
 	CoAPMessage* remove(message_id_t msg_id)
 	{
-		CoAPMessage* prev;
-		CoAPMessage* msg = for_id(msg_id, prev);
-		if (msg) {
-			remove(msg, prev);
-		}
+		const int slot = slot_for(msg_id);
+		if (slot<0)
+			return nullptr;
+		CoAPMessage* msg = messages[slot];
+		remove_slot(slot);
 		return msg;
 	}
 
@@ -477,8 +780,11 @@ public:
 	/**
 	 * Registers that this message has been sent from the application.
 	 * Confirmable messages, and ack/reset responses are cached.
+	 *
+	 * @param deferred	When not null, a confirmable message is held back if the window of messages in flight is full,
+	 * and this is set to true. The message is sent later from process(). When null, the message is always sent.
 	 */
-	ProtocolError send(Message& msg, system_tick_t time);
+	ProtocolError send(Message& msg, system_tick_t time, bool* deferred=nullptr);
 
 	/**
 	 * Notifies the message store that a message has been received.
@@ -497,10 +803,13 @@ public:
 	 */
 	void clear()
 	{
-		while (head!=nullptr)
+		for (size_t slot=0; slot<CAPACITY; slot++)
 		{
-			delete remove(head->get_id());
+			delete messages[slot];
+			messages[slot] = nullptr;
 		}
+		count = 0;
+		in_flight_count = 0;
 	}
 
 };
@@ -590,6 +899,13 @@ public:
 		return server;
 	}
 
+	/**
+	 * Sets the maximum number of confirmable messages sent to the server before an acknowledgement is received.
+	 */
+	void set_max_in_flight(uint8_t count) {
+		client.set_max_in_flight(count);
+	}
+
 	/**
 	 * Clear the message stores when the channel is initially established.
 	 */
@@ -615,8 +931,9 @@ public:
 
 		// determine the type of message.
 		CoAPMessageStore& store = msg.is_request() ? client : server;
-		ProtocolError error = store.send(msg, millis());
-		if (!error)
+		bool deferred = false;
+		ProtocolError error = store.send(msg, millis(), &deferred);
+		if (!error && !deferred)
 			error = channel::send(msg);
 		return error;
 	}
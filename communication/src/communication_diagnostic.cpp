@@ -2,3 +2,8 @@
 
 particle::SimpleIntegerDiagnosticData g_rateLimitedEventsCounter(DIAG_ID_CLOUD_RATE_LIMITED_EVENTS, DIAG_NAME_CLOUD_RATE_LIMITED_EVENTS);
 particle::SimpleIntegerDiagnosticData g_unacknowledgedMessageCounter(DIAG_ID_CLOUD_UNACKNOWLEDGED_MESSAGES, DIAG_NAME_CLOUD_UNACKNOWLEDGED_MESSAGES);
+particle::SimpleIntegerDiagnosticData g_queuedEventsCounter(DIAG_ID_CLOUD_QUEUED_EVENTS, DIAG_NAME_CLOUD_QUEUED_EVENTS);
+particle::SimpleIntegerDiagnosticData g_droppedQueuedEventsCounter(DIAG_ID_CLOUD_DROPPED_QUEUED_EVENTS, DIAG_NAME_CLOUD_DROPPED_QUEUED_EVENTS);
+particle::SimpleIntegerDiagnosticData g_sentQueuedEventsCounter(DIAG_ID_CLOUD_SENT_QUEUED_EVENTS, DIAG_NAME_CLOUD_SENT_QUEUED_EVENTS);
+particle::SimpleIntegerDiagnosticData g_throttledEventsCounter(DIAG_ID_CLOUD_THROTTLED_EVENTS, DIAG_NAME_CLOUD_THROTTLED_EVENTS);
+particle::SimpleIntegerDiagnosticData g_droppedThrottledEventsCounter(DIAG_ID_CLOUD_DROPPED_THROTTLED_EVENTS, DIAG_NAME_CLOUD_DROPPED_THROTTLED_EVENTS);
@@ -2,3 +2,8 @@
 
 extern particle::SimpleIntegerDiagnosticData g_rateLimitedEventsCounter;
 extern particle::SimpleIntegerDiagnosticData g_unacknowledgedMessageCounter;
+extern particle::SimpleIntegerDiagnosticData g_queuedEventsCounter;
+extern particle::SimpleIntegerDiagnosticData g_droppedQueuedEventsCounter;
+extern particle::SimpleIntegerDiagnosticData g_sentQueuedEventsCounter;
+extern particle::SimpleIntegerDiagnosticData g_throttledEventsCounter;
+extern particle::SimpleIntegerDiagnosticData g_droppedThrottledEventsCounter;
@@ -0,0 +1,334 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "compression.h"
+#include "coap.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace particle { namespace protocol {
+
+namespace {
+
+const unsigned MIN_MATCH = 3;
+const unsigned MAX_MATCH = 258;
+const unsigned HASH_BITS = 8;
+const unsigned END_OF_BLOCK = 256;
+
+const uint16_t LENGTH_BASE[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+		67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const uint8_t LENGTH_EXTRA[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+
+// distances beyond the window are never used, so the table stops at the code covering COMPRESSION_WINDOW_SIZE
+const uint16_t DISTANCE_BASE[] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769 };
+const uint8_t DISTANCE_EXTRA[] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8 };
+
+static_assert(COMPRESSION_WINDOW_SIZE <= 1024, "distance table should cover the compression window");
+
+/**
+ * Writes bits to a buffer, least significant bit first, as required by DEFLATE.
+ */
+class BitWriter
+{
+	uint8_t* p_;
+	uint8_t* const end_;
+	uint32_t bits_;
+	unsigned count_;
+	bool overflow_;
+
+public:
+	BitWriter(uint8_t* buf, size_t size) :
+			p_(buf),
+			end_(buf + size),
+			bits_(0),
+			count_(0),
+			overflow_(false)
+	{
+	}
+
+	void put(uint32_t value, unsigned count)
+	{
+		bits_ |= value << count_;
+		count_ += count;
+		while (count_ >= 8)
+		{
+			if (p_ == end_)
+				overflow_ = true;
+			else
+				*p_++ = bits_;
+			bits_ >>= 8;
+			count_ -= 8;
+		}
+	}
+
+	/**
+	 * Writes a Huffman code, which is stored most significant bit first.
+	 */
+	void put_code(uint32_t code, unsigned count)
+	{
+		uint32_t reversed = 0;
+		for (unsigned i = 0; i < count; i++)
+		{
+			reversed = (reversed << 1) | (code & 1);
+			code >>= 1;
+		}
+		put(reversed, count);
+	}
+
+	void flush()
+	{
+		if (count_)
+			put(0, 8 - count_);
+	}
+
+	bool overflow() const
+	{
+		return overflow_;
+	}
+
+	uint8_t* next() const
+	{
+		return p_;
+	}
+};
+
+/**
+ * Writes a literal/length symbol using the fixed Huffman code.
+ */
+void put_symbol(BitWriter& writer, unsigned symbol)
+{
+	if (symbol < 144)
+		writer.put_code(0x30 + symbol, 8);
+	else if (symbol < 256)
+		writer.put_code(0x190 + symbol - 144, 9);
+	else if (symbol < 280)
+		writer.put_code(symbol - 256, 7);
+	else
+		writer.put_code(0xc0 + symbol - 280, 8);
+}
+
+void put_match(BitWriter& writer, unsigned length, unsigned distance)
+{
+	unsigned code = sizeof(LENGTH_BASE)/sizeof(LENGTH_BASE[0]) - 1;
+	while (LENGTH_BASE[code] > length)
+		code--;
+	put_symbol(writer, 257 + code);
+	writer.put(length - LENGTH_BASE[code], LENGTH_EXTRA[code]);
+
+	code = sizeof(DISTANCE_BASE)/sizeof(DISTANCE_BASE[0]) - 1;
+	while (DISTANCE_BASE[code] > distance)
+		code--;
+	writer.put_code(code, 5);
+	writer.put(distance - DISTANCE_BASE[code], DISTANCE_EXTRA[code]);
+}
+
+inline unsigned hash(const uint8_t* p)
+{
+	return ((uint32_t(p[0]) << 16 | uint32_t(p[1]) << 8 | p[2]) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+struct OptionHeader
+{
+	unsigned delta;
+	unsigned length;
+	size_t size;	// the size of the header, excluding the option value
+};
+
+bool decode_nibble(unsigned nibble, const uint8_t*& p, const uint8_t* end, unsigned& value)
+{
+	if (nibble < 13)
+	{
+		value = nibble;
+	}
+	else if (nibble == 13 && p < end)
+	{
+		value = 13 + *p++;
+	}
+	else if (nibble == 14 && p + 1 < end)
+	{
+		value = 269 + (p[0] << 8 | p[1]);
+		p += 2;
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+bool decode_option(const uint8_t* buf, const uint8_t* end, OptionHeader& header)
+{
+	const uint8_t* p = buf + 1;
+	if (!decode_nibble(*buf >> 4, p, end, header.delta) || !decode_nibble(*buf & 0x0f, p, end, header.length))
+		return false;
+	header.size = p - buf;
+	return buf + header.size + header.length <= end;
+}
+
+size_t encode_option_header(uint8_t* buf, unsigned delta, unsigned length)
+{
+	uint8_t* p = buf + 1;
+	p += CoAP::extended_option_value(p, CoAP::option_value_nibble(delta), delta);
+	p += CoAP::extended_option_value(p, CoAP::option_value_nibble(length), length);
+	buf[0] = CoAP::option_value_nibble(delta) << 4 | CoAP::option_value_nibble(length);
+	return p - buf;
+}
+
+} // namespace
+
+size_t compress(const uint8_t* data, size_t size, uint8_t* dest, size_t max_size)
+{
+	if (size >= 0xffff)
+		return 0;
+	// the most recent position + 1 of each hashed 3-byte sequence, 0 if none
+	uint16_t head[1 << HASH_BITS] = {};
+	BitWriter writer(dest, max_size);
+	writer.put(1, 1);	// final block
+	writer.put(1, 2);	// fixed Huffman codes
+	size_t i = 0;
+	while (i < size && !writer.overflow())
+	{
+		unsigned length = 0;
+		unsigned distance = 0;
+		if (i + MIN_MATCH <= size)
+		{
+			const unsigned h = hash(data + i);
+			const size_t candidate = head[h];
+			head[h] = i + 1;
+			if (candidate && i + 1 - candidate <= COMPRESSION_WINDOW_SIZE)
+			{
+				const size_t start = candidate - 1;
+				const size_t max_length = (size - i < MAX_MATCH) ? size - i : MAX_MATCH;
+				while (length < max_length && data[start + length] == data[i + length])
+					length++;
+				distance = i - start;
+			}
+		}
+		if (length >= MIN_MATCH)
+		{
+			put_match(writer, length, distance);
+			for (size_t j = i + 1; j < i + length && j + MIN_MATCH <= size; j++)
+				head[hash(data + j)] = j + 1;
+			i += length;
+		}
+		else
+		{
+			put_symbol(writer, data[i]);
+			i++;
+		}
+	}
+	put_symbol(writer, END_OF_BLOCK);
+	writer.flush();
+	if (writer.overflow())
+		return 0;
+	return writer.next() - dest;
+}
+
+size_t payload_offset(const uint8_t* buf, size_t length)
+{
+	const uint8_t* const end = buf + length;
+	size_t pos = 4 + (buf[0] & 0x0f);
+	while (pos < length)
+	{
+		if (buf[pos] == 0xff)
+			return pos + 1;
+		OptionHeader header;
+		if (!decode_option(buf + pos, end, header))
+			break;
+		pos += header.size + header.length;
+	}
+	return length;
+}
+
+size_t compress_payload(uint8_t* buf, size_t length, uint8_t* scratch, size_t scratch_size)
+{
+	if (length < 4)
+		return length;
+	const uint8_t* const end = buf + length;
+	const unsigned content_format = CoAPOption::CONTENT_FORMAT;
+	// find the payload marker and where the Content-Format option goes, keeping the options in order
+	size_t pos = 4 + (buf[0] & 0x0f);
+	unsigned number = 0;
+	size_t insert = 0;
+	unsigned insert_number = 0;
+	bool found = false;
+	while (pos < length && buf[pos] != 0xff)
+	{
+		OptionHeader header;
+		if (!decode_option(buf + pos, end, header))
+			return length;
+		if (number + header.delta == content_format)
+			return length;	// the payload already has a format
+		if (!found && number + header.delta > content_format)
+		{
+			found = true;
+			insert = pos;
+			insert_number = number;
+		}
+		number += header.delta;
+		pos += header.size + header.length;
+	}
+	if (pos >= length)
+		return length;
+	const size_t marker = pos;
+	if (!found)
+	{
+		insert = marker;
+		insert_number = number;
+	}
+	const size_t payload_size = length - marker - 1;
+	if (payload_size < MIN_COMPRESSIBLE_PAYLOAD_SIZE)
+		return length;
+
+	uint8_t option[8];
+	size_t option_size = encode_option_header(option, content_format - insert_number, 2);
+	option[option_size++] = DEFLATE_CONTENT_FORMAT >> 8;
+	option[option_size++] = DEFLATE_CONTENT_FORMAT & 0xff;
+
+	// the option following the new one is now encoded relative to Content-Format
+	uint8_t next_header[5];
+	size_t next_old_size = 0;
+	size_t next_new_size = 0;
+	if (insert < marker)
+	{
+		OptionHeader header;
+		decode_option(buf + insert, end, header);
+		next_old_size = header.size;
+		next_new_size = encode_option_header(next_header, insert_number + header.delta - content_format, header.length);
+	}
+	const size_t added = option_size + next_new_size - next_old_size;
+	if (payload_size <= added + 1)
+		return length;
+	// the compressed message has to be smaller than the original
+	const size_t max_size = std::min(payload_size - added - 1, scratch_size);
+	const size_t compressed_size = compress(buf + marker + 1, payload_size, scratch, max_size);
+	if (!compressed_size)
+		return length;
+
+	const size_t tail = insert + next_old_size;
+	const size_t tail_size = marker - tail;
+	memmove(buf + insert + option_size + next_new_size, buf + tail, tail_size);
+	memcpy(buf + insert, option, option_size);
+	memcpy(buf + insert + option_size, next_header, next_new_size);
+	size_t p = insert + option_size + next_new_size + tail_size;
+	buf[p++] = 0xff;
+	memcpy(buf + p, scratch, compressed_size);
+	return p + compressed_size;
+}
+
+}}
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "protocol_defs.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+
+namespace particle
+{
+namespace protocol
+{
+
+/**
+ * The size of the LZ77 window used to find repeated data. This matches the dictionary size
+ * that miniz is configured with on the device, so the output can be decompressed with
+ * tinfl on the device as well as with any inflate implementation.
+ */
+const size_t COMPRESSION_WINDOW_SIZE = 1024;
+
+/**
+ * Payloads shorter than this are not worth compressing.
+ */
+const size_t MIN_COMPRESSIBLE_PAYLOAD_SIZE = 32;
+
+/**
+ * The CoAP Content-Format of a payload compressed with raw DEFLATE. The value is from
+ * the range reserved for experimental use.
+ */
+const uint16_t DEFLATE_CONTENT_FORMAT = 65000;
+
+/**
+ * Compresses data as a single raw DEFLATE block (RFC 1951) with fixed Huffman codes.
+ *
+ * @param data The data to compress.
+ * @param size The size of the data.
+ * @param dest The buffer receiving the compressed data.
+ * @param max_size The maximum size of the compressed data.
+ * @return The size of the compressed data, or 0 if it doesn't fit in `max_size` bytes.
+ */
+size_t compress(const uint8_t* data, size_t size, uint8_t* dest, size_t max_size);
+
+/**
+ * Compresses the payload of a CoAP message in place if that makes the message smaller.
+ * A Content-Format option with the value DEFLATE_CONTENT_FORMAT is added to the message
+ * to indicate that the payload is compressed.
+ *
+ * @param buf The message.
+ * @param length The length of the message.
+ * @param scratch A buffer receiving the compressed payload before it's copied to the message.
+ * @param scratch_size The size of the scratch buffer. Payloads that don't compress to this size are left as is.
+ * @return The new length of the message. This is `length` if the payload was left as is.
+ */
+size_t compress_payload(uint8_t* buf, size_t length, uint8_t* scratch, size_t scratch_size);
+
+/**
+ * Compresses the payloads of outgoing messages once the server has agreed to receive compressed
+ * payloads. The scratch buffer used for compression is allocated when compression is enabled,
+ * and reused for all messages until compression is disabled.
+ */
+class PayloadCompressor
+{
+public:
+	/**
+	 * The size of the scratch buffer. A compressed payload is always smaller than the message.
+	 */
+	static const size_t BUFFER_SIZE = PROTOCOL_BUFFER_SIZE;
+
+	/**
+	 * Enables or disables compression. Returns false if the scratch buffer can't be allocated,
+	 * in which case compression remains disabled.
+	 */
+	bool set_enabled(bool enabled)
+	{
+		if (!enabled)
+			buffer_.reset();
+		else if (!buffer_)
+			buffer_.reset(new (std::nothrow) uint8_t[BUFFER_SIZE]);
+		return enabled==is_enabled();
+	}
+
+	bool is_enabled() const
+	{
+		return buffer_!=nullptr;
+	}
+
+	/**
+	 * Compresses the payload of a message in place when compression is enabled and that makes
+	 * the message smaller. Returns the new length of the message.
+	 */
+	size_t compress(uint8_t* buf, size_t length)
+	{
+		return buffer_ ? compress_payload(buf, length, buffer_.get(), BUFFER_SIZE) : length;
+	}
+
+private:
+	std::unique_ptr<uint8_t[]> buffer_;
+};
+
+/**
+ * Retrieves the offset of the payload of a CoAP message, after the payload marker.
+ * Returns `length` if the message has no payload.
+ */
+size_t payload_offset(const uint8_t* buf, size_t length);
+
+}}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "logging.h"
+LOG_SOURCE_CATEGORY("comm.ota")
+
+#include "delta_patch.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace particle { namespace protocol {
+
+namespace {
+
+inline uint32_t read_uint32(const uint8_t* p)
+{
+	return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+}
+
+inline uint16_t read_uint16(const uint8_t* p)
+{
+	return p[0] << 8 | p[1];
+}
+
+} // namespace
+
+ProtocolError DeltaPatch::apply(const uint8_t* chunk, size_t size, Callbacks& callbacks) const
+{
+	const uint8_t* p = chunk;
+	const uint8_t* const end = chunk + size;
+	if (size < 4)
+		return MALFORMED_MESSAGE;
+	size_t target = read_uint32(p);
+	p += 4;
+	if (target % TARGET_ALIGNMENT || target > target_length)
+	{
+		LOG(ERROR, "Invalid target offset: %u", (unsigned)target);
+		return MALFORMED_MESSAGE;
+	}
+
+	uint8_t buf[BUFFER_SIZE];
+	size_t buffered = 0;
+	while (p < end)
+	{
+		const uint8_t op = *p++;
+		size_t source = 0;
+		if (op == COPY || op == DIFF)
+		{
+			if (end - p < 4)
+				return MALFORMED_MESSAGE;
+			source = read_uint32(p);
+			p += 4;
+		}
+		else if (op != DATA)
+		{
+			LOG(ERROR, "Unknown patch record: %u", (unsigned)op);
+			return MALFORMED_MESSAGE;
+		}
+		if (end - p < 2)
+			return MALFORMED_MESSAGE;
+		size_t length = read_uint16(p);
+		p += 2;
+		const uint8_t* bytes = nullptr;
+		if (op != COPY)
+		{
+			if (size_t(end - p) < length)
+				return MALFORMED_MESSAGE;
+			bytes = p;
+			p += length;
+		}
+		if (op != DATA && (source > source_length || length > source_length - source))
+		{
+			LOG(ERROR, "Patch refers to data outside of the source image");
+			return MALFORMED_MESSAGE;
+		}
+		if (length > target_length - target - buffered)
+		{
+			LOG(ERROR, "Patch refers to data outside of the target image");
+			return MALFORMED_MESSAGE;
+		}
+
+		while (length > 0)
+		{
+			const size_t n = std::min(length, BUFFER_SIZE - buffered);
+			uint8_t* const out = buf + buffered;
+			if (op == DATA)
+			{
+				memcpy(out, bytes, n);
+			}
+			else
+			{
+				if (callbacks.read_source(source, out, n))
+					return IO_ERROR;
+				if (op == DIFF)
+				{
+					for (size_t i = 0; i < n; ++i)
+						out[i] += bytes[i];
+				}
+				source += n;
+			}
+			if (bytes)
+				bytes += n;
+			buffered += n;
+			length -= n;
+			if (buffered == BUFFER_SIZE)
+			{
+				if (callbacks.write_target(target, buf, buffered))
+					return IO_ERROR;
+				target += buffered;
+				buffered = 0;
+			}
+		}
+	}
+	if (buffered > 0 && callbacks.write_target(target, buf, buffered))
+		return IO_ERROR;
+	return NO_ERROR;
+}
+
+}}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "protocol_defs.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace particle
+{
+namespace protocol
+{
+
+/**
+ * Applies a delta patch that reconstructs a firmware image from the image installed on the device.
+ *
+ * The patch is transferred in chunks, and each chunk is self-contained so that chunks can be applied
+ * in any order, as they arrive with fast OTA. A chunk has the following format (all values are
+ * big-endian):
+ *
+ *     chunk  := target_offset:u32 record*
+ *     record := DATA length:u16 bytes[length]
+ *             | COPY source_offset:u32 length:u16
+ *             | DIFF source_offset:u32 length:u16 bytes[length]
+ *
+ * A DATA record writes its bytes to the target image, a COPY record writes bytes of the source image,
+ * and a DIFF record writes the bytewise sum of the source image and its bytes. The records of a chunk
+ * write consecutive bytes of the target image, starting at the chunk's target offset.
+ *
+ * Flash is written a word at a time, so the target offset of each chunk has to be word-aligned, and
+ * all chunks except the one at the end of the image have to produce a multiple of TARGET_ALIGNMENT bytes.
+ */
+class DeltaPatch
+{
+public:
+	enum Op
+	{
+		DATA = 0,
+		COPY = 1,
+		DIFF = 2
+	};
+
+	static const size_t TARGET_ALIGNMENT = 4;
+
+	/**
+	 * The size of the buffer used to stage output. This bounds the RAM needed to apply a patch.
+	 */
+	static const size_t BUFFER_SIZE = 128;
+
+	static_assert(BUFFER_SIZE % TARGET_ALIGNMENT == 0, "the buffer should hold whole words");
+
+	struct Callbacks
+	{
+		/**
+		 * Reads bytes of the source image.
+		 *
+		 * @return 0 on success.
+		 */
+		virtual int read_source(uint32_t offset, uint8_t* data, size_t length)=0;
+
+		/**
+		 * Writes bytes of the target image.
+		 *
+		 * @return 0 on success.
+		 */
+		virtual int write_target(uint32_t offset, const uint8_t* data, size_t length)=0;
+	};
+
+	DeltaPatch(size_t source_length, size_t target_length) :
+			source_length(source_length),
+			target_length(target_length)
+	{
+	}
+
+	/**
+	 * Applies a chunk of the patch.
+	 *
+	 * @return MALFORMED_MESSAGE if the chunk is invalid or refers to data outside of the source
+	 * or target images, IO_ERROR if the source can't be read or the target can't be written.
+	 */
+	ProtocolError apply(const uint8_t* chunk, size_t size, Callbacks& callbacks) const;
+
+private:
+	size_t source_length;
+	size_t target_length;
+};
+
+}}
@@ -227,7 +227,22 @@ ProtocolError DTLSMessageChannel::init(
 
 inline int DTLSMessageChannel::send(const uint8_t* data, size_t len)
 {
-	if (move_session && len && data[0]==23)
+	if (move_session && len && data[0]==23 && is_outgoing_record(data) &&
+			data+len+DEVICE_ID_LEN+1 <= ssl_context.out_buf+MBEDTLS_SSL_BUFFER_LEN)
+	{
+		// the device ID fits in the record buffer after the record
+		uint8_t* d = const_cast<uint8_t*>(data);
+		d[0] = 254;
+		memcpy(d+len, device_id, DEVICE_ID_LEN);
+		d[len+DEVICE_ID_LEN] = DEVICE_ID_LEN;
+		int result = callbacks.send(d, len+DEVICE_ID_LEN+1, callbacks.tx_context);
+		// mbedtls may send the record again
+		d[0] = 23;
+		if (result==int(len+DEVICE_ID_LEN+1))
+			result = len;
+		return result;
+	}
+	else if (move_session && len && data[0]==23)
 	{
 		uint8_t d[len+DEVICE_ID_LEN+1];
 		memcpy(d, data, len);
@@ -330,7 +345,58 @@ ProtocolError DTLSMessageChannel::setup_context()
 
 ProtocolError DTLSMessageChannel::establish(uint32_t& flags, uint32_t app_state_crc)
 {
+	if (!establishing)
+	{
+		const ProtocolError error = start_handshake(flags, app_state_crc);
+		if (error)
+			return error;
+		establishing = true;
+	}
+
 	int ret = 0;
+	const system_tick_t start = callbacks.millis();
+	do
+	{
+		ret = mbedtls_ssl_handshake_step(&ssl_context);
+		if (ret != 0)
+			break;
+
+		// we've already received the ServerHello, thus
+		// we have the random values for client and server
+		if (ssl_context.state == MBEDTLS_SSL_SERVER_KEY_EXCHANGE)
+		{
+			memcpy(handshake_random, ssl_context.handshake->randbytes, sizeof(handshake_random));
+		}
+	}
+	while (ssl_context.state != MBEDTLS_SSL_HANDSHAKE_OVER &&
+			callbacks.millis() - start < HANDSHAKE_STEP_TIME);
+
+	if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE ||
+			(!ret && ssl_context.state != MBEDTLS_SSL_HANDSHAKE_OVER))
+	{
+		// retransmissions and the handshake timeout are handled by the mbedtls timer
+		return HANDSHAKE_IN_PROGRESS;
+	}
+
+	establishing = false;
+	if (ret)
+	{
+		LOG(ERROR,"handshake failed -%x", -ret);
+		reset_session();
+	}
+	else
+	{
+		sessionPersist.prepare_save(handshake_random, keys_checksum, &ssl_context, 0);
+	}
+	return ret==0 ? NO_ERROR : IO_ERROR_GENERIC_ESTABLISH;
+}
+
+/**
+ * Sets up the context for a new handshake, or resumes the persisted session.
+ * @return NO_ERROR if the handshake should go ahead.
+ */
+ProtocolError DTLSMessageChannel::start_handshake(uint32_t& flags, uint32_t app_state_crc)
+{
 	// LOG(INFO,"setup context");
 	ProtocolError error = setup_context();
 	if (error) {
@@ -368,45 +434,38 @@ ProtocolError DTLSMessageChannel::establish(uint32_t& flags, uint32_t app_state_
 		if (error)
 			return error;
 	}
-	uint8_t random[64];
-
-	do
-	{
-		while (ssl_context.state != MBEDTLS_SSL_HANDSHAKE_OVER)
-		{
-			ret = mbedtls_ssl_handshake_step(&ssl_context);
-
-			if (ret != 0)
-				break;
+	return NO_ERROR;
+}
 
-			// we've already received the ServerHello, thus
-			// we have the random values for client and server
-			if (ssl_context.state == MBEDTLS_SSL_SERVER_KEY_EXCHANGE)
-			{
-				memcpy(random, ssl_context.handshake->randbytes, 64);
-			}
-		}
-	}
-	while(ret == MBEDTLS_ERR_SSL_WANT_READ ||
-	      ret == MBEDTLS_ERR_SSL_WANT_WRITE);
+ProtocolError DTLSMessageChannel::notify_established()
+{
+	sessionPersist.make_persistent();
+	sessionPersist.save(callbacks.save);
+	return NO_ERROR;
+}
 
-	if (ret)
-	{
-		LOG(ERROR,"handshake failed -%x", -ret);
-		reset_session();
+ProtocolError DTLSMessageChannel::create(Message& message, size_t minimum_size)
+{
+	if (minimum_size>MESSAGE_CAPACITY) {
+		LOG(WARN,"Insufficient storage for message size %d", minimum_size);
+		return INSUFFICIENT_STORAGE;
 	}
-	else
+	if (!ssl_context.out_msg)
+		return INVALID_STATE;
+	if (ssl_context.out_left && mbedtls_ssl_flush_output(&ssl_context))
 	{
-		sessionPersist.prepare_save(random, keys_checksum, &ssl_context, 0);
+		// the message overwrites the record the socket didn't take, which is lost like any other datagram
+		ssl_context.out_left = 0;
 	}
-	return ret==0 ? NO_ERROR : IO_ERROR_GENERIC_ESTABLISH;
+	message.clear();
+	message.set_buffer(ssl_context.out_msg, MESSAGE_CAPACITY);
+	message.set_length(0);
+	return NO_ERROR;
 }
 
-ProtocolError DTLSMessageChannel::notify_established()
+ProtocolError DTLSMessageChannel::response(Message& original, Message& response, size_t required)
 {
-	sessionPersist.make_persistent();
-	sessionPersist.save(callbacks.save);
-	return NO_ERROR;
+	return create(response, required);
 }
 
 ProtocolError DTLSMessageChannel::receive(Message& message)
@@ -414,12 +473,20 @@ ProtocolError DTLSMessageChannel::receive(Message& message)
 	if (ssl_context.state != MBEDTLS_SSL_HANDSHAKE_OVER)
 		return INVALID_STATE;
 
-	create(message);
-	uint8_t* buf = message.buf();
-	size_t len = message.capacity();
+	message.clear();
+	message.set_buffer(ssl_context.in_msg, MESSAGE_CAPACITY);
 
 	conf.read_timeout = 0;
-	int ret = mbedtls_ssl_read(&ssl_context, buf, len);
+	// reading no data decrypts the next record in place and leaves it in the record buffer
+	uint8_t none;
+	int ret = mbedtls_ssl_read(&ssl_context, &none, 0);
+	if (!ret && ssl_context.in_offt) {
+		ret = ssl_context.in_msglen;
+		message.set_buffer(ssl_context.in_offt, MBEDTLS_SSL_MAX_CONTENT_LEN - (ssl_context.in_offt - ssl_context.in_msg));
+		// the record is consumed, the next read fetches another one
+		ssl_context.in_msglen = 0;
+		ssl_context.in_offt = nullptr;
+	}
 	if (ret<0) {
 		switch (ret) {
 		case MBEDTLS_ERR_SSL_WANT_READ:
@@ -479,7 +546,16 @@ ProtocolError DTLSMessageChannel::send(Message& message)
       LOG_PRINT(TRACE, "\r\n");
 #endif
 
-  int ret = mbedtls_ssl_write(&ssl_context, message.buf(), message.length());
+  int ret;
+  if (is_outgoing_record(message.buf()))
+  {
+	  ret = write_record(message);
+  }
+  else
+  {
+	  // a message that was received or created elsewhere is copied to the record
+	  ret = mbedtls_ssl_write(&ssl_context, message.buf(), message.length());
+  }
   if (ret < 0 && ret != MBEDTLS_ERR_SSL_WANT_WRITE)
   {
 	  LOG(WARN, "mbedtls_ssl_write returned %x", ret);
@@ -490,6 +566,26 @@ ProtocolError DTLSMessageChannel::send(Message& message)
   return NO_ERROR;
 }
 
+/**
+ * Encrypts and sends a message that was created in the outgoing record buffer.
+ * @return 0 or a negative mbedtls error.
+ */
+int DTLSMessageChannel::write_record(Message& message)
+{
+	const size_t len = message.length();
+	if (len > MBEDTLS_SSL_MAX_CONTENT_LEN)
+		return MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+	// the plaintext offset changes when the handshake completes, so a message created before
+	// then is moved into place
+	if (message.buf() != ssl_context.out_msg)
+		memmove(ssl_context.out_msg, message.buf(), len);
+	// a pending record has already been overwritten by the message
+	ssl_context.out_left = 0;
+	ssl_context.out_msgtype = MBEDTLS_SSL_MSG_APPLICATION_DATA;
+	ssl_context.out_msglen = len;
+	return mbedtls_ssl_write_record(&ssl_context);
+}
+
 bool DTLSMessageChannel::is_unreliable()
 {
 	return true;
@@ -519,6 +615,11 @@ ProtocolError DTLSMessageChannel::command(Command command, void* arg)
 	case SAVE_SESSION:
 		sessionPersist.save(callbacks.save);
 		break;
+
+	case CANCEL_ESTABLISH:
+		// the context is set up again when the next handshake starts
+		establishing = false;
+		break;
 	}
 	return NO_ERROR;
 }
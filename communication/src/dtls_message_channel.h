@@ -25,7 +25,6 @@
 #include "service_debug.h"
 #include "device_keys.h"
 #include "message_channel.h"
-#include "buffer_message_channel.h"
 
 #include "mbedtls/ssl.h"
 #include "mbedtls/ssl_internal.h"
@@ -46,12 +45,13 @@ namespace protocol
 const size_t DEVICE_ID_LEN = 12;
 
 /**
- * This implements the lightweight and RSA encrypted handshake, AES session encryption over a TCP Stream.
+ * This implements the DTLS handshake and session encryption over a UDP socket.
  *
- * The buffer provided to the message starts at offset 2 to allow a 2-byte length to be added.
- * The buffer length extends to the maximum capacity minus 16 so there is room for PKCS#1v5 padding.
+ * The channel has no message buffer of its own. Messages are created in the mbedtls outgoing
+ * record buffer and encrypted where they are, and received messages are decrypted in place
+ * in the incoming record buffer and handed to the protocol without being copied.
  */
-class DTLSMessageChannel: public BufferMessageChannel<PROTOCOL_BUFFER_SIZE>
+class DTLSMessageChannel: public AbstractMessageChannel
 {
 public:
 
@@ -102,6 +102,28 @@ private:
 	bool move_session;
 	const uint8_t* device_id;
 
+	/**
+	 * Set while a handshake is waiting for the server between calls to establish().
+	 */
+	bool establishing;
+
+	/**
+	 * The client and server random values, kept from the ServerHello until the session is saved.
+	 */
+	uint8_t handshake_random[64];
+
+	/**
+	 * The time establish() spends stepping through the handshake before returning
+	 * HANDSHAKE_IN_PROGRESS, so that other work can run in between.
+	 */
+	static const system_tick_t HANDSHAKE_STEP_TIME = 20;
+
+	/**
+	 * The capacity of a message, which is never more than an mbedtls record holds.
+	 */
+	static const size_t MESSAGE_CAPACITY = PROTOCOL_BUFFER_SIZE < MBEDTLS_SSL_MAX_CONTENT_LEN ?
+			PROTOCOL_BUFFER_SIZE : MBEDTLS_SSL_MAX_CONTENT_LEN;
+
     void init();
     void dispose();
 
@@ -114,14 +136,26 @@ private:
     int send(const uint8_t* data, size_t len);
     int recv(uint8_t* data, size_t len);
 
+	/**
+	 * Determines if the given message buffer is inside the outgoing record buffer.
+	 */
+	bool is_outgoing_record(const uint8_t* buf) const
+	{
+		return ssl_context.out_buf && buf >= ssl_context.out_buf &&
+				buf < ssl_context.out_buf + MBEDTLS_SSL_BUFFER_LEN;
+	}
+
+	int write_record(Message& message);
+
 	ProtocolError setup_context();
+	ProtocolError start_handshake(uint32_t& flags, uint32_t app_state_crc);
 
 	void cancel_move_session() { move_session = false; }
 
 	void reset_session();
 
  public:
-	DTLSMessageChannel() : coap_state(nullptr), move_session(false) {}
+	DTLSMessageChannel() : coap_state(nullptr), move_session(false), establishing(false) {}
 
 	ProtocolError init(const uint8_t* core_private, size_t core_private_len,
 		const uint8_t* core_public, size_t core_public_len,
@@ -134,14 +168,25 @@ private:
 	virtual ProtocolError establish(uint32_t& flags, uint32_t app_crc) override;
 
 	/**
-	 * Retrieve first the 2 byte length from the stream, which determines
+	 * Points the message at the plaintext part of the outgoing record, so that it is
+	 * encrypted in place when it's sent.
+	 */
+	virtual ProtocolError create(Message& message, size_t minimum_size=0) override;
+
+	/**
+	 * The response is created in the outgoing record, leaving the received message intact.
+	 */
+	virtual ProtocolError response(Message& original, Message& response, size_t required) override;
+
+	/**
+	 * Receives the next record. The message refers to the decrypted record in the incoming
+	 * record buffer and is valid until the next call to receive().
 	 */
 	virtual ProtocolError receive(Message& message) override;
 
 	/**
-	 * Sends the given message. The message length is prepended to the message
-	 * and the message padded with PKCS#1 padding before being sent using
-	 * the send callback.
+	 * Sends the given message. A message created by this channel is encrypted in place,
+	 * so its contents are undefined once it's sent.
 	 */
 	virtual ProtocolError send(Message& message) override;
 
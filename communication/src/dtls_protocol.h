@@ -81,6 +81,7 @@ public:
 			result = wait_confirmable();
 			break;
 		case ProtocolCommands::DISCONNECT:
+			cancel_handshake();
 			result = wait_confirmable();
 			ack_handlers.clear();
 			break;
@@ -89,6 +90,7 @@ public:
 			result = NO_ERROR;
 			break;
 		case ProtocolCommands::TERMINATE:
+			cancel_handshake();
 			ack_handlers.clear();
 			result = NO_ERROR;
 			break;
@@ -101,12 +103,22 @@ public:
 			}
 			break;
 		}
+		case ProtocolCommands::CANCEL_HANDSHAKE:
+			cancel_handshake();
+			result = NO_ERROR;
+			break;
 		}
 		return result;
 	}
 
 
 
+	virtual int set_max_in_flight(unsigned count) override
+	{
+		channel.set_max_in_flight(count>CoAPMessage::MAX_NSTART ? CoAPMessage::MAX_NSTART : count);
+		return 0;
+	}
+
 	/**
 	 * Ensures that all outstanding sent coap messages have been acknowledged.
 	 */
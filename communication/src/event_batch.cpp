@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "logging.h"
+LOG_SOURCE_CATEGORY("comm.batch")
+
+#include "event_batch.h"
+
+#include <new>
+
+namespace particle { namespace protocol {
+
+namespace {
+
+/**
+ * The handlers of the events in a batch that wait for the batch to be acknowledged.
+ */
+struct AckHandlers
+{
+	CompletionHandler handlers[EventBatch::MAX_EVENTS];
+	size_t count = 0;
+
+	static void completed(int error, const void* data, void* callback_data, void* reserved)
+	{
+		AckHandlers* self = static_cast<AckHandlers*>(callback_data);
+		for (size_t i = 0; i < self->count; ++i) {
+			if (error) {
+				self->handlers[i].setError(error, (const char*)data);
+			} else {
+				self->handlers[i].setResult();
+			}
+		}
+		delete self;
+	}
+};
+
+} // namespace
+
+int EventBatch::set_max_size(size_t size)
+{
+	if (size > MAX_PAYLOAD_SIZE) {
+		size = MAX_PAYLOAD_SIZE;
+	}
+	if (size && !buffer_) {
+		// the events already added may exceed a smaller limit, so the buffer always has room for the largest batch
+		buffer_.reset(new (std::nothrow) uint8_t[MAX_PAYLOAD_SIZE]);
+		if (!buffer_) {
+			return SYSTEM_ERROR_NO_MEMORY;
+		}
+	}
+	max_size_ = size;
+	if (!size && !count_) {
+		buffer_.reset();
+	}
+	return 0;
+}
+
+int EventBatch::add(const char* event_name, const char* data, int ttl, EventType::Enum event_type, int flags,
+		bool confirmable, CompletionHandler handler, system_tick_t time)
+{
+	const size_t length = record_size(event_name, data);
+	if (!is_enabled() || !has_room(length)) {
+		return SYSTEM_ERROR_LIMIT_EXCEEDED;
+	}
+	if (!count_) {
+		start_ = time;
+	}
+	size_ += Messages::event_batch_record(buffer_.get() + size_, event_name, data, ttl, event_type);
+	if (flags & EventType::WITH_ACK) {
+		ack_mask_ |= (1 << count_);
+	}
+	confirmable_ = confirmable_ || confirmable;
+	handlers_[count_++] = std::move(handler);
+	return 0;
+}
+
+CompletionHandler EventBatch::sent()
+{
+	CompletionHandler ack_handler;
+	AckHandlers* ack_handlers = nullptr;
+	if (ack_mask_) {
+		ack_handlers = new (std::nothrow) AckHandlers();
+		if (ack_handlers) {
+			ack_handler = CompletionHandler(AckHandlers::completed, ack_handlers);
+		} else {
+			LOG(ERROR, "Unable to track acknowledgement of batched events");
+		}
+	}
+	for (size_t i = 0; i < count_; ++i) {
+		if (!(ack_mask_ & (1 << i))) {
+			handlers_[i].setResult();
+		} else if (ack_handlers) {
+			ack_handlers->handlers[ack_handlers->count++] = std::move(handlers_[i]);
+		} else {
+			handlers_[i].setError(SYSTEM_ERROR_NO_MEMORY);
+		}
+	}
+	clear();
+	return ack_handler;
+}
+
+void EventBatch::complete(int error)
+{
+	for (size_t i = 0; i < count_; ++i) {
+		if (error) {
+			handlers_[i].setError(error);
+		} else {
+			handlers_[i].setResult();
+		}
+	}
+	clear();
+}
+
+void EventBatch::clear()
+{
+	size_ = 0;
+	count_ = 0;
+	ack_mask_ = 0;
+	confirmable_ = false;
+	if (!is_enabled()) {
+		buffer_.reset();
+	}
+}
+
+}}
@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "protocol_defs.h"
+#include "events.h"
+#include "messages.h"
+
+#include "completion_handler.h"
+
+#include <memory>
+
+namespace particle
+{
+namespace protocol
+{
+
+/**
+ * Collects published events so they can be sent to the cloud in a single message.
+ *
+ * Events are encoded into the batch payload as they are added (see Messages::event_batch_record()).
+ * The batch is due to be sent once it reaches its maximum size, holds MAX_EVENTS events, or
+ * the oldest event has waited for the linger period.
+ */
+class EventBatch
+{
+public:
+	/**
+	 * The maximum number of events in a batch.
+	 */
+	static const size_t MAX_EVENTS = 16;
+
+	static_assert(MAX_EVENTS <= 16, "each event needs a bit in the acknowledgement mask");
+
+	/**
+	 * The largest batch payload that fits in a single protocol message.
+	 */
+	static const size_t MAX_PAYLOAD_SIZE = PROTOCOL_BUFFER_SIZE - Messages::event_batch_header_size;
+
+	/**
+	 * The default time in milliseconds the first event in a batch waits for other events.
+	 */
+	static const system_tick_t DEFAULT_LINGER = 1000;
+
+	/**
+	 * An event decoded from the batch payload. The name and data are not null-terminated.
+	 */
+	struct Event
+	{
+		const char* name;
+		size_t name_length;
+		const char* data;
+		size_t data_length;
+		int ttl;
+		EventType::Enum event_type;
+		int flags;
+	};
+
+	EventBatch() :
+			max_size_(0),
+			linger_(DEFAULT_LINGER),
+			size_(0),
+			count_(0),
+			start_(0),
+			ack_mask_(0),
+			confirmable_(false)
+	{
+	}
+
+	/**
+	 * Sets the maximum size of the batch payload in bytes. The size is limited to MAX_PAYLOAD_SIZE.
+	 * A size of 0 disables batching; events already in the batch are still sent.
+	 */
+	int set_max_size(size_t size);
+
+	void set_linger(system_tick_t linger)
+	{
+		linger_ = linger;
+	}
+
+	bool is_enabled() const
+	{
+		return max_size_ > 0;
+	}
+
+	bool has_events() const
+	{
+		return count_ > 0;
+	}
+
+	size_t count() const
+	{
+		return count_;
+	}
+
+	/**
+	 * Determines if the batch message should be confirmable.
+	 */
+	bool is_confirmable() const
+	{
+		return confirmable_;
+	}
+
+	const uint8_t* data() const
+	{
+		return buffer_.get();
+	}
+
+	size_t size() const
+	{
+		return size_;
+	}
+
+	/**
+	 * The number of bytes the given event occupies in the batch payload.
+	 */
+	static size_t record_size(const char* event_name, const char* data)
+	{
+		return Messages::event_batch_record_header_size + strnlen(event_name, MAX_EVENT_NAME_LENGTH) +
+				(data ? strnlen(data, MAX_EVENT_DATA_LENGTH) : 0);
+	}
+
+	/**
+	 * Determines if an event of the given size can be batched at all.
+	 */
+	bool accepts(size_t record_size) const
+	{
+		return is_enabled() && record_size <= max_size_;
+	}
+
+	/**
+	 * Determines if an event of the given size can be added without sending the batch first.
+	 */
+	bool has_room(size_t record_size) const
+	{
+		return count_ < MAX_EVENTS && size_ + record_size <= max_size_;
+	}
+
+	/**
+	 * Determines if the batch should be sent.
+	 */
+	bool is_due(system_tick_t time) const
+	{
+		return count_ && (count_ >= MAX_EVENTS || size_ >= max_size_ || time - start_ >= linger_);
+	}
+
+	/**
+	 * Adds an event to the batch. The completion handler is invoked once the batch is sent or,
+	 * for events published with EventType::WITH_ACK, once the batch is acknowledged.
+	 */
+	int add(const char* event_name, const char* data, int ttl, EventType::Enum event_type, int flags,
+			bool confirmable, CompletionHandler handler, system_tick_t time);
+
+	/**
+	 * Notification that the batch has been sent. The handlers of events that don't wait for
+	 * an acknowledgement are completed, and the batch is emptied.
+	 *
+	 * @return A handler that completes the remaining events once the batch is acknowledged.
+	 * The handler is empty if no event waits for an acknowledgement.
+	 */
+	CompletionHandler sent();
+
+	/**
+	 * Completes the handlers of all events with the given result and empties the batch.
+	 */
+	void complete(int error);
+
+	/**
+	 * Moves out the handler of the event at the given position, so that it can be completed
+	 * elsewhere. complete() then has no effect on that event.
+	 */
+	CompletionHandler take_handler(size_t index)
+	{
+		return std::move(handlers_[index]);
+	}
+
+	/**
+	 * Invokes the given function for each event in the batch, in the order they were added.
+	 */
+	template<typename F>
+	void for_each(F f) const
+	{
+		const uint8_t* p = buffer_.get();
+		for (size_t i = 0; i < count_; ++i)
+		{
+			Event event;
+			event.event_type = EventType::Enum(p[0]);
+			event.name_length = p[1];
+			event.ttl = (p[2] << 16) | (p[3] << 8) | p[4];
+			event.data_length = (p[5] << 8) | p[6];
+			event.name = (const char*)p + Messages::event_batch_record_header_size;
+			event.data = event.name + event.name_length;
+			event.flags = (ack_mask_ & (1 << i)) ? EventType::WITH_ACK : 0;
+			f(event);
+			p += Messages::event_batch_record_header_size + event.name_length + event.data_length;
+		}
+	}
+
+private:
+	std::unique_ptr<uint8_t[]> buffer_;
+	CompletionHandler handlers_[MAX_EVENTS];
+
+	/**
+	 * The maximum size of the batch payload.
+	 */
+	size_t max_size_;
+
+	system_tick_t linger_;
+
+	/**
+	 * The size of the events in the batch.
+	 */
+	size_t size_;
+
+	size_t count_;
+
+	/**
+	 * The time the first event was added to the batch.
+	 */
+	system_tick_t start_;
+
+	/**
+	 * A bit for each event that waits for the batch to be acknowledged.
+	 */
+	uint16_t ack_mask_;
+
+	bool confirmable_;
+
+	void clear();
+};
+
+}}
@@ -41,14 +41,13 @@ namespace EventType {
 	  EMPTY_FLAGS = 0,
 	   NO_ACK = 0x2,
 	   WITH_ACK = 0x8,
+	   PRIORITY_HIGH = 0x10,	// sent ahead of other events held back by the rate limit
+	   PRIORITY_LOW = 0x80,	// sent after other events held back by the rate limit
 
-	   ALL_FLAGS = NO_ACK | WITH_ACK
+	   ALL_FLAGS = NO_ACK | WITH_ACK | PRIORITY_HIGH | PRIORITY_LOW
   };
 
-  static_assert((PUBLIC & NO_ACK)==0 &&
-	  (PRIVATE & NO_ACK)==0 &&
-	  (PUBLIC & WITH_ACK)==0 &&
-	  (PRIVATE & WITH_ACK)==0, "flags should be distinct from event type");
+  static_assert(((PUBLIC | PRIVATE) & ALL_FLAGS)==0, "flags should be distinct from event type");
 
 /**
  * The flags are encoded in with the event type.
@@ -77,5 +77,27 @@ namespace FileTransfer {
 
     PARTICLE_STATIC_ASSERT(Descriptor_size, sizeof(Descriptor)==20);
 
+    /**
+     * Describes a delta patch that reconstructs the file from a module installed on the device.
+     * When a patch is transferred, the descriptor's file length is the length of the reconstructed file.
+     */
+    struct Patch
+    {
+        /**
+         * The length of the patch data.
+         */
+        uint32_t length;
+
+        /**
+         * The length of the installed module the patch applies to, including its CRC.
+         */
+        uint32_t source_length;
+
+        /**
+         * The CRC-32 of the installed module.
+         */
+        uint32_t source_crc;
+    };
+
 };
 
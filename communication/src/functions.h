@@ -38,7 +38,9 @@ class Functions
     ProtocolError function_result(MessageChannel& channel, const void* result, SparkReturnType::Enum, token_t token)
     {
         Message message;
-        channel.create(message, Messages::function_return_size);
+        const ProtocolError error = channel.create(message, Messages::function_return_size);
+        if (error)
+            return error;
         size_t length = Messages::function_return(message.buf(), 0, token, long(result), channel.is_unreliable());
         message.set_length(length);
         return channel.send(message);
@@ -34,6 +34,10 @@ int LightSSLProtocol::command(ProtocolCommands::Enum command, uint32_t data)
     ack_handlers.clear();
     result = NO_ERROR;
     break;
+  case ProtocolCommands::CANCEL_HANDSHAKE:
+    cancel_handshake();
+    result = NO_ERROR;
+    break;
   }
   return result;
 }
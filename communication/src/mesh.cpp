@@ -15,7 +15,8 @@ const unsigned MESH_COMMAND_TIMEOUT = 3 * 60 * 1000;
 
 uint8_t* buildNetworkUpdateMessage(uint8_t token, Message& message, MessageChannel& channel, MeshCommand::NetworkUpdate& update)
 {
-	channel.create(message);
+	if (channel.create(message))
+		return nullptr;
 
 	uint8_t* const buf = message.buf();
 	uint8_t* p = buf;
@@ -55,6 +56,8 @@ ProtocolError Mesh::network_update(Protocol& protocol, uint8_t token, MessageCha
 {
 	Message message;
 	uint8_t* p = buildNetworkUpdateMessage(token, message, channel, networkInfo.update);
+	if (!p)
+		return registerCompletionHandler(protocol, INVALID_STATE, message, c);
 
 	// the server is expecting everything from flags onwards.
 	p += CoAP::payload(p, &networkInfo.flags, sizeof(MeshCommand::NetworkInfo)-offsetof(MeshCommand::NetworkInfo,flags));
@@ -65,6 +68,8 @@ ProtocolError Mesh::device_joined(Protocol& protocol, uint8_t token, MessageChan
 {
 	Message message;
 	uint8_t* p = buildNetworkUpdateMessage(token, message, channel, update);
+	if (!p)
+		return registerCompletionHandler(protocol, INVALID_STATE, message, c);
 	p += CoAP::uri_query(p, CoAPOption::URI_PATH, joined ? "j=1" : "j=0");
 	return sendNetworkUpdate(p, protocol, message, channel, c);
 }
@@ -73,6 +78,8 @@ ProtocolError Mesh::device_gateway(Protocol& protocol, uint8_t token, MessageCha
 {
 	Message message;
 	uint8_t* p = buildNetworkUpdateMessage(token, message, channel, update);
+	if (!p)
+		return registerCompletionHandler(protocol, INVALID_STATE, message, c);
 	p += CoAP::uri_query(p, CoAPOption::URI_PATH, active ? "br=1" : "br=0");
 	return sendNetworkUpdate(p, protocol, message, channel, c);
 }
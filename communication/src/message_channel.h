@@ -173,6 +173,12 @@ struct Channel
 		 * Save session - saves the session to persistent store.
 		 */
 		SAVE_SESSION = 4,
+
+		/**
+		 * Abandon a handshake that is in progress, so that the next
+		 * call to establish() starts a new one.
+		 */
+		CANCEL_ESTABLISH = 5,
 	};
 
 
@@ -203,6 +209,10 @@ struct Channel
  * message operations. The only operation that does not invalidate an existing
  * message is MessageChannel::response() since this allocates the new message at the end of the existing one.
  *
+ * An implementation may also hand out the buffers it encrypts and decrypts in, so a received
+ * message is only valid until the next receive() and a created message's contents are
+ * undefined once it's sent.
+ *
  */
 struct MessageChannel : public Channel
 {
@@ -216,6 +226,8 @@ struct MessageChannel : public Channel
 
 	/**
 	 * Establish this channel for communication.
+	 * A channel may return HANDSHAKE_IN_PROGRESS while it waits for the server, in which case
+	 * establish() is called again with the same arguments to continue the handshake.
 	 * @param flags on return, SKIP_SESSION_RESUME_HELLO is set if the hello/vars/funcs/sucriptions regitration is not needed.
 	 * @param app_state_crc	The crc of the current application state.
 	 */
@@ -207,6 +207,29 @@ size_t Messages::variable_value(unsigned char *buf, message_id_t message_id,
 	return size + length;
 }
 
+size_t Messages::variable_block(unsigned char *buf, message_id_t message_id, token_t token,
+		uint32_t block_num, bool more, uint8_t szx)
+{
+	buf[0] = 0x61; // acknowledgment, one-byte token
+	buf[1] = 0x45; // response code 2.05 CONTENT
+	buf[2] = message_id >> 8;
+	buf[3] = message_id & 0xff;
+	buf[4] = token;
+
+	// the option value is sent in as few bytes as possible, and 0 is sent as an empty value
+	const uint32_t value = block_num << 4 | (more ? 0x08 : 0) | (szx & 0x07);
+	const size_t value_len = value > 0xffff ? 3 : value > 0xff ? 2 : value ? 1 : 0;
+	size_t len = 5;
+	buf[len++] = 0xd0 | value_len; // the option delta follows in one byte
+	buf[len++] = CoAPOption::BLOCK2 - 13;
+	for (size_t i = value_len; i > 0; --i)
+	{
+		buf[len++] = (value >> ((i - 1) * 8)) & 0xff;
+	}
+	buf[len++] = 0xff; // payload marker
+	return len;
+}
+
 size_t Messages::time_request(uint8_t* buf, uint16_t message_id, uint8_t token)
 {
 	unsigned char *p = buf;
@@ -332,6 +355,46 @@ size_t Messages::event(uint8_t buf[], uint16_t message_id, const char *event_nam
   return p - buf;
 }
 
+size_t Messages::event_batch(uint8_t buf[], uint16_t message_id, bool confirmable)
+{
+  uint8_t *p = buf;
+  *p++ = confirmable ? 0x40 : 0x50; // non-confirmable /confirmable, no token
+  *p++ = 0x02; // code 0.02 POST request
+  *p++ = message_id >> 8;
+  *p++ = message_id & 0xff;
+  *p++ = 0xb1; // one-byte Uri-Path option
+  *p++ = 'b';
+  *p++ = 0xff;
+  return p - buf;
+}
+
+size_t Messages::event_batch_record(uint8_t buf[], const char *event_name,
+             const char *data, int ttl, EventType::Enum event_type)
+{
+  const size_t name_len = strnlen(event_name, MAX_EVENT_NAME_LENGTH);
+  const size_t data_len = data ? strnlen(data, MAX_EVENT_DATA_LENGTH) : 0;
+  if (ttl < 0)
+    ttl = 0;
+  else if (ttl > event_batch_max_ttl)
+    ttl = event_batch_max_ttl;
+  uint8_t *p = buf;
+  *p++ = event_type;
+  *p++ = name_len;
+  *p++ = (ttl >> 16) & 0xff;
+  *p++ = (ttl >> 8) & 0xff;
+  *p++ = ttl & 0xff;
+  *p++ = data_len >> 8;
+  *p++ = data_len & 0xff;
+  memcpy(p, event_name, name_len);
+  p += name_len;
+  if (data_len)
+  {
+    memcpy(p, data, data_len);
+    p += data_len;
+  }
+  return p - buf;
+}
+
 size_t Messages::coded_ack(uint8_t* buf, uint8_t token, uint8_t code,
                            uint8_t message_id_msb, uint8_t message_id_lsb,
                            uint8_t* data, size_t data_len)
@@ -71,6 +71,21 @@ public:
 	static size_t variable_value(unsigned char *buf, message_id_t message_id,
 			token_t token, const void *return_value, int length);
 
+	/**
+	 * The largest size of the header written by variable_block(), including the payload marker.
+	 */
+	static const size_t variable_block_max_header_size = 11;
+
+	/**
+	 * Writes the header of a 2.05 response carrying one block of a variable value, with a Block2
+	 * option (RFC 7959) describing the block. The payload follows the returned header.
+	 * @param block_num	The index of the block.
+	 * @param more		true if the value continues in the next block.
+	 * @param szx		The block size exponent. The block size is 2^(szx+4) bytes.
+	 */
+	static size_t variable_block(unsigned char *buf, message_id_t message_id, token_t token,
+			uint32_t block_num, bool more, uint8_t szx);
+
 	static size_t time_request(uint8_t* buf, uint16_t message_id, uint8_t token);
 
 	static size_t chunk_missed(uint8_t* buf, uint16_t message_id, chunk_index_t chunk_index);
@@ -89,6 +104,35 @@ public:
 	static size_t event(uint8_t buf[], uint16_t message_id, const char *event_name,
 	             const char *data, int ttl, EventType::Enum event_type, bool confirmable);
 
+	/**
+	 * The size of the header written by event_batch(), including the payload marker.
+	 */
+	static const size_t event_batch_header_size = 7;
+
+	/**
+	 * The size of the header preceding the name and data of each event in a batch.
+	 */
+	static const size_t event_batch_record_header_size = 7;
+
+	/**
+	 * Writes the header of a message carrying several events. The events follow in the payload,
+	 * each written with event_batch_record().
+	 */
+	static size_t event_batch(uint8_t buf[], uint16_t message_id, bool confirmable);
+
+	/**
+	 * The largest TTL that can be encoded in a batch record.
+	 */
+	static const int event_batch_max_ttl = 0xffffff;
+
+	/**
+	 * Writes one event of a batch: the event type, the name length (1 byte), the TTL (3 bytes),
+	 * and the data length (2 bytes), followed by the name and data. The TTL is clamped to the
+	 * range 0 to event_batch_max_ttl.
+	 */
+	static size_t event_batch_record(uint8_t buf[], const char *event_name,
+	             const char *data, int ttl, EventType::Enum event_type);
+
 
     static inline size_t empty_ack(unsigned char *buf,
                           unsigned char message_id_msb,
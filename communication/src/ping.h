@@ -1,9 +1,33 @@
 #pragma once
 
 #include "protocol_defs.h"
+#include <cstring>
 
 namespace particle { namespace protocol {
 
+/**
+ * What has been learned about how long the NAT binding of a network stays open while the
+ * connection is idle.
+ */
+struct __attribute__((packed)) KeepaliveRecord
+{
+	uint32_t network;		// identifies the network, 0 if it isn't known
+	uint32_t safe;			// the longest idle time after which a ping was acknowledged
+	uint32_t failed;		// the shortest idle time after which a probe went unanswered, 0 if none did
+};
+
+/**
+ * The keepalive records that are persisted across resets, most recently used first.
+ */
+struct __attribute__((packed)) KeepaliveState
+{
+	enum { MAX_NETWORKS = 4 };
+
+	uint16_t size;
+	uint16_t count;
+	KeepaliveRecord records[MAX_NETWORKS];
+};
+
 class Pinger
 {
 	bool expecting_ping_ack;
@@ -11,8 +35,82 @@ class Pinger
 	system_tick_t ping_timeout;
 	keepalive_source_t keepalive_source;
 
+	/**
+	 * The longest interval that adaptive keepalive may probe, 0 when the interval is fixed.
+	 */
+	system_tick_t adaptive_max;
+
+	/**
+	 * The idle time before the ping awaiting an ack was sent, or 0 if that ping isn't a probe of
+	 * the binding lifetime.
+	 */
+	system_tick_t probe_idle;
+	system_tick_t probe_interval;
+	bool sent_since_received;
+	bool state_changed;
+	uint32_t network;
+	KeepaliveState learned;
+
+	KeepaliveRecord& current() { return learned.records[0]; }
+	const KeepaliveRecord& current() const { return learned.records[0]; }
+
+	void probe_acknowledged()
+	{
+		KeepaliveRecord& record = current();
+		if (probe_idle > record.safe)
+		{
+			record.safe = probe_idle;
+			if (record.failed && record.failed <= record.safe)
+			{
+				// the earlier failure wasn't caused by the binding timing out
+				record.failed = 0;
+			}
+			state_changed = true;
+		}
+	}
+
+	void probe_failed()
+	{
+		KeepaliveRecord& record = current();
+		// a timeout at the configured interval is a lost connection, not something to learn from
+		if (probe_interval > ping_interval)
+		{
+			if (probe_idle <= record.safe)
+			{
+				// what was safe no longer is, so the network has changed: learn it again
+				record.safe = 0;
+			}
+			if (!record.failed || probe_idle < record.failed)
+			{
+				record.failed = probe_idle;
+			}
+			state_changed = true;
+		}
+	}
+
 public:
-	Pinger() : expecting_ping_ack(false), ping_interval(0), ping_timeout(10000), keepalive_source(KeepAliveSource::SYSTEM) {}
+	/**
+	 * The interval is considered converged when the longest safe interval and the shortest
+	 * failed one are this close together.
+	 */
+	static const system_tick_t ADAPTIVE_RESOLUTION = 5000;
+
+	Pinger() :
+			expecting_ping_ack(false),
+			ping_interval(0),
+			ping_timeout(10000),
+			keepalive_source(KeepAliveSource::SYSTEM),
+			adaptive_max(0),
+			probe_idle(0),
+			probe_interval(0),
+			sent_since_received(false),
+			state_changed(false),
+			network(0),
+			learned()
+	{
+		learned.size = sizeof(learned);
+		learned.count = 1;
+	}
 
 	/**
 	 * Sets the ping interval that the client will send pings to the server, and the expected maximum response time.
@@ -44,6 +142,109 @@ public:
 	void reset()
 	{
 		expecting_ping_ack = false;
+		probe_idle = 0;
+		sent_since_received = false;
+	}
+
+	/**
+	 * Enables adaptive keepalive, which probes ever longer intervals, up to the given maximum,
+	 * for the longest one after which the NAT binding of the current network is still open. The
+	 * configured interval is the shortest one used. A maximum of 0 disables adaptive keepalive.
+	 */
+	void set_adaptive(system_tick_t max_interval)
+	{
+		adaptive_max = max_interval;
+	}
+
+	bool is_adaptive() const { return adaptive_max != 0; }
+
+	/**
+	 * Selects the network whose binding lifetime is used and learned. Networks that haven't been
+	 * seen before are learned from scratch, replacing the least recently used one.
+	 */
+	void set_network(uint32_t id)
+	{
+		network = id;
+		if (current().network == id)
+		{
+			return;
+		}
+		unsigned index = 1;
+		while (index < learned.count && learned.records[index].network != id)
+		{
+			index++;
+		}
+		if (index == learned.count)
+		{
+			if (learned.count < KeepaliveState::MAX_NETWORKS)
+			{
+				learned.count++;
+			}
+			else
+			{
+				index--;
+			}
+			learned.records[index] = KeepaliveRecord();
+			learned.records[index].network = id;
+		}
+		const KeepaliveRecord record = learned.records[index];
+		memmove(learned.records + 1, learned.records, index * sizeof(KeepaliveRecord));
+		learned.records[0] = record;
+		state_changed = true;
+	}
+
+	/**
+	 * The records learned, to be persisted when take_state_changed() returns true.
+	 */
+	const KeepaliveState& state() const { return learned; }
+
+	/**
+	 * Restores persisted records. The currently selected network stays selected.
+	 */
+	void restore_state(const KeepaliveState& state)
+	{
+		if (state.size == sizeof(state) && state.count >= 1 && state.count <= KeepaliveState::MAX_NETWORKS)
+		{
+			learned = state;
+			set_network(network);
+			state_changed = false;
+		}
+	}
+
+	/**
+	 * Determines if the records changed since this was last called.
+	 */
+	bool take_state_changed()
+	{
+		const bool changed = state_changed;
+		state_changed = false;
+		return changed;
+	}
+
+	/**
+	 * The interval after which a ping is sent, which with adaptive keepalive is either the
+	 * next interval to probe, or once the binding lifetime is known, somewhat less than that.
+	 */
+	system_tick_t interval() const
+	{
+		if (!adaptive_max || !ping_interval)
+		{
+			return ping_interval;
+		}
+		const KeepaliveRecord& record = current();
+		const system_tick_t safe = record.safe > ping_interval ? record.safe : ping_interval;
+		if (safe >= adaptive_max)
+		{
+			return adaptive_max;
+		}
+		if (record.failed && record.failed <= safe + ADAPTIVE_RESOLUTION)
+		{
+			// converged, leave a margin for the binding timers not being exact
+			const system_tick_t margin = safe - safe / 10;
+			return margin > ping_interval ? margin : ping_interval;
+		}
+		const system_tick_t probe = record.failed ? safe + (record.failed - safe) / 2 : safe + safe / 2;
+		return probe < adaptive_max ? probe : adaptive_max;
 	}
 
 	/**
@@ -56,14 +257,27 @@ public:
 			if (ping_timeout < millis_since_last_message)
 			{
 				// timed out, disconnect
+				if (probe_idle)
+				{
+					// unanswered pings are how a lost binding shows: the server can't match
+					// datagrams arriving from a new port to the session
+					probe_failed();
+					probe_idle = 0;
+				}
 				return PING_TIMEOUT;
 			}
 		}
 		else
 		{
-			if (ping_interval && ping_interval < millis_since_last_message)
+			const system_tick_t interval = this->interval();
+			if (interval && interval < millis_since_last_message)
 			{
 				expecting_ping_ack = true;
+				// only a ping sent on time after a quiet period says anything about the binding;
+				// forced pings and pings after outgoing traffic don't
+				probe_idle = (adaptive_max && !sent_since_received && millis_since_last_message / 2 < interval) ?
+						millis_since_last_message : 0;
+				probe_interval = interval;
 				return ping();
 			}
 		}
@@ -72,7 +286,28 @@ public:
 
 	bool is_expecting_ping_ack() const { return expecting_ping_ack; }
 
-	void message_received() { expecting_ping_ack = false; }
+	void message_received()
+	{
+		if (expecting_ping_ack && probe_idle)
+		{
+			probe_acknowledged();
+		}
+		probe_idle = 0;
+		expecting_ping_ack = false;
+		sent_since_received = false;
+	}
+
+	/**
+	 * Notes that a message was sent, which refreshes the NAT binding without the server
+	 * necessarily replying.
+	 */
+	void message_sent()
+	{
+		if (!expecting_ping_ack)
+		{
+			sent_since_received = true;
+		}
+	}
 };
 
 
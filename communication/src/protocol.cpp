@@ -24,6 +24,7 @@ LOG_SOURCE_CATEGORY("comm.protocol")
 #include "chunked_transfer.h"
 #include "subscriptions.h"
 #include "functions.h"
+#include "compression.h"
 
 namespace particle { namespace protocol {
 
@@ -92,8 +93,8 @@ ProtocolError Protocol::handle_received_message(Message& message,
 		char variable_key[MAX_VARIABLE_KEY_LENGTH+1];
 		variables.decode_variable_request(variable_key, message);
 		return variables.handle_variable_request(variable_key, message,
-				channel, token, msg_id,
-				descriptor.variable_type, descriptor.get_variable);
+				channel, token, msg_id, compressor,
+				descriptor.variable_type, descriptor.get_variable, descriptor.read_variable);
 	}
 	case CoAPMessageType::SAVE_BEGIN:
 		// fall through
@@ -126,10 +127,16 @@ ProtocolError Protocol::handle_received_message(Message& message,
 		return channel.send(message);
 
 	case CoAPMessageType::HELLO:
+	{
+		// the server's flags are in the same position as in the hello sent by the device
+		const size_t payload = payload_offset(queue, message.length());
+		if (message.length() >= payload + 6)
+			set_payload_compression(queue[payload + 5] & HelloFlag::COMPRESSION_SUPPORT);
 		if (message.get_type()==CoAPType::CON)
 			send_empty_ack(message, msg_id);
 		descriptor.ota_upgrade_status_sent();
 		break;
+	}
 
 	case CoAPMessageType::TIME:
 		handle_time_response(
@@ -242,6 +249,28 @@ void Protocol::init(const SparkCallbacks &callbacks,
 	chunkedTransfer.init(&chunkedTransferCallbacks);
 
 	initialized = true;
+	if (pinger.is_adaptive())
+	{
+		restore_keepalive_state();
+	}
+}
+
+void Protocol::restore_keepalive_state()
+{
+	KeepaliveState state;
+	if (callbacks.restore && callbacks.restore(&state, sizeof(state), SparkCallbacks::PERSIST_KEEPALIVE, nullptr) == sizeof(state))
+	{
+		pinger.restore_state(state);
+	}
+}
+
+void Protocol::save_keepalive_state()
+{
+	if (pinger.take_state_changed() && callbacks.save)
+	{
+		const KeepaliveState& state = pinger.state();
+		callbacks.save(&state, sizeof(state), SparkCallbacks::PERSIST_KEEPALIVE, nullptr);
+	}
 }
 
 uint32_t Protocol::application_state_checksum(uint32_t (*calc_crc)(const uint8_t* data, uint32_t len), uint32_t subscriptions_crc,
@@ -283,17 +312,49 @@ uint32_t Protocol::application_state_checksum()
 int Protocol::begin()
 {
 	LOG_CATEGORY("comm.protocol.handshake");
-	LOG(INFO,"Establish secure connection");
-	chunkedTransfer.reset();
-	pinger.reset();
-	timesync_.reset();
+	if (handshake_state == HANDSHAKE_IDLE)
+	{
+		LOG(INFO,"Establish secure connection");
+		chunkedTransfer.reset();
+		pinger.reset();
+		timesync_.reset();
+
+		// FIXME: Pending completion handlers should be cancelled at the end of a previous session
+		ack_handlers.clear();
+		last_ack_handlers_update = callbacks.millis();
+
+		handshake_channel_flags = 0;
+		handshake_app_state_crc = application_state_checksum();
+		handshake_state = HANDSHAKE_ESTABLISH;
+	}
+	const ProtocolError error = continue_handshake();
+	if (error != HANDSHAKE_IN_PROGRESS)
+	{
+		handshake_state = HANDSHAKE_IDLE;
+	}
+	return error;
+}
 
-	// FIXME: Pending completion handlers should be cancelled at the end of a previous session
-	ack_handlers.clear();
-	last_ack_handlers_update = callbacks.millis();
+/**
+ * Takes the handshake as far as it can go without waiting for the server.
+ */
+ProtocolError Protocol::continue_handshake()
+{
+	LOG_CATEGORY("comm.protocol.handshake");
+	if (handshake_state == HANDSHAKE_HELLO_ACK)
+	{
+		return hello_acknowledged();
+	}
+	if (handshake_state == HANDSHAKE_HELLO_RESPONSE)
+	{
+		return hello_response();
+	}
 
-	uint32_t channel_flags = 0;
-	ProtocolError error = channel.establish(channel_flags, application_state_checksum());
+	ProtocolError error = channel.establish(handshake_channel_flags, handshake_app_state_crc);
+	if (error == HANDSHAKE_IN_PROGRESS)
+	{
+		return error;
+	}
 	bool session_resumed = (error==SESSION_RESUMED);
 	if (error && !session_resumed) {
 		LOG(ERROR,"handshake failed with code %d", error);
@@ -304,7 +365,7 @@ int Protocol::begin()
 	{
 		// for now, unconditionally move the session on resumption
 		channel.command(MessageChannel::MOVE_SESSION, nullptr);
-		if (channel_flags & SKIP_SESSION_RESUME_HELLO) {
+		if (handshake_channel_flags & SKIP_SESSION_RESUME_HELLO) {
 			flags |= SKIP_SESSION_RESUME_HELLO;
 		}
 	}
@@ -326,16 +387,51 @@ int Protocol::begin()
 		LOG(ERROR,"Could not send HELLO message: %d", error);
 		return error;
 	}
+	if (channel.is_unreliable())
+	{
+		handshake_state = HANDSHAKE_HELLO_ACK;
+		return HANDSHAKE_IN_PROGRESS;
+	}
+	return complete_handshake();
+}
+
+/**
+ * Processes one event while waiting for the hello to be acknowledged.
+ */
+ProtocolError Protocol::hello_acknowledged()
+{
+	CoAPMessageType::Enum message_type;
+	const ProtocolError error = event_loop(message_type);
+	if (error)
+	{
+		return error;
+	}
+	if (hello_ack_result == HELLO_ACK_PENDING)
+	{
+		return HANDSHAKE_IN_PROGRESS;
+	}
+	if (hello_ack_result)
+	{
+		LOG(ERROR,"HELLO message not acknowledged: %d", hello_ack_result);
+		return (hello_ack_result == SYSTEM_ERROR_TIMEOUT) ? MESSAGE_TIMEOUT : MESSAGE_RESET;
+	}
+	return complete_handshake();
+}
 
+/**
+ * Waits for the server's hello if required, or else completes the handshake.
+ */
+ProtocolError Protocol::complete_handshake()
+{
 	if (flags & REQUIRE_HELLO_RESPONSE) {
 		LOG(INFO,"Receiving HELLO response");
-		error = hello_response();
-		if (error)
-			return error;
+		hello_sent_millis = callbacks.millis();
+		handshake_state = HANDSHAKE_HELLO_RESPONSE;
+		return HANDSHAKE_IN_PROGRESS;
 	}
 	LOG(INFO,"Handshake completed");
 	channel.notify_established();
-	return error;
+	return NO_ERROR;
 }
 
 /**
@@ -345,25 +441,53 @@ int Protocol::begin()
 ProtocolError Protocol::hello(bool was_ota_upgrade_successful)
 {
 	Message message;
-	channel.create(message);
+	ProtocolError error = channel.create(message);
+	if (error)
+		return error;
 
-	uint8_t flags = was_ota_upgrade_successful ? 1 : 0;
-	flags |= 2;		// diagnostics support
+	uint8_t flags = was_ota_upgrade_successful ? HelloFlag::OTA_UPGRADE_SUCCESSFUL : 0;
+	flags |= HelloFlag::DIAGNOSTICS_SUPPORT;
+	flags |= HelloFlag::COMPRESSION_SUPPORT;
+	if (callbacks.read_firmware)
+		flags |= HelloFlag::DELTA_UPDATE_SUPPORT;
+	// compression is enabled again once the server's hello confirms it's supported
+	set_payload_compression(false);
 	size_t len = build_hello(message, flags);
 	message.set_length(len);
-	message.set_confirm_received(true);
+	const bool unreliable = channel.is_unreliable();
+	message.set_confirm_received(!unreliable);
 	last_message_millis = callbacks.millis();
-	return channel.send(message);
+	error = channel.send(message);
+	if (!error && unreliable)
+	{
+		hello_ack_result = HELLO_ACK_PENDING;
+		add_ack_handler(message.get_id(), CompletionHandler([](int error, const void* data, void* callback_data, void* reserved) {
+			static_cast<Protocol*>(callback_data)->hello_ack_result = error;
+		}, this), HELLO_ACK_TIMEOUT);
+	}
+	return error;
 }
 
 ProtocolError Protocol::hello_response()
 {
-	ProtocolError error = event_loop(CoAPMessageType::HELLO,  4000); // read the hello message from the server
+	CoAPMessageType::Enum message_type;
+	ProtocolError error = event_loop(message_type);
+	if (!error && message_type != CoAPMessageType::HELLO)
+	{
+		if (callbacks.millis() - hello_sent_millis < HELLO_RESPONSE_TIMEOUT)
+		{
+			return HANDSHAKE_IN_PROGRESS;
+		}
+		error = MESSAGE_TIMEOUT;
+	}
 	if (error)
 	{
 		LOG(ERROR,"Handshake: could not receive HELLO response %d", error);
+		return error;
 	}
-	return error;
+	LOG(INFO,"Handshake completed");
+	channel.notify_established();
+	return NO_ERROR;
 }
 
 /**
@@ -422,6 +546,10 @@ ProtocolError Protocol::event_loop(CoAPMessageType::Enum& message_type)
 			error = event_loop_idle();
 		}
 	}
+	if (pinger.is_adaptive())
+	{
+		save_keepalive_state();
+	}
 
 	if (error)
 	{
@@ -516,7 +644,9 @@ void Protocol::build_describe_message(Appender& appender, int desc_flags)
 ProtocolError Protocol::send_description(token_t token, message_id_t msg_id, int desc_flags)
 {
 	Message message;
-	channel.create(message);
+	ProtocolError error = channel.create(message);
+	if (error)
+		return error;
 	uint8_t* buf = message.buf();
 	message.set_id(msg_id);
 	size_t desc = Messages::description(buf, msg_id, token);
@@ -526,6 +656,9 @@ ProtocolError Protocol::send_description(token_t token, message_id_t msg_id, int
 	build_describe_message(appender, desc_flags);
 
 	int msglen = appender.next() - (uint8_t*) buf;
+	if (!appender.overflowed()) {
+		msglen = compressor.compress(buf, msglen);
+	}
 	message.set_length(msglen);
 	if (appender.overflowed()) {
 		LOG(ERROR, "Describe message overflowed by %d bytes", appender.overflowed());
@@ -540,7 +673,7 @@ ProtocolError Protocol::send_description(token_t token, message_id_t msg_id, int
 	LOG(INFO,"Sending '%s%s%s' describe message", desc_flags & DESCRIBE_SYSTEM ? "S" : "",
 											  desc_flags & DESCRIBE_APPLICATION ? "A" : "",
 											  desc_flags & DESCRIBE_METRICS ? "M" : "");
-	ProtocolError error = channel.send(message);
+	error = channel.send(message);
 	if (error==NO_ERROR && descriptor.app_state_selector_info &&
             (desc_flags & DESCRIBE_APPLICATION || desc_flags & DESCRIBE_SYSTEM))
 	{
@@ -563,6 +696,11 @@ ProtocolError Protocol::send_description(token_t token, message_id_t msg_id, int
 
 int Protocol::ChunkedTransferCallbacks::prepare_for_firmware_update(FileTransfer::Descriptor& data, uint32_t flags, void* reserved)
 {
+	if (reserved && !callbacks->read_firmware)
+	{
+		// a delta patch can't be applied without access to the installed firmware
+		return SYSTEM_ERROR_NOT_SUPPORTED;
+	}
 	return callbacks->prepare_for_firmware_update(data, flags, reserved);
 }
 
@@ -586,6 +724,27 @@ system_tick_t Protocol::ChunkedTransferCallbacks::millis()
 	return callbacks->millis();
 }
 
+int Protocol::ChunkedTransferCallbacks::read_firmware(uint32_t offset, uint8_t* data, size_t length, void* reserved)
+{
+	if (!callbacks->read_firmware)
+		return SYSTEM_ERROR_NOT_SUPPORTED;
+	return callbacks->read_firmware(offset, data, length, reserved);
+}
+
+int Protocol::ChunkedTransferCallbacks::save_transfer_state(const void* data, size_t length, void* reserved)
+{
+	if (!callbacks->save)
+		return SYSTEM_ERROR_NOT_SUPPORTED;
+	return callbacks->save(data, length, SparkCallbacks::PERSIST_TRANSFER, reserved);
+}
+
+int Protocol::ChunkedTransferCallbacks::restore_transfer_state(void* data, size_t max_length, void* reserved)
+{
+	if (!callbacks->restore)
+		return 0;
+	return callbacks->restore(data, max_length, SparkCallbacks::PERSIST_TRANSFER, reserved);
+}
+
 int Protocol::get_describe_data(spark_protocol_describe_data* data, void* reserved)
 {
 	data->maximum_size = 768;  // a conservative guess based on dtls and lightssl encryption overhead and the CoAP data
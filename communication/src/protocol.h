@@ -85,6 +85,12 @@ class Protocol
 
 		  virtual system_tick_t millis();
 
+		  virtual int read_firmware(uint32_t offset, uint8_t* data, size_t length, void*);
+
+		  virtual int save_transfer_state(const void* data, size_t length, void*);
+
+		  virtual int restore_transfer_state(void* data, size_t max_length, void*);
+
 	} chunkedTransferCallbacks;
 
 	/**
@@ -131,6 +137,50 @@ class Protocol
 
 	uint8_t flags;
 
+	/**
+	 * Enabled when the server has agreed to receive compressed payloads.
+	 */
+	PayloadCompressor compressor;
+
+	enum HandshakeState
+	{
+		HANDSHAKE_IDLE,
+		HANDSHAKE_ESTABLISH,		// the channel is being established
+		HANDSHAKE_HELLO_ACK,		// the hello was sent, waiting for it to be acknowledged
+		HANDSHAKE_HELLO_RESPONSE	// waiting for the server's hello
+	};
+
+	/**
+	 * How far the handshake started by begin() has got.
+	 */
+	HandshakeState handshake_state;
+	uint32_t handshake_channel_flags;
+	uint32_t handshake_app_state_crc;
+	system_tick_t hello_sent_millis;
+
+	/**
+	 * The result of sending the hello over an unreliable channel, HELLO_ACK_PENDING until it's
+	 * acknowledged or times out.
+	 */
+	int hello_ack_result;
+
+	static const int HELLO_ACK_PENDING = 1;
+
+	/**
+	 * The time to wait for the hello to be acknowledged, which is as long as the CoAP layer
+	 * retransmits it.
+	 */
+	static const system_tick_t HELLO_ACK_TIMEOUT = 60000;
+
+	/**
+	 * The time to wait for the server's hello.
+	 */
+	static const system_tick_t HELLO_RESPONSE_TIMEOUT = 4000;
+
+	ProtocolError continue_handshake();
+	ProtocolError hello_acknowledged();
+	ProtocolError complete_handshake();
+
 public:
 	enum Flags
 	{
@@ -165,6 +215,13 @@ protected:
 	CompletionHandlerMap<message_id_t> ack_handlers;
 
 
+	void set_payload_compression(bool enabled)
+	{
+		if (!compressor.set_enabled(enabled))
+			LOG(WARN, "Unable to allocate compression buffer, payloads are sent uncompressed");
+		publisher.set_compressor(compressor.is_enabled() ? &compressor : nullptr);
+	}
+
 	void set_protocol_flags(int flags)
 	{
 		this->flags = flags;
@@ -181,13 +238,15 @@ protected:
 	ProtocolError handle_key_change(Message& message);
 
 	/**
-	 * Send the hello message over the channel.
+	 * Send the hello message over the channel. Over an unreliable channel, the acknowledgement
+	 * is reported to hello_ack_result rather than waited for.
 	 * @param was_ota_upgrade_successful {@code true} if the previous OTA update was successful.
 	 */
 	ProtocolError hello(bool was_ota_upgrade_successful);
 
 	/**
-	 * Send a hello response
+	 * Checks for the server's hello once.
+	 * @return HANDSHAKE_IN_PROGRESS if it hasn't arrived and the wait hasn't timed out.
 	 */
 	ProtocolError hello_response();
 
@@ -199,7 +258,9 @@ protected:
 	ProtocolError ping(bool forceCoAP=false)
 	{
 		Message message;
-		channel.create(message);
+		const ProtocolError error = channel.create(message);
+		if (error)
+			return error;
 		size_t len = 0;
 		if (!forceCoAP && (flags & PING_AS_EMPTY_MESSAGE)) {
 			len = Messages::keep_alive(message.buf());
@@ -228,6 +289,27 @@ protected:
 					{	return ping();});
 			if (error)
 				return error;
+			if (handshake_state != HANDSHAKE_IDLE)
+			{
+				// events are held back until the server has responded to the hello
+				return NO_ERROR;
+			}
+			if (publisher.has_throttled_events())
+			{
+				// failures are reported to the event's completion handler
+				publisher.process_throttle(channel, callbacks.millis());
+			}
+			if (publisher.is_batch_due(callbacks.millis()))
+			{
+				// failures are handled by the publisher, and a broken connection is detected by the pinger
+				publisher.send_batch(channel);
+			}
+#if HAL_PLATFORM_FILESYSTEM
+			if (publisher.has_queued_events())
+			{
+				return publisher.process_queue(channel, callbacks.millis());
+			}
+#endif
 		}
 		return NO_ERROR;
 	}
@@ -278,6 +360,12 @@ protected:
 
 	uint32_t application_state_checksum();
 
+	/**
+	 * Restores and saves what adaptive keepalive has learned.
+	 */
+	void restore_keepalive_state();
+	void save_keepalive_state();
+
 public:
 	Protocol(MessageChannel& channel) :
 			channel(channel),
@@ -285,7 +373,12 @@ public:
 			product_firmware_version(PRODUCT_FIRMWARE_VERSION),
 			publisher(this),
 			last_ack_handlers_update(0),
-			initialized(false)
+			initialized(false),
+			handshake_state(HANDSHAKE_IDLE),
+			handshake_channel_flags(0),
+			handshake_app_state_crc(0),
+			hello_sent_millis(0),
+			hello_ack_result(0)
 	{
 	}
 
@@ -304,11 +397,78 @@ public:
 		pinger.set_interval(interval, source);
 	}
 
+	/**
+	 * Enables adaptive keepalive, probing intervals up to the given maximum, or disables it if
+	 * the maximum is 0. What was learned before a reset is restored.
+	 */
+	int set_adaptive_keepalive(system_tick_t max_interval)
+	{
+		pinger.set_adaptive(max_interval);
+		if (max_interval && initialized)
+		{
+			restore_keepalive_state();
+		}
+		return 0;
+	}
+
+	/**
+	 * Identifies the network the device is connected through, so the binding lifetime learned
+	 * for each network is kept apart.
+	 */
+	int set_keepalive_network(uint32_t network)
+	{
+		pinger.set_network(network);
+		return 0;
+	}
+
 	void set_fast_ota(unsigned data)
 	{
 		chunkedTransfer.set_fast_ota(data);
 	}
 
+	/**
+	 * Sets the maximum number of confirmable messages sent before waiting for an acknowledgement.
+	 * Only supported by protocols that manage message reliability.
+	 */
+	virtual int set_max_in_flight(unsigned count)
+	{
+		return SYSTEM_ERROR_NOT_SUPPORTED;
+	}
+
+	int set_event_batch_size(size_t size)
+	{
+		return publisher.set_batch_size(size);
+	}
+
+	int set_event_batch_linger(system_tick_t linger)
+	{
+		publisher.set_batch_linger(linger);
+		return 0;
+	}
+
+	int set_publish_rate_interval(system_tick_t interval)
+	{
+		return publisher.set_rate_limit(interval, publisher.get_rate_burst());
+	}
+
+	int set_publish_rate_burst(unsigned burst)
+	{
+		return publisher.set_rate_limit(publisher.get_rate_interval(), burst);
+	}
+
+	int set_publish_throttle_size(size_t count)
+	{
+		publisher.set_throttle_size(count);
+		return 0;
+	}
+
+#if HAL_PLATFORM_FILESYSTEM
+	int set_publish_queue_size(size_t size)
+	{
+		return publisher.set_queue_size(size);
+	}
+#endif
+
 	void set_handlers(CommunicationsHandlers& handlers)
 	{
 		copy_and_init(&this->handlers, sizeof(this->handlers), &handlers, handlers.size);
@@ -330,9 +490,29 @@ public:
 
 	/**
 	 * Establish a secure connection and send and process the hello message.
+	 * The handshake doesn't block while waiting for the server: begin() returns
+	 * HANDSHAKE_IN_PROGRESS and is called again to continue it.
 	 */
 	int begin();
 
+	/**
+	 * Abandons a handshake that hasn't completed, such as when the connection is closed.
+	 * The next call to begin() starts a new handshake.
+	 */
+	void cancel_handshake()
+	{
+		if (handshake_state != HANDSHAKE_IDLE)
+		{
+			channel.command(Channel::CANCEL_ESTABLISH);
+			handshake_state = HANDSHAKE_IDLE;
+		}
+	}
+
+	bool is_handshake_in_progress() const
+	{
+		return handshake_state != HANDSHAKE_IDLE;
+	}
+
 	/**
 	 * Wait for a specific message type to be received.
 	 * @param message_type		The type of message wait for
@@ -375,6 +555,7 @@ public:
 			handler.setError(toSystemError(error));
 			return false;
 		}
+		pinger.message_sent();
 		return true;
 	}
 
@@ -455,7 +636,8 @@ public:
 		return timesync_.send_request(callbacks.millis(), [&]() {
 			uint8_t token = next_token();
 			Message message;
-			channel.create(message);
+			if (channel.create(message))
+				return false;
 			size_t len = Messages::time_request(message.buf(), 0, token);
 			message.set_length(len);
 			return !channel.send(message);
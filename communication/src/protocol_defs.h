@@ -47,6 +47,7 @@ enum ProtocolError
     /* 23 */ IO_ERROR_LIGHTSSL_RECEIVE,
     /* 24 */ IO_ERROR_LIGHTSSL_HANDSHAKE_NONCE,
     /* 25 */ IO_ERROR_LIGHTSSL_HANDSHAKE_RECV_KEY,
+    /* 27 */ HANDSHAKE_IN_PROGRESS,    // not an error: the handshake continues on the next call
 
     /*
      * NOTE: when adding more ProtocolError codes, be sure to update toSystemError() in protocol_defs.cpp
@@ -111,7 +112,16 @@ namespace Connection
 enum Enum
 {
     PING = 0,
-    FAST_OTA = 1
+    FAST_OTA = 1,
+    PUBLISH_QUEUE = 2,  // maximum size in bytes of the persistent publish queue, 0 disables the queue
+    MAX_IN_FLIGHT = 3,  // maximum number of confirmable messages sent without waiting for an acknowledgement
+    EVENT_BATCH_SIZE = 4,   // maximum payload size in bytes of a batch of events, 0 disables batching
+    EVENT_BATCH_LINGER = 5, // time in milliseconds an event waits for other events to be batched with it
+    PUBLISH_RATE_INTERVAL = 6,  // average time in milliseconds between published events
+    PUBLISH_RATE_BURST = 7,     // number of events that may be published back to back
+    PUBLISH_THROTTLE = 8,       // maximum number of events held back by the rate limit, 0 rejects them
+    ADAPTIVE_KEEPALIVE = 9,     // longest keepalive interval in milliseconds to probe for, 0 disables probing
+    KEEPALIVE_NETWORK = 10      // identifies the network the device is connected through
 };
 }
 
@@ -121,6 +131,15 @@ typedef std::function<int()> callback;
 const product_id_t UNDEFINED_PRODUCT_ID = product_id_t(-1);
 const product_firmware_version_t UNDEFINED_PRODUCT_VERSION = product_firmware_version_t(-1);
 
+namespace HelloFlag {
+enum Enum {
+    OTA_UPGRADE_SUCCESSFUL = 0x01,
+    DIAGNOSTICS_SUPPORT    = 0x02,
+    COMPRESSION_SUPPORT    = 0x04, // payloads may be compressed, see compression.h
+    DELTA_UPDATE_SUPPORT   = 0x08  // firmware may be sent as a patch, see delta_patch.h
+};
+}
+
 namespace UpdateFlag {
 enum Enum {
     ERROR         = 0x00,
@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "logging.h"
+LOG_SOURCE_CATEGORY("comm.pubq")
+
+#include "publish_queue.h"
+
+#if HAL_PLATFORM_FILESYSTEM
+
+#include "communication_diagnostic.h"
+
+#include <new>
+
+namespace particle { namespace protocol {
+
+int PublishQueue::set_max_size(size_t size)
+{
+	if (size && !buffer_) {
+		buffer_.reset(new (std::nothrow) uint8_t[MAX_ENTRY_SIZE]);
+		if (!buffer_) {
+			return SYSTEM_ERROR_NO_MEMORY;
+		}
+		// pick up any events that were stored before the last reset
+		const int ret = queue_.count(&size_);
+		if (ret < 0) {
+			LOG(ERROR, "Unable to read publish queue, error %d; discarding it", ret);
+			clear(SYSTEM_ERROR_IO);
+		} else {
+			count_ = ret;
+		}
+		g_queuedEventsCounter = count_;
+	}
+	max_size_ = size;
+	if (!size) {
+		return 0;
+	}
+	LOG(INFO, "Publish queue enabled, %u events stored, %u/%u bytes used", (unsigned)count_, (unsigned)size_, (unsigned)size);
+	// honor the new limit for the events already stored
+	return make_room(0);
+}
+
+int PublishQueue::push_back(const char* event_name, const char* data, int ttl, EventType::Enum event_type, int flags,
+		CompletionHandler* handler)
+{
+	return push_back(event_name, strnlen(event_name, MAX_EVENT_NAME_LENGTH), data, data ? strnlen(data, MAX_EVENT_DATA_LENGTH) : 0,
+			ttl, event_type, flags, handler);
+}
+
+int PublishQueue::push_back(const char* event_name, size_t name_length, const char* data, size_t data_length, int ttl,
+		EventType::Enum event_type, int flags, CompletionHandler* handler)
+{
+	if (!is_enabled()) {
+		return SYSTEM_ERROR_INVALID_STATE;
+	}
+	if (name_length > MAX_EVENT_NAME_LENGTH || data_length > MAX_EVENT_DATA_LENGTH) {
+		return SYSTEM_ERROR_TOO_LARGE;
+	}
+	const size_t length = sizeof(Entry) + name_length + data_length;
+	int ret = make_room(length);
+	if (ret < 0) {
+		return ret;
+	}
+	// every event stored from now on has a handler slot, so that the slots line up with the entries
+	std::unique_ptr<Pending> pending(new (std::nothrow) Pending());
+	if (!pending) {
+		return SYSTEM_ERROR_NO_MEMORY;
+	}
+	Entry* entry = (Entry*)buffer_.get();
+	entry->name_length = name_length;
+	entry->event_type = event_type;
+	entry->flags = flags;
+	entry->reserved = 0;
+	entry->ttl = ttl;
+	entry->data_length = data_length;
+	memcpy(buffer_.get() + sizeof(Entry), event_name, name_length);
+	if (data_length) {
+		memcpy(buffer_.get() + sizeof(Entry) + name_length, data, data_length);
+	}
+	ret = queue_.pushBack(buffer_.get(), length);
+	if (ret < 0) {
+		return ret;
+	}
+	if (handler) {
+		pending->handler = std::move(*handler);
+	}
+	if (pending_tail_) {
+		pending_tail_->next = pending.get();
+	} else {
+		pending_head_ = pending.get();
+	}
+	pending_tail_ = pending.release();
+	pending_count_++;
+	count_++;
+	size_ += length + sizeof(fs::FileQueue::QueueEntry);
+	g_queuedEventsCounter = count_;
+	return 0;
+}
+
+int PublishQueue::front(Event& event)
+{
+	if (!count_ || !buffer_) {
+		return SYSTEM_ERROR_NOT_FOUND;
+	}
+	uint8_t* const buf = buffer_.get();
+	fs::FileQueue::QueueEntry header;
+	// leave room for the two null terminators
+	int ret = queue_.front(header, buf, MAX_ENTRY_SIZE - 2);
+	if (ret < 0) {
+		return ret;
+	}
+	Entry entry;
+	memcpy(&entry, buf, sizeof(entry));
+	if (entry.name_length > MAX_EVENT_NAME_LENGTH || entry.data_length > MAX_EVENT_DATA_LENGTH ||
+			sizeof(Entry) + entry.name_length + entry.data_length + sizeof(header) != header.size) {
+		LOG(ERROR, "Invalid publish queue entry");
+		ret = drop_front(SYSTEM_ERROR_BAD_DATA);
+		return (ret < 0) ? ret : SYSTEM_ERROR_BAD_DATA;
+	}
+	// shift the data by one byte to make room for the name's null terminator
+	char* name = (char*)buf + sizeof(Entry);
+	char* data = name + entry.name_length + 1;
+	memmove(data, name + entry.name_length, entry.data_length);
+	name[entry.name_length] = 0;
+	data[entry.data_length] = 0;
+	event.name = name;
+	event.data = data;
+	event.ttl = entry.ttl;
+	event.event_type = EventType::Enum(entry.event_type);
+	event.flags = entry.flags;
+	return 0;
+}
+
+int PublishQueue::pop_front(CompletionHandler* handler)
+{
+	if (!count_) {
+		return SYSTEM_ERROR_NOT_FOUND;
+	}
+	fs::FileQueue::QueueEntry header;
+	int ret = queue_.front(header, buffer_.get(), MAX_ENTRY_SIZE);
+	if (ret < 0) {
+		return ret;
+	}
+	ret = queue_.popFront();
+	if (ret < 0) {
+		return ret;
+	}
+	if (count_ == pending_count_) {
+		std::unique_ptr<Pending> pending(pending_head_);
+		pending_head_ = pending->next;
+		if (!pending_head_) {
+			pending_tail_ = nullptr;
+		}
+		pending_count_--;
+		if (handler) {
+			*handler = std::move(pending->handler);
+		}
+	}
+	count_--;
+	size_ = (size_ > header.size) ? size_ - header.size : 0;
+	if (!count_) {
+		size_ = 0;
+	}
+	g_queuedEventsCounter = count_;
+	return 0;
+}
+
+int PublishQueue::drop_front(int error)
+{
+	CompletionHandler handler;
+	const int ret = pop_front(&handler);
+	if (!ret) {
+		handler.setError(error);
+		g_droppedQueuedEventsCounter++;
+	}
+	return ret;
+}
+
+int PublishQueue::clear(int error)
+{
+	fail_pending(error);
+	count_ = 0;
+	size_ = 0;
+	g_queuedEventsCounter = 0;
+	const int ret = queue_.clear();
+	// the file doesn't exist if the queue was empty
+	return (ret < 0 && ret != LFS_ERR_NOENT) ? ret : 0;
+}
+
+void PublishQueue::fail_pending(int error)
+{
+	while (pending_head_) {
+		std::unique_ptr<Pending> pending(pending_head_);
+		pending_head_ = pending->next;
+		pending->handler.setError(error);
+	}
+	pending_tail_ = nullptr;
+	pending_count_ = 0;
+}
+
+/**
+ * Ensures there's space for an entry of the given size, dropping the oldest entries if necessary.
+ */
+int PublishQueue::make_room(size_t entry_size)
+{
+	const size_t required = entry_size ? entry_size + sizeof(fs::FileQueue::QueueEntry) : 0;
+	if (required > max_size_) {
+		return SYSTEM_ERROR_TOO_LARGE;
+	}
+	bool dropped = false;
+	while (count_ && size_ + required > max_size_) {
+		const int ret = drop_front(SYSTEM_ERROR_LIMIT_EXCEEDED);
+		if (ret < 0) {
+			return ret;
+		}
+		dropped = true;
+	}
+	if (dropped) {
+		LOG(WARN, "Publish queue full, dropped oldest events. %u events remain", (unsigned)count_);
+	}
+	// removed entries are only reclaimed when the queue is emptied or compacted
+	const int file_size = queue_.fileSize();
+	if (file_size < 0) {
+		return file_size;
+	}
+	if (file_size + required > max_size_) {
+		const int ret = queue_.compact(buffer_.get(), MAX_ENTRY_SIZE);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+}}
+
+#endif // HAL_PLATFORM_FILESYSTEM
@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "hal_platform.h"
+
+#if HAL_PLATFORM_FILESYSTEM
+
+#include "protocol_defs.h"
+#include "events.h"
+#include "file_queue.h"
+
+#include "completion_handler.h"
+
+#include <memory>
+
+namespace particle
+{
+namespace protocol
+{
+
+/**
+ * A persistent queue of events that could not be published while the cloud was unreachable.
+ *
+ * Events are stored in a file on the filesystem so they survive a reset. The space used by the
+ * queue is bounded: when an event doesn't fit, the oldest events are dropped to make room for it.
+ *
+ * The completion handlers of the events stored since the queue was created are kept in memory,
+ * so that they're completed only once their events are sent. The handlers of the events that are
+ * still stored when the queue is destroyed fail with SYSTEM_ERROR_QUEUED.
+ */
+class PublishQueue
+{
+public:
+	/**
+	 * An event as it's stored in the queue file. The name and data follow the header
+	 * and are not null-terminated.
+	 */
+	struct __attribute__((packed)) Entry
+	{
+		uint8_t name_length;
+		uint8_t event_type;
+		uint8_t flags;
+		uint8_t reserved;
+		int32_t ttl;
+		uint16_t data_length;
+	};
+
+	/**
+	 * The maximum size of an entry, and the size of the buffer used to read and write entries.
+	 * The name and data are null-terminated in the buffer when read back.
+	 */
+	static const size_t MAX_ENTRY_SIZE = sizeof(Entry) + MAX_EVENT_NAME_LENGTH + 1 + MAX_EVENT_DATA_LENGTH + 1;
+
+	/**
+	 * An event read back from the queue.
+	 */
+	struct Event
+	{
+		const char* name;
+		const char* data;
+		int ttl;
+		EventType::Enum event_type;
+		int flags;
+	};
+
+	explicit PublishQueue(const char* path) :
+			queue_(path),
+			pending_head_(nullptr),
+			pending_tail_(nullptr),
+			pending_count_(0),
+			max_size_(0),
+			count_(0),
+			size_(0)
+	{
+	}
+
+	~PublishQueue()
+	{
+		fail_pending(SYSTEM_ERROR_QUEUED);
+	}
+
+	/**
+	 * Sets the maximum number of bytes the queue may occupy on the filesystem.
+	 * A size of 0 disables the queue. Events already stored are retained
+	 * (subject to the new limit) and sent once the cloud connection is available.
+	 */
+	int set_max_size(size_t size);
+
+	bool is_enabled() const
+	{
+		return max_size_ > 0;
+	}
+
+	bool has_events() const
+	{
+		return count_ > 0;
+	}
+
+	size_t count() const
+	{
+		return count_;
+	}
+
+	/**
+	 * Adds an event to the back of the queue, dropping the oldest events if there isn't enough room.
+	 * The handler, if given, is moved into the queue if the event is stored, and is returned by
+	 * pop_front() once the event is removed. It fails if the event is dropped.
+	 */
+	int push_back(const char* event_name, const char* data, int ttl, EventType::Enum event_type, int flags,
+			CompletionHandler* handler = nullptr);
+
+	/**
+	 * Adds an event whose name and data are not null-terminated.
+	 */
+	int push_back(const char* event_name, size_t name_length, const char* data, size_t data_length, int ttl,
+			EventType::Enum event_type, int flags, CompletionHandler* handler = nullptr);
+
+	/**
+	 * Retrieves the event at the front of the queue. The returned strings remain valid
+	 * until the queue is next modified. A corrupt entry is removed from the queue, in which case
+	 * SYSTEM_ERROR_BAD_DATA is returned.
+	 */
+	int front(Event& event);
+
+	/**
+	 * Removes the event at the front of the queue. If the event was stored with a handler and
+	 * `handler` is given, the handler is moved to it.
+	 */
+	int pop_front(CompletionHandler* handler = nullptr);
+
+	/**
+	 * Removes all events. Their handlers fail with the given error.
+	 */
+	int clear(int error);
+
+private:
+	/**
+	 * The handler of an event stored since the queue was created.
+	 */
+	struct Pending
+	{
+		Pending* next;
+		CompletionHandler handler;
+	};
+
+	fs::FileQueue queue_;
+	std::unique_ptr<uint8_t[]> buffer_;
+
+	/**
+	 * The handlers of the last pending_count_ events in the queue, oldest first. The events
+	 * before them were stored before the queue was created.
+	 */
+	Pending* pending_head_;
+	Pending* pending_tail_;
+	size_t pending_count_;
+
+	/**
+	 * The maximum size of the queue in bytes.
+	 */
+	size_t max_size_;
+
+	/**
+	 * The number of events in the queue.
+	 */
+	size_t count_;
+
+	/**
+	 * The number of bytes used by the events in the queue, including the entry headers.
+	 */
+	size_t size_;
+
+	int make_room(size_t entry_size);
+	int drop_front(int error);
+	void fail_pending(int error);
+};
+
+}}
+
+#endif // HAL_PLATFORM_FILESYSTEM
@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "logging.h"
+LOG_SOURCE_CATEGORY("comm.throttle")
+
+#include "publish_throttle.h"
+
+#include "communication_diagnostic.h"
+
+#include <cstring>
+#include <new>
+
+namespace particle { namespace protocol {
+
+void PublishThrottle::set_max_events(size_t count)
+{
+	max_events = count;
+	while (count_ > max_events)
+	{
+		// events of any priority
+		if (!drop_lower(HIGH - 1))
+			break;
+	}
+}
+
+ProtocolError PublishThrottle::push(Priority priority, const char* event_name, const char* data, int ttl,
+		EventType::Enum event_type, int flags, CompletionHandler& handler)
+{
+	if (count_ >= max_events && !(max_events && drop_lower(priority)))
+	{
+		g_droppedThrottledEventsCounter++;
+		return BANDWIDTH_EXCEEDED;
+	}
+	std::unique_ptr<Event> event(new (std::nothrow) Event());
+	if (!event)
+		return INSUFFICIENT_STORAGE;
+	const size_t name_length = strnlen(event_name, MAX_EVENT_NAME_LENGTH);
+	const size_t data_length = data ? strnlen(data, MAX_EVENT_DATA_LENGTH) : 0;
+	event->text.reset(new (std::nothrow) char[name_length + 1 + data_length + 1]);
+	if (!event->text)
+		return INSUFFICIENT_STORAGE;
+	char* const text = event->text.get();
+	memcpy(text, event_name, name_length);
+	text[name_length] = 0;
+	if (data)
+		memcpy(text + name_length + 1, data, data_length);
+	text[name_length + 1 + data_length] = 0;
+	event->name_length = name_length;
+	event->has_data = (data != nullptr);
+	event->next = nullptr;
+	event->ttl = ttl;
+	event->event_type = event_type;
+	event->flags = flags;
+	event->handler = std::move(handler);
+
+	Lane& lane = lanes[priority];
+	Event* const e = event.release();
+	if (lane.tail)
+		lane.tail->next = e;
+	else
+		lane.head = e;
+	lane.tail = e;
+	count_++;
+	update_diagnostics();
+	return NO_ERROR;
+}
+
+std::unique_ptr<PublishThrottle::Event> PublishThrottle::pop()
+{
+	for (Lane& lane : lanes)
+	{
+		if (lane.head)
+		{
+			std::unique_ptr<Event> event(lane.head);
+			lane.head = event->next;
+			if (!lane.head)
+				lane.tail = nullptr;
+			event->next = nullptr;
+			count_--;
+			update_diagnostics();
+			return event;
+		}
+	}
+	return std::unique_ptr<Event>();
+}
+
+void PublishThrottle::clear(ProtocolError error)
+{
+	while (has_events())
+	{
+		std::unique_ptr<Event> event = pop();
+		event->handler.setError(toSystemError(error));
+	}
+}
+
+bool PublishThrottle::drop_lower(int priority)
+{
+	for (int i = PRIORITY_COUNT - 1; i > priority; i--)
+	{
+		Lane& lane = lanes[i];
+		if (!lane.head)
+			continue;
+		// the lanes are singly linked, so find the event before the tail
+		Event* prev = nullptr;
+		for (Event* e = lane.head; e != lane.tail; e = e->next)
+			prev = e;
+		std::unique_ptr<Event> event(lane.tail);
+		lane.tail = prev;
+		if (prev)
+			prev->next = nullptr;
+		else
+			lane.head = nullptr;
+		count_--;
+		update_diagnostics();
+		LOG(WARN, "Dropped throttled event %s", event->name());
+		event->handler.setError(toSystemError(BANDWIDTH_EXCEEDED));
+		g_droppedThrottledEventsCounter++;
+		return true;
+	}
+	return false;
+}
+
+void PublishThrottle::update_diagnostics()
+{
+	g_throttledEventsCounter = count_;
+}
+
+}}
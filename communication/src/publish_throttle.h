@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "protocol_defs.h"
+#include "events.h"
+
+#include "completion_handler.h"
+
+#include <memory>
+
+namespace particle
+{
+namespace protocol
+{
+
+/**
+ * Holds published events that exceed the rate limit until they can be sent.
+ *
+ * There is a lane for each priority. Events leave the throttle highest priority first, and in
+ * the order they were published within a lane. When the throttle is full, an event replaces the
+ * most recent event of a lower priority, which fails with BANDWIDTH_EXCEEDED.
+ */
+class PublishThrottle
+{
+public:
+	enum Priority
+	{
+		HIGH = 0,
+		NORMAL = 1,
+		LOW = 2,
+		PRIORITY_COUNT = 3
+	};
+
+	/**
+	 * The default maximum number of events held.
+	 */
+	static const size_t DEFAULT_MAX_EVENTS = 8;
+
+	/**
+	 * An event waiting for the rate limit.
+	 */
+	class Event
+	{
+	public:
+		Event* next;
+		CompletionHandler handler;
+		int ttl;
+		EventType::Enum event_type;
+		int flags;
+
+		const char* name() const
+		{
+			return text.get();
+		}
+
+		/**
+		 * The event data, or null if the event has none.
+		 */
+		const char* data() const
+		{
+			return has_data ? text.get() + name_length + 1 : nullptr;
+		}
+
+	private:
+		std::unique_ptr<char[]> text;
+		size_t name_length;
+		bool has_data;
+
+		friend class PublishThrottle;
+	};
+
+	PublishThrottle() :
+			lanes(),
+			count_(0),
+			max_events(DEFAULT_MAX_EVENTS)
+	{
+	}
+
+	~PublishThrottle()
+	{
+		clear(BANDWIDTH_EXCEEDED);
+	}
+
+	static Priority priority(int flags)
+	{
+		if (flags & EventType::PRIORITY_HIGH)
+			return HIGH;
+		if (flags & EventType::PRIORITY_LOW)
+			return LOW;
+		return NORMAL;
+	}
+
+	/**
+	 * Sets the maximum number of events held. 0 disables the throttle, so events exceeding
+	 * the rate limit are rejected. Events above the new maximum fail, lowest priority first.
+	 */
+	void set_max_events(size_t count);
+
+	bool is_enabled() const
+	{
+		return max_events > 0;
+	}
+
+	size_t count() const
+	{
+		return count_;
+	}
+
+	bool has_events() const
+	{
+		return count_ > 0;
+	}
+
+	/**
+	 * Determines if there are events of the given priority or a higher one waiting.
+	 */
+	bool has_events(Priority priority) const
+	{
+		for (int i = HIGH; i <= priority; i++)
+		{
+			if (lanes[i].head)
+				return true;
+		}
+		return false;
+	}
+
+	/**
+	 * Adds an event to the back of its lane. The handler is moved into the throttle and completed
+	 * when the event is sent.
+	 *
+	 * @return BANDWIDTH_EXCEEDED if the throttle is full of events of the same or a higher priority,
+	 * INSUFFICIENT_STORAGE if the event can't be allocated.
+	 */
+	ProtocolError push(Priority priority, const char* event_name, const char* data, int ttl,
+			EventType::Enum event_type, int flags, CompletionHandler& handler);
+
+	/**
+	 * Removes the oldest event of the highest priority.
+	 */
+	std::unique_ptr<Event> pop();
+
+	/**
+	 * Fails all the events held with the given error.
+	 */
+	void clear(ProtocolError error);
+
+private:
+	struct Lane
+	{
+		Event* head;
+		Event* tail;
+	};
+
+	Lane lanes[PRIORITY_COUNT];
+	size_t count_;
+	size_t max_events;
+
+	/**
+	 * Fails the most recent event of the lowest priority that is lower than the given one.
+	 */
+	bool drop_lower(int priority);
+	void update_diagnostics();
+};
+
+}}
@@ -15,6 +15,9 @@
  * License along with this library; if not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "logging.h"
+LOG_SOURCE_CATEGORY("comm.publisher")
+
 #include "publisher.h"
 
 #include "protocol.h"
@@ -22,3 +25,191 @@
 void particle::protocol::Publisher::add_ack_handler(message_id_t msg_id, CompletionHandler handler) {
     protocol->add_ack_handler(msg_id, std::move(handler), SEND_EVENT_ACK_TIMEOUT);
 }
+
+void particle::protocol::Publisher::event_sent(Message& message, int flags, CompletionHandler& handler) {
+    // Register completion handler only if acknowledgement was requested explicitly
+    if ((flags & EventType::WITH_ACK) && message.has_id()) {
+        add_ack_handler(message.get_id(), std::move(handler));
+    } else {
+        handler.setResult();
+    }
+}
+
+namespace particle { namespace protocol {
+
+ProtocolError Publisher::send_event_now(MessageChannel& channel, bool is_system_event, const char* event_name,
+		const char* data, int ttl, EventType::Enum event_type, int flags, system_tick_t time,
+		CompletionHandler& handler)
+{
+	ProtocolError result = NO_ERROR;
+	if (!is_system_event && batch.accepts(EventBatch::record_size(event_name, data))) {
+		result = batch_event(channel, event_name, data, ttl, event_type, flags, time, handler);
+	} else {
+		Message message;
+		result = send_event_message(channel, message, event_name, data, ttl, event_type, flags);
+		if (result == NO_ERROR) {
+			event_sent(message, flags, handler);
+		}
+#if HAL_PLATFORM_FILESYSTEM
+		else if (!is_system_event && queue.is_enabled()) {
+			result = enqueue_event(event_name, data, ttl, event_type, flags, handler);
+		}
+#endif
+	}
+	if (result != NO_ERROR) {
+		// no-op if the handler was already moved to the batch and completed there
+		handler.setError(toSystemError(result));
+	}
+	return result;
+}
+
+ProtocolError Publisher::process_throttle(MessageChannel& channel, system_tick_t time)
+{
+	while (throttle.has_events() && rate_limit.acquire(time)) {
+		std::unique_ptr<PublishThrottle::Event> event = throttle.pop();
+		// send_event_now() completes the handler, including on failure
+		CompletionHandler handler = std::move(event->handler);
+		const ProtocolError error = send_event_now(channel, false, event->name(), event->data(), event->ttl,
+				event->event_type, event->flags, time, handler);
+		if (error) {
+			LOG(WARN, "Unable to send throttled event, error %d", error);
+			return error;
+		}
+	}
+	return NO_ERROR;
+}
+
+ProtocolError Publisher::batch_event(MessageChannel& channel, const char* event_name, const char* data, int ttl,
+		EventType::Enum event_type, int flags, system_tick_t time, CompletionHandler& handler)
+{
+	if (!batch.has_room(EventBatch::record_size(event_name, data))) {
+		const ProtocolError error = send_batch(channel);
+		if (error) {
+			return error;
+		}
+	}
+	const int ret = batch.add(event_name, data, ttl, event_type, flags, is_confirmable(channel, flags),
+			std::move(handler), time);
+	if (ret < 0) {
+		return INSUFFICIENT_STORAGE;
+	}
+	if (batch.is_due(time)) {
+		return send_batch(channel);
+	}
+	return NO_ERROR;
+}
+
+ProtocolError Publisher::send_batch(MessageChannel& channel)
+{
+	if (!batch.has_events()) {
+		return NO_ERROR;
+	}
+	Message message;
+	ProtocolError error = channel.create(message, Messages::event_batch_header_size + batch.size());
+	if (!error) {
+		const size_t header_size = Messages::event_batch(message.buf(), 0, batch.is_confirmable());
+		memcpy(message.buf() + header_size, batch.data(), batch.size());
+		size_t length = header_size + batch.size();
+		if (compressor) {
+			length = compressor->compress(message.buf(), length);
+		}
+		message.set_length(length);
+		error = channel.send(message);
+	}
+	if (error) {
+		LOG(WARN, "Unable to send %u batched events, error %d", (unsigned)batch.count(), error);
+#if HAL_PLATFORM_FILESYSTEM
+		if (queue.is_enabled()) {
+			size_t index = 0;
+			batch.for_each([this, &index](const EventBatch::Event& event) {
+				// the handler moves to the queue with the event and is completed once it's sent
+				CompletionHandler handler = batch.take_handler(index++);
+				const int ret = queue.push_back(event.name, event.name_length, event.data, event.data_length,
+						event.ttl, event.event_type, event.flags, &handler);
+				if (ret < 0) {
+					LOG(ERROR, "Unable to store batched event, error %d", ret);
+					handler.setError(ret);
+				}
+			});
+			batch.complete(0);
+			return NO_ERROR;
+		}
+#endif
+		batch.complete(toSystemError(error));
+		return error;
+	}
+	LOG(TRACE, "Sent %u batched events", (unsigned)batch.count());
+	CompletionHandler handler = batch.sent();
+	if (handler) {
+		if (message.has_id()) {
+			add_ack_handler(message.get_id(), std::move(handler));
+		} else {
+			handler.setResult();
+		}
+	}
+	return NO_ERROR;
+}
+
+}}
+
+#if HAL_PLATFORM_FILESYSTEM
+
+namespace particle { namespace protocol {
+
+ProtocolError Publisher::enqueue_event(const char* event_name, const char* data, int ttl,
+		EventType::Enum event_type, int flags, CompletionHandler& handler)
+{
+	// the handler moves to the queue with the event and is completed once it's sent
+	const int ret = queue.push_back(event_name, data, ttl, event_type, flags, &handler);
+	if (ret < 0) {
+		LOG(ERROR, "Unable to store event %s, error %d", event_name, ret);
+		return INSUFFICIENT_STORAGE;
+	}
+	return NO_ERROR;
+}
+
+ProtocolError Publisher::process_queue(MessageChannel& channel, system_tick_t time)
+{
+	for (unsigned i = 0; i < PUBLISH_QUEUE_BATCH_SIZE && queue.has_events(); ++i) {
+		PublishQueue::Event event;
+		int ret = queue.front(event);
+		if (ret == SYSTEM_ERROR_BAD_DATA) {
+			// the corrupt entry has been dropped by the queue
+			continue;
+		}
+		if (ret < 0) {
+			// the cloud connection is fine, so only the stored events are given up
+			LOG(ERROR, "Unable to read stored event, error %d; discarding the stored events", ret);
+			queue.clear(SYSTEM_ERROR_IO);
+			break;
+		}
+		// the token is only taken once the event is sent
+		if (!rate_limit.available(time)) {
+			break;
+		}
+		Message message;
+		const ProtocolError error = send_event_message(channel, message, event.name, event.data,
+				event.ttl, event.event_type, event.flags);
+		if (error) {
+			// the event stays at the front of the queue until the next attempt
+			LOG(WARN, "Unable to send stored event, error %d", error);
+			break;
+		}
+		rate_limit.acquire(time);
+		g_sentQueuedEventsCounter++;
+		const int flags = event.flags;
+		CompletionHandler handler;
+		ret = queue.pop_front(&handler);
+		if (ret < 0) {
+			// the event would be sent again
+			LOG(ERROR, "Unable to remove sent event, error %d; discarding the stored events", ret);
+			queue.clear(SYSTEM_ERROR_IO);
+		}
+		event_sent(message, flags, handler);
+	}
+	return NO_ERROR;
+}
+
+}}
+
+#endif // HAL_PLATFORM_FILESYSTEM
@@ -26,6 +26,11 @@
 
 #include "completion_handler.h"
 #include "communication_diagnostic.h"
+#include "publish_queue.h"
+#include "event_batch.h"
+#include "compression.h"
+#include "publish_throttle.h"
+#include "token_bucket.h"
 
 namespace particle
 {
@@ -37,8 +42,21 @@ class Protocol;
 class Publisher
 {
 public:
+	/**
+	 * The default average time in milliseconds between user events, and the default number of
+	 * user events that may be published back to back.
+	 */
+	static const system_tick_t DEFAULT_RATE_INTERVAL = 250;
+	static const unsigned DEFAULT_RATE_BURST = 4;
+
 	explicit Publisher(Protocol* protocol) :
-			protocol(protocol)
+			protocol(protocol),
+			compressor(nullptr),
+			rate_limit(DEFAULT_RATE_INTERVAL, DEFAULT_RATE_BURST),
+			system_rate_limit(SYSTEM_RATE_INTERVAL, SYSTEM_RATE_BURST)
+#if HAL_PLATFORM_FILESYSTEM
+			, queue(PUBLISH_QUEUE_FILE)
+#endif
 	{
 	}
 
@@ -47,84 +65,232 @@ public:
 		return !strncmp(event_name, "spark", 5);
 	}
 
+	/**
+	 * Takes a token from the rate limit that applies to the event.
+	 *
+	 * @return true if the event exceeds the rate limit.
+	 */
 	bool is_rate_limited(bool is_system_event, system_tick_t millis)
 	{
-		if (is_system_event)
-		{
-			static uint16_t lastMinute = 0;
-			static uint8_t eventsThisMinute = 0;
+		return !(is_system_event ? system_rate_limit : rate_limit).acquire(millis);
+	}
 
-			uint16_t currentMinute = uint16_t(millis >> 16);
-			if (currentMinute == lastMinute)
-			{      // == handles millis() overflow
-				if (eventsThisMinute == 255)
-					return true;
-			}
-			else
-			{
-				lastMinute = currentMinute;
-				eventsThisMinute = 0;
+	/**
+	 * Sends an event. A user event that exceeds the rate limit is held back by the throttle and
+	 * sent from process_throttle() once the rate allows. System events have a separate, more
+	 * generous rate limit, and are rejected when they exceed it.
+	 */
+	ProtocolError send_event(MessageChannel& channel, const char* event_name,
+			const char* data, int ttl, EventType::Enum event_type, int flags,
+			system_tick_t time, CompletionHandler handler)
+	{
+		bool is_system_event = is_system(event_name);
+#if HAL_PLATFORM_FILESYSTEM
+		// keep the publish order while earlier events are still waiting in the queue
+		if (!is_system_event && queue.is_enabled() && queue.has_events()) {
+			return enqueue_event(event_name, data, ttl, event_type, flags, handler);
+		}
+#endif
+		if (is_system_event) {
+			if (is_rate_limited(true, time)) {
+				g_rateLimitedEventsCounter++;
+				return BANDWIDTH_EXCEEDED;
 			}
-			eventsThisMinute++;
 		}
-		else
-		{
-			static system_tick_t recent_event_ticks[5] =
-			{ (system_tick_t) -1000, (system_tick_t) -1000,
-					(system_tick_t) -1000, (system_tick_t) -1000,
-					(system_tick_t) -1000 };
-			static int evt_tick_idx = 0;
-
-			system_tick_t now = recent_event_ticks[evt_tick_idx] = millis;
-			evt_tick_idx++;
-			evt_tick_idx %= 5;
-			if (now - recent_event_ticks[evt_tick_idx] < 1000)
-			{
-				// exceeded allowable burst of 4 events per second
-				return true;
+		else {
+			// events of the same or a higher priority that are held back go first
+			const PublishThrottle::Priority priority = PublishThrottle::priority(flags);
+			if (throttle.has_events(priority) || is_rate_limited(false, time)) {
+				g_rateLimitedEventsCounter++;
+				return throttle.push(priority, event_name, data, ttl, event_type, flags, handler);
 			}
 		}
-		return false;
+		return send_event_now(channel, is_system_event, event_name, data, ttl, event_type, flags, time, handler);
 	}
 
-	ProtocolError send_event(MessageChannel& channel, const char* event_name,
-			const char* data, int ttl, EventType::Enum event_type, int flags,
-			system_tick_t time, CompletionHandler handler)
+	/**
+	 * Sets the rate limit for user events.
+	 *
+	 * @param interval The average time in milliseconds between events. 0 disables the limit.
+	 * @param burst The number of events that may be published back to back.
+	 */
+	int set_rate_limit(system_tick_t interval, unsigned burst)
 	{
-		bool is_system_event = is_system(event_name);
-		bool rate_limited = is_rate_limited(is_system_event, time);
-		if (rate_limited) {
-			g_rateLimitedEventsCounter++;
-			return BANDWIDTH_EXCEEDED;
+		if (!burst) {
+			return SYSTEM_ERROR_INVALID_ARGUMENT;
 		}
+		rate_limit.configure(interval, burst);
+		return 0;
+	}
+
+	system_tick_t get_rate_interval() const
+	{
+		return rate_limit.get_interval();
+	}
+
+	unsigned get_rate_burst() const
+	{
+		return rate_limit.get_burst();
+	}
+
+	/**
+	 * Sets the maximum number of events held back by the rate limit. 0 rejects events that
+	 * exceed the rate limit with BANDWIDTH_EXCEEDED.
+	 */
+	void set_throttle_size(size_t count)
+	{
+		throttle.set_max_events(count);
+	}
+
+	bool has_throttled_events() const
+	{
+		return throttle.has_events();
+	}
+
+	/**
+	 * Sends the events held back by the throttle, highest priority first, while the rate limit allows.
+	 */
+	ProtocolError process_throttle(MessageChannel& channel, system_tick_t time);
+
+	/**
+	 * Sets the compressor used for event data when that makes the message smaller.
+	 * nullptr disables compression.
+	 */
+	void set_compressor(PayloadCompressor* compressor)
+	{
+		this->compressor = compressor;
+	}
+
+	/**
+	 * Sets the maximum size of the payload of a batch of events. A size of 0 disables batching.
+	 */
+	int set_batch_size(size_t size)
+	{
+		return batch.set_max_size(size);
+	}
+
+	/**
+	 * Sets the time in milliseconds an event waits for other events to be batched with it.
+	 */
+	void set_batch_linger(system_tick_t linger)
+	{
+		batch.set_linger(linger);
+	}
 
-		Message message;
-		channel.create(message);
+	bool is_batch_due(system_tick_t time) const
+	{
+		return batch.is_due(time);
+	}
+
+	/**
+	 * Sends the batched events as a single message.
+	 */
+	ProtocolError send_batch(MessageChannel& channel);
+
+#if HAL_PLATFORM_FILESYSTEM
+	/**
+	 * Sets the maximum number of bytes used to store events that could not be sent.
+	 * A size of 0 disables the queue.
+	 */
+	int set_queue_size(size_t size)
+	{
+		return queue.set_max_size(size);
+	}
+
+	bool has_queued_events() const
+	{
+		return queue.has_events();
+	}
+
+	/**
+	 * Sends a batch of stored events. Sending stops early when the rate limit is reached,
+	 * so the remaining events are sent on subsequent calls.
+	 */
+	ProtocolError process_queue(MessageChannel& channel, system_tick_t time);
+#endif
+
+private:
+	Protocol* protocol;
+
+	/**
+	 * Set when the server accepts compressed payloads.
+	 */
+	PayloadCompressor* compressor;
+
+	EventBatch batch;
+
+	/**
+	 * Roughly the limit of 255 system events per 65 seconds that was enforced before.
+	 */
+	static const system_tick_t SYSTEM_RATE_INTERVAL = 256;
+	static const unsigned SYSTEM_RATE_BURST = 255;
+
+	TokenBucket rate_limit;
+	TokenBucket system_rate_limit;
+	PublishThrottle throttle;
+
+	/**
+	 * Sends an event, or adds it to the batch. The handler is completed, or moved to where it's
+	 * completed once the event is acknowledged, on all paths including failures.
+	 */
+	ProtocolError send_event_now(MessageChannel& channel, bool is_system_event, const char* event_name,
+			const char* data, int ttl, EventType::Enum event_type, int flags, system_tick_t time,
+			CompletionHandler& handler);
+
+	ProtocolError batch_event(MessageChannel& channel, const char* event_name, const char* data, int ttl,
+			EventType::Enum event_type, int flags, system_tick_t time, CompletionHandler& handler);
+
+#if HAL_PLATFORM_FILESYSTEM
+	/**
+	 * The file used to store events while the cloud is unreachable.
+	 */
+	static constexpr const char* PUBLISH_QUEUE_FILE = "/sys/pubqueue.bin";
+
+	/**
+	 * The maximum number of stored events sent from a single call to process_queue().
+	 */
+	static const unsigned PUBLISH_QUEUE_BATCH_SIZE = 4;
+
+	PublishQueue queue;
+
+	ProtocolError enqueue_event(const char* event_name, const char* data, int ttl,
+			EventType::Enum event_type, int flags, CompletionHandler& handler);
+#endif
+
+	static bool is_confirmable(MessageChannel& channel, int flags)
+	{
 		bool confirmable = channel.is_unreliable();
 		if (flags & EventType::NO_ACK) {
 			confirmable = false;
 		} else if (flags & EventType::WITH_ACK) {
 			confirmable = true;
 		}
+		return confirmable;
+	}
+
+	ProtocolError send_event_message(MessageChannel& channel, Message& message, const char* event_name,
+			const char* data, int ttl, EventType::Enum event_type, int flags)
+	{
+		const ProtocolError error = channel.create(message);
+		if (error) {
+			return error;
+		}
 		size_t msglen = Messages::event(message.buf(), 0, event_name, data, ttl,
-				event_type, confirmable);
-		message.set_length(msglen);
-		const ProtocolError result = channel.send(message);
-		if (result == NO_ERROR) {
-			// Register completion handler only if acknowledgement was requested explicitly
-			if ((flags & EventType::WITH_ACK) && message.has_id()) {
-			    add_ack_handler(message.get_id(), std::move(handler));
-			} else {
-			    handler.setResult();
-			}
+				event_type, is_confirmable(channel, flags));
+		if (compressor) {
+			msglen = compressor->compress(message.buf(), msglen);
 		}
-		return result;
+		message.set_length(msglen);
+		return channel.send(message);
 	}
 
-private:
-	Protocol* protocol;
-
 	void add_ack_handler(message_id_t msg_id, CompletionHandler handler);
+
+	/**
+	 * Completes the handler of an event that has been sent, or once it's acknowledged if that
+	 * was requested.
+	 */
+	void event_sent(Message& message, int flags, CompletionHandler& handler);
 };
 
 }}
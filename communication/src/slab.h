@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#include "service_debug.h"
+
+namespace particle
+{
+namespace protocol
+{
+
+/**
+ * A pool of equally sized blocks, each holding a single allocation. Free blocks are kept in a
+ * list, so allocating and freeing a block takes constant time. The blocks are allocated from the
+ * heap as a single chunk on first use, so the amount of memory used is bounded by the configured
+ * number of blocks and individual allocations never touch the heap.
+ *
+ * @param BlockSize The size of a block in bytes.
+ */
+template<size_t BlockSize>
+class Slab
+{
+	static_assert(BlockSize>=sizeof(void*) && BlockSize%sizeof(void*)==0, "block size should be a multiple of the pointer size");
+
+public:
+	static const size_t BLOCK_SIZE = BlockSize;
+
+	/**
+	 * @param count The number of blocks.
+	 */
+	explicit Slab(size_t count) :
+			blocks(nullptr),
+			free_list(nullptr),
+			block_count(0),
+			size_blocks(count),
+			used(0),
+			peak(0),
+			failures(0)
+	{
+	}
+
+	~Slab()
+	{
+		release();
+	}
+
+	/**
+	 * Sets the number of blocks. The blocks are reallocated with the new count once all blocks
+	 * allocated from the current chunk have been returned.
+	 */
+	void resize(size_t count)
+	{
+		size_blocks = count;
+		if (!used)
+			release();
+	}
+
+	/**
+	 * Allocates a block. Returns nullptr if all blocks are in use.
+	 */
+	void* allocate()
+	{
+		if (!blocks && size_blocks)
+			reserve();
+		if (!free_list)
+		{
+			failures++;
+			return nullptr;
+		}
+		void* ptr = free_list;
+		free_list = *(void**)ptr;
+		if (++used>peak)
+			peak = used;
+		return ptr;
+	}
+
+	/**
+	 * Returns a block previously allocated with allocate() to the slab.
+	 */
+	void deallocate(void* ptr)
+	{
+		SPARK_ASSERT(owns(ptr) && ((uint8_t*)ptr-blocks)%BlockSize==0);
+		*(void**)ptr = free_list;
+		free_list = ptr;
+		if (!--used && block_count!=size_blocks)
+			release();	// apply the new size
+	}
+
+	/**
+	 * Determines if the given pointer is within this slab.
+	 */
+	bool owns(const void* ptr) const
+	{
+		return blocks && (const uint8_t*)ptr>=blocks && (const uint8_t*)ptr<blocks+block_count*BlockSize;
+	}
+
+	/**
+	 * The total number of bytes in the slab.
+	 */
+	size_t capacity() const
+	{
+		return (blocks ? block_count : size_blocks)*BlockSize;
+	}
+
+	/**
+	 * The number of bytes currently allocated.
+	 */
+	size_t used_bytes() const
+	{
+		return used*BlockSize;
+	}
+
+	/**
+	 * The largest number of bytes that have been allocated at the same time.
+	 */
+	size_t peak_bytes() const
+	{
+		return peak*BlockSize;
+	}
+
+	/**
+	 * The number of allocations that failed because the slab was full.
+	 */
+	unsigned failed_allocations() const
+	{
+		return failures;
+	}
+
+private:
+	uint8_t* blocks;
+
+	/**
+	 * The first free block. Each free block starts with a pointer to the next one.
+	 */
+	void* free_list;
+
+	/**
+	 * The number of blocks in the allocated chunk.
+	 */
+	size_t block_count;
+
+	/**
+	 * The configured number of blocks.
+	 */
+	size_t size_blocks;
+
+	size_t used;
+	size_t peak;
+	unsigned failures;
+
+	void reserve()
+	{
+		// new[] returns memory aligned for any type, and each block size is a multiple of the pointer size
+		blocks = new (std::nothrow) uint8_t[size_blocks*BlockSize];
+		if (!blocks)
+			return;
+		block_count = size_blocks;
+		free_list = nullptr;
+		for (size_t i=block_count; i>0; i--)
+		{
+			void* block = blocks+(i-1)*BlockSize;
+			*(void**)block = free_list;
+			free_list = block;
+		}
+	}
+
+	void release()
+	{
+		delete[] blocks;
+		blocks = nullptr;
+		free_list = nullptr;
+		block_count = 0;
+	}
+};
+
+}}
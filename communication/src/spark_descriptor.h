@@ -103,7 +103,19 @@ struct SparkDescriptor
      */
     bool (*append_metrics)(appender_fn appender, void* append, uint32_t flags, uint32_t page, void* reserved);
 
-    void* reserved[1];      // add a few additional pointers
+    /**
+     * Optional callback - may be null.
+     * Reads part of the value of a variable that is generated when it's requested rather than kept
+     * in memory. Such values are sent in blocks, so they can be larger than a single message.
+     * @param variable_key	The name of the variable.
+     * @param offset		The offset of the first byte to read.
+     * @param data		The destination buffer.
+     * @param size		The number of bytes to read.
+     * @param reserved	For future expansion.
+     * @return the number of bytes read, which is less than `size` only at the end of the value, or
+     *      a negative value if the variable isn't read with this callback.
+     */
+    int (*read_variable)(const char* variable_key, size_t offset, char* data, size_t size, void* reserved);
 };
 
 PARTICLE_STATIC_ASSERT(SparkDescriptor_size, sizeof(SparkDescriptor)==60 || sizeof(void*)!=4);
@@ -190,6 +190,44 @@ int spark_protocol_set_connection_property(ProtocolFacade* protocol, unsigned pr
     {
         protocol->set_fast_ota(data);
     }
+#if HAL_PLATFORM_FILESYSTEM
+    else if (property_id == particle::protocol::Connection::PUBLISH_QUEUE)
+    {
+        return protocol->set_publish_queue_size(data);
+    }
+#endif
+    else if (property_id == particle::protocol::Connection::MAX_IN_FLIGHT)
+    {
+        return protocol->set_max_in_flight(data);
+    }
+    else if (property_id == particle::protocol::Connection::EVENT_BATCH_SIZE)
+    {
+        return protocol->set_event_batch_size(data);
+    }
+    else if (property_id == particle::protocol::Connection::EVENT_BATCH_LINGER)
+    {
+        return protocol->set_event_batch_linger(data);
+    }
+    else if (property_id == particle::protocol::Connection::PUBLISH_RATE_INTERVAL)
+    {
+        return protocol->set_publish_rate_interval(data);
+    }
+    else if (property_id == particle::protocol::Connection::PUBLISH_RATE_BURST)
+    {
+        return protocol->set_publish_rate_burst(data);
+    }
+    else if (property_id == particle::protocol::Connection::PUBLISH_THROTTLE)
+    {
+        return protocol->set_publish_throttle_size(data);
+    }
+    else if (property_id == particle::protocol::Connection::ADAPTIVE_KEEPALIVE)
+    {
+        return protocol->set_adaptive_keepalive(data);
+    }
+    else if (property_id == particle::protocol::Connection::KEEPALIVE_NETWORK)
+    {
+        return protocol->set_keepalive_network(data);
+    }
     return 0;
 }
 int spark_protocol_command(ProtocolFacade* protocol, ProtocolCommands::Enum cmd, uint32_t data, void* reserved)
@@ -107,7 +107,19 @@ struct SparkCallbacks
 
   	enum PersistType
 	{
-  		PERSIST_SESSION = 0
+  		PERSIST_SESSION = 0,
+		/**
+		 * The state of an interrupted firmware transfer. Saving 0 bytes discards the state.
+		 */
+		PERSIST_TRANSFER = 1,
+		/**
+		 * The keepalive intervals learned for recently used networks.
+		 */
+		PERSIST_KEEPALIVE = 2,
+		/**
+		 * The resolved addresses of the cloud server. Only used by the system.
+		 */
+		PERSIST_SERVER_ADDRESS = 3
 	};
 	int (*save)(const void* data, size_t length, uint8_t type, void* reserved);
 	/**
@@ -116,9 +128,18 @@ struct SparkCallbacks
 	int (*restore)(void* data, size_t max_length, uint8_t type, void* reserved);
 
 	// size == 52
+
+	/**
+	 * Reads the installed firmware module selected by prepare_for_firmware_update()
+	 * when an update is sent as a delta patch.
+	 * @return 0 on success
+	 */
+	int (*read_firmware)(uint32_t offset, uint8_t* data, size_t length, void* reserved);
+
+	// size == 56
 };
 
-PARTICLE_STATIC_ASSERT(SparkCallbacks_size, sizeof(SparkCallbacks)==(sizeof(void*)*13));
+PARTICLE_STATIC_ASSERT(SparkCallbacks_size, sizeof(SparkCallbacks)==(sizeof(void*)*14));
 
 /**
  * Application-supplied callbacks. (Deliberately distinct from the system-supplied
@@ -199,7 +220,8 @@ namespace ProtocolCommands {
     WAKE,
     DISCONNECT,
     TERMINATE,
-    FORCE_PING
+    FORCE_PING,
+    CANCEL_HANDSHAKE
   };
 };
 
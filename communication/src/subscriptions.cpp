@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "logging.h"
+LOG_SOURCE_CATEGORY("comm.subscriptions")
+
+#include "subscriptions.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+namespace particle { namespace protocol {
+
+namespace {
+
+/**
+ * Compares two strings of the given lengths lexicographically.
+ */
+int compare(const char* s1, size_t len1, const char* s2, size_t len2)
+{
+	const int cmp = memcmp(s1, s2, std::min(len1, len2));
+	if (cmp)
+		return cmp;
+	return (len1 < len2) ? -1 : (len1 > len2);
+}
+
+inline bool is_prefix(const char* prefix, size_t prefix_len, const char* str, size_t len)
+{
+	return prefix_len <= len && !memcmp(prefix, str, prefix_len);
+}
+
+} // namespace
+
+ProtocolError Subscriptions::reserve(size_t size)
+{
+	if (size <= capacity)
+		return NO_ERROR;
+	if (size > MAX_EVENT_HANDLERS)
+		return INSUFFICIENT_STORAGE;
+	size_t new_capacity = std::max(size, capacity ? capacity * 2 : (size_t)4);
+	if (new_capacity > MAX_EVENT_HANDLERS)
+		new_capacity = MAX_EVENT_HANDLERS;
+	FilteringEventHandler** new_handlers = new (std::nothrow) FilteringEventHandler*[new_capacity];
+	IndexEntry* new_index = new (std::nothrow) IndexEntry[new_capacity];
+	if (!new_handlers || !new_index)
+	{
+		delete[] new_handlers;
+		delete[] new_index;
+		return INSUFFICIENT_STORAGE;
+	}
+	if (count)
+	{
+		memcpy(new_handlers, handlers, count * sizeof(handlers[0]));
+		memcpy(new_index, index, count * sizeof(index[0]));
+	}
+	delete[] handlers;
+	delete[] index;
+	handlers = new_handlers;
+	index = new_index;
+	capacity = new_capacity;
+	return NO_ERROR;
+}
+
+void Subscriptions::rebuild_index()
+{
+	// insertion sort by filter, which keeps equal filters in the order they were added
+	for (uint16_t i = 0; i < count; i++)
+	{
+		IndexEntry entry = { i, NO_ENTRY, (uint8_t)strnlen(handlers[i]->filter, sizeof(handlers[i]->filter)) };
+		uint16_t j = i;
+		while (j > 0 && compare(filter(j - 1), index[j - 1].length, handlers[i]->filter, entry.length) > 0)
+		{
+			index[j] = index[j - 1];
+			j--;
+		}
+		index[j] = entry;
+	}
+	// the filters that are prefixes of an entry's filter are found on the chain of the preceding
+	// entry, since every string sorted between a prefix and the entry starts with that prefix
+	for (uint16_t i = 1; i < count; i++)
+	{
+		IndexEntry& entry = index[i];
+		uint16_t p = i - 1;
+		while (p != NO_ENTRY && !is_prefix(filter(p), index[p].length, filter(i), entry.length))
+			p = index[p].parent;
+		if (p != NO_ENTRY && index[p].length == entry.length)
+		{
+			// same filter as the preceding entry
+			entry.parent = index[p].parent;
+		}
+		else
+		{
+			entry.parent = p;
+		}
+	}
+}
+
+void Subscriptions::dispatch(const char* event_name, size_t event_name_length, const char* data,
+		void (*call_event_handler)(uint16_t size, FilteringEventHandler* handler, const char* event,
+				const char* data, void* reserved))
+{
+	// find the last entry whose filter is not greater than the event name
+	size_t lo = 0, hi = count;
+	while (lo < hi)
+	{
+		const size_t mid = (lo + hi) / 2;
+		if (compare(filter(mid), index[mid].length, event_name, event_name_length) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	uint16_t entry = lo ? lo - 1 : NO_ENTRY;
+	// the longest matching filter is on its chain, and that filter's chain has all the others
+	while (entry != NO_ENTRY && !is_prefix(filter(entry), index[entry].length, event_name, event_name_length))
+		entry = index[entry].parent;
+
+	while (entry != NO_ENTRY)
+	{
+		uint16_t first = entry;
+		while (first > 0 && index[first - 1].length == index[entry].length &&
+				!memcmp(filter(first - 1), filter(entry), index[entry].length))
+			first--;
+		const uint16_t parent = index[entry].parent;
+		for (uint16_t i = first; i <= entry; i++)
+		{
+			FilteringEventHandler* handler = handlers[index[i].handler];
+			// don't call the handler directly, use a callback for it.
+			if (!call_event_handler)
+			{
+				if (handler->handler_data)
+				{
+					EventHandlerWithData fn = (EventHandlerWithData)handler->handler;
+					fn(handler->handler_data, event_name, data);
+				}
+				else
+				{
+					handler->handler(event_name, data);
+				}
+			}
+			else
+			{
+				call_event_handler(sizeof(FilteringEventHandler), handler, event_name, data, NULL);
+			}
+		}
+		entry = parent;
+	}
+}
+
+void Subscriptions::remove_event_handlers(const char* event_name)
+{
+	uint16_t dest = 0;
+	for (uint16_t i = 0; i < count; i++)
+	{
+		if (!event_name || !strcmp(event_name, handlers[i]->filter))
+		{
+			delete handlers[i];
+		}
+		else
+		{
+			handlers[dest++] = handlers[i];
+		}
+	}
+	count = dest;
+	if (!count)
+	{
+		delete[] handlers;
+		delete[] index;
+		handlers = nullptr;
+		index = nullptr;
+		capacity = 0;
+	}
+	else
+	{
+		rebuild_index();
+	}
+}
+
+bool Subscriptions::event_handler_exists(const char *event_name, EventHandler handler,
+		void *handler_data, SubscriptionScope::Enum scope, const char* id)
+{
+	for (uint16_t i = 0; i < count; i++)
+	{
+		const FilteringEventHandler& h = *handlers[i];
+		if (h.handler == handler && h.handler_data == handler_data && h.scope == scope)
+		{
+			const size_t MAX_FILTER_LEN = sizeof(h.filter);
+			const size_t FILTER_LEN = strnlen(event_name, MAX_FILTER_LEN);
+			if (!strncmp(h.filter, event_name, FILTER_LEN))
+			{
+				const size_t MAX_ID_LEN = sizeof(h.device_id) - 1;
+				const size_t id_len = id ? strnlen(id, MAX_ID_LEN) : 0;
+				if (id_len)
+					return !strncmp(h.device_id, id, id_len);
+				else
+					return !h.device_id[0];
+			}
+		}
+	}
+	return false;
+}
+
+ProtocolError Subscriptions::add_event_handler(const char *event_name, EventHandler handler,
+		void *handler_data, SubscriptionScope::Enum scope, const char* id)
+{
+	if (event_handler_exists(event_name, handler, handler_data, scope, id))
+		return NO_ERROR;
+
+	ProtocolError error = reserve(count + 1);
+	if (error)
+	{
+		LOG(ERROR, "Unable to add event handler, %u handlers registered", (unsigned)count);
+		return error;
+	}
+	FilteringEventHandler* h = new (std::nothrow) FilteringEventHandler();
+	if (!h)
+		return INSUFFICIENT_STORAGE;
+	const size_t MAX_FILTER_LEN = sizeof(h->filter);
+	const size_t FILTER_LEN = strnlen(event_name, MAX_FILTER_LEN);
+	memcpy(h->filter, event_name, FILTER_LEN);
+	h->handler = handler;
+	h->handler_data = handler_data;
+	const size_t MAX_ID_LEN = sizeof(h->device_id) - 1;
+	const size_t id_len = id ? strnlen(id, MAX_ID_LEN) : 0;
+	memcpy(h->device_id, id, id_len);
+	h->scope = scope;
+	handlers[count++] = h;
+	rebuild_index();
+	return NO_ERROR;
+}
+
+}}
@@ -19,23 +19,85 @@
 
 #pragma once
 
-namespace particle
-{
-namespace protocol
-{
-
 #include "protocol_defs.h"
 #include "events.h"
+#include "messages.h"
 #include "message_channel.h"
 #include <stdint.h>
 
+/**
+ * The maximum number of event handlers. Storage for the handlers is allocated as they are added.
+ */
+#ifndef PROTOCOL_MAX_EVENT_HANDLERS
+#define PROTOCOL_MAX_EVENT_HANDLERS 64
+#endif
+
+namespace particle
+{
+namespace protocol
+{
+
+/**
+ * Maintains the event handlers registered by this device and dispatches received events to them.
+ *
+ * Handlers are kept in the order they were added, which is the order in which subscriptions are
+ * sent to the cloud and in which the subscriptions checksum is computed. Alongside, an index of the
+ * handlers sorted by filter is maintained, where each entry links to the entry of the longest other
+ * filter that is a prefix of its own. Dispatching an event finds the greatest filter that is not
+ * greater than the event name with a binary search, and then follows the links, so only the handlers
+ * whose filter matches the event are visited.
+ */
 class Subscriptions
 {
 public:
 	typedef uint32_t (*calculate_crc_fn)(const unsigned char *buf, uint32_t buflen);
 
+	static const size_t MAX_EVENT_HANDLERS = PROTOCOL_MAX_EVENT_HANDLERS;
+
+	static_assert(MAX_EVENT_HANDLERS > 0 && MAX_EVENT_HANDLERS < 0xffff, "index entries are 16-bit");
+
 private:
-	FilteringEventHandler event_handlers[5];
+	struct IndexEntry
+	{
+		/**
+		 * The position of the handler in `handlers`.
+		 */
+		uint16_t handler;
+		/**
+		 * The last index entry of the longest filter that is a proper prefix of this entry's filter,
+		 * or NO_ENTRY.
+		 */
+		uint16_t parent;
+		/**
+		 * The length of the filter, which is not null-terminated if it fills the whole field.
+		 */
+		uint8_t length;
+	};
+
+	static const uint16_t NO_ENTRY = 0xffff;
+
+	/**
+	 * The handlers in the order they were added. Handlers are allocated individually, so that a
+	 * handler passed to `call_event_handler` stays in place as other handlers are added.
+	 */
+	FilteringEventHandler** handlers;
+	/**
+	 * The handlers sorted by filter, and by position for equal filters.
+	 */
+	IndexEntry* index;
+	uint16_t count;
+	uint16_t capacity;
+
+	ProtocolError reserve(size_t size);
+	void rebuild_index();
+	void dispatch(const char* event_name, size_t event_name_length, const char* data,
+			void (*call_event_handler)(uint16_t size, FilteringEventHandler* handler, const char* event,
+					const char* data, void* reserved));
+
+	const char* filter(uint16_t entry) const
+	{
+		return handlers[index[entry].handler]->filter;
+	}
 
 protected:
 
@@ -43,13 +105,15 @@ protected:
 	{
 	    size_t msglen;
 	    Message message;
-	    channel.create(message);
+	    ProtocolError result = channel.create(message);
+	    if (result)
+	        return result;
         if (device_id)
        	  msglen = subscription(message.buf(), 0, filter, device_id);
         else
           msglen = subscription(message.buf(), 0, filter, scope);
         message.set_length(msglen);
-        ProtocolError result = channel.send(message);
+        result = channel.send(message);
         return result;
 	}
 
@@ -60,9 +124,25 @@ protected:
 
 public:
 
-	Subscriptions()
+	Subscriptions() :
+			handlers(nullptr),
+			index(nullptr),
+			count(0),
+			capacity(0)
+	{
+	}
+
+	~Subscriptions()
 	{
-		memset(&event_handlers, 0, sizeof(event_handlers));
+		remove_event_handlers(nullptr);
+	}
+
+	Subscriptions(const Subscriptions&) = delete;
+	Subscriptions& operator=(const Subscriptions&) = delete;
+
+	size_t event_handler_count() const
+	{
+		return count;
 	}
 
 	uint32_t compute_subscriptions_checksum(calculate_crc_fn calculate_crc)
@@ -150,167 +230,41 @@ public:
 		// null terminate event name string
 		event_name[event_name_length] = 0;
 
-		const int NUM_HANDLERS = sizeof(event_handlers)
-				/ sizeof(FilteringEventHandler);
-		for (int i = 0; i < NUM_HANDLERS; i++)
-		{
-			if (NULL == event_handlers[i].handler)
-			{
-				break;
-			}
-			const size_t MAX_FILTER_LENGTH = sizeof(event_handlers[i].filter);
-			const size_t filter_length = strnlen(event_handlers[i].filter,
-					MAX_FILTER_LENGTH);
-
-			if (event_name_length < filter_length)
-			{
-				// does not match this filter, try the next event handler
-				continue;
-			}
-
-			const int cmp = memcmp(event_handlers[i].filter, event_name,
-					filter_length);
-			if (0 == cmp)
-			{
-				// don't call the handler directly, use a callback for it.
-				if (!call_event_handler)
-				{
-					if (event_handlers[i].handler_data)
-					{
-						EventHandlerWithData handler =
-								(EventHandlerWithData) event_handlers[i].handler;
-						handler(event_handlers[i].handler_data,
-								(char *) event_name, (char *) data);
-					}
-					else
-					{
-						event_handlers[i].handler((char *) event_name,
-								(char *) data);
-					}
-				}
-				else
-				{
-					call_event_handler(sizeof(FilteringEventHandler),
-							&event_handlers[i], (const char*) event_name,
-							(const char*) data, NULL);
-				}
-			}
-			// else continue the for loop to try the next handler
-		}
+		dispatch((const char*)event_name, event_name_length, (const char*)data, call_event_handler);
 		return NO_ERROR;
 	}
 
 	template<typename F> ProtocolError for_each(F callback)
 	{
-		const int NUM_HANDLERS = sizeof(event_handlers)
-				/ sizeof(FilteringEventHandler);
 		ProtocolError error = NO_ERROR;
-		for (unsigned i = 0; i < NUM_HANDLERS; i++)
+		for (unsigned i = 0; i < count; i++)
 		{
-			if (nullptr != event_handlers[i].handler)
-			{
-				error = callback(event_handlers[i]);
-				if (error)
-					break;
-			}
+			error = callback(*handlers[i]);
+			if (error)
+				break;
 		}
 		return error;
 	}
 
-	void remove_event_handlers(const char* event_name)
-	{
-		if (NULL == event_name)
-		{
-			memset(event_handlers, 0, sizeof(event_handlers));
-		}
-		else
-		{
-			const int NUM_HANDLERS = sizeof(event_handlers)
-					/ sizeof(FilteringEventHandler);
-			int dest = 0;
-			for (int i = 0; i < NUM_HANDLERS; i++)
-			{
-				if (!strcmp(event_name, event_handlers[i].filter))
-				{
-					memset(&event_handlers[i], 0, sizeof(event_handlers[i]));
-				}
-				else
-				{
-					if (dest != i)
-					{
-						memcpy(event_handlers + dest, event_handlers + i,
-								sizeof(event_handlers[i]));
-						memset(event_handlers + i, 0,
-								sizeof(event_handlers[i]));
-					}
-					dest++;
-				}
-			}
-		}
-	}
+	/**
+	 * Removes the handlers with the given filter, or all handlers if `event_name` is null.
+	 */
+	void remove_event_handlers(const char* event_name);
 
 	/**
 	 * Determines if the given handler exists.
 	 */
 	bool event_handler_exists(const char *event_name, EventHandler handler,
-			void *handler_data, SubscriptionScope::Enum scope, const char* id)
-	{
-		const int NUM_HANDLERS = sizeof(event_handlers)
-				/ sizeof(FilteringEventHandler);
-		for (int i = 0; i < NUM_HANDLERS; i++)
-		{
-			if (event_handlers[i].handler == handler
-					&& event_handlers[i].handler_data == handler_data
-					&& event_handlers[i].scope == scope)
-			{
-				const size_t MAX_FILTER_LEN = sizeof(event_handlers[i].filter);
-				const size_t FILTER_LEN = strnlen(event_name, MAX_FILTER_LEN);
-				if (!strncmp(event_handlers[i].filter, event_name, FILTER_LEN))
-				{
-					const size_t MAX_ID_LEN =
-							sizeof(event_handlers[i].device_id) - 1;
-					const size_t id_len = id ? strnlen(id, MAX_ID_LEN) : 0;
-					if (id_len)
-						return !strncmp(event_handlers[i].device_id, id, id_len);
-					else
-						return !event_handlers[i].device_id[0];
-				}
-			}
-		}
-		return false;
-	}
+			void *handler_data, SubscriptionScope::Enum scope, const char* id);
 
 	/**
 	 * Adds the given handler.
+	 *
+	 * @return INSUFFICIENT_STORAGE if there are MAX_EVENT_HANDLERS handlers already or
+	 * the handler can't be allocated.
 	 */
 	ProtocolError add_event_handler(const char *event_name, EventHandler handler,
-			void *handler_data, SubscriptionScope::Enum scope, const char* id)
-	{
-		if (event_handler_exists(event_name, handler, handler_data, scope, id))
-			return NO_ERROR;
-
-		const int NUM_HANDLERS = sizeof(event_handlers) / sizeof(FilteringEventHandler);
-		for (int i = 0; i < NUM_HANDLERS; i++)
-		{
-			if (NULL == event_handlers[i].handler)
-			{
-				const size_t MAX_FILTER_LEN = sizeof(event_handlers[i].filter);
-				const size_t FILTER_LEN = strnlen(event_name, MAX_FILTER_LEN);
-				memcpy(event_handlers[i].filter, event_name, FILTER_LEN);
-				memset(event_handlers[i].filter + FILTER_LEN, 0, MAX_FILTER_LEN - FILTER_LEN);
-				event_handlers[i].handler = handler;
-				event_handlers[i].handler_data = handler_data;
-				event_handlers[i].device_id[0] = 0;
-				const size_t MAX_ID_LEN = sizeof(event_handlers[i].device_id) - 1;
-				const size_t id_len = id ? strnlen(id, MAX_ID_LEN) : 0;
-				memcpy(event_handlers[i].device_id, id, id_len);
-				event_handlers[i].device_id[id_len] = 0;
-				event_handlers[i].scope = scope;
-				return NO_ERROR;
-			}
-		}
-		return INSUFFICIENT_STORAGE;
-	}
+			void *handler_data, SubscriptionScope::Enum scope, const char* id);
 
 	inline ProtocolError send_subscriptions(MessageChannel& channel)
 	{
@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "protocol_defs.h"
+
+namespace particle
+{
+namespace protocol
+{
+
+/**
+ * A token bucket rate limiter. The bucket holds up to `burst` tokens and gains a token every
+ * `interval` milliseconds. Each operation takes a token, so on average one operation is allowed
+ * per interval, and up to `burst` operations may happen back to back after a quiet period.
+ */
+class TokenBucket
+{
+public:
+	TokenBucket(system_tick_t interval, unsigned burst) :
+			interval(interval),
+			burst(burst),
+			tokens(burst),
+			last_refill(0),
+			started(false)
+	{
+	}
+
+	/**
+	 * Changes the rate. The bucket starts full with the new burst size.
+	 */
+	void configure(system_tick_t interval, unsigned burst)
+	{
+		this->interval = interval;
+		this->burst = burst;
+		tokens = burst;
+		started = false;
+	}
+
+	/**
+	 * Takes a token if one is available.
+	 */
+	bool acquire(system_tick_t now)
+	{
+		if (!available(now))
+			return false;
+		tokens--;
+		return true;
+	}
+
+	/**
+	 * Determines if a token is available without taking it.
+	 */
+	bool available(system_tick_t now)
+	{
+		refill(now);
+		return tokens > 0;
+	}
+
+	system_tick_t get_interval() const
+	{
+		return interval;
+	}
+
+	unsigned get_burst() const
+	{
+		return burst;
+	}
+
+private:
+	system_tick_t interval;
+	unsigned burst;
+	unsigned tokens;
+	system_tick_t last_refill;
+	bool started;
+
+	void refill(system_tick_t now)
+	{
+		if (!started)
+		{
+			started = true;
+			last_refill = now;
+			return;
+		}
+		if (!interval)
+		{
+			tokens = burst;
+			return;
+		}
+		// unsigned arithmetic handles millis() overflow
+		const system_tick_t elapsed = now - last_refill;
+		const system_tick_t count = elapsed / interval;
+		if (count)
+		{
+			last_refill += count * interval;
+			if (count >= burst - tokens)
+			{
+				tokens = burst;
+				// a full bucket doesn't accumulate time towards the next token
+				last_refill = now;
+			}
+			else
+			{
+				tokens += count;
+			}
+		}
+	}
+};
+
+}}
@@ -24,6 +24,7 @@
 #include "message_channel.h"
 #include "messages.h"
 #include "spark_descriptor.h"
+#include "compression.h"
 
 
 namespace particle
@@ -60,9 +61,21 @@ public:
     }
 
     ProtocolError handle_variable_request(char* variable_key, Message& message, MessageChannel& channel, token_t token, message_id_t message_id,
+        PayloadCompressor& compressor,
         SparkReturnType::Enum (*variable_type)(const char *variable_key),
-        const void *(*get_variable)(const char *variable_key))
+        const void *(*get_variable)(const char *variable_key),
+        int (*read_variable)(const char* variable_key, size_t offset, char* data, size_t size, void* reserved))
     {
+        if (read_variable)
+        {
+            bool handled = false;
+            const ProtocolError error = send_variable_block(variable_key, message, channel, token, message_id,
+                    read_variable, handled);
+            if (handled) {
+                return error;
+            }
+        }
+
         uint8_t* queue = message.buf();
         message.set_id(message_id);
         // get variable value according to type using the descriptor
@@ -90,6 +103,7 @@ public:
                 str_length = max_length;
             }
             response = Messages::variable_value(queue, message_id, token, str_val, str_length);
+            response = compressor.compress(queue, response);
         }
         else if(SparkReturnType::DOUBLE == var_type)
         {
@@ -100,6 +114,152 @@ public:
         message.set_length(response);
         return channel.send(message);
     }
+
+    /**
+     * Finds the value of the Block2 option in a request.
+     * @return true if the request has a valid Block2 option.
+     */
+    static bool decode_block2(const Message& message, uint32_t& value)
+    {
+        const uint8_t* p = message.buf();
+        const uint8_t* const end = p + message.length();
+        if (message.length() < 4) {
+            return false;
+        }
+        p += 4 + (p[0] & 0x0f); // header and token
+        unsigned option = 0;
+        while (p < end && *p != 0xff)
+        {
+            unsigned delta = *p >> 4;
+            unsigned length = *p & 0x0f;
+            ++p;
+            if (!decode_option_field(delta, p, end) || !decode_option_field(length, p, end) ||
+                    length > (size_t)(end - p)) {
+                return false;
+            }
+            option += delta;
+            if (option == CoAPOption::BLOCK2)
+            {
+                if (length > 3) {
+                    return false;
+                }
+                value = 0;
+                for (unsigned i = 0; i < length; ++i) {
+                    value = value << 8 | p[i];
+                }
+                return true;
+            }
+            if (option > CoAPOption::BLOCK2) {
+                break;
+            }
+            p += length;
+        }
+        return false;
+    }
+
+    /**
+     * The block size exponent of the largest block that fits in a message of the given capacity.
+     */
+    static uint8_t max_block_szx(size_t capacity)
+    {
+        uint8_t szx = 6; // 1024 bytes, the largest block size
+        // one more byte is read to find out if the block is the last one
+        while (szx > 0 && (16u << szx) + Messages::variable_block_max_header_size + 1 > capacity) {
+            --szx;
+        }
+        return szx;
+    }
+
+private:
+
+    static bool decode_option_field(unsigned& field, const uint8_t*& p, const uint8_t* end)
+    {
+        if (field == 13)
+        {
+            if (p >= end) {
+                return false;
+            }
+            field = 13 + *p++;
+        }
+        else if (field == 14)
+        {
+            if (end - p < 2) {
+                return false;
+            }
+            field = 269 + (p[0] << 8 | p[1]);
+            p += 2;
+        }
+        else if (field == 15) {
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Sends the block of a variable value requested by the Block2 option of the request, or the
+     * first block if there's no such option. Values that fit in a single block are sent without
+     * the option, like the values of other variables.
+     * @param handled	Set to false if the variable isn't read with the read_variable callback.
+     */
+    ProtocolError send_variable_block(const char* variable_key, Message& message, MessageChannel& channel, token_t token, message_id_t message_id,
+        int (*read_variable)(const char* variable_key, size_t offset, char* data, size_t size, void* reserved),
+        bool& handled)
+    {
+        // the request is overwritten by the response, so it's decoded first
+        uint32_t block = 0;
+        const bool has_block = decode_block2(message, block);
+        uint8_t szx = max_block_szx(message.capacity());
+        uint32_t block_num = has_block ? block >> 4 : 0;
+        if (has_block)
+        {
+            const uint8_t client_szx = block & 0x07;
+            if (client_szx == 7)
+            {
+                // reserved (RFC 7959, section 2.2)
+                handled = true;
+                message.set_length(Messages::coded_ack(message.buf(), token, CoAPCode::BAD_OPTION, message_id >> 8, message_id & 0xff));
+                return channel.send(message);
+            }
+            if (client_szx < szx) {
+                szx = client_szx; // the client asked for smaller blocks
+            } else {
+                // the block starts at the same offset in the smaller blocks sent (RFC 7959, section 2.4)
+                block_num <<= client_szx - szx;
+            }
+        }
+        const size_t block_size = 16u << szx;
+
+        // the data is read past the largest header and moved next to the actual header afterwards
+        uint8_t* queue = message.buf();
+        char* data = (char*)queue + Messages::variable_block_max_header_size;
+        const int n = read_variable(variable_key, block_num * block_size, data, block_size + 1, nullptr);
+        if (n < 0) {
+            handled = false;
+            return NO_ERROR;
+        }
+        handled = true;
+        message.set_id(message_id);
+        size_t length = n;
+        if (block_num > 0 && length == 0)
+        {
+            // the block is past the end of the value
+            message.set_length(Messages::coded_ack(queue, token, CoAPCode::BAD_OPTION, message_id >> 8, message_id & 0xff));
+            return channel.send(message);
+        }
+        const bool more = length > block_size;
+        if (more) {
+            length = block_size;
+        }
+        size_t header = 0;
+        if (has_block || more) {
+            header = Messages::variable_block(queue, message_id, token, block_num, more, szx);
+        } else {
+            header = Messages::content(queue, message_id, token);
+        }
+        memmove(queue + header, data, length);
+        message.set_length(header + length);
+        return channel.send(message);
+    }
 };
 
 
@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+
+#include "chunked_transfer.h"
+
+#include "catch.hpp"
+#include "fakeit.hpp"
+
+using namespace particle::protocol;
+using namespace fakeit;
+
+namespace {
+
+const uint16_t CHUNK_SIZE = 16;
+
+struct Storage : ChunkedTransfer::Callbacks
+{
+	std::vector<uint8_t> state;
+	std::vector<uint32_t> prepare_flags;
+	unsigned chunks_saved = 0;
+
+	int prepare_for_firmware_update(FileTransfer::Descriptor& data, uint32_t flags, void*) override
+	{
+		prepare_flags.push_back(flags);
+		return 0;
+	}
+
+	int save_firmware_chunk(FileTransfer::Descriptor& descriptor, const unsigned char* chunk, void*) override
+	{
+		chunks_saved++;
+		return 0;
+	}
+
+	int finish_firmware_update(FileTransfer::Descriptor& data, uint32_t flags, void*) override
+	{
+		return 0;
+	}
+
+	uint32_t calculate_crc(const unsigned char *buf, uint32_t buflen) override
+	{
+		uint32_t sum = 0;
+		for (uint32_t i = 0; i < buflen; i++)
+			sum += buf[i];
+		return sum;
+	}
+
+	system_tick_t millis() override
+	{
+		return 0;
+	}
+
+	int read_firmware(uint32_t offset, uint8_t* data, size_t length, void*) override
+	{
+		return -1;
+	}
+
+	int save_transfer_state(const void* data, size_t length, void*) override
+	{
+		state.assign((const uint8_t*)data, (const uint8_t*)data + length);
+		return 0;
+	}
+
+	int restore_transfer_state(void* data, size_t max_length, void*) override
+	{
+		const size_t size = std::min(max_length, state.size());
+		memcpy(data, state.data(), size);
+		return size;
+	}
+};
+
+/**
+ * A channel that records the messages sent.
+ */
+struct TransferChannel
+{
+	Mock<MessageChannel> mock;
+	uint8_t rx[PROTOCOL_BUFFER_SIZE];
+	uint8_t tx[PROTOCOL_BUFFER_SIZE];
+	std::vector<std::vector<uint8_t>> sent;
+
+	TransferChannel()
+	{
+		When(Method(mock, create)).AlwaysDo([this](Message& msg, size_t) {
+			msg.set_buffer(tx, sizeof(tx));
+			return NO_ERROR;
+		});
+		When(Method(mock, response)).AlwaysDo([this](Message&, Message& msg, size_t) {
+			msg.set_buffer(tx, sizeof(tx));
+			return NO_ERROR;
+		});
+		When(Method(mock, send)).AlwaysDo([this](Message& msg) {
+			sent.push_back(std::vector<uint8_t>(msg.buf(), msg.buf() + msg.length()));
+			return NO_ERROR;
+		});
+		When(Method(mock, is_unreliable)).AlwaysReturn(true);
+	}
+
+	MessageChannel& get()
+	{
+		return mock.get();
+	}
+
+	Message update_begin(uint32_t transfer_id, uint16_t chunks)
+	{
+		const uint32_t file_length = chunks * CHUNK_SIZE;
+		const uint8_t data[] = { 0x41, 0x02, 0x00, 0x01, 0x7a, 0xb1, 'u', 0xff,
+				ChunkedTransfer::FAST_OTA | ChunkedTransfer::RESUMABLE,
+				CHUNK_SIZE >> 8, CHUNK_SIZE & 0xff,
+				0, 0, uint8_t(file_length >> 8), uint8_t(file_length & 0xff),
+				FileTransfer::Store::FIRMWARE,
+				0, 0, 0, 0,
+				uint8_t(transfer_id >> 24), uint8_t(transfer_id >> 16), uint8_t(transfer_id >> 8), uint8_t(transfer_id) };
+		return received(data, sizeof(data));
+	}
+
+	Message chunk(uint16_t index)
+	{
+		uint8_t data[7 + 5 + 3 + 1 + CHUNK_SIZE] = { 0x51, 0x02, 0x00, 0x02, 0x7a, 0xb1, 'c' };
+		uint8_t* p = data + 7;
+		uint32_t crc = 0;
+		for (unsigned i = 0; i < CHUNK_SIZE; i++)
+			crc += index;
+		*p++ = 0x04;
+		*p++ = crc >> 24; *p++ = crc >> 16; *p++ = crc >> 8; *p++ = crc;
+		*p++ = 0x02;
+		*p++ = index >> 8; *p++ = index & 0xff;
+		*p++ = 0xff;
+		memset(p, index, CHUNK_SIZE);
+		return received(data, sizeof(data));
+	}
+
+	Message update_done()
+	{
+		const uint8_t data[] = { 0x41, 0x03, 0x00, 0x03, 0x7a, 0xb1, 'u' };
+		return received(data, sizeof(data));
+	}
+
+	/**
+	 * The chunk indices in a request for missing chunks.
+	 */
+	std::vector<uint16_t> missing_chunks(const std::vector<uint8_t>& msg)
+	{
+		std::vector<uint16_t> indices;
+		if (msg.size() >= 7 && msg[5] == 'c' && msg[6] == 0xff)
+		{
+			for (size_t i = 7; i + 1 < msg.size(); i += 2)
+				indices.push_back(msg[i] << 8 | msg[i + 1]);
+		}
+		return indices;
+	}
+
+private:
+	Message received(const uint8_t* data, size_t size)
+	{
+		Message msg(rx, sizeof(rx), size);
+		memcpy(rx, data, size);
+		return msg;
+	}
+};
+
+} // namespace
+
+SCENARIO("an interrupted transfer is resumed")
+{
+	Storage storage;
+	TransferChannel channel;
+	GIVEN("a resumable transfer that is interrupted")
+	{
+		ChunkedTransfer transfer;
+		transfer.init(&storage);
+		transfer.reset();
+		Message begin = channel.update_begin(0x1234, 4);
+		REQUIRE(transfer.handle_update_begin(0x7a, begin, channel.get())==NO_ERROR);
+		REQUIRE(storage.prepare_flags.back()==0);
+		Message c0 = channel.chunk(0);
+		REQUIRE(transfer.handle_chunk(0x7a, c0, channel.get())==NO_ERROR);
+		Message c2 = channel.chunk(2);
+		REQUIRE(transfer.handle_chunk(0x7a, c2, channel.get())==NO_ERROR);
+		REQUIRE(storage.chunks_saved==2);
+		transfer.cancel();
+		REQUIRE(!storage.state.empty());
+
+		WHEN("the same transfer begins again")
+		{
+			ChunkedTransfer resumed;
+			resumed.init(&storage);
+			resumed.reset();
+			channel.sent.clear();
+			Message begin = channel.update_begin(0x1234, 4);
+			REQUIRE(resumed.handle_update_begin(0x7a, begin, channel.get())==NO_ERROR);
+			THEN("the data already stored is kept")
+			{
+				REQUIRE(storage.prepare_flags.back()==ChunkedTransfer::RESUME);
+				// the ACK and UpdateReady
+				REQUIRE(channel.sent.size()==2);
+				REQUIRE(channel.sent[1].back()==(ChunkedTransfer::FAST_OTA_ENABLED | ChunkedTransfer::TRANSFER_RESUMED));
+			}
+			AND_WHEN("the server finishes the transfer")
+			{
+				Message done = channel.update_done();
+				REQUIRE(resumed.handle_update_done(0x7a, done, channel.get())==NO_ERROR);
+				THEN("only the chunks not received before are requested")
+				{
+					REQUIRE(channel.missing_chunks(channel.sent.back())==std::vector<uint16_t>({ 1, 3 }));
+				}
+			}
+		}
+		WHEN("a different transfer begins")
+		{
+			ChunkedTransfer other;
+			other.init(&storage);
+			other.reset();
+			Message begin = channel.update_begin(0x5678, 4);
+			REQUIRE(other.handle_update_begin(0x7a, begin, channel.get())==NO_ERROR);
+			THEN("it starts from the beginning")
+			{
+				REQUIRE(storage.prepare_flags.back()==0);
+				REQUIRE((channel.sent.back().back() & ChunkedTransfer::TRANSFER_RESUMED)==0);
+			}
+		}
+	}
+}
+
+SCENARIO("missed chunks are requested while earlier requests are answered")
+{
+	Storage storage;
+	TransferChannel channel;
+	GIVEN("a transfer where no chunks arrived")
+	{
+		ChunkedTransfer transfer;
+		transfer.init(&storage);
+		transfer.reset();
+		Message begin = channel.update_begin(0x1234, 10);
+		REQUIRE(transfer.handle_update_begin(0x7a, begin, channel.get())==NO_ERROR);
+		Message done = channel.update_done();
+		REQUIRE(transfer.handle_update_done(0x7a, done, channel.get())==NO_ERROR);
+		REQUIRE(channel.missing_chunks(channel.sent.back())==std::vector<uint16_t>({ 0, 1 }));
+
+		WHEN("a requested chunk arrives")
+		{
+			channel.sent.clear();
+			Message c0 = channel.chunk(0);
+			REQUIRE(transfer.handle_chunk(0x7a, c0, channel.get())==NO_ERROR);
+			THEN("the next missing chunk is requested without waiting for UpdateDone")
+			{
+				REQUIRE(channel.sent.size()==1);
+				REQUIRE(channel.missing_chunks(channel.sent.back())==std::vector<uint16_t>({ 2 }));
+			}
+		}
+	}
+}
+
+SCENARIO("the received chunks are tracked independently of the message buffers")
+{
+	Storage storage;
+	TransferChannel channel;
+	ChunkedTransfer transfer;
+	transfer.init(&storage);
+	transfer.reset();
+	Message begin = channel.update_begin(0x1234, 4);
+	REQUIRE(transfer.handle_update_begin(0x7a, begin, channel.get())==NO_ERROR);
+	Message c1 = channel.chunk(1);
+	REQUIRE(transfer.handle_chunk(0x7a, c1, channel.get())==NO_ERROR);
+
+	// the channel reuses its buffers for other messages
+	memset(channel.rx, 0xff, sizeof(channel.rx));
+	memset(channel.tx, 0xff, sizeof(channel.tx));
+
+	Message done = channel.update_done();
+	REQUIRE(transfer.handle_update_done(0x7a, done, channel.get())==NO_ERROR);
+	REQUIRE(channel.missing_chunks(channel.sent.back())==std::vector<uint16_t>({ 0, 2, 3 }));
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <iostream>
+
+#include "coap_channel.h"
+
+#include "catch.hpp"
+#include "fakeit.hpp"
+
+using namespace particle::protocol;
+using namespace fakeit;
+
+/**
+ * Measures how long it takes the message store to process acknowledgements with many messages in flight.
+ * The benchmark is hidden by default, run it with `runner [benchmark]`.
+ */
+SCENARIO("benchmark acknowledgement processing with many messages in flight", "[.][benchmark]")
+{
+	const size_t in_flight = CoAPMessageStore::capacity();
+	const unsigned rounds = 20000;
+
+	Mock<MessageChannel> mock;
+	When(Method(mock,command)).AlwaysReturn(NO_ERROR);
+	MessageChannel& channel = mock.get();
+	CoAPMessageStore store;
+	store.set_max_in_flight(in_flight);
+
+	uint8_t con[] = { 0x40, 0x02, 0, 0, 0xB1, 'e' };	// POST /e
+	uint8_t ack[] = { 0x60, 0, 0, 0 };
+	Message request(con, sizeof(con), sizeof(con));
+	Message response(ack, sizeof(ack), sizeof(ack));
+
+	message_id_t next_id = 1;
+	auto send = [&]() {
+		con[2] = next_id >> 8;
+		con[3] = next_id & 0xFF;
+		next_id++;
+		request.decode_id();
+		return store.send(request, 0);
+	};
+
+	// fill the store, then acknowledge the oldest message and send a new one each time, so
+	// the number of messages in flight stays constant
+	for (size_t i=0; i<in_flight; i++)
+		REQUIRE(send()==NO_ERROR);
+
+	std::chrono::nanoseconds elapsed(0);
+	message_id_t acked_id = 1;
+	for (unsigned i=0; i<rounds; i++)
+	{
+		ack[2] = acked_id >> 8;
+		ack[3] = acked_id & 0xFF;
+		acked_id++;
+		response.set_length(sizeof(ack));
+		const auto start = std::chrono::steady_clock::now();
+		const ProtocolError error = store.receive(response, channel, 0);
+		elapsed += std::chrono::steady_clock::now()-start;
+		REQUIRE(error==NO_ERROR);
+		REQUIRE(response.length()==sizeof(ack));	// the acknowledgement matched a message
+		REQUIRE(send()==NO_ERROR);
+	}
+
+	REQUIRE(store.size()==in_flight);
+	std::cout << "{\"benchmark\":\"coap_ack\",\"in_flight\":" << in_flight
+			<< ",\"acks\":" << rounds
+			<< ",\"ns_per_ack\":" << elapsed.count()/rounds
+			<< ",\"slab_peak_bytes\":" << store.storage().peak_bytes()
+			<< ",\"slab_capacity\":" << store.storage().capacity()
+			<< "}" << std::endl;
+
+	store.clear();
+	REQUIRE(CoAPMessage::messages()==0);
+}
@@ -18,6 +18,7 @@
  */
 
 #include <climits>
+#include <vector>
 
 #include "coap_channel.h"
 #include "forward_message_channel.h"
@@ -148,7 +149,7 @@ SCENARIO("a message can be added and removed by id", "[reliability]")
 					THEN("the removed message is the one added")
 					{
 						REQUIRE(removed==&message);
-						REQUIRE(message.get_next()==nullptr);
+						REQUIRE(store.from_id(id)==nullptr);
 						AND_WHEN("the same id is removed again") {
 							CoAPMessage* removed2 = store.remove(id);
 							THEN("no message is retrieved") {
@@ -201,7 +202,7 @@ SCENARIO("a message can be added to a message store with the same id more than o
 
 }
 
-SCENARIO("multiple messages are stored in a list in the order they are added, most recent first")
+SCENARIO("multiple messages are stored in the order they are added")
 {
 	const message_id_t id1 = 456;
 	const message_id_t id2 = 345;
@@ -221,9 +222,10 @@ SCENARIO("multiple messages are stored in a list in the order they are added, mo
 			REQUIRE(store.add(m1)==NO_ERROR);
 			REQUIRE(store.add(m2)==NO_ERROR);
 
-			THEN("the second message points to the first")
+			THEN("the second message is newer than the first")
 			{
-				REQUIRE(m2->get_next()==m1);
+				REQUIRE(store.size()==2);
+				REQUIRE(int16_t(m2->get_seq()-m1->get_seq())>0);
 				AND_THEN("both messages can be retrieved")
 				{
 					REQUIRE(store.from_id(id1)==m1);
@@ -234,7 +236,7 @@ SCENARIO("multiple messages are stored in a list in the order they are added, mo
 					REQUIRE(store.remove(id2)==m2);
 					THEN("only that message is removed")
 					{
-						CHECK(m2->get_next()==nullptr);
+						CHECK(store.size()==1);
 						CHECK(store.from_id(id2)==nullptr);
 						CHECK(store.from_id(id1)==m1);
 					}
@@ -417,7 +419,7 @@ SCENARIO("a CoAPMessage can be created with the message buffer part of the alloc
 	REQUIRE(coapmsg!=nullptr);
 
 	REQUIRE(coapmsg->get_id()==1234);
-	REQUIRE(coapmsg->get_next()==nullptr);
+	REQUIRE(CoAPMessage::storage().owns(coapmsg));
 	REQUIRE(coapmsg->matches(1234));
 	REQUIRE(coapmsg->get_data_length()==sizeof(buf));
 
@@ -1139,3 +1141,315 @@ SCENARIO("a message flagged as confirm received waits synchronously for acknowle
 
 	}
 }
+
+SCENARIO("confirmable messages beyond the in-flight window are held back until acknowledged")
+{
+	GIVEN("a CoAPReliableChannel allowing 2 messages in flight")
+	{
+		Mock<MessageChannel> mock;
+		MessageChannel& delegate = mock.get();
+		system_tick_t now = 0;
+		auto time = [&now]() { return now; };
+		ForwardCoAPReliableChannel<decltype(time)> channel(delegate, time);
+		channel.set_max_in_flight(2);
+
+		std::vector<message_id_t> sent;
+		When(Method(mock,send)).AlwaysDo([&sent](Message& msg) {
+			sent.push_back(msg.buf()[2] << 8 | msg.buf()[3]);
+			return NO_ERROR;
+		});
+
+		uint8_t con1[] = { 0x40, 0, 0, 1 };
+		uint8_t con2[] = { 0x40, 0, 0, 2 };
+		uint8_t con3[] = { 0x40, 0, 0, 3 };
+		Message m1(con1, sizeof(con1), sizeof(con1));
+		Message m2(con2, sizeof(con2), sizeof(con2));
+		Message m3(con3, sizeof(con3), sizeof(con3));
+		m1.decode_id();
+		m2.decode_id();
+		m3.decode_id();
+
+		WHEN("3 confirmable messages are sent")
+		{
+			REQUIRE(channel.send(m1)==NO_ERROR);
+			REQUIRE(channel.send(m2)==NO_ERROR);
+			REQUIRE(channel.send(m3)==NO_ERROR);
+
+			THEN("only the first 2 are passed to the channel")
+			{
+				REQUIRE(sent.size()==2);
+				REQUIRE(sent[0]==1);
+				REQUIRE(sent[1]==2);
+				REQUIRE(channel.client_messages().in_flight()==2);
+				REQUIRE(channel.client_messages().from_id(3)!=nullptr);
+			}
+
+			AND_WHEN("the first message is acknowledged")
+			{
+				uint8_t ack[] = { 0x60, 0, 0, 1 };
+				When(Method(mock,receive)).Do([&ack](Message& msg) {
+					memcpy(msg.buf(), ack, sizeof(ack));
+					msg.set_length(sizeof(ack));
+					return NO_ERROR;
+				});
+				uint8_t buf[10];
+				Message received(buf, sizeof(buf));
+				REQUIRE(channel.receive(received)==NO_ERROR);
+
+				THEN("the held back message is sent")
+				{
+					REQUIRE(sent.size()==3);
+					REQUIRE(sent[2]==3);
+					REQUIRE(channel.client_messages().from_id(1)==nullptr);
+					REQUIRE(channel.client_messages().in_flight()==2);
+				}
+			}
+
+			AND_WHEN("the messages in flight time out and are retransmitted")
+			{
+				When(Method(mock,receive)).AlwaysDo([](Message& msg) {
+					msg.set_length(0);
+					return NO_ERROR;
+				});
+				now += CoAPMessage::transmit_timeout(1);
+				uint8_t buf[10];
+				Message received(buf, sizeof(buf));
+				REQUIRE(channel.receive(received)==NO_ERROR);
+
+				THEN("the window is reduced")
+				{
+					REQUIRE(channel.client_messages().get_window()==1);
+					REQUIRE(channel.client_messages().in_flight()==2);
+					REQUIRE(sent.size()==4);
+				}
+			}
+		}
+	}
+}
+
+SCENARIO("messages whose IDs collide in the message store can be retrieved and removed in any order")
+{
+	const size_t capacity = CoAPMessageStore::capacity();
+	const message_id_t id1 = 5;
+	const message_id_t id2 = id1+capacity;
+	const message_id_t id3 = id1+2*capacity;
+	const message_id_t id4 = id1+1;
+	GIVEN("a message store with messages that share the same slot")
+	{
+		CoAPMessageStore store;
+		CoAPMessage* m1 = new CoAPMessage(id1);
+		CoAPMessage* m2 = new CoAPMessage(id2);
+		CoAPMessage* m3 = new CoAPMessage(id3);
+		CoAPMessage* m4 = new CoAPMessage(id4);
+		REQUIRE(store.add(m1)==NO_ERROR);
+		REQUIRE(store.add(m2)==NO_ERROR);
+		REQUIRE(store.add(m4)==NO_ERROR);
+		REQUIRE(store.add(m3)==NO_ERROR);
+		REQUIRE(store.size()==4);
+
+		WHEN("the first colliding message is removed")
+		{
+			REQUIRE(store.remove(id1)==m1);
+			delete m1;
+			THEN("the other messages can still be retrieved")
+			{
+				REQUIRE(store.from_id(id1)==nullptr);
+				REQUIRE(store.from_id(id2)==m2);
+				REQUIRE(store.from_id(id3)==m3);
+				REQUIRE(store.from_id(id4)==m4);
+				REQUIRE(store.size()==3);
+			}
+		}
+		WHEN("the middle colliding message is removed")
+		{
+			REQUIRE(store.remove(id2)==m2);
+			delete m2;
+			THEN("the other messages can still be retrieved")
+			{
+				REQUIRE(store.from_id(id1)==m1);
+				REQUIRE(store.from_id(id2)==nullptr);
+				REQUIRE(store.from_id(id3)==m3);
+				REQUIRE(store.from_id(id4)==m4);
+			}
+		}
+	}
+	REQUIRE(CoAPMessage::messages()==0);
+	REQUIRE(CoAPMessage::storage().used_bytes()==0);
+}
+
+SCENARIO("a full message store does not discard confirmable messages waiting to be acknowledged")
+{
+	GIVEN("a message store filled with confirmable messages")
+	{
+		CoAPMessageStore store;
+		store.set_max_in_flight(CoAPMessageStore::capacity());
+		uint8_t buf[] = { 0x40, 0, 0, 0 };
+		Message msg(buf, sizeof(buf), sizeof(buf));
+		for (size_t i=0; i<CoAPMessageStore::capacity(); i++)
+		{
+			buf[3] = i+1;
+			msg.decode_id();
+			REQUIRE(store.send(msg, 0)==NO_ERROR);
+		}
+		REQUIRE(store.size()==CoAPMessageStore::capacity());
+
+		WHEN("another confirmable message is sent")
+		{
+			buf[2] = 1;
+			msg.decode_id();
+			THEN("the message is rejected")
+			{
+				REQUIRE(store.send(msg, 0)==INSUFFICIENT_STORAGE);
+				REQUIRE(store.size()==CoAPMessageStore::capacity());
+				REQUIRE(store.from_id(1)!=nullptr);
+			}
+		}
+	}
+	REQUIRE(CoAPMessage::messages()==0);
+}
+
+SCENARIO("a full message store discards the oldest response to make room for a new one")
+{
+	GIVEN("a message store filled with acknowledgements")
+	{
+		CoAPMessageStore store;
+		store.set_max_in_flight(CoAPMessageStore::capacity());
+		uint8_t buf[] = { 0x60, 0, 0, 0 };
+		Message msg(buf, sizeof(buf), sizeof(buf));
+		for (size_t i=0; i<CoAPMessageStore::capacity(); i++)
+		{
+			buf[3] = i+1;
+			msg.decode_id();
+			REQUIRE(store.send(msg, 0)==NO_ERROR);
+		}
+
+		WHEN("another acknowledgement is sent")
+		{
+			buf[2] = 1;
+			buf[3] = 0;
+			msg.decode_id();
+			REQUIRE(store.send(msg, 0)==NO_ERROR);
+			THEN("the oldest acknowledgement is discarded")
+			{
+				REQUIRE(store.size()==CoAPMessageStore::capacity());
+				REQUIRE(store.from_id(1)==nullptr);
+				REQUIRE(store.from_id(2)!=nullptr);
+				REQUIRE(store.from_id(0x100)!=nullptr);
+			}
+		}
+	}
+	REQUIRE(CoAPMessage::messages()==0);
+}
+
+SCENARIO("CoAP messages are allocated from fixed-size blocks")
+{
+	GIVEN("a message pool")
+	{
+		CoAPMessagePool pool(1);
+		const size_t full_count = COAP_MESSAGE_POOL_SIZE(1);
+		std::vector<CoAPMessage*> allocated;
+		WHEN("full-size messages are allocated")
+		{
+			for (size_t i=0; i<=full_count; i++)
+				allocated.push_back(new (pool, PROTOCOL_BUFFER_SIZE) CoAPMessage(i));
+			THEN("allocation fails once the full blocks are used")
+			{
+				REQUIRE(allocated[full_count-1]!=nullptr);
+				REQUIRE(allocated[full_count]==nullptr);
+				REQUIRE(pool.failed_allocations()==1);
+				AND_WHEN("a message is freed")
+				{
+					delete allocated[0];
+					allocated[0] = nullptr;
+					THEN("the block can be allocated again")
+					{
+						REQUIRE(pool.used_bytes()==(full_count-1)*CoAPMessagePool::FULL_BLOCK_SIZE);
+						allocated[0] = new (pool, PROTOCOL_BUFFER_SIZE) CoAPMessage(0);
+						REQUIRE(allocated[0]!=nullptr);
+					}
+				}
+			}
+		}
+		WHEN("small messages are allocated")
+		{
+			for (size_t i=0; i<=COAP_MESSAGE_SMALL_COUNT+full_count; i++)
+				allocated.push_back(new (pool, 4) CoAPMessage(i));
+			THEN("the full blocks are used once the small blocks are used")
+			{
+				REQUIRE(allocated[COAP_MESSAGE_SMALL_COUNT+full_count-1]!=nullptr);
+				REQUIRE(allocated[COAP_MESSAGE_SMALL_COUNT+full_count]==nullptr);
+				REQUIRE(pool.used_bytes()==pool.capacity());
+			}
+		}
+		WHEN("a message larger than a full block is allocated")
+		{
+			CoAPMessage* msg = new (pool, CoAPMessagePool::FULL_BLOCK_SIZE) CoAPMessage(1);
+			THEN("allocation fails")
+			{
+				REQUIRE(msg==nullptr);
+				REQUIRE(pool.used_bytes()==0);
+			}
+		}
+		for (CoAPMessage* msg : allocated)
+			delete msg;
+		REQUIRE(pool.used_bytes()==0);
+	}
+	REQUIRE(CoAPMessage::messages()==0);
+}
+
+SCENARIO("each message store has its own message pool")
+{
+	CoAPMessageStore client, server;
+	uint8_t buf[] = { 0x40, 0, 0, 1 };
+	Message msg(buf, sizeof(buf), sizeof(buf));
+	msg.decode_id();
+	REQUIRE(client.send(msg, 0)==NO_ERROR);
+	REQUIRE(client.storage().used_bytes()==CoAPMessagePool::SMALL_BLOCK_SIZE);
+	REQUIRE(server.storage().used_bytes()==0);
+	REQUIRE(client.storage().owns(client.from_id(1)));
+	REQUIRE(CoAPMessage::storage().used_bytes()==0);
+	client.clear();
+	REQUIRE(client.storage().used_bytes()==0);
+	REQUIRE(CoAPMessage::messages()==0);
+}
+
+SCENARIO("the CoAP message pool is sized from the number of messages in flight")
+{
+	const size_t default_capacity = COAP_MESSAGE_SMALL_COUNT*CoAPMessagePool::SMALL_BLOCK_SIZE+
+			COAP_MESSAGE_POOL_SIZE(CoAPMessage::NSTART)*CoAPMessagePool::FULL_BLOCK_SIZE;
+	const size_t large_capacity = COAP_MESSAGE_SMALL_COUNT*CoAPMessagePool::SMALL_BLOCK_SIZE+
+			COAP_MESSAGE_POOL_SIZE(8)*CoAPMessagePool::FULL_BLOCK_SIZE;
+	CoAPMessageStore store;
+	REQUIRE(store.storage().capacity()==default_capacity);
+	GIVEN("no messages are stored")
+	{
+		WHEN("the number of messages in flight is increased")
+		{
+			store.set_max_in_flight(8);
+			THEN("the pool grows")
+			{
+				REQUIRE(store.storage().capacity()==large_capacity);
+			}
+		}
+	}
+	GIVEN("a message is allocated from a larger pool")
+	{
+		CoAPMessagePool pool(8);
+		CoAPMessage* msg = new (pool, PROTOCOL_BUFFER_SIZE) CoAPMessage(1);
+		REQUIRE(msg!=nullptr);
+		WHEN("the number of messages in flight is reduced")
+		{
+			pool.reserve(CoAPMessage::NSTART);
+			THEN("the pool is resized once the message is deleted")
+			{
+				REQUIRE(pool.capacity()==large_capacity);
+				REQUIRE(pool.owns(msg));
+				delete msg;
+				msg = nullptr;
+				REQUIRE(pool.capacity()==default_capacity);
+			}
+		}
+		delete msg;
+	}
+	REQUIRE(CoAPMessage::messages()==0);
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <string>
+
+#include "compression.h"
+#include "messages.h"
+
+#include "catch.hpp"
+
+using namespace particle::protocol;
+
+namespace {
+
+const char JSON[] = "{\"temperature\":21.5,\"humidity\":40,\"pressure\":1013,"
+		"\"temperature_min\":19.5,\"humidity_min\":35,\"pressure_min\":1009,"
+		"\"temperature_max\":23.5,\"humidity_max\":45,\"pressure_max\":1017}";
+
+} // namespace
+
+SCENARIO("data with repetition is compressed")
+{
+	GIVEN("some JSON data")
+	{
+		uint8_t dest[sizeof(JSON)];
+		WHEN("the data is compressed")
+		{
+			const size_t size = compress((const uint8_t*)JSON, strlen(JSON), dest, sizeof(dest));
+			THEN("the compressed data is smaller")
+			{
+				REQUIRE(size>0);
+				REQUIRE(size<strlen(JSON));
+				// a single final block with fixed Huffman codes
+				REQUIRE((dest[0] & 0x07)==0x03);
+			}
+		}
+		WHEN("the compressed data doesn't fit in the buffer")
+		{
+			const size_t size = compress((const uint8_t*)JSON, strlen(JSON), dest, 10);
+			THEN("compression fails")
+			{
+				REQUIRE(size==0);
+			}
+		}
+	}
+	GIVEN("a short repeated sequence")
+	{
+		const uint8_t data[] = { 'a', 'a', 'a', 'a', 'a', 'a', 'a', 'a' };
+		uint8_t dest[16];
+		THEN("it's encoded as a literal followed by a match")
+		{
+			// literal 'a', length 7 at distance 1, end of block
+			const uint8_t expected[] = { 0x4b, 0x84, 0x02, 0x00 };
+			REQUIRE(compress(data, sizeof(data), dest, sizeof(dest))==sizeof(expected));
+			REQUIRE(!memcmp(dest, expected, sizeof(expected)));
+		}
+	}
+}
+
+SCENARIO("the payload of a message is compressed only when that makes it smaller")
+{
+	PayloadCompressor compressor;
+	REQUIRE(compressor.set_enabled(true));
+	GIVEN("an event message with JSON data")
+	{
+		uint8_t buf[512];
+		const size_t length = Messages::event(buf, 0x1234, "weather/station", JSON, 3600, EventType::PRIVATE, true);
+		const size_t payload = payload_offset(buf, length);
+		REQUIRE(payload<length);
+		REQUIRE(!memcmp(buf + payload, JSON, strlen(JSON)));
+
+		WHEN("the payload is compressed")
+		{
+			const size_t compressed = compressor.compress(buf, length);
+			THEN("the message is smaller")
+			{
+				REQUIRE(compressed<length);
+			}
+			THEN("the Content-Format option is inserted between the Uri-Path and Max-Age options")
+			{
+				// 'E' and "weather/station" Uri-Path options
+				const size_t options = 4 + 2 + 17;
+				REQUIRE(buf[options]==0x12);	// delta 1 (Content-Format), length 2
+				REQUIRE(buf[options + 1]==(DEFLATE_CONTENT_FORMAT >> 8));
+				REQUIRE(buf[options + 2]==(DEFLATE_CONTENT_FORMAT & 0xff));
+				REQUIRE(buf[options + 3]==0x23);	// delta 2 (Max-Age), length 3
+				REQUIRE(payload_offset(buf, compressed)==options + 3 + 4 + 1);
+			}
+		}
+	}
+	GIVEN("compression is disabled")
+	{
+		uint8_t buf[512];
+		const size_t length = Messages::event(buf, 0x1234, "weather/station", JSON, 3600, EventType::PRIVATE, true);
+		REQUIRE(compressor.set_enabled(false));
+		THEN("the message is unchanged")
+		{
+			REQUIRE(!compressor.is_enabled());
+			REQUIRE(compressor.compress(buf, length)==length);
+		}
+	}
+	GIVEN("a message with a short payload")
+	{
+		uint8_t buf[64];
+		const size_t length = Messages::event(buf, 0x1234, "event", "data", 60, EventType::PRIVATE, true);
+		THEN("the payload is not compressed")
+		{
+			REQUIRE(compressor.compress(buf, length)==length);
+		}
+	}
+	GIVEN("a message with data that doesn't compress")
+	{
+		uint8_t buf[256];
+		char data[100];
+		uint32_t x = 1;
+		for (size_t i = 0; i < sizeof(data) - 1; i++)
+		{
+			x = x * 1103515245 + 12345;
+			data[i] = ' ' + (x >> 16) % 90;
+		}
+		data[sizeof(data) - 1] = 0;
+		const size_t length = Messages::event(buf, 0x1234, "event", data, 60, EventType::PRIVATE, true);
+		THEN("the message is unchanged")
+		{
+			uint8_t original[256];
+			memcpy(original, buf, length);
+			REQUIRE(compressor.compress(buf, length)==length);
+			REQUIRE(!memcmp(original, buf, length));
+		}
+	}
+	GIVEN("a variable value")
+	{
+		uint8_t buf[512];
+		const size_t length = Messages::variable_value(buf, 0x1234, 0x55, JSON, strlen(JSON));
+		THEN("the Content-Format option is added after the token")
+		{
+			const size_t compressed = compressor.compress(buf, length);
+			REQUIRE(compressed<length);
+			REQUIRE(buf[4]==0x55);
+			REQUIRE(buf[5]==0xc2);	// delta 12 (Content-Format), length 2
+			REQUIRE(buf[8]==0xff);
+		}
+	}
+}
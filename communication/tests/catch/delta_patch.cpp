@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <vector>
+
+#include "delta_patch.h"
+
+#include "catch.hpp"
+
+using namespace particle::protocol;
+
+namespace {
+
+struct Images : DeltaPatch::Callbacks
+{
+	std::vector<uint8_t> source;
+	std::vector<uint8_t> target;
+	size_t writes = 0;
+
+	Images(size_t source_length, size_t target_length) :
+			source(source_length),
+			target(target_length, 0xff)
+	{
+		for (size_t i = 0; i < source_length; i++)
+			source[i] = i * 7;
+	}
+
+	int read_source(uint32_t offset, uint8_t* data, size_t length) override
+	{
+		REQUIRE(offset + length <= source.size());
+		memcpy(data, source.data() + offset, length);
+		return 0;
+	}
+
+	int write_target(uint32_t offset, const uint8_t* data, size_t length) override
+	{
+		REQUIRE(offset + length <= target.size());
+		memcpy(target.data() + offset, data, length);
+		writes++;
+		return 0;
+	}
+};
+
+class Chunk
+{
+public:
+	std::vector<uint8_t> data;
+
+	explicit Chunk(uint32_t target_offset)
+	{
+		put32(target_offset);
+	}
+
+	Chunk& literal(const std::vector<uint8_t>& bytes)
+	{
+		data.push_back(DeltaPatch::DATA);
+		put16(bytes.size());
+		data.insert(data.end(), bytes.begin(), bytes.end());
+		return *this;
+	}
+
+	Chunk& copy(uint32_t source_offset, uint16_t length)
+	{
+		data.push_back(DeltaPatch::COPY);
+		put32(source_offset);
+		put16(length);
+		return *this;
+	}
+
+	Chunk& diff(uint32_t source_offset, const std::vector<uint8_t>& bytes)
+	{
+		data.push_back(DeltaPatch::DIFF);
+		put32(source_offset);
+		put16(bytes.size());
+		data.insert(data.end(), bytes.begin(), bytes.end());
+		return *this;
+	}
+
+private:
+	void put32(uint32_t value)
+	{
+		put16(value >> 16);
+		put16(value & 0xffff);
+	}
+
+	void put16(uint16_t value)
+	{
+		data.push_back(value >> 8);
+		data.push_back(value & 0xff);
+	}
+};
+
+} // namespace
+
+SCENARIO("a delta patch chunk reconstructs part of the target image")
+{
+	GIVEN("a source image")
+	{
+		Images images(1024, 1024);
+		DeltaPatch patch(images.source.size(), images.target.size());
+
+		WHEN("a chunk with each kind of record is applied")
+		{
+			Chunk chunk(8);
+			chunk.literal({ 1, 2, 3 }).copy(100, 5).diff(200, { 1, 0, 0xff });
+			REQUIRE(patch.apply(chunk.data.data(), chunk.data.size(), images)==NO_ERROR);
+			THEN("the records write consecutive bytes from the target offset")
+			{
+				REQUIRE(images.target[7]==0xff);
+				REQUIRE(images.target[8]==1);
+				REQUIRE(images.target[10]==3);
+				for (int i = 0; i < 5; i++)
+					REQUIRE(images.target[11 + i]==images.source[100 + i]);
+				REQUIRE(images.target[16]==uint8_t(images.source[200] + 1));
+				REQUIRE(images.target[17]==images.source[201]);
+				REQUIRE(images.target[18]==uint8_t(images.source[202] - 1));
+				REQUIRE(images.target[19]==0xff);
+			}
+		}
+		WHEN("a chunk produces more data than the staging buffer holds")
+		{
+			Chunk chunk(0);
+			chunk.copy(0, 1000);
+			REQUIRE(patch.apply(chunk.data.data(), chunk.data.size(), images)==NO_ERROR);
+			THEN("the data is written in pieces")
+			{
+				REQUIRE(images.writes==(1000 + DeltaPatch::BUFFER_SIZE - 1) / DeltaPatch::BUFFER_SIZE);
+				REQUIRE(std::equal(images.source.begin(), images.source.begin() + 1000, images.target.begin()));
+			}
+		}
+	}
+}
+
+SCENARIO("an invalid delta patch chunk is rejected")
+{
+	Images images(256, 256);
+	DeltaPatch patch(images.source.size(), images.target.size());
+
+	GIVEN("a chunk with an unaligned target offset")
+	{
+		Chunk chunk(2);
+		chunk.literal({ 1 });
+		THEN("it's rejected")
+		{
+			REQUIRE(patch.apply(chunk.data.data(), chunk.data.size(), images)==MALFORMED_MESSAGE);
+			REQUIRE(images.writes==0);
+		}
+	}
+	GIVEN("a chunk that copies data beyond the end of the source image")
+	{
+		Chunk chunk(0);
+		chunk.copy(250, 10);
+		THEN("it's rejected")
+		{
+			REQUIRE(patch.apply(chunk.data.data(), chunk.data.size(), images)==MALFORMED_MESSAGE);
+		}
+	}
+	GIVEN("a chunk that writes beyond the end of the target image")
+	{
+		Chunk chunk(252);
+		chunk.literal({ 1, 2, 3, 4, 5 });
+		THEN("it's rejected")
+		{
+			REQUIRE(patch.apply(chunk.data.data(), chunk.data.size(), images)==MALFORMED_MESSAGE);
+		}
+	}
+	GIVEN("a truncated chunk")
+	{
+		Chunk chunk(0);
+		chunk.literal({ 1, 2, 3, 4 });
+		THEN("it's rejected")
+		{
+			REQUIRE(patch.apply(chunk.data.data(), chunk.data.size() - 1, images)==MALFORMED_MESSAGE);
+		}
+	}
+	GIVEN("a chunk with an unknown record")
+	{
+		Chunk chunk(0);
+		chunk.data.push_back(0x7f);
+		THEN("it's rejected")
+		{
+			REQUIRE(patch.apply(chunk.data.data(), chunk.data.size(), images)==MALFORMED_MESSAGE);
+		}
+	}
+}
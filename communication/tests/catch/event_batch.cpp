@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string>
+#include <vector>
+
+#include "event_batch.h"
+
+#include "catch.hpp"
+
+using namespace particle;
+using namespace particle::protocol;
+
+namespace {
+
+struct Completion
+{
+	bool called = false;
+	int error = 0;
+
+	CompletionHandler handler()
+	{
+		return CompletionHandler([](int error, const void* data, void* callback_data, void* reserved) {
+			Completion* self = static_cast<Completion*>(callback_data);
+			self->called = true;
+			self->error = error;
+		}, this);
+	}
+};
+
+} // namespace
+
+SCENARIO("events added to a batch are encoded in order")
+{
+	GIVEN("an enabled batch")
+	{
+		EventBatch batch;
+		REQUIRE(batch.set_max_size(100)==0);
+		Completion c1, c2;
+		REQUIRE(batch.add("temp", "21", 60, EventType::PRIVATE, 0, false, c1.handler(), 0)==0);
+		REQUIRE(batch.add("hum", nullptr, 3600, EventType::PUBLIC, 0, false, c2.handler(), 10)==0);
+
+		THEN("the payload holds both events")
+		{
+			REQUIRE(batch.count()==2);
+			REQUIRE(batch.size()==EventBatch::record_size("temp", "21") + EventBatch::record_size("hum", nullptr));
+			const uint8_t expected[] = { 'E', 4, 0, 0, 60, 0, 2, 't', 'e', 'm', 'p', '2', '1' };
+			REQUIRE(!memcmp(batch.data(), expected, sizeof(expected)));
+		}
+		THEN("the events can be decoded")
+		{
+			std::vector<std::string> names;
+			std::vector<int> ttls;
+			batch.for_each([&](const EventBatch::Event& event) {
+				names.push_back(std::string(event.name, event.name_length));
+				ttls.push_back(event.ttl);
+			});
+			REQUIRE(names.size()==2);
+			REQUIRE(names[0]=="temp");
+			REQUIRE(names[1]=="hum");
+			REQUIRE(ttls[1]==3600);
+		}
+		THEN("the batch is due once the linger period has passed")
+		{
+			REQUIRE(!batch.is_due(EventBatch::DEFAULT_LINGER-1));
+			REQUIRE(batch.is_due(EventBatch::DEFAULT_LINGER));
+		}
+		batch.complete(0);
+	}
+}
+
+SCENARIO("the TTL of a batched event is clamped to 3 bytes")
+{
+	EventBatch batch;
+	REQUIRE(batch.set_max_size(EventBatch::MAX_PAYLOAD_SIZE)==0);
+	Completion c1, c2;
+	REQUIRE(batch.add("long", nullptr, 0x1000000, EventType::PRIVATE, 0, false, c1.handler(), 0)==0);
+	REQUIRE(batch.add("negative", nullptr, -1, EventType::PRIVATE, 0, false, c2.handler(), 0)==0);
+	std::vector<int> ttls;
+	batch.for_each([&](const EventBatch::Event& event) {
+		ttls.push_back(event.ttl);
+	});
+	REQUIRE(ttls==std::vector<int>({ Messages::event_batch_max_ttl, 0 }));
+	batch.complete(0);
+}
+
+SCENARIO("a batch does not exceed its maximum size")
+{
+	GIVEN("a batch with room for one event")
+	{
+		EventBatch batch;
+		const size_t size = EventBatch::record_size("event", "data");
+		REQUIRE(batch.set_max_size(size + 1)==0);
+		Completion c1, c2;
+		REQUIRE(batch.add("event", "data", 60, EventType::PRIVATE, 0, false, c1.handler(), 0)==0);
+
+		THEN("there is no room for another event")
+		{
+			REQUIRE(!batch.has_room(size));
+			REQUIRE(batch.add("event", "data", 60, EventType::PRIVATE, 0, false, c2.handler(), 0)!=0);
+			REQUIRE(c2.called);
+		}
+		THEN("an event larger than the batch is not accepted")
+		{
+			REQUIRE(!batch.accepts(size + 2));
+		}
+		batch.complete(0);
+	}
+	GIVEN("a batch size larger than a protocol buffer")
+	{
+		EventBatch batch;
+		REQUIRE(batch.set_max_size(PROTOCOL_BUFFER_SIZE * 2)==0);
+		THEN("the batch is limited to a single message")
+		{
+			REQUIRE(batch.accepts(EventBatch::MAX_PAYLOAD_SIZE));
+			REQUIRE(!batch.accepts(EventBatch::MAX_PAYLOAD_SIZE + 1));
+		}
+	}
+}
+
+SCENARIO("completion handlers are invoked for each batched event")
+{
+	GIVEN("a batch with an event that requests an acknowledgement")
+	{
+		EventBatch batch;
+		REQUIRE(batch.set_max_size(200)==0);
+		Completion c1, c2, c3;
+		REQUIRE(batch.add("a", "1", 60, EventType::PRIVATE, 0, false, c1.handler(), 0)==0);
+		REQUIRE(batch.add("b", "2", 60, EventType::PRIVATE, EventType::WITH_ACK, true, c2.handler(), 0)==0);
+		REQUIRE(batch.add("c", "3", 60, EventType::PRIVATE, EventType::WITH_ACK, true, c3.handler(), 0)==0);
+		REQUIRE(batch.is_confirmable());
+
+		WHEN("the batch is sent")
+		{
+			CompletionHandler ack = batch.sent();
+			THEN("only the event without acknowledgement is completed")
+			{
+				REQUIRE(!batch.has_events());
+				REQUIRE(c1.called);
+				REQUIRE(!c2.called);
+				REQUIRE(!c3.called);
+				REQUIRE(bool(ack));
+			}
+			AND_WHEN("the batch is acknowledged")
+			{
+				ack.setResult();
+				THEN("the remaining events are completed")
+				{
+					REQUIRE(c2.called);
+					REQUIRE(c2.error==0);
+					REQUIRE(c3.called);
+					REQUIRE(c3.error==0);
+				}
+			}
+			AND_WHEN("the acknowledgement times out")
+			{
+				ack.setError(SYSTEM_ERROR_TIMEOUT);
+				THEN("the remaining events fail")
+				{
+					REQUIRE(c2.error==SYSTEM_ERROR_TIMEOUT);
+					REQUIRE(c3.error==SYSTEM_ERROR_TIMEOUT);
+				}
+			}
+		}
+		WHEN("the batch cannot be sent")
+		{
+			batch.complete(SYSTEM_ERROR_IO);
+			THEN("all events fail")
+			{
+				REQUIRE(c1.error==SYSTEM_ERROR_IO);
+				REQUIRE(c2.error==SYSTEM_ERROR_IO);
+				REQUIRE(c3.error==SYSTEM_ERROR_IO);
+			}
+		}
+	}
+}
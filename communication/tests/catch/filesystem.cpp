@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "filesystem.h"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <string>
+
+namespace {
+
+filesystem_t g_fs = {};
+
+// std::map doesn't move its elements, so open files can refer to their contents directly
+std::map<std::string, std::string> g_files;
+
+int g_error = 0;
+
+std::string& contents(lfs_file_t* file)
+{
+	return *static_cast<std::string*>(file->data);
+}
+
+} // namespace
+
+int lfs_file_open(lfs_t* lfs, lfs_file_t* file, const char* path, int flags)
+{
+	if (g_error) {
+		return g_error;
+	}
+	auto it = g_files.find(path);
+	if (it == g_files.end()) {
+		if (!(flags & LFS_O_CREAT)) {
+			return LFS_ERR_NOENT;
+		}
+		it = g_files.insert(std::make_pair(std::string(path), std::string())).first;
+	} else if ((flags & LFS_O_CREAT) && (flags & LFS_O_EXCL)) {
+		return LFS_ERR_EXIST;
+	}
+	if (flags & LFS_O_TRUNC) {
+		it->second.clear();
+	}
+	file->data = &it->second;
+	file->pos = 0;
+	file->flags = flags;
+	return 0;
+}
+
+int lfs_file_close(lfs_t* lfs, lfs_file_t* file)
+{
+	file->data = nullptr;
+	return g_error;
+}
+
+lfs_ssize_t lfs_file_read(lfs_t* lfs, lfs_file_t* file, void* buffer, lfs_size_t size)
+{
+	if (g_error) {
+		return g_error;
+	}
+	if (!(file->flags & LFS_O_RDONLY)) {
+		return LFS_ERR_INVAL;
+	}
+	const std::string& data = contents(file);
+	const size_t n = (file->pos < data.size()) ? std::min<size_t>(size, data.size() - file->pos) : 0;
+	memcpy(buffer, data.data() + file->pos, n);
+	file->pos += n;
+	return n;
+}
+
+lfs_ssize_t lfs_file_write(lfs_t* lfs, lfs_file_t* file, const void* buffer, lfs_size_t size)
+{
+	if (g_error) {
+		return g_error;
+	}
+	if (!(file->flags & LFS_O_WRONLY)) {
+		return LFS_ERR_INVAL;
+	}
+	std::string& data = contents(file);
+	if (file->flags & LFS_O_APPEND) {
+		file->pos = data.size();
+	}
+	if (data.size() < file->pos + size) {
+		data.resize(file->pos + size);
+	}
+	data.replace(file->pos, size, static_cast<const char*>(buffer), size);
+	file->pos += size;
+	return size;
+}
+
+lfs_soff_t lfs_file_seek(lfs_t* lfs, lfs_file_t* file, lfs_soff_t off, int whence)
+{
+	if (g_error) {
+		return g_error;
+	}
+	lfs_soff_t pos = off;
+	if (whence == LFS_SEEK_CUR) {
+		pos += file->pos;
+	} else if (whence == LFS_SEEK_END) {
+		pos += contents(file).size();
+	}
+	if (pos < 0) {
+		return LFS_ERR_INVAL;
+	}
+	file->pos = pos;
+	return pos;
+}
+
+lfs_soff_t lfs_file_tell(lfs_t* lfs, lfs_file_t* file)
+{
+	return file->pos;
+}
+
+lfs_soff_t lfs_file_size(lfs_t* lfs, lfs_file_t* file)
+{
+	return contents(file).size();
+}
+
+int lfs_remove(lfs_t* lfs, const char* path)
+{
+	if (g_error) {
+		return g_error;
+	}
+	return g_files.erase(path) ? 0 : LFS_ERR_NOENT;
+}
+
+int lfs_rename(lfs_t* lfs, const char* oldpath, const char* newpath)
+{
+	if (g_error) {
+		return g_error;
+	}
+	const auto it = g_files.find(oldpath);
+	if (it == g_files.end()) {
+		return LFS_ERR_NOENT;
+	}
+	std::string data = std::move(it->second);
+	g_files.erase(it);
+	g_files[newpath] = std::move(data);
+	return 0;
+}
+
+int lfs_stat(lfs_t* lfs, const char* path, struct lfs_info* info)
+{
+	if (g_error) {
+		return g_error;
+	}
+	const auto it = g_files.find(path);
+	if (it == g_files.end()) {
+		return LFS_ERR_NOENT;
+	}
+	info->type = LFS_TYPE_REG;
+	info->size = it->second.size();
+	strncpy(info->name, path, LFS_NAME_MAX);
+	info->name[LFS_NAME_MAX] = 0;
+	return 0;
+}
+
+int filesystem_mount(filesystem_t* fs)
+{
+	fs->instance.mounted = 1;
+	return 0;
+}
+
+int filesystem_unmount(filesystem_t* fs)
+{
+	fs->instance.mounted = 0;
+	return 0;
+}
+
+filesystem_t* filesystem_get_instance(void* reserved)
+{
+	return &g_fs;
+}
+
+int filesystem_lock(filesystem_t* fs)
+{
+	return 0;
+}
+
+int filesystem_unlock(filesystem_t* fs)
+{
+	return 0;
+}
+
+namespace particle { namespace test {
+
+void Filesystem::reset()
+{
+	g_files.clear();
+	g_error = 0;
+}
+
+std::string* Filesystem::file(const char* path)
+{
+	const auto it = g_files.find(path);
+	return (it != g_files.end()) ? &it->second : nullptr;
+}
+
+void Filesystem::fail(int error)
+{
+	g_error = error;
+}
+
+} } /* particle::test */
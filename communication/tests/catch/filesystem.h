@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/*
+ * An in-memory stand-in for the littlefs based filesystem of the Gen 3 platforms. It implements
+ * the subset of the littlefs API that is used by the code under test, with the same signatures
+ * and error codes, so that the publish queue can be tested on the host.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define LFS_NAME_MAX 255
+
+typedef uint32_t lfs_size_t;
+typedef uint32_t lfs_off_t;
+typedef int32_t lfs_ssize_t;
+typedef int32_t lfs_soff_t;
+
+enum lfs_error {
+	LFS_ERR_OK = 0,
+	LFS_ERR_IO = -5,
+	LFS_ERR_NOENT = -2,
+	LFS_ERR_EXIST = -17,
+	LFS_ERR_INVAL = -22,
+	LFS_ERR_NOSPC = -28
+};
+
+enum lfs_open_flags {
+	LFS_O_RDONLY = 1,
+	LFS_O_WRONLY = 2,
+	LFS_O_RDWR = 3,
+	LFS_O_CREAT = 0x0100,
+	LFS_O_EXCL = 0x0200,
+	LFS_O_TRUNC = 0x0400,
+	LFS_O_APPEND = 0x0800
+};
+
+enum lfs_whence_flags {
+	LFS_SEEK_SET = 0,
+	LFS_SEEK_CUR = 1,
+	LFS_SEEK_END = 2
+};
+
+enum lfs_type {
+	LFS_TYPE_REG = 0x11,
+	LFS_TYPE_DIR = 0x22
+};
+
+struct lfs_info {
+	uint8_t type;
+	lfs_size_t size;
+	char name[LFS_NAME_MAX + 1];
+};
+
+typedef struct lfs {
+	int mounted;
+} lfs_t;
+
+typedef struct lfs_file {
+	void* data; // The file contents, owned by the filesystem
+	lfs_off_t pos;
+	int flags;
+} lfs_file_t;
+
+typedef struct {
+	lfs_t instance;
+} filesystem_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+int lfs_file_open(lfs_t* lfs, lfs_file_t* file, const char* path, int flags);
+int lfs_file_close(lfs_t* lfs, lfs_file_t* file);
+lfs_ssize_t lfs_file_read(lfs_t* lfs, lfs_file_t* file, void* buffer, lfs_size_t size);
+lfs_ssize_t lfs_file_write(lfs_t* lfs, lfs_file_t* file, const void* buffer, lfs_size_t size);
+lfs_soff_t lfs_file_seek(lfs_t* lfs, lfs_file_t* file, lfs_soff_t off, int whence);
+lfs_soff_t lfs_file_tell(lfs_t* lfs, lfs_file_t* file);
+lfs_soff_t lfs_file_size(lfs_t* lfs, lfs_file_t* file);
+int lfs_remove(lfs_t* lfs, const char* path);
+int lfs_rename(lfs_t* lfs, const char* oldpath, const char* newpath);
+int lfs_stat(lfs_t* lfs, const char* path, struct lfs_info* info);
+
+int filesystem_mount(filesystem_t* fs);
+int filesystem_unmount(filesystem_t* fs);
+filesystem_t* filesystem_get_instance(void* reserved);
+
+int filesystem_lock(filesystem_t* fs);
+int filesystem_unlock(filesystem_t* fs);
+
+#ifdef __cplusplus
+}
+
+#include <string>
+
+namespace particle { namespace fs {
+
+struct FsLock {
+	FsLock(filesystem_t* fs)
+			: fs_(fs) {
+		lock();
+	}
+
+	~FsLock() {
+		unlock();
+	}
+
+	void lock() {
+		filesystem_lock(fs_);
+	}
+
+	void unlock() {
+		filesystem_unlock(fs_);
+	}
+
+private:
+	filesystem_t* fs_;
+};
+
+} } /* particle::fs */
+
+namespace particle { namespace test {
+
+/**
+ * Test controls of the in-memory filesystem.
+ */
+struct Filesystem
+{
+	/**
+	 * Removes all files.
+	 */
+	static void reset();
+
+	/**
+	 * Returns the contents of a file, or nullptr if the file doesn't exist. The contents can be
+	 * modified to simulate corruption.
+	 */
+	static std::string* file(const char* path);
+
+	/**
+	 * Makes all subsequent file operations fail with the given error. An error of 0 restores
+	 * normal operation.
+	 */
+	static void fail(int error);
+};
+
+} } /* particle::test */
+
+#endif /* __cplusplus */
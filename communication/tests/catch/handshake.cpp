@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "loopback_cloud.h"
+
+#include "catch.hpp"
+
+using namespace particle::protocol;
+using namespace particle::protocol::test;
+
+namespace {
+
+void init(LoopbackProtocol& protocol)
+{
+	SparkKeys keys;
+	memset(&keys, 0, sizeof(keys));
+	keys.size = sizeof(keys);
+	SparkCallbacks callbacks;
+	memset(&callbacks, 0, sizeof(callbacks));
+	callbacks.size = sizeof(callbacks);
+	callbacks.millis = LoopbackCloud::millis;
+	SparkDescriptor descriptor;
+	memset(&descriptor, 0, sizeof(descriptor));
+	descriptor.size = sizeof(descriptor);
+	descriptor.was_ota_upgrade_successful = []{ return false; };
+	descriptor.ota_upgrade_status_sent = []{};
+	const char id[12] = { 0 };
+	protocol.init(id, keys, callbacks, descriptor);
+}
+
+} // namespace
+
+SCENARIO("the handshake returns while waiting for the server's hello")
+{
+	LoopbackCloud cloud(LoopbackCloud::Link{ 50, 0, 0, 1 });
+	LoopbackProtocol protocol(cloud);
+	init(protocol);
+
+	GIVEN("the handshake has started")
+	{
+		REQUIRE(protocol.begin()==HANDSHAKE_IN_PROGRESS);
+		REQUIRE(protocol.is_handshake_in_progress());
+
+		THEN("it completes when the hello arrives")
+		{
+			unsigned calls = 1;
+			int error;
+			while ((error = protocol.begin())==HANDSHAKE_IN_PROGRESS)
+			{
+				calls++;
+				REQUIRE(calls < 1000);
+			}
+			REQUIRE(error==NO_ERROR);
+			REQUIRE(calls > 1);
+			REQUIRE(cloud.hellos_received()==1);
+			REQUIRE(!protocol.is_handshake_in_progress());
+		}
+
+		THEN("a cancelled handshake starts over")
+		{
+			protocol.cancel_handshake();
+			REQUIRE(!protocol.is_handshake_in_progress());
+			int error;
+			while ((error = protocol.begin())==HANDSHAKE_IN_PROGRESS);
+			REQUIRE(error==NO_ERROR);
+			// the new session doesn't see the hello sent in the abandoned one
+			REQUIRE(cloud.hellos_received()==1);
+		}
+	}
+}
+
+SCENARIO("the handshake times out if the hello isn't acknowledged")
+{
+	// the round trip takes longer than the hello is retransmitted for
+	LoopbackCloud cloud(LoopbackCloud::Link{ 40000, 0, 0, 1 });
+	LoopbackProtocol protocol(cloud);
+	init(protocol);
+
+	int error;
+	while ((error = protocol.begin())==HANDSHAKE_IN_PROGRESS);
+	REQUIRE(error==MESSAGE_TIMEOUT);
+	REQUIRE(!protocol.is_handshake_in_progress());
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "heap_usage.h"
+
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+// the size of each block is stored in front of it, keeping the block aligned for any type
+union Header
+{
+	struct
+	{
+		size_t size;
+		bool tracked;
+	} block;
+	std::max_align_t align;
+};
+
+size_t g_current = 0;
+size_t g_peak = 0;
+unsigned g_excluded = 0;
+
+void* allocate(size_t size)
+{
+	Header* header = static_cast<Header*>(malloc(sizeof(Header) + size));
+	if (!header)
+		return nullptr;
+	header->block.size = size;
+	header->block.tracked = !g_excluded;
+	if (header->block.tracked)
+	{
+		g_current += size;
+		if (g_current > g_peak)
+			g_peak = g_current;
+	}
+	return header + 1;
+}
+
+void release(void* ptr)
+{
+	if (!ptr)
+		return;
+	Header* header = static_cast<Header*>(ptr) - 1;
+	if (header->block.tracked)
+		g_current -= header->block.size;
+	free(header);
+}
+
+} // namespace
+
+size_t HeapUsage::current()
+{
+	return g_current;
+}
+
+size_t HeapUsage::peak()
+{
+	return g_peak;
+}
+
+void HeapUsage::reset_peak()
+{
+	g_peak = g_current;
+}
+
+HeapUsage::Exclude::Exclude()
+{
+	g_excluded++;
+}
+
+HeapUsage::Exclude::~Exclude()
+{
+	g_excluded--;
+}
+
+void* operator new(size_t size)
+{
+	void* ptr = allocate(size);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	return allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+	return allocate(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+	release(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+	release(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+	release(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+	release(ptr);
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+/**
+ * Tracks the memory allocated with operator new by the test runner, so that benchmarks can
+ * report the heap high-water mark of the code they exercise.
+ */
+struct HeapUsage
+{
+	/**
+	 * The number of bytes currently allocated.
+	 */
+	static size_t current();
+
+	/**
+	 * The largest number of bytes allocated at once since the last call to reset_peak().
+	 */
+	static size_t peak();
+
+	/**
+	 * Starts tracking the peak from the current usage.
+	 */
+	static void reset_peak();
+
+	/**
+	 * Excludes the memory allocated during its lifetime, such as by test fixtures, from the usage.
+	 */
+	class Exclude
+	{
+	public:
+		Exclude();
+		~Exclude();
+	};
+};
@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "loopback_cloud.h"
+
+#include "chunked_transfer.h"
+#include "heap_usage.h"
+
+namespace particle { namespace protocol { namespace test {
+
+namespace {
+
+enum Type
+{
+	CON = 0,
+	NON = 1,
+	ACK = 2,
+	RST = 3
+};
+
+const uint8_t POST = 0x02;
+const uint8_t GET = 0x01;
+const uint8_t PUT = 0x03;
+const uint8_t CHANGED = 0x44;	// 2.04
+
+} // namespace
+
+system_tick_t LoopbackCloud::now = 0;
+
+LoopbackCloud::LoopbackCloud(const Link& link) :
+		link(link),
+		random(link.seed),
+		to_cloud_free(0),
+		to_device_free(0),
+		next_id(0x8000),
+		update_state(UPDATE_NONE),
+		update_length(0),
+		update_chunk_size(0),
+		events(0),
+		hellos(0),
+		chunks(0),
+		resent_chunks(0),
+		dropped(0)
+{
+	now = 0;
+}
+
+bool LoopbackCloud::is_lost()
+{
+	if (link.loss && random() % 100 < link.loss)
+	{
+		dropped++;
+		return true;
+	}
+	return false;
+}
+
+ProtocolError LoopbackCloud::handshake(bool resume_session)
+{
+	const HeapUsage::Exclude exclude;
+	// a new session starts with an empty link
+	to_cloud.clear();
+	to_device.clear();
+	pending.clear();
+	update_state = UPDATE_NONE;
+
+	const unsigned round_trips = resume_session ? RESUMED_HANDSHAKE_ROUND_TRIPS : FULL_HANDSHAKE_ROUND_TRIPS;
+	for (unsigned i = 0; i < round_trips; i++)
+	{
+		system_tick_t timeout = HANDSHAKE_TIMEOUT_MIN;
+		// the flight is resent if either it or the reply is lost
+		while (is_lost() || is_lost())
+		{
+			now += timeout;
+			if (timeout >= HANDSHAKE_TIMEOUT_MAX)
+				return IO_ERROR_GENERIC_ESTABLISH;
+			timeout *= 2;
+		}
+		now += 2 * link.latency;
+	}
+	return resume_session ? SESSION_RESUMED : NO_ERROR;
+}
+
+void LoopbackCloud::transmit(std::deque<Datagram>& queue, system_tick_t& free, const uint8_t* data, size_t size)
+{
+	system_tick_t sent = now;
+	if (link.bandwidth)
+	{
+		// datagrams are sent one after another, and lost datagrams take their share of the link too
+		if (free > sent)
+			sent = free;
+		sent += size * 1000 / link.bandwidth;
+		free = sent;
+	}
+	if (is_lost())
+		return;
+	Datagram datagram;
+	datagram.due = sent + link.latency;
+	datagram.data.assign(data, data + size);
+	queue.push_back(std::move(datagram));
+}
+
+void LoopbackCloud::device_send(const uint8_t* data, size_t size)
+{
+	const HeapUsage::Exclude exclude;
+	transmit(to_cloud, to_cloud_free, data, size);
+}
+
+size_t LoopbackCloud::device_receive(uint8_t* buf, size_t size)
+{
+	const HeapUsage::Exclude exclude;
+	while (!to_cloud.empty() && to_cloud.front().due <= now)
+	{
+		const Datagram datagram = std::move(to_cloud.front());
+		to_cloud.pop_front();
+		process(datagram.data);
+	}
+	resend_pending();
+	if (!to_device.empty() && to_device.front().due <= now)
+	{
+		const Datagram datagram = std::move(to_device.front());
+		to_device.pop_front();
+		const size_t length = datagram.data.size() < size ? datagram.data.size() : size;
+		memcpy(buf, datagram.data.data(), length);
+		return length;
+	}
+	now++;
+	return 0;
+}
+
+void LoopbackCloud::send(const uint8_t* data, size_t size)
+{
+	transmit(to_device, to_device_free, data, size);
+}
+
+void LoopbackCloud::send_confirmable(const uint8_t* data, size_t size)
+{
+	Pending p;
+	p.id = next_id++;
+	p.resend = now + ACK_TIMEOUT;
+	p.count = 1;
+	p.data.assign(data, data + size);
+	p.data[2] = p.id >> 8;
+	p.data[3] = p.id & 0xff;
+	send(p.data.data(), p.data.size());
+	pending.push_back(std::move(p));
+}
+
+void LoopbackCloud::resend_pending()
+{
+	for (auto it = pending.begin(); it != pending.end();)
+	{
+		if (it->resend > now)
+		{
+			++it;
+		}
+		else if (it->count > CoAPMessage::MAX_RETRANSMIT)
+		{
+			// the device is no longer listening
+			it = pending.erase(it);
+		}
+		else
+		{
+			send(it->data.data(), it->data.size());
+			it->count++;
+			it->resend = now + (ACK_TIMEOUT << (it->count - 1));
+			++it;
+		}
+	}
+}
+
+void LoopbackCloud::process(const std::vector<uint8_t>& msg)
+{
+	if (msg.size() < 4)
+		return;	// a keep-alive
+	const uint8_t type = (msg[0] >> 4) & 0x03;
+	const uint8_t token_length = msg[0] & 0x0f;
+	const uint8_t code = msg[1];
+	if (type == ACK || type == RST)
+	{
+		const message_id_t id = msg[2] << 8 | msg[3];
+		for (auto it = pending.begin(); it != pending.end(); ++it)
+		{
+			if (it->id == id)
+			{
+				pending.erase(it);
+				break;
+			}
+		}
+		return;
+	}
+	if (type == CON)
+		acknowledge(msg);
+
+	// the first Uri-Path option is a single character
+	const size_t path_index = 5 + token_length;
+	const char path = msg.size() > path_index ? msg[path_index] : 0;
+	if (code == POST && path == 'h')
+	{
+		hellos++;
+		send_hello();
+	}
+	else if (code == POST && (path == 'e' || path == 'E'))
+	{
+		events++;
+	}
+	else if (code == GET && path == 'c' && update_state == UPDATE_SENDING)
+	{
+		// the payload is a list of the missing chunk indices
+		for (size_t i = path_index + 2; i + 1 < msg.size(); i += 2)
+		{
+			send_chunk(msg[i] << 8 | msg[i + 1]);
+			resent_chunks++;
+		}
+		send_update_done();
+	}
+	else if (code == CHANGED && token_length == 1 && msg[4] == UPDATE_TOKEN && update_state == UPDATE_BEGIN_SENT)
+	{
+		// UpdateReady
+		update_state = UPDATE_SENDING;
+		const uint16_t count = (update_length + update_chunk_size - 1) / update_chunk_size;
+		for (uint16_t i = 0; i < count; i++)
+			send_chunk(i);
+		send_update_done();
+	}
+}
+
+void LoopbackCloud::acknowledge(const std::vector<uint8_t>& msg)
+{
+	uint8_t ack[5];
+	size_t size;
+	if (!msg[1])
+		size = Messages::empty_ack(ack, msg[2], msg[3]);	// ping
+	else if ((msg[0] & 0x0f) == 1)
+		size = Messages::coded_ack(ack, msg[4], CHANGED, msg[2], msg[3]);
+	else
+		size = Messages::coded_ack(ack, CHANGED, msg[2], msg[3]);
+	send(ack, size);
+}
+
+void LoopbackCloud::send_hello()
+{
+	uint8_t hello[16];
+	const size_t size = Messages::hello(hello, 0, 0, 0, 0, 0, true, nullptr, 0);
+	send_confirmable(hello, size);
+}
+
+void LoopbackCloud::begin_update(uint32_t file_length, uint16_t chunk_size)
+{
+	const HeapUsage::Exclude exclude;
+	update_state = UPDATE_BEGIN_SENT;
+	update_length = file_length;
+	update_chunk_size = chunk_size;
+	const uint8_t begin[] = { 0x41, POST, 0, 0, UPDATE_TOKEN, 0xb1, 'u', 0xff,
+			ChunkedTransfer::FAST_OTA,
+			uint8_t(chunk_size >> 8), uint8_t(chunk_size),
+			uint8_t(file_length >> 24), uint8_t(file_length >> 16), uint8_t(file_length >> 8), uint8_t(file_length),
+			FileTransfer::Store::FIRMWARE,
+			0, 0, 0, 0 };
+	send_confirmable(begin, sizeof(begin));
+}
+
+void LoopbackCloud::send_chunk(uint16_t index)
+{
+	const uint32_t offset = uint32_t(index) * update_chunk_size;
+	if (offset >= update_length)
+		return;
+	const size_t size = (update_length - offset < update_chunk_size) ? update_length - offset : update_chunk_size;
+	std::vector<uint8_t> chunk(16 + size);
+	uint8_t* p = chunk.data();
+	*p++ = 0x51;	// non-confirmable, one-byte token
+	*p++ = POST;
+	*p++ = next_id >> 8;
+	*p++ = next_id & 0xff;
+	next_id++;
+	*p++ = UPDATE_TOKEN;
+	*p++ = 0xb1;
+	*p++ = 'c';
+	uint8_t* const crc = p;
+	p += 5;
+	*p++ = 0x02;
+	*p++ = index >> 8;
+	*p++ = index & 0xff;
+	*p++ = 0xff;
+	for (size_t i = 0; i < size; i++)
+		p[i] = uint8_t(index + i);
+	const uint32_t value = chunk_crc(p, size);
+	crc[0] = 0x04;
+	crc[1] = value >> 24;
+	crc[2] = value >> 16;
+	crc[3] = value >> 8;
+	crc[4] = value;
+	send(chunk.data(), chunk.size());
+	chunks++;
+}
+
+void LoopbackCloud::send_update_done()
+{
+	const uint8_t done[] = { 0x41, PUT, 0, 0, UPDATE_TOKEN, 0xb1, 'u' };
+	send_confirmable(done, sizeof(done));
+}
+
+uint32_t LoopbackCloud::chunk_crc(const uint8_t* data, size_t size)
+{
+	// a stand-in for the CRC computed by the HAL, which isn't what's being measured
+	uint32_t sum = 0;
+	for (size_t i = 0; i < size; i++)
+		sum += data[i];
+	return sum;
+}
+
+}}}
@@ -0,0 +1,330 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <deque>
+#include <random>
+#include <vector>
+
+#include "protocol.h"
+#include "coap_channel.h"
+#include "buffer_message_channel.h"
+
+namespace particle
+{
+namespace protocol
+{
+namespace test
+{
+
+/**
+ * A stand-in for the cloud that the protocol talks to over an in-process loopback link.
+ *
+ * Datagrams in both directions are delayed by the link latency and the time needed to transmit
+ * them at the link bandwidth, and a percentage of them are dropped at random. Time is simulated:
+ * it advances by 1 millisecond each time the device polls for a datagram and none has arrived,
+ * like a device loop running at 1 kHz, so the results don't depend on the speed of the host.
+ *
+ * The cloud acknowledges confirmable messages, answers the device hello, counts events and
+ * sends firmware updates in fast OTA mode, resending the chunks the device reports missing.
+ * Its own confirmable messages are resent until they are acknowledged.
+ *
+ * The memory used by the cloud isn't counted by HeapUsage. There is a single simulated clock,
+ * so only one instance should be used at a time.
+ */
+class LoopbackCloud
+{
+public:
+	struct Link
+	{
+		/**
+		 * The one-way delay of each datagram.
+		 */
+		system_tick_t latency;
+
+		/**
+		 * The percentage of datagrams dropped in each direction.
+		 */
+		unsigned loss;
+
+		/**
+		 * The link bandwidth in bytes per second, or 0 if it's unlimited.
+		 */
+		unsigned bandwidth;
+
+		/**
+		 * Seeds the random loss, so that runs with the same link are repeatable.
+		 */
+		unsigned seed;
+	};
+
+	/**
+	 * The DTLS handshake retransmission timeouts configured in DTLSMessageChannel.
+	 */
+	static const system_tick_t HANDSHAKE_TIMEOUT_MIN = 3000;
+	static const system_tick_t HANDSHAKE_TIMEOUT_MAX = 6000;
+
+	/**
+	 * The number of round trips of a full DTLS handshake with a cookie exchange, and of an
+	 * abbreviated handshake that resumes a session.
+	 */
+	static const unsigned FULL_HANDSHAKE_ROUND_TRIPS = 3;
+	static const unsigned RESUMED_HANDSHAKE_ROUND_TRIPS = 2;
+
+	explicit LoopbackCloud(const Link& link);
+
+	/**
+	 * The simulated time, suitable for SparkCallbacks::millis.
+	 */
+	static system_tick_t millis()
+	{
+		return now;
+	}
+
+	/**
+	 * Simulates the DTLS handshake, which the device does before the protocol handshake.
+	 * The time needed for public key operations isn't included.
+	 *
+	 * @return SESSION_RESUMED if the session was resumed, IO_ERROR_GENERIC_ESTABLISH if a
+	 * handshake flight timed out.
+	 */
+	ProtocolError handshake(bool resume_session);
+
+	/**
+	 * Sends a datagram from the device.
+	 */
+	void device_send(const uint8_t* data, size_t size);
+
+	/**
+	 * Retrieves the next datagram that arrived at the device.
+	 * @return the size of the datagram, or 0 if none arrived.
+	 */
+	size_t device_receive(uint8_t* buf, size_t size);
+
+	/**
+	 * Starts sending a firmware update of the given size to the device.
+	 */
+	void begin_update(uint32_t file_length, uint16_t chunk_size);
+
+	/**
+	 * Determines if there are datagrams on the link or messages waiting to be acknowledged.
+	 */
+	bool is_idle() const
+	{
+		return to_cloud.empty() && to_device.empty() && pending.empty();
+	}
+
+	unsigned events_received() const
+	{
+		return events;
+	}
+
+	unsigned hellos_received() const
+	{
+		return hellos;
+	}
+
+	unsigned chunks_sent() const
+	{
+		return chunks;
+	}
+
+	unsigned chunks_resent() const
+	{
+		return resent_chunks;
+	}
+
+	unsigned datagrams_dropped() const
+	{
+		return dropped;
+	}
+
+	static uint32_t chunk_crc(const uint8_t* data, size_t size);
+
+private:
+	struct Datagram
+	{
+		system_tick_t due;
+		std::vector<uint8_t> data;
+	};
+
+	/**
+	 * A confirmable message sent by the cloud that hasn't been acknowledged.
+	 */
+	struct Pending
+	{
+		message_id_t id;
+		system_tick_t resend;
+		unsigned count;
+		std::vector<uint8_t> data;
+	};
+
+	enum UpdateState
+	{
+		UPDATE_NONE,
+		UPDATE_BEGIN_SENT,
+		UPDATE_SENDING
+	};
+
+	static const system_tick_t ACK_TIMEOUT = 4000;
+	static const token_t UPDATE_TOKEN = 0x7a;
+
+	static system_tick_t now;
+
+	Link link;
+	std::minstd_rand random;
+	std::deque<Datagram> to_cloud;
+	std::deque<Datagram> to_device;
+	std::vector<Pending> pending;
+	system_tick_t to_cloud_free;
+	system_tick_t to_device_free;
+	message_id_t next_id;
+
+	UpdateState update_state;
+	uint32_t update_length;
+	uint16_t update_chunk_size;
+
+	unsigned events;
+	unsigned hellos;
+	unsigned chunks;
+	unsigned resent_chunks;
+	unsigned dropped;
+
+	bool is_lost();
+	void transmit(std::deque<Datagram>& queue, system_tick_t& free, const uint8_t* data, size_t size);
+	void send(const uint8_t* data, size_t size);
+	void send_confirmable(const uint8_t* data, size_t size);
+	void resend_pending();
+	void process(const std::vector<uint8_t>& msg);
+	void acknowledge(const std::vector<uint8_t>& msg);
+	void send_hello();
+	void send_chunk(uint16_t index);
+	void send_update_done();
+};
+
+/**
+ * The device end of the loopback link. It takes the place of DTLSMessageChannel in the channel
+ * stack, and is sent and received from in the same way.
+ */
+class LoopbackChannel : public BufferMessageChannel<PROTOCOL_BUFFER_SIZE>
+{
+	LoopbackCloud* cloud;
+	bool resume_session;
+
+public:
+	LoopbackChannel() :
+			cloud(nullptr),
+			resume_session(false)
+	{
+	}
+
+	void init(LoopbackCloud* cloud, bool resume_session)
+	{
+		this->cloud = cloud;
+		this->resume_session = resume_session;
+	}
+
+	ProtocolError establish(uint32_t& flags, uint32_t app_state_crc) override
+	{
+		return cloud->handshake(resume_session);
+	}
+
+	ProtocolError send(Message& msg) override
+	{
+		cloud->device_send(msg.buf(), msg.length());
+		return NO_ERROR;
+	}
+
+	ProtocolError receive(Message& msg) override
+	{
+		create(msg);
+		msg.set_length(cloud->device_receive(msg.buf(), msg.capacity()));
+		return NO_ERROR;
+	}
+
+	ProtocolError command(Command cmd, void* arg) override
+	{
+		return NO_ERROR;
+	}
+
+	bool is_unreliable() override
+	{
+		return true;
+	}
+
+	ProtocolError notify_established() override
+	{
+		return NO_ERROR;
+	}
+};
+
+/**
+ * The protocol as DTLSProtocol sets it up, talking to a LoopbackCloud.
+ */
+class LoopbackProtocol : public Protocol
+{
+	CoAPChannel<CoAPReliableChannel<LoopbackChannel, decltype(SparkCallbacks::millis)>> channel;
+	uint8_t device_id[12];
+
+public:
+	LoopbackProtocol(LoopbackCloud& cloud, bool resume_session=false) :
+			Protocol(channel),
+			device_id()
+	{
+		channel.init(&cloud, resume_session);
+	}
+
+	void init(const char* id, const SparkKeys& keys, const SparkCallbacks& callbacks,
+			const SparkDescriptor& descriptor) override
+	{
+		memcpy(device_id, id, sizeof(device_id));
+		channel.set_millis(callbacks.millis);
+		set_protocol_flags(REQUIRE_HELLO_RESPONSE);
+		Protocol::init(callbacks, descriptor);
+	}
+
+	size_t build_hello(Message& message, uint8_t flags) override
+	{
+		product_details_t deets;
+		deets.size = sizeof(deets);
+		get_product_details(deets);
+		return Messages::hello(message.buf(), 0, flags, PLATFORM_ID, deets.product_id,
+				deets.product_version, true, device_id, sizeof(device_id));
+	}
+
+	int command(ProtocolCommands::Enum command, uint32_t data) override
+	{
+		return UNKNOWN;
+	}
+
+	int set_max_in_flight(unsigned count) override
+	{
+		channel.set_max_in_flight(count>CoAPMessage::MAX_NSTART ? CoAPMessage::MAX_NSTART : count);
+		return 0;
+	}
+
+	/**
+	 * The largest number of bytes used at the same time by the messages in the channel's message stores.
+	 */
+	size_t message_peak_bytes() const
+	{
+		return channel.client_messages().storage().peak_bytes()+channel.server_messages().storage().peak_bytes();
+	}
+};
+
+}}}
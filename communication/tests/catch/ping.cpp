@@ -21,6 +21,8 @@
 
 #include "catch.hpp"
 
+#include <limits>
+
 using namespace particle::protocol;
 
 SCENARIO("ping requests and responses are managed")
@@ -149,3 +151,157 @@ SCENARIO("ping requests and responses are managed")
 	}
 
 }
+
+namespace {
+
+/**
+ * Pings until adaptive keepalive has had the given number of tries, acknowledging the pings
+ * sent after an idle time the NAT binding survives and timing out the others.
+ */
+void probe(Pinger& pinger, system_tick_t binding_lifetime, unsigned tries)
+{
+	for (unsigned i = 0; i < tries; i++)
+	{
+		const system_tick_t idle = pinger.interval() + 1;
+		REQUIRE(pinger.process(idle, []{return NO_ERROR;})==NO_ERROR);
+		REQUIRE(pinger.is_expecting_ping_ack());
+		if (idle <= binding_lifetime)
+		{
+			pinger.message_received();
+		}
+		else
+		{
+			REQUIRE(pinger.process(10001, []{return IO_ERROR;})==PING_TIMEOUT);
+			pinger.reset();
+		}
+	}
+}
+
+} // namespace
+
+SCENARIO("adaptive keepalive finds the longest interval the binding survives")
+{
+	Pinger pinger;
+	pinger.init(15000, 10000);
+
+	GIVEN("adaptive keepalive is disabled")
+	{
+		THEN("the configured interval is used")
+		{
+			REQUIRE(pinger.interval()==15000);
+			probe(pinger, 60000, 5);
+			REQUIRE(pinger.interval()==15000);
+			REQUIRE(!pinger.take_state_changed());
+		}
+	}
+
+	GIVEN("adaptive keepalive is enabled")
+	{
+		pinger.set_adaptive(120000);
+
+		THEN("longer intervals are probed after each acknowledged ping")
+		{
+			REQUIRE(pinger.interval()==22500);
+			probe(pinger, 60000, 1);
+			REQUIRE(pinger.take_state_changed());
+			REQUIRE(pinger.state().records[0].safe==22501);
+			REQUIRE(pinger.interval()==33751);
+		}
+
+		THEN("a probe that goes unanswered limits the interval")
+		{
+			probe(pinger, 30000, 2);
+			REQUIRE(pinger.state().records[0].safe==22501);
+			REQUIRE(pinger.state().records[0].failed==33752);
+			REQUIRE(pinger.interval()==28126);
+		}
+
+		THEN("the interval converges a margin below the binding lifetime")
+		{
+			probe(pinger, 40000, 20);
+			REQUIRE(pinger.interval()<40000);
+			REQUIRE(pinger.interval()>=(40000 - Pinger::ADAPTIVE_RESOLUTION) * 9 / 10);
+			const system_tick_t converged = pinger.interval();
+			probe(pinger, 40000, 5);
+			REQUIRE(pinger.interval()==converged);
+		}
+
+		THEN("the interval doesn't exceed the maximum")
+		{
+			probe(pinger, 1000000, 20);
+			REQUIRE(pinger.interval()==120000);
+		}
+
+		THEN("the interval doesn't go below the configured one")
+		{
+			probe(pinger, 5000, 10);
+			REQUIRE(pinger.interval()>=15000);
+		}
+
+		THEN("forced pings aren't probes")
+		{
+			REQUIRE(pinger.process(std::numeric_limits<system_tick_t>::max(), []{return NO_ERROR;})==NO_ERROR);
+			pinger.message_received();
+			REQUIRE(pinger.state().records[0].safe==0);
+			REQUIRE(pinger.interval()==22500);
+		}
+
+		THEN("pings after outgoing messages aren't probes")
+		{
+			pinger.message_sent();
+			probe(pinger, 60000, 1);
+			REQUIRE(pinger.state().records[0].safe==0);
+		}
+
+		THEN("a failure at an interval that used to be safe starts learning again")
+		{
+			probe(pinger, 40000, 20);
+			const system_tick_t interval = pinger.interval();
+			probe(pinger, 20000, 1);
+			REQUIRE(pinger.state().records[0].safe==0);
+			REQUIRE(pinger.state().records[0].failed==interval + 1);
+			REQUIRE(pinger.interval()<interval);
+		}
+
+		THEN("each network is learned separately")
+		{
+			pinger.set_network(1);
+			probe(pinger, 60000, 3);
+			const system_tick_t interval = pinger.interval();
+			pinger.set_network(2);
+			REQUIRE(pinger.interval()==22500);
+			pinger.set_network(1);
+			REQUIRE(pinger.interval()==interval);
+		}
+
+		THEN("the least recently used network is forgotten")
+		{
+			for (uint32_t network = 1; network <= KeepaliveState::MAX_NETWORKS + 1; network++)
+			{
+				pinger.set_network(network);
+				probe(pinger, 60000, 1);
+			}
+			REQUIRE(pinger.state().count==KeepaliveState::MAX_NETWORKS);
+			pinger.set_network(1);
+			REQUIRE(pinger.state().records[0].safe==0);
+			pinger.set_network(KeepaliveState::MAX_NETWORKS);
+			REQUIRE(pinger.state().records[0].safe==22501);
+		}
+
+		THEN("what was learned can be restored")
+		{
+			pinger.set_network(7);
+			probe(pinger, 60000, 3);
+			const system_tick_t interval = pinger.interval();
+			const KeepaliveState state = pinger.state();
+
+			Pinger restored;
+			restored.init(15000, 10000);
+			restored.set_adaptive(120000);
+			restored.set_network(7);
+			restored.restore_state(state);
+			REQUIRE(restored.interval()==interval);
+			REQUIRE(!restored.take_state_changed());
+		}
+	}
+}
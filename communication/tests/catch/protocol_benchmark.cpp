@@ -0,0 +1,401 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "loopback_cloud.h"
+#include "heap_usage.h"
+
+#include "catch.hpp"
+
+using namespace particle;
+using namespace particle::protocol;
+using namespace particle::protocol::test;
+
+/*
+ * Benchmarks of the protocol talking to a LoopbackCloud. Each benchmark prints a line of JSON
+ * per link, so that the results can be compared between builds. Times marked "ms" are simulated
+ * and depend only on the protocol and the link, "host_ms" is the time taken on the host.
+ *
+ * The benchmarks are hidden by default, run them with `runner [benchmark]`, or `make benchmark`.
+ * The links can be replaced with a single one by setting PROTOCOL_BENCHMARK_LATENCY,
+ * PROTOCOL_BENCHMARK_LOSS and PROTOCOL_BENCHMARK_BANDWIDTH in the environment.
+ */
+
+namespace {
+
+const char DEVICE_ID[12] = { 0 };
+const char EVENT_DATA[] = "0123456789abcdef0123456789abcdef";
+const system_tick_t TIME_LIMIT = 10 * 60 * 1000;
+
+unsigned env(const char* name, unsigned default_value)
+{
+	const char* value = getenv(name);
+	return value ? unsigned(atoi(value)) : default_value;
+}
+
+std::vector<LoopbackCloud::Link> links()
+{
+	// latency, loss, bandwidth, seed
+	std::vector<LoopbackCloud::Link> links = {
+		{ 50, 0, 64000, 1 },
+		{ 50, 5, 64000, 1 },
+		{ 300, 10, 16000, 1 }
+	};
+	if (getenv("PROTOCOL_BENCHMARK_LATENCY") || getenv("PROTOCOL_BENCHMARK_LOSS") || getenv("PROTOCOL_BENCHMARK_BANDWIDTH"))
+	{
+		LoopbackCloud::Link link = links.front();
+		link.latency = env("PROTOCOL_BENCHMARK_LATENCY", link.latency);
+		link.loss = env("PROTOCOL_BENCHMARK_LOSS", link.loss);
+		link.bandwidth = env("PROTOCOL_BENCHMARK_BANDWIDTH", link.bandwidth);
+		links.assign(1, link);
+	}
+	return links;
+}
+
+std::ostream& operator<<(std::ostream& out, const LoopbackCloud::Link& link)
+{
+	return out << "\"latency_ms\":" << link.latency << ",\"loss_percent\":" << link.loss
+			<< ",\"bandwidth\":" << link.bandwidth;
+}
+
+/**
+ * The firmware update storage of the device.
+ */
+struct Firmware
+{
+	static unsigned chunks_saved;
+	static bool finished;
+
+	static int prepare(FileTransfer::Descriptor& data, uint32_t flags, void*)
+	{
+		if (!(flags & ChunkedTransfer::DRY_RUN))
+		{
+			chunks_saved = 0;
+			finished = false;
+		}
+		return 0;
+	}
+
+	static int save_chunk(FileTransfer::Descriptor& descriptor, const unsigned char* chunk, void*)
+	{
+		chunks_saved++;
+		return 0;
+	}
+
+	static int finish(FileTransfer::Descriptor& data, uint32_t flags, void*)
+	{
+		if (!(flags & UpdateFlag::VALIDATE_ONLY))
+			finished = true;
+		return 0;
+	}
+
+	static uint32_t crc(const unsigned char* buf, uint32_t length)
+	{
+		return LoopbackCloud::chunk_crc(buf, length);
+	}
+};
+
+unsigned Firmware::chunks_saved = 0;
+bool Firmware::finished = false;
+
+bool was_ota_upgrade_successful()
+{
+	return false;
+}
+
+void ota_upgrade_status_sent()
+{
+}
+
+void init(Protocol& protocol)
+{
+	SparkKeys keys;
+	memset(&keys, 0, sizeof(keys));
+	keys.size = sizeof(keys);
+	SparkCallbacks callbacks;
+	memset(&callbacks, 0, sizeof(callbacks));
+	callbacks.size = sizeof(callbacks);
+	callbacks.millis = LoopbackCloud::millis;
+	callbacks.calculate_crc = Firmware::crc;
+	callbacks.prepare_for_firmware_update = Firmware::prepare;
+	callbacks.save_firmware_chunk = Firmware::save_chunk;
+	callbacks.finish_firmware_update = Firmware::finish;
+	SparkDescriptor descriptor;
+	memset(&descriptor, 0, sizeof(descriptor));
+	descriptor.size = sizeof(descriptor);
+	descriptor.was_ota_upgrade_successful = was_ota_upgrade_successful;
+	descriptor.ota_upgrade_status_sent = ota_upgrade_status_sent;
+	protocol.init(DEVICE_ID, keys, callbacks, descriptor);
+	// the rate limit would be measured rather than the protocol
+	protocol.set_publish_rate_interval(0);
+}
+
+/**
+ * Runs the handshake to completion.
+ */
+int handshake(Protocol& protocol)
+{
+	int error;
+	do
+	{
+		error = protocol.begin();
+	}
+	while (error == HANDSHAKE_IN_PROGRESS);
+	return error;
+}
+
+/**
+ * Connects, retrying when the link drops the handshake.
+ */
+void connect(Protocol& protocol)
+{
+	int attempts = 0;
+	while (handshake(protocol) != NO_ERROR)
+		REQUIRE(++attempts < 10);
+}
+
+class Stopwatch
+{
+	std::chrono::steady_clock::time_point start;
+	std::chrono::nanoseconds total;
+
+public:
+	Stopwatch() : total(0)
+	{
+	}
+
+	void resume()
+	{
+		start = std::chrono::steady_clock::now();
+	}
+
+	void pause()
+	{
+		total += std::chrono::steady_clock::now() - start;
+	}
+
+	double ms() const
+	{
+		return total.count() / 1e6;
+	}
+
+	double ns() const
+	{
+		return total.count();
+	}
+};
+
+struct Completions
+{
+	unsigned acked = 0;
+	unsigned failed = 0;
+
+	unsigned count() const
+	{
+		return acked + failed;
+	}
+
+	CompletionHandler handler()
+	{
+		return CompletionHandler([](int error, const void* data, void* callback_data, void* reserved) {
+			Completions* self = static_cast<Completions*>(callback_data);
+			if (error)
+				self->failed++;
+			else
+				self->acked++;
+		}, this);
+	}
+};
+
+} // namespace
+
+/*
+ * The DTLS handshake isn't run: LoopbackChannel models it as a number of round trips over the
+ * link, without the cryptography, so this measures the protocol handshake plus the modeled
+ * DTLS round trips, not the cost of a real DTLS handshake.
+ */
+SCENARIO("benchmark connection setup with a modeled DTLS handshake", "[.][benchmark]")
+{
+	const unsigned connections = 20;
+	for (const LoopbackCloud::Link& link : links())
+	{
+		for (const bool resume : { false, true })
+		{
+			const size_t heap_base = HeapUsage::current();
+			HeapUsage::reset_peak();
+			LoopbackCloud cloud(link);
+			LoopbackProtocol protocol(cloud, resume);
+			init(protocol);
+
+			Stopwatch host;
+			unsigned failed = 0;
+			system_tick_t total = 0;
+			system_tick_t longest = 0;
+			for (unsigned i = 0; i < connections; i++)
+			{
+				const system_tick_t start = LoopbackCloud::millis();
+				host.resume();
+				const int error = handshake(protocol);
+				host.pause();
+				const system_tick_t elapsed = LoopbackCloud::millis() - start;
+				if (error)
+				{
+					failed++;
+					continue;
+				}
+				total += elapsed;
+				if (elapsed > longest)
+					longest = elapsed;
+			}
+			REQUIRE(failed < connections);
+			std::cout << "{\"benchmark\":\"connect_modeled\"," << link
+					<< ",\"resumed\":" << (resume ? "true" : "false")
+					<< ",\"connections\":" << connections
+					<< ",\"failed\":" << failed
+					<< ",\"mean_ms\":" << total / (connections - failed)
+					<< ",\"max_ms\":" << longest
+					<< ",\"host_us\":" << host.ns() / connections / 1000
+					<< ",\"heap_peak_bytes\":" << HeapUsage::peak() - heap_base
+					<< "}" << std::endl;
+		}
+	}
+}
+
+SCENARIO("benchmark publishing events without acknowledgement", "[.][benchmark]")
+{
+	const unsigned count = 2000;
+	for (const LoopbackCloud::Link& link : links())
+	{
+		const size_t heap_base = HeapUsage::current();
+		HeapUsage::reset_peak();
+		LoopbackCloud cloud(link);
+		LoopbackProtocol protocol(cloud);
+		init(protocol);
+		connect(protocol);
+
+		const system_tick_t start = LoopbackCloud::millis();
+		Stopwatch host;
+		unsigned rejected = 0;
+		for (unsigned i = 0; i < count; i++)
+		{
+			host.resume();
+			const bool sent = protocol.send_event("benchmark", EVENT_DATA, 60, EventType::PRIVATE,
+					EventType::NO_ACK, CompletionHandler());
+			host.pause();
+			if (!sent)
+				rejected++;
+		}
+		while (!cloud.is_idle() && LoopbackCloud::millis() - start < TIME_LIMIT)
+			protocol.event_loop();
+		const system_tick_t elapsed = LoopbackCloud::millis() - start;
+		std::cout << "{\"benchmark\":\"publish_no_ack\"," << link
+				<< ",\"events\":" << count
+				<< ",\"rejected\":" << rejected
+				<< ",\"delivered\":" << cloud.events_received()
+				<< ",\"events_per_sec\":" << cloud.events_received() * 1000.0 / (elapsed ? elapsed : 1)
+				<< ",\"host_ns_per_event\":" << host.ns() / count
+				<< ",\"heap_peak_bytes\":" << HeapUsage::peak() - heap_base
+				<< "}" << std::endl;
+	}
+}
+
+SCENARIO("benchmark publishing events with acknowledgement", "[.][benchmark]")
+{
+	const unsigned count = 500;
+	// events published by the application before it waits for acknowledgements
+	const unsigned window = 16;
+	for (const LoopbackCloud::Link& link : links())
+	{
+		const size_t heap_base = HeapUsage::current();
+		HeapUsage::reset_peak();
+		LoopbackCloud cloud(link);
+		LoopbackProtocol protocol(cloud);
+		init(protocol);
+		connect(protocol);
+
+		Completions completions;
+		const system_tick_t start = LoopbackCloud::millis();
+		Stopwatch host;
+		host.resume();
+		unsigned sent = 0;
+		while (completions.count() < count && LoopbackCloud::millis() - start < TIME_LIMIT)
+		{
+			if (sent < count && sent - completions.count() < window)
+			{
+				protocol.send_event("benchmark", EVENT_DATA, 60, EventType::PRIVATE,
+						EventType::WITH_ACK, completions.handler());
+				sent++;
+			}
+			else
+			{
+				protocol.event_loop();
+			}
+		}
+		host.pause();
+		REQUIRE(completions.count() == count);
+		const system_tick_t elapsed = LoopbackCloud::millis() - start;
+		std::cout << "{\"benchmark\":\"publish_ack\"," << link
+				<< ",\"events\":" << count
+				<< ",\"acknowledged\":" << completions.acked
+				<< ",\"failed\":" << completions.failed
+				<< ",\"events_per_sec\":" << completions.acked * 1000.0 / (elapsed ? elapsed : 1)
+				<< ",\"host_ms\":" << host.ms()
+				<< ",\"heap_peak_bytes\":" << HeapUsage::peak() - heap_base
+				<< "}" << std::endl;
+	}
+}
+
+SCENARIO("benchmark a firmware update", "[.][benchmark]")
+{
+	const uint32_t file_length = 128 * 1024;
+	const uint16_t chunk_size = 512;
+	for (const LoopbackCloud::Link& link : links())
+	{
+		const size_t heap_base = HeapUsage::current();
+		HeapUsage::reset_peak();
+		LoopbackCloud cloud(link);
+		LoopbackProtocol protocol(cloud);
+		init(protocol);
+		connect(protocol);
+
+		const system_tick_t start = LoopbackCloud::millis();
+		Stopwatch host;
+		host.resume();
+		cloud.begin_update(file_length, chunk_size);
+		Firmware::finished = false;
+		while (!Firmware::finished && LoopbackCloud::millis() - start < TIME_LIMIT)
+			protocol.event_loop();
+		host.pause();
+		REQUIRE(Firmware::finished);
+		const system_tick_t elapsed = LoopbackCloud::millis() - start;
+		std::cout << "{\"benchmark\":\"firmware_update\"," << link
+				<< ",\"bytes\":" << file_length
+				<< ",\"chunk_size\":" << chunk_size
+				<< ",\"chunks_sent\":" << cloud.chunks_sent()
+				<< ",\"chunks_resent\":" << cloud.chunks_resent()
+				<< ",\"ms\":" << elapsed
+				<< ",\"bytes_per_sec\":" << file_length * 1000.0 / (elapsed ? elapsed : 1)
+				<< ",\"host_us_per_chunk\":" << host.ns() / cloud.chunks_sent() / 1000
+				<< ",\"heap_peak_bytes\":" << HeapUsage::peak() - heap_base
+				<< ",\"slab_peak_bytes\":" << protocol.message_peak_bytes()
+				<< "}" << std::endl;
+	}
+}
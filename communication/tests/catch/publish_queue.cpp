@@ -0,0 +1,453 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "publisher.h"
+#include "publish_queue.h"
+#include "file_queue.h"
+#include "communication_diagnostic.h"
+#include "filesystem.h"
+
+#include "catch.hpp"
+#include "fakeit.hpp"
+
+using namespace particle;
+using namespace particle::protocol;
+using namespace fakeit;
+
+namespace {
+
+const char* const QUEUE_FILE = "/sys/test_queue.bin";
+
+void push(fs::FileQueue& queue, const std::string& item)
+{
+	std::string data(item);
+	REQUIRE(queue.pushBack(&data[0], data.size()) == 0);
+}
+
+std::string front(fs::FileQueue& queue)
+{
+	fs::FileQueue::QueueEntry entry;
+	char buf[64] = {};
+	REQUIRE(queue.front(entry, buf, sizeof(buf)) >= 0);
+	return std::string(buf, entry.size - sizeof(entry));
+}
+
+std::vector<std::string> names(PublishQueue& queue)
+{
+	std::vector<std::string> result;
+	while (queue.has_events()) {
+		PublishQueue::Event event;
+		REQUIRE(queue.front(event) == 0);
+		result.push_back(event.name);
+		REQUIRE(queue.pop_front() == 0);
+	}
+	return result;
+}
+
+/**
+ * A channel that records the names of the events sent.
+ */
+struct EventChannel
+{
+	Mock<MessageChannel> mock;
+	uint8_t buf[PROTOCOL_BUFFER_SIZE];
+	std::vector<std::string> sent;
+	ProtocolError error = NO_ERROR;
+	ProtocolError create_error = NO_ERROR;
+
+	EventChannel()
+	{
+		When(Method(mock, create)).AlwaysDo([this](Message& msg, size_t) {
+			if (create_error) {
+				return create_error;
+			}
+			msg.set_buffer(buf, sizeof(buf));
+			return NO_ERROR;
+		});
+		When(Method(mock, send)).AlwaysDo([this](Message& msg) {
+			if (error) {
+				return error;
+			}
+			// a short event name is a single Uri-Path option that follows the event type
+			sent.push_back(std::string((const char*)msg.buf() + 7, msg.buf()[6] & 0x0f));
+			return NO_ERROR;
+		});
+		When(Method(mock, is_unreliable)).AlwaysReturn(true);
+	}
+
+	MessageChannel& get()
+	{
+		return mock.get();
+	}
+};
+
+struct Completion
+{
+	bool called = false;
+	int error = 0;
+
+	CompletionHandler handler()
+	{
+		return CompletionHandler([](int error, const void* data, void* callback_data, void* reserved) {
+			Completion* self = static_cast<Completion*>(callback_data);
+			self->called = true;
+			self->error = error;
+		}, this);
+	}
+};
+
+} // namespace
+
+SCENARIO("a file queue reclaims the space of removed entries when compacted")
+{
+	test::Filesystem::reset();
+	fs::FileQueue queue(QUEUE_FILE);
+	char buf[64];
+
+	GIVEN("a queue with no file")
+	{
+		THEN("compacting has no effect")
+		{
+			REQUIRE(queue.compact(buf, sizeof(buf)) == 0);
+			REQUIRE(queue.fileSize() == 0);
+			REQUIRE(test::Filesystem::file(QUEUE_FILE) == nullptr);
+		}
+	}
+
+	GIVEN("a queue with 3 entries")
+	{
+		push(queue, "a");
+		push(queue, "bb");
+		push(queue, "ccc");
+		const int size = queue.fileSize();
+		REQUIRE(size == int(3 * sizeof(fs::FileQueue::QueueEntry) + 6));
+
+		WHEN("the front entry is removed")
+		{
+			REQUIRE(queue.popFront() == 0);
+			THEN("the file keeps its size until it's compacted")
+			{
+				REQUIRE(queue.fileSize() == size);
+				REQUIRE(queue.compact(buf, sizeof(buf)) == 0);
+				REQUIRE(queue.fileSize() == int(2 * sizeof(fs::FileQueue::QueueEntry) + 5));
+				REQUIRE(test::Filesystem::file("/sys/test_queue.bin~") == nullptr);
+			}
+			THEN("the remaining entries are retained in order")
+			{
+				REQUIRE(queue.compact(buf, sizeof(buf)) == 0);
+				size_t bytes = 0;
+				REQUIRE(queue.count(&bytes) == 2);
+				REQUIRE(bytes == 2 * sizeof(fs::FileQueue::QueueEntry) + 5);
+				REQUIRE(front(queue) == "bb");
+				REQUIRE(queue.popFront() == 0);
+				REQUIRE(front(queue) == "ccc");
+			}
+		}
+
+		WHEN("the buffer is too small for an entry")
+		{
+			REQUIRE(queue.popFront() == 0);
+			THEN("compacting fails and the queue is unchanged")
+			{
+				REQUIRE(queue.compact(buf, 2) < 0);
+				REQUIRE(queue.fileSize() == size);
+				REQUIRE(queue.count() == 2);
+				REQUIRE(test::Filesystem::file("/sys/test_queue.bin~") == nullptr);
+			}
+		}
+
+		WHEN("all entries are removed")
+		{
+			for (int i = 0; i < 3; i++) {
+				REQUIRE(queue.popFront() == 0);
+			}
+			THEN("the file is deleted")
+			{
+				REQUIRE(test::Filesystem::file(QUEUE_FILE) == nullptr);
+				REQUIRE(queue.fileSize() == 0);
+			}
+		}
+	}
+}
+
+SCENARIO("the publish queue stores events in a file")
+{
+	test::Filesystem::reset();
+	PublishQueue queue(QUEUE_FILE);
+
+	GIVEN("a disabled queue")
+	{
+		THEN("events are rejected")
+		{
+			REQUIRE(queue.push_back("event", "data", 60, EventType::PRIVATE, 0) == SYSTEM_ERROR_INVALID_STATE);
+		}
+	}
+
+	GIVEN("an enabled queue")
+	{
+		REQUIRE(queue.set_max_size(1024) == 0);
+
+		WHEN("events are added")
+		{
+			REQUIRE(queue.push_back("a", "data a", 60, EventType::PRIVATE, 0) == 0);
+			REQUIRE(queue.push_back("b", nullptr, 120, EventType::PUBLIC, EventType::NO_ACK) == 0);
+			THEN("they are read back in order with their properties")
+			{
+				REQUIRE(queue.count() == 2);
+				PublishQueue::Event event;
+				REQUIRE(queue.front(event) == 0);
+				REQUIRE(std::string(event.name) == "a");
+				REQUIRE(std::string(event.data) == "data a");
+				REQUIRE(event.ttl == 60);
+				REQUIRE(event.event_type == EventType::PRIVATE);
+				REQUIRE(queue.pop_front() == 0);
+				REQUIRE(queue.front(event) == 0);
+				REQUIRE(std::string(event.name) == "b");
+				REQUIRE(std::string(event.data) == "");
+				REQUIRE(event.ttl == 120);
+				REQUIRE(event.event_type == EventType::PUBLIC);
+				REQUIRE(event.flags == EventType::NO_ACK);
+				REQUIRE(queue.pop_front() == 0);
+				REQUIRE(!queue.has_events());
+				REQUIRE(queue.front(event) == SYSTEM_ERROR_NOT_FOUND);
+			}
+			THEN("they are picked up by a queue using the same file")
+			{
+				PublishQueue restored(QUEUE_FILE);
+				REQUIRE(restored.set_max_size(1024) == 0);
+				REQUIRE(names(restored) == std::vector<std::string>({ "a", "b" }));
+			}
+		}
+
+		WHEN("the queue is full")
+		{
+			REQUIRE(queue.set_max_size(3 * (sizeof(PublishQueue::Entry) + sizeof(fs::FileQueue::QueueEntry) + 5)) == 0);
+			const int dropped = g_droppedQueuedEventsCounter;
+			for (const char* name: { "a", "b", "c", "d", "e" }) {
+				REQUIRE(queue.push_back(name, "data", 60, EventType::PRIVATE, 0) == 0);
+			}
+			THEN("the oldest events are dropped")
+			{
+				REQUIRE(int(g_droppedQueuedEventsCounter) == dropped + 2);
+				REQUIRE(names(queue) == std::vector<std::string>({ "c", "d", "e" }));
+			}
+			THEN("the file doesn't grow beyond the limit")
+			{
+				REQUIRE(queue.push_back("f", "data", 60, EventType::PRIVATE, 0) == 0);
+				REQUIRE(size_t(fs::FileQueue(QUEUE_FILE).fileSize()) <= 3 * (sizeof(PublishQueue::Entry) + sizeof(fs::FileQueue::QueueEntry) + 5));
+			}
+		}
+
+		WHEN("an event doesn't fit in the queue")
+		{
+			REQUIRE(queue.set_max_size(16) == 0);
+			THEN("it's rejected")
+			{
+				REQUIRE(queue.push_back("event", "data", 60, EventType::PRIVATE, 0) == SYSTEM_ERROR_TOO_LARGE);
+			}
+		}
+
+		WHEN("the front entry is corrupt")
+		{
+			REQUIRE(queue.push_back("a", "data", 60, EventType::PRIVATE, 0) == 0);
+			REQUIRE(queue.push_back("b", "data", 60, EventType::PRIVATE, 0) == 0);
+			std::string* file = test::Filesystem::file(QUEUE_FILE);
+			REQUIRE(file != nullptr);
+			(*file)[sizeof(fs::FileQueue::QueueEntry)] = char(0xff); // name_length
+			THEN("it's dropped and the next event is available")
+			{
+				PublishQueue::Event event;
+				REQUIRE(queue.front(event) == SYSTEM_ERROR_BAD_DATA);
+				REQUIRE(queue.count() == 1);
+				REQUIRE(queue.front(event) == 0);
+				REQUIRE(std::string(event.name) == "b");
+			}
+		}
+
+		WHEN("the file can't be read")
+		{
+			REQUIRE(queue.push_back("a", "data", 60, EventType::PRIVATE, 0) == 0);
+			test::Filesystem::fail(LFS_ERR_IO);
+			THEN("the error is reported and the event is retained")
+			{
+				PublishQueue::Event event;
+				REQUIRE(queue.front(event) == LFS_ERR_IO);
+				test::Filesystem::fail(0);
+				REQUIRE(queue.count() == 1);
+				REQUIRE(queue.front(event) == 0);
+			}
+		}
+	}
+}
+
+SCENARIO("the publisher sends the events stored in the queue")
+{
+	test::Filesystem::reset();
+	EventChannel channel;
+	{
+		PublishQueue stored("/sys/pubqueue.bin");
+		REQUIRE(stored.set_max_size(1024) == 0);
+		for (const char* name: { "a", "b", "c" }) {
+			REQUIRE(stored.push_back(name, "data", 60, EventType::PRIVATE, EventType::NO_ACK) == 0);
+		}
+	}
+	Publisher publisher(nullptr);
+	REQUIRE(publisher.set_queue_size(1024) == 0);
+	REQUIRE(publisher.has_queued_events());
+
+	GIVEN("readable events")
+	{
+		THEN("they are sent in order and removed from the queue")
+		{
+			REQUIRE(publisher.process_queue(channel.get(), 0) == NO_ERROR);
+			REQUIRE(channel.sent == std::vector<std::string>({ "a", "b", "c" }));
+			REQUIRE(!publisher.has_queued_events());
+			REQUIRE(test::Filesystem::file("/sys/pubqueue.bin") == nullptr);
+		}
+	}
+
+	GIVEN("a corrupt event")
+	{
+		(*test::Filesystem::file("/sys/pubqueue.bin"))[sizeof(fs::FileQueue::QueueEntry)] = char(0xff);
+		THEN("it's skipped")
+		{
+			REQUIRE(publisher.process_queue(channel.get(), 0) == NO_ERROR);
+			REQUIRE(channel.sent == std::vector<std::string>({ "b", "c" }));
+			REQUIRE(!publisher.has_queued_events());
+		}
+	}
+
+	GIVEN("a filesystem error")
+	{
+		test::Filesystem::fail(LFS_ERR_IO);
+		THEN("the stored events are discarded without failing the connection")
+		{
+			REQUIRE(publisher.process_queue(channel.get(), 0) == NO_ERROR);
+			test::Filesystem::fail(0);
+			REQUIRE(channel.sent.empty());
+			REQUIRE(!publisher.has_queued_events());
+		}
+	}
+
+	GIVEN("an event that can't be sent")
+	{
+		REQUIRE(publisher.set_rate_limit(1000, 1) == 0);
+		channel.error = IO_ERROR;
+		REQUIRE(publisher.process_queue(channel.get(), 0) == NO_ERROR);
+		THEN("it doesn't use up the rate limit")
+		{
+			channel.error = NO_ERROR;
+			REQUIRE(publisher.process_queue(channel.get(), 0) == NO_ERROR);
+			REQUIRE(channel.sent == std::vector<std::string>({ "a" }));
+		}
+	}
+}
+
+SCENARIO("an event isn't sent when the channel can't create a message")
+{
+	test::Filesystem::reset();
+	EventChannel channel;
+	Completion completion;
+	Publisher publisher(nullptr);
+	channel.create_error = INVALID_STATE;
+	REQUIRE(publisher.send_event(channel.get(), "a", "data", 60, EventType::PRIVATE, 0, 0, completion.handler()) == INVALID_STATE);
+	REQUIRE(channel.sent.empty());
+	REQUIRE((completion.called && completion.error == toSystemError(INVALID_STATE)));
+}
+
+SCENARIO("the handlers of stored events complete once the events are sent")
+{
+	test::Filesystem::reset();
+	EventChannel channel;
+	Completion c1, c2;
+	std::unique_ptr<Publisher> publisher(new Publisher(nullptr));
+	REQUIRE(publisher->set_queue_size(1024) == 0);
+	channel.error = IO_ERROR;
+	// the event is stored when it can't be sent, and the next one keeps the order
+	REQUIRE(publisher->send_event(channel.get(), "a", "data", 60, EventType::PRIVATE, EventType::WITH_ACK, 0, c1.handler()) == NO_ERROR);
+	REQUIRE(publisher->send_event(channel.get(), "b", "data", 60, EventType::PRIVATE, 0, 0, c2.handler()) == NO_ERROR);
+	REQUIRE(publisher->has_queued_events());
+	REQUIRE(!c1.called);
+	REQUIRE(!c2.called);
+
+	WHEN("the events are sent")
+	{
+		channel.error = NO_ERROR;
+		REQUIRE(publisher->process_queue(channel.get(), 0) == NO_ERROR);
+		THEN("their handlers succeed")
+		{
+			REQUIRE(channel.sent == std::vector<std::string>({ "a", "b" }));
+			REQUIRE((c1.called && c1.error == 0));
+			REQUIRE((c2.called && c2.error == 0));
+		}
+	}
+
+	WHEN("the publisher is destroyed before the events are sent")
+	{
+		publisher.reset();
+		THEN("their handlers fail with a distinct error and the events are kept")
+		{
+			REQUIRE((c1.called && c1.error == SYSTEM_ERROR_QUEUED));
+			REQUIRE((c2.called && c2.error == SYSTEM_ERROR_QUEUED));
+			PublishQueue stored("/sys/pubqueue.bin");
+			REQUIRE(stored.set_max_size(1024) == 0);
+			REQUIRE(names(stored) == std::vector<std::string>({ "a", "b" }));
+		}
+	}
+}
+
+SCENARIO("the handlers of dropped events fail")
+{
+	test::Filesystem::reset();
+	PublishQueue queue(QUEUE_FILE);
+	REQUIRE(queue.set_max_size(2 * (sizeof(PublishQueue::Entry) + sizeof(fs::FileQueue::QueueEntry) + 5)) == 0);
+	Completion c1, c2, c3;
+	CompletionHandler h1 = c1.handler(), h2 = c2.handler(), h3 = c3.handler();
+	REQUIRE(queue.push_back("a", "data", 60, EventType::PRIVATE, 0, &h1) == 0);
+	REQUIRE(queue.push_back("b", "data", 60, EventType::PRIVATE, 0, &h2) == 0);
+	REQUIRE(queue.push_back("c", "data", 60, EventType::PRIVATE, 0, &h3) == 0);
+	REQUIRE((c1.called && c1.error == SYSTEM_ERROR_LIMIT_EXCEEDED));
+	REQUIRE(!c2.called);
+
+	WHEN("an event is removed")
+	{
+		CompletionHandler handler;
+		REQUIRE(queue.pop_front(&handler) == 0);
+		THEN("its handler is returned")
+		{
+			REQUIRE(!c2.called);
+			handler.setResult();
+			REQUIRE((c2.called && c2.error == 0));
+			REQUIRE(!c3.called);
+		}
+	}
+
+	WHEN("the queue is cleared")
+	{
+		REQUIRE(queue.clear(SYSTEM_ERROR_IO) == 0);
+		THEN("the handlers fail with the given error")
+		{
+			REQUIRE((c2.called && c2.error == SYSTEM_ERROR_IO));
+			REQUIRE((c3.called && c3.error == SYSTEM_ERROR_IO));
+			REQUIRE(!queue.has_events());
+		}
+	}
+}
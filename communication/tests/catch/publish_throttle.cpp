@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string>
+#include <vector>
+
+#include "publish_throttle.h"
+#include "token_bucket.h"
+
+#include "catch.hpp"
+
+using namespace particle;
+using namespace particle::protocol;
+
+namespace {
+
+struct Completion
+{
+	bool called = false;
+	int error = 0;
+
+	CompletionHandler handler()
+	{
+		return CompletionHandler([](int error, const void* data, void* callback_data, void* reserved) {
+			Completion* self = static_cast<Completion*>(callback_data);
+			self->called = true;
+			self->error = error;
+		}, this);
+	}
+};
+
+ProtocolError push(PublishThrottle& throttle, const char* name, int flags, Completion& completion)
+{
+	CompletionHandler handler = completion.handler();
+	return throttle.push(PublishThrottle::priority(flags), name, "data", 60, EventType::PRIVATE, flags, handler);
+}
+
+std::vector<std::string> drain(PublishThrottle& throttle)
+{
+	std::vector<std::string> names;
+	while (throttle.has_events())
+	{
+		std::unique_ptr<PublishThrottle::Event> event = throttle.pop();
+		names.push_back(event->name());
+		event->handler.setResult();
+	}
+	return names;
+}
+
+} // namespace
+
+SCENARIO("a token bucket allows bursts and limits the average rate")
+{
+	GIVEN("a bucket with a burst of 4 and one token per second")
+	{
+		TokenBucket bucket(1000, 4);
+		THEN("4 operations are allowed at once")
+		{
+			for (int i = 0; i < 4; i++)
+				REQUIRE(bucket.acquire(0));
+			REQUIRE(!bucket.acquire(0));
+		}
+		WHEN("the bucket is empty")
+		{
+			for (int i = 0; i < 4; i++)
+				bucket.acquire(0);
+			THEN("a token is added each interval")
+			{
+				REQUIRE(!bucket.acquire(999));
+				REQUIRE(bucket.acquire(1000));
+				REQUIRE(!bucket.acquire(1500));
+				REQUIRE(bucket.acquire(2000));
+			}
+			THEN("no more than the burst accumulates")
+			{
+				for (int i = 0; i < 4; i++)
+					REQUIRE(bucket.acquire(100000));
+				REQUIRE(!bucket.acquire(100000));
+			}
+			THEN("millis() overflow doesn't stall the bucket")
+			{
+				TokenBucket wrap(1000, 1);
+				REQUIRE(wrap.acquire(system_tick_t(-500)));
+				REQUIRE(!wrap.acquire(system_tick_t(-1)));
+				REQUIRE(wrap.acquire(500));
+			}
+		}
+	}
+	GIVEN("a bucket without an interval")
+	{
+		TokenBucket bucket(0, 1);
+		THEN("there is no limit")
+		{
+			for (int i = 0; i < 100; i++)
+				REQUIRE(bucket.acquire(0));
+		}
+	}
+}
+
+SCENARIO("throttled events are released by priority")
+{
+	GIVEN("events of each priority")
+	{
+		PublishThrottle throttle;
+		Completion c[4];
+		REQUIRE(push(throttle, "telemetry", EventType::PRIORITY_LOW, c[0])==NO_ERROR);
+		REQUIRE(push(throttle, "status", 0, c[1])==NO_ERROR);
+		REQUIRE(push(throttle, "alarm", EventType::PRIORITY_HIGH, c[2])==NO_ERROR);
+		REQUIRE(push(throttle, "status2", 0, c[3])==NO_ERROR);
+		REQUIRE(throttle.count()==4);
+
+		THEN("the highest priority is released first, in publish order within a priority")
+		{
+			REQUIRE(drain(throttle)==std::vector<std::string>({ "alarm", "status", "status2", "telemetry" }));
+		}
+		THEN("waiting events are found by priority")
+		{
+			REQUIRE(throttle.has_events(PublishThrottle::HIGH));
+			drain(throttle);
+			REQUIRE(!throttle.has_events(PublishThrottle::LOW));
+		}
+	}
+	GIVEN("a full throttle")
+	{
+		PublishThrottle throttle;
+		throttle.set_max_events(2);
+		Completion low, normal, high, other;
+		REQUIRE(push(throttle, "telemetry", EventType::PRIORITY_LOW, low)==NO_ERROR);
+		REQUIRE(push(throttle, "status", 0, normal)==NO_ERROR);
+
+		WHEN("a higher priority event is published")
+		{
+			REQUIRE(push(throttle, "alarm", EventType::PRIORITY_HIGH, high)==NO_ERROR);
+			THEN("it replaces the lowest priority event, which fails")
+			{
+				REQUIRE(low.called);
+				REQUIRE(low.error==toSystemError(BANDWIDTH_EXCEEDED));
+				REQUIRE(drain(throttle)==std::vector<std::string>({ "alarm", "status" }));
+			}
+		}
+		WHEN("an event of the lowest priority is published")
+		{
+			THEN("it's rejected")
+			{
+				REQUIRE(push(throttle, "telemetry2", EventType::PRIORITY_LOW, other)==BANDWIDTH_EXCEEDED);
+				REQUIRE(!low.called);
+				REQUIRE(throttle.count()==2);
+			}
+		}
+		WHEN("the throttle is disabled")
+		{
+			throttle.set_max_events(0);
+			THEN("the events held fail")
+			{
+				REQUIRE(low.called);
+				REQUIRE(normal.called);
+				REQUIRE(push(throttle, "status", 0, other)==BANDWIDTH_EXCEEDED);
+			}
+		}
+	}
+}
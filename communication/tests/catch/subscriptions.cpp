@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string>
+#include <vector>
+
+#include "subscriptions.h"
+
+#include "catch.hpp"
+#include "fakeit.hpp"
+
+using namespace particle::protocol;
+
+namespace {
+
+std::vector<std::string> received;
+
+void handler_a(void* data, const char* event_name, const char*)
+{
+	received.push_back(std::string((const char*)data) + ":" + event_name);
+}
+
+uint32_t crc(const unsigned char* buf, uint32_t len)
+{
+	uint32_t sum = 0;
+	for (uint32_t i = 0; i < len; i++)
+		sum = sum * 31 + buf[i];
+	return sum;
+}
+
+/**
+ * Computes the checksum of the handlers as stored by earlier releases, in a zero-filled array.
+ */
+uint32_t legacy_checksum(const std::vector<const char*>& filters)
+{
+	uint32_t checksum = 0;
+	for (const char* filter : filters)
+	{
+		FilteringEventHandler h;
+		memset(&h, 0, sizeof(h));
+		strncpy(h.filter, filter, sizeof(h.filter));
+		h.scope = SubscriptionScope::MY_DEVICES;
+		uint32_t chk[4];
+		chk[0] = checksum;
+		chk[1] = crc((const uint8_t*)h.device_id, sizeof(h.device_id));
+		chk[2] = crc((const uint8_t*)h.filter, sizeof(h.filter));
+		chk[3] = crc((const uint8_t*)&h.scope, sizeof(h.scope));
+		checksum = crc((const uint8_t*)chk, sizeof(chk));
+	}
+	return checksum;
+}
+
+void dispatch(Subscriptions& subscriptions, const char* event_name)
+{
+	fakeit::Mock<MessageChannel> channel;
+	uint8_t buf[256];
+	Message message(buf, sizeof(buf) - 1, Messages::event(buf, 0x1234, event_name, "data", 60, EventType::PUBLIC, false));
+	received.clear();
+	REQUIRE(subscriptions.handle_event(message, nullptr, channel.get())==NO_ERROR);
+}
+
+} // namespace
+
+SCENARIO("events are dispatched to the handlers whose filter is a prefix of the event name")
+{
+	GIVEN("more handlers than fit in the original table")
+	{
+		Subscriptions subscriptions;
+		const std::vector<const char*> filters = { "temp", "", "temp/room", "hum", "temp/roof", "temp", "t", "humidity" };
+		for (const char* filter : filters)
+			REQUIRE(subscriptions.add_event_handler(filter, (EventHandler)handler_a, (void*)filter, SubscriptionScope::MY_DEVICES, nullptr)==NO_ERROR);
+		REQUIRE(subscriptions.event_handler_count()==filters.size() - 1);	// "temp" is added once
+
+		THEN("an event is dispatched to every matching handler, longest filter first")
+		{
+			dispatch(subscriptions, "temp/room/1");
+			REQUIRE(received==std::vector<std::string>({ "temp/room:temp/room/1", "temp:temp/room/1", "t:temp/room/1", ":temp/room/1" }));
+		}
+		THEN("an event that only matches the empty filter reaches that handler")
+		{
+			dispatch(subscriptions, "pressure");
+			REQUIRE(received==std::vector<std::string>({ ":pressure" }));
+		}
+		THEN("a filter that extends the event name doesn't match")
+		{
+			dispatch(subscriptions, "humid");
+			REQUIRE(received==std::vector<std::string>({ "hum:humid", ":humid" }));
+		}
+		THEN("the checksum is the same as for the fixed table")
+		{
+			REQUIRE(subscriptions.compute_subscriptions_checksum(crc)==legacy_checksum({ "temp", "", "temp/room", "hum", "temp/roof", "t", "humidity" }));
+		}
+		WHEN("the handlers for a filter are removed")
+		{
+			subscriptions.remove_event_handlers("temp");
+			THEN("the others keep their order and still match")
+			{
+				REQUIRE(subscriptions.compute_subscriptions_checksum(crc)==legacy_checksum({ "", "temp/room", "hum", "temp/roof", "t", "humidity" }));
+				dispatch(subscriptions, "temp/roof");
+				REQUIRE(received==std::vector<std::string>({ "temp/roof:temp/roof", "t:temp/roof", ":temp/roof" }));
+			}
+		}
+	}
+	GIVEN("handlers with the same filter")
+	{
+		Subscriptions subscriptions;
+		const char* first = "first";
+		const char* second = "second";
+		subscriptions.add_event_handler("e", (EventHandler)handler_a, (void*)first, SubscriptionScope::MY_DEVICES, nullptr);
+		subscriptions.add_event_handler("ev", (EventHandler)handler_a, (void*)first, SubscriptionScope::MY_DEVICES, nullptr);
+		subscriptions.add_event_handler("e", (EventHandler)handler_a, (void*)second, SubscriptionScope::MY_DEVICES, nullptr);
+		THEN("they are called in the order they were added")
+		{
+			dispatch(subscriptions, "event");
+			REQUIRE(received==std::vector<std::string>({ "first:event", "first:event", "second:event" }));
+		}
+	}
+	GIVEN("the maximum number of handlers")
+	{
+		Subscriptions subscriptions;
+		for (size_t i = 0; i < Subscriptions::MAX_EVENT_HANDLERS; i++)
+		{
+			const std::string filter = "event" + std::to_string(i);
+			REQUIRE(subscriptions.add_event_handler(filter.c_str(), (EventHandler)handler_a, (void*)"h", SubscriptionScope::MY_DEVICES, nullptr)==NO_ERROR);
+		}
+		THEN("no more can be added")
+		{
+			REQUIRE(subscriptions.add_event_handler("other", (EventHandler)handler_a, (void*)"h", SubscriptionScope::MY_DEVICES, nullptr)==INSUFFICIENT_STORAGE);
+		}
+	}
+}
@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string>
+#include <vector>
+
+#include "variables.h"
+
+#include "catch.hpp"
+#include "fakeit.hpp"
+
+using namespace particle::protocol;
+using namespace fakeit;
+
+namespace {
+
+const token_t TOKEN = 0x7a;
+const message_id_t MESSAGE_ID = 0x1234;
+
+size_t value_size = 0;
+unsigned reads = 0;
+
+char value_at(size_t offset)
+{
+	return 'a' + offset % 26;
+}
+
+std::string value(size_t size)
+{
+	std::string s;
+	for (size_t i = 0; i < size; i++)
+		s += value_at(i);
+	return s;
+}
+
+int read_variable(const char* key, size_t offset, char* data, size_t size, void* reserved)
+{
+	if (strcmp(key, "dump"))
+		return -1;
+	reads++;
+	size_t n = 0;
+	for (; n < size && offset + n < value_size; n++)
+		data[n] = value_at(offset + n);
+	return n;
+}
+
+SparkReturnType::Enum variable_type(const char* key)
+{
+	return SparkReturnType::STRING;
+}
+
+const void* get_variable(const char* key)
+{
+	return "stored";
+}
+
+/**
+ * A GET request for the variable, with a Block2 option if block_option isn't negative.
+ */
+size_t request(uint8_t* buf, const char* key, int block_option)
+{
+	size_t len = 0;
+	buf[len++] = 0x41; // confirmable, one-byte token
+	buf[len++] = 0x01; // GET
+	buf[len++] = MESSAGE_ID >> 8;
+	buf[len++] = MESSAGE_ID & 0xff;
+	buf[len++] = TOKEN;
+	buf[len++] = 0xb1; // Uri-Path
+	buf[len++] = 'v';
+	buf[len++] = strlen(key); // Uri-Path
+	memcpy(buf + len, key, strlen(key));
+	len += strlen(key);
+	if (block_option >= 0)
+	{
+		const size_t value_len = block_option > 0xff ? 2 : block_option ? 1 : 0;
+		buf[len++] = 0xc0 | value_len; // Block2, delta 12 from Uri-Path
+		for (size_t i = value_len; i > 0; i--)
+			buf[len++] = block_option >> ((i - 1) * 8);
+	}
+	return len;
+}
+
+struct Response
+{
+	uint8_t code;
+	bool has_block;
+	uint32_t block;
+	std::string payload;
+};
+
+Response get(size_t capacity, const char* key, int block_option)
+{
+	Mock<MessageChannel> channel;
+	std::vector<uint8_t> sent;
+	When(Method(channel, send)).AlwaysDo([&](Message& msg) {
+		sent.assign(msg.buf(), msg.buf() + msg.length());
+		return NO_ERROR;
+	});
+	std::vector<uint8_t> buf(capacity);
+	Message message(buf.data(), capacity, request(buf.data(), key, block_option));
+	Variables variables;
+	PayloadCompressor compressor;
+	char variable_key[MAX_VARIABLE_KEY_LENGTH+1];
+	variables.decode_variable_request(variable_key, message);
+	REQUIRE(variables.handle_variable_request(variable_key, message, channel.get(), TOKEN, MESSAGE_ID, compressor,
+			variable_type, get_variable, read_variable) == NO_ERROR);
+
+	Response r = {};
+	REQUIRE(sent.size() >= 5);
+	REQUIRE(sent[0] == 0x61); // acknowledgment, one-byte token
+	REQUIRE(CoAP::message_id(sent.data()) == MESSAGE_ID);
+	REQUIRE(sent[4] == TOKEN);
+	r.code = sent[1];
+	Message response(sent.data(), sent.size(), sent.size());
+	r.has_block = Variables::decode_block2(response, r.block);
+	auto marker = std::find(sent.begin() + 5, sent.end(), 0xff);
+	if (marker != sent.end())
+		r.payload.assign(marker + 1, sent.end());
+	return r;
+}
+
+} // namespace
+
+SCENARIO("variable values that fit in one block are sent without a Block2 option")
+{
+	value_size = 100;
+	Response r = get(PROTOCOL_BUFFER_SIZE, "dump", -1);
+	REQUIRE(r.code == CoAPCode::CONTENT);
+	REQUIRE_FALSE(r.has_block);
+	REQUIRE(r.payload == value(100));
+}
+
+SCENARIO("large variable values are read and sent block by block")
+{
+	value_size = 2000;
+	reads = 0;
+	const size_t capacity = 640;
+	// the largest block that fits in the message with its header is 512 bytes
+	REQUIRE(Variables::max_block_szx(capacity) == 5);
+
+	GIVEN("the client doesn't ask for a block size")
+	{
+		std::string received;
+		Response r = get(capacity, "dump", -1);
+		REQUIRE(r.code == CoAPCode::CONTENT);
+		REQUIRE(r.has_block);
+		REQUIRE(r.block == (0 << 4 | 0x08 | 5));
+		received += r.payload;
+		for (uint32_t num = 1; num < 4; num++)
+		{
+			r = get(capacity, "dump", num << 4 | 5);
+			REQUIRE(r.code == CoAPCode::CONTENT);
+			REQUIRE(r.has_block);
+			REQUIRE((r.block >> 4) == num);
+			REQUIRE(bool(r.block & 0x08) == (num < 3));
+			received += r.payload;
+		}
+		REQUIRE(received == value(2000));
+		// each block is generated separately
+		REQUIRE(reads == 4);
+	}
+
+	GIVEN("the client asks for smaller blocks")
+	{
+		std::string received;
+		for (uint32_t num = 0; ; num++)
+		{
+			Response r = get(capacity, "dump", num << 4 | 2);
+			REQUIRE(r.code == CoAPCode::CONTENT);
+			REQUIRE((r.block & 0x07) == 2);
+			REQUIRE(r.payload.size() <= 64);
+			received += r.payload;
+			if (!(r.block & 0x08))
+				break;
+		}
+		REQUIRE(received == value(2000));
+	}
+
+	GIVEN("the client asks for larger blocks than fit in a message")
+	{
+		Response r = get(capacity, "dump", 6);
+		REQUIRE((r.block & 0x07) == 5);
+		REQUIRE(r.payload == value(512));
+		THEN("later blocks start at the offset of the requested block")
+		{
+			r = get(capacity, "dump", 1 << 4 | 6);
+			REQUIRE(r.code == CoAPCode::CONTENT);
+			REQUIRE((r.block >> 4) == 2);
+			REQUIRE((r.block & 0x07) == 5);
+			REQUIRE(r.payload == value(2000).substr(1024, 512));
+		}
+	}
+
+	GIVEN("the client asks for the reserved block size")
+	{
+		Response r = get(capacity, "dump", 7);
+		REQUIRE(r.code == CoAPCode::BAD_OPTION);
+	}
+
+	GIVEN("the client asks for a block past the end of the value")
+	{
+		Response r = get(capacity, "dump", 4 << 4 | 5);
+		REQUIRE(r.code == CoAPCode::BAD_OPTION);
+	}
+}
+
+SCENARIO("variables that aren't streamed are sent from their stored value")
+{
+	Response r = get(PROTOCOL_BUFFER_SIZE, "other", -1);
+	REQUIRE(r.code == CoAPCode::CONTENT);
+	REQUIRE_FALSE(r.has_block);
+	REQUIRE(r.payload == "stored");
+}
+
+SCENARIO("the Block2 option is encoded in as few bytes as possible")
+{
+	uint8_t buf[16];
+	uint32_t block = 0;
+
+	size_t len = Messages::variable_block(buf, MESSAGE_ID, TOKEN, 0, false, 0);
+	REQUIRE(len == 8);
+	REQUIRE(Variables::decode_block2(Message(buf, sizeof(buf), len), block));
+	REQUIRE(block == 0);
+
+	len = Messages::variable_block(buf, MESSAGE_ID, TOKEN, 300, true, 6);
+	REQUIRE(len == 10);
+	REQUIRE(Variables::decode_block2(Message(buf, sizeof(buf), len), block));
+	REQUIRE(block == (300 << 4 | 0x08 | 6));
+}
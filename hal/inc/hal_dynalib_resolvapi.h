@@ -38,6 +38,7 @@ DYNALIB_FN(2, hal_resolvapi, resolv_add_dns_server, int(const struct sockaddr*,
 DYNALIB_FN(3, hal_resolvapi, resolv_del_dns_server, int(const struct sockaddr*))
 DYNALIB_FN(4, hal_resolvapi, resolv_event_handler_add, resolv_event_handler_cookie_t(resolv_event_handler_t, void*))
 DYNALIB_FN(5, hal_resolvapi, resolv_event_handler_del, int(resolv_event_handler_cookie_t))
+DYNALIB_FN(6, hal_resolvapi, resolv_get_cache_stats, int(struct resolv_cache_stats*, void*))
 
 DYNALIB_END(hal_resolvapi)
 
@@ -48,6 +48,9 @@ DYNALIB_FN(12, hal_socket, sock_send, int(int, const void*, size_t, int))
 DYNALIB_FN(13, hal_socket, sock_sendto, int(int, const void*, size_t, int, const struct sockaddr*, socklen_t))
 DYNALIB_FN(14, hal_socket, sock_socket, int(int, int, int))
 DYNALIB_FN(15, hal_socket, sock_fcntl, int(int, int, ...))
+DYNALIB_FN(16, hal_socket, sock_recvmmsg, int(int, struct sock_mmsghdr*, unsigned int, int))
+DYNALIB_FN(17, hal_socket, sock_sendmmsg, int(int, struct sock_mmsghdr*, unsigned int, int))
+DYNALIB_FN(18, hal_socket, sock_poll, int(struct pollfd*, nfds_t, int))
 
 DYNALIB_END(hal_socket)
 
@@ -235,6 +235,39 @@ ssize_t sock_send(int s, const void* dataptr, size_t size, int flags);
 ssize_t sock_sendto(int s, const void* dataptr, size_t size, int flags,
                     const struct sockaddr* to, socklen_t tolen);
 
+/** A message sent with sock_sendmmsg() or received with sock_recvmmsg() */
+struct sock_mmsghdr {
+    struct msghdr msg_hdr; /**< Message header */
+    unsigned int msg_len;  /**< Number of bytes sent or received */
+};
+
+/**
+ * Receive multiple messages from the socket.
+ *
+ * Only the first message is waited for according to the flags, the remaining ones are
+ * received if they are already available.
+ *
+ * @param[in]    s       a socket that has been created with sock_socket()
+ * @param[inout] msgvec  the messages, msg_len of each received message is set to its size
+ * @param[in]    vlen    the number of messages in msgvec
+ * @param[in]    flags   a combination of MSG_DONTWAIT, MSG_PEEK and MSG_TRUNC
+ *
+ * @returns    The number of messages received or -1 on error, with errno set accordingly.
+ */
+int sock_recvmmsg(int s, struct sock_mmsghdr* msgvec, unsigned int vlen, int flags);
+
+/**
+ * Send multiple messages through the socket.
+ *
+ * @param[in]    s       a socket that has been created with sock_socket()
+ * @param[inout] msgvec  the messages, msg_len of each sent message is set to its size
+ * @param[in]    vlen    the number of messages in msgvec
+ * @param[in]    flags   a combination of MSG_MORE and MSG_DONTWAIT
+ *
+ * @returns    The number of messages sent or -1 on error, with errno set accordingly.
+ */
+int sock_sendmmsg(int s, struct sock_mmsghdr* msgvec, unsigned int vlen, int flags);
+
 /**
  * Create an endpoint for communication - a socket.
  *
@@ -258,6 +291,18 @@ int sock_socket(int domain, int type, int protocol);
  */
 int sock_fcntl(int s, int cmd, ...);
 
+/**
+ * Wait for events on a set of sockets.
+ *
+ * @param[inout] fds      the sockets and the events to wait for, revents of each is set to the
+ *                        events that occurred
+ * @param[in]    nfds     the number of sockets in fds
+ * @param[in]    timeout  the time to wait in milliseconds, or -1 to wait indefinitely
+ *
+ * @returns    The number of sockets with events, 0 on timeout or -1 on error, with errno set accordingly.
+ */
+int sock_poll(struct pollfd* fds, nfds_t nfds, int timeout);
+
 /**
  * @}
  *
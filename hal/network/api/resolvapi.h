@@ -44,6 +44,16 @@ typedef void (*resolv_event_handler_t)(void* arg, const void* ptr);
 resolv_event_handler_cookie_t resolv_event_handler_add(resolv_event_handler_t handler, void* arg);
 int resolv_event_handler_del(resolv_event_handler_cookie_t cookie);
 
+struct resolv_cache_stats {
+    uint16_t size; /* Size of this structure */
+    uint16_t reserved;
+    uint32_t hits; /* Lookups answered without sending a query, including negative_hits */
+    uint32_t misses; /* Lookups that required sending a query */
+    uint32_t negative_hits; /* Lookups answered with a recent failure to resolve the same name */
+};
+
+int resolv_get_cache_stats(struct resolv_cache_stats* stats, void* reserved);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -20,10 +20,12 @@
 #include "socket_hal_posix.h"
 
 #include "system_error.h"
+#include "timer_hal.h"
 #include "logging.h"
 
 #include "lwiplock.h"
 #include "lwip_util.h"
+#include "dns_cache.h"
 
 #include "lwip/dns.h"
 
@@ -128,8 +130,11 @@ struct Record { // RFC 1035, 4.1.3
 // Maximum size of a UDP message
 const size_t MAX_MESSAGE_SIZE = 512; // RFC 1035, 2.3.4
 
-// Value of the TTL field sent in all response messages
-const uint32_t DEFAULT_TTL = 0; // Do not cache (RFC 1035, 4.1.3)
+// Value of the TTL field sent in all response messages, in seconds. LwIP doesn't report the TTL
+// of the records it resolves, so a short fixed value is used in place of the one suggested
+// by RFC 6147, 5.1.7. This lets the clients cache the records without keeping stale addresses
+// for long
+const uint32_t DEFAULT_TTL = 60;
 
 // Timeout for select() in milliseconds
 const unsigned SOCKET_RECV_TIMEOUT = 1000;
@@ -193,7 +198,7 @@ ssize_t writeRecord(char* data, size_t size, const Record& r) {
     Record rr = {};
     rr.type = lwip_htons(r.type);
     rr.cls = lwip_htons(r.cls);
-    rr.ttl = lwip_htons(r.ttl);
+    rr.ttl = lwip_htonl(r.ttl);
     rr.rdlength = lwip_htons(r.rdlength);
     memcpy(data, &rr, sizeof(Record));
     return sizeof(Record);
@@ -321,6 +326,7 @@ struct Dns64::Query {
     Header h;
     Question q;
     uint16_t type;
+    system_tick_t started; // Time the current lookup was started
 };
 
 int Dns64::init(if_t iface, const ip6_addr_t& prefix, uint16_t port) {
@@ -547,18 +553,28 @@ int Dns64::sendErrorResponse(int error, const char* name, const Query& q, Contex
 }
 
 int Dns64::getHostByName(const char* name, ip_addr_t* addr, Query* q) {
-    const uint8_t addrType = (q->type == Type::A) ? LWIP_DNS_ADDRTYPE_IPV4 : LWIP_DNS_ADDRTYPE_IPV6;
-    LwipTcpIpCoreLock lock; // LwIP's DNS client API is not thread-safe
-    const auto lwipRet = dns_gethostbyname_addrtype(name, addr, Dns64::dnsCallback, q, addrType);
-    lock.unlock();
+    const auto cache = DnsCache::instance();
+    q->started = HAL_Timer_Get_Milli_Seconds();
+    auto lwipRet = cache->lookup(name, addr, Dns64::dnsCallback, q, addrType(q->type));
+    if (lwipRet == ERR_VAL && q->type == Type::AAAA) {
+        // The hostname is known to have no IPv6 address, try getting an IPv4 address
+        q->type = Type::A;
+        lwipRet = cache->lookup(name, addr, Dns64::dnsCallback, q, addrType(q->type));
+    }
     if (lwipRet == ERR_INPROGRESS) {
         return GetHostByNameResult::PENDING;
+    } else if (lwipRet == ERR_VAL) {
+        return SYSTEM_ERROR_NOT_FOUND;
     } else if (lwipRet != ERR_OK) {
         return lwipToSystemError(lwipRet);
     }
     return GetHostByNameResult::DONE;
 }
 
+uint8_t Dns64::addrType(uint16_t type) {
+    return (type == Type::A) ? LWIP_DNS_ADDRTYPE_IPV4 : LWIP_DNS_ADDRTYPE_IPV6;
+}
+
 void Dns64::dnsCallback(const char* name, const ip_addr_t* addr, void* data) {
     DEBUG("dns_found_callback: name: %s, address: %s", name ? name : "NULL", addr ? IPADDR_NTOA(addr) : "NULL");
     std::unique_ptr<Query> q(static_cast<Query*>(data));
@@ -570,6 +586,10 @@ void Dns64::dnsCallback(const char* name, const ip_addr_t* addr, void* data) {
         return;
     }
     int ret = 0;
+    if (!addr) {
+        // Answer repeated queries for this hostname and type without a lookup
+        DnsCache::instance()->lookupFailed(name, addrType(q->type), q->started);
+    }
     if (addr) {
         ret = sendResponse(*addr, name, *q, ctx.get());
     } else if (q->type == Type::AAAA) {
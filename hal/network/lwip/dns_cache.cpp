@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "dns_cache.h"
+
+#include "lwiplock.h"
+#include "timer_hal.h"
+#include "system_error.h"
+
+#include "lwip/sys.h"
+
+#include <memory>
+#include <new>
+
+namespace particle {
+
+namespace net {
+
+namespace {
+
+// A blocking lookup. LwIP may call the callback after resolve() has stopped waiting, in which
+// case the callback frees the lookup. Both check the state with the TCP/IP core lock held.
+struct Lookup {
+    sys_sem_t sem;
+    ip_addr_t addr;
+    system_tick_t started;
+    bool found;
+    bool done;
+    bool abandoned;
+};
+
+} // particle::net::
+
+DnsCache::DnsCache() :
+        hits_(0),
+        misses_(0),
+        negativeHits_(0) {
+}
+
+DnsCache* DnsCache::instance() {
+    static DnsCache cache;
+    return &cache;
+}
+
+int DnsCache::resolve(const char* name, uint8_t addrType, ip_addr_t* addr) {
+    std::unique_ptr<Lookup> lk(new(std::nothrow) Lookup());
+    if (!lk) {
+        return SYSTEM_ERROR_NO_MEMORY;
+    }
+    if (sys_sem_new(&lk->sem, 0) != ERR_OK) {
+        return SYSTEM_ERROR_NO_MEMORY;
+    }
+    lk->started = HAL_Timer_Get_Milli_Seconds();
+    const err_t ret = lookup(name, addr, resolveCallback, lk.get(), addrType);
+    if (ret == ERR_INPROGRESS && sys_arch_sem_wait(&lk->sem, RESOLVE_TIMEOUT) == SYS_ARCH_TIMEOUT) {
+        const LwipTcpIpCoreLock lock;
+        if (!lk->done) {
+            // LwIP calls the callback on both success and failure, it frees the lookup
+            lk->abandoned = true;
+            lk.release();
+            return SYSTEM_ERROR_TIMEOUT;
+        }
+    }
+    sys_sem_free(&lk->sem);
+    if (ret == ERR_OK) {
+        return 0;
+    }
+    if (ret == ERR_VAL) {
+        return SYSTEM_ERROR_NOT_FOUND;
+    }
+    if (ret != ERR_INPROGRESS) {
+        return SYSTEM_ERROR_NETWORK;
+    }
+    if (!lk->found) {
+        return lookupFailed(name, addrType, lk->started) ? SYSTEM_ERROR_NOT_FOUND : SYSTEM_ERROR_TIMEOUT;
+    }
+    ip_addr_copy(*addr, lk->addr);
+    return 0;
+}
+
+err_t DnsCache::lookup(const char* name, ip_addr_t* addr, dns_found_callback callback, void* arg, uint8_t addrType) {
+    const LwipTcpIpCoreLock lock;
+    if (negative_.find(name, addrType, HAL_Timer_Get_Milli_Seconds())) {
+        ++hits_;
+        ++negativeHits_;
+        return ERR_VAL;
+    }
+    const err_t ret = dns_gethostbyname_addrtype(name, addr, callback, arg, addrType);
+    if (ret == ERR_OK) {
+        ++hits_;
+    } else if (ret == ERR_INPROGRESS) {
+        ++misses_;
+    }
+    return ret;
+}
+
+bool DnsCache::lookupFailed(const char* name, uint8_t addrType, system_tick_t started) {
+    const LwipTcpIpCoreLock lock;
+    return negative_.addFailed(name, addrType, started, HAL_Timer_Get_Milli_Seconds());
+}
+
+void DnsCache::clear() {
+    const LwipTcpIpCoreLock lock;
+    negative_.clear();
+}
+
+void DnsCache::getStats(resolv_cache_stats* stats) const {
+    const LwipTcpIpCoreLock lock;
+    stats->hits = hits_;
+    stats->misses = misses_;
+    stats->negative_hits = negativeHits_;
+}
+
+void DnsCache::resolveCallback(const char* name, const ip_addr_t* addr, void* arg) {
+    const auto lk = static_cast<Lookup*>(arg);
+    if (lk->abandoned) {
+        sys_sem_free(&lk->sem);
+        delete lk;
+        return;
+    }
+    if (addr) {
+        ip_addr_copy(lk->addr, *addr);
+        lk->found = true;
+    }
+    lk->done = true;
+    sys_sem_signal(&lk->sem);
+}
+
+} // particle::net
+
+} // particle
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "resolvapi.h"
+#include "system_tick_hal.h"
+#include "dns_negative_cache.h"
+
+#include "lwip/dns.h"
+
+namespace particle {
+
+namespace net {
+
+/**
+ * Front end to LwIP's DNS client that avoids network traffic for repeated lookups.
+ *
+ * Resolved addresses are kept in LwIP's DNS table, which expires them according to the TTL
+ * of their records. LwIP doesn't remember lookups that failed, so this class keeps a bounded
+ * number of those that the server answered for a fixed time, see `DnsNegativeCache`. All lookups
+ * are counted, see `resolv_get_cache_stats()`.
+ */
+class DnsCache {
+public:
+    /**
+     * Maximum time in milliseconds `resolve()` waits for a lookup to complete.
+     */
+    static const system_tick_t RESOLVE_TIMEOUT = 30000;
+
+    /**
+     * Resolves a hostname. This method blocks until the lookup completes or times out.
+     *
+     * @param name Hostname.
+     * @param addrType Address type (LWIP_DNS_ADDRTYPE_*).
+     * @param addr Resolved address.
+     * @return 0 on success, `SYSTEM_ERROR_NOT_FOUND` if the server reported that the hostname
+     *         has no address of the given type, `SYSTEM_ERROR_TIMEOUT` if the lookup didn't
+     *         complete, or another error code.
+     */
+    int resolve(const char* name, uint8_t addrType, ip_addr_t* addr);
+    /**
+     * Starts resolving a hostname. This is a counterpart of `dns_gethostbyname_addrtype()`.
+     *
+     * @return `ERR_OK` if the address is known, `ERR_INPROGRESS` if the callback will be called
+     *         once the lookup completes, `ERR_VAL` if a recent lookup of the hostname failed, or
+     *         another LwIP error code.
+     *
+     * @note If the lookup completes with an error, call `lookupFailed()` from the callback.
+     */
+    err_t lookup(const char* name, ip_addr_t* addr, dns_found_callback callback, void* arg, uint8_t addrType);
+    /**
+     * Remembers that a lookup started at the given time failed, if the failure was an answer
+     * from the server rather than a timeout.
+     *
+     * @return `true` if the hostname is known not to have an address of the given type.
+     */
+    bool lookupFailed(const char* name, uint8_t addrType, system_tick_t started);
+    /**
+     * Forgets all failed lookups.
+     */
+    void clear();
+
+    void getStats(resolv_cache_stats* stats) const;
+
+    static DnsCache* instance();
+
+protected:
+    DnsCache();
+
+private:
+    DnsNegativeCache negative_;
+    uint32_t hits_;
+    uint32_t misses_;
+    uint32_t negativeHits_;
+
+    static void resolveCallback(const char* name, const ip_addr_t* addr, void* arg);
+};
+
+} // particle::net
+
+} // particle
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "dns_negative_cache.h"
+
+#include <cstring>
+#include <new>
+#include <strings.h>
+
+namespace particle {
+
+namespace net {
+
+bool DnsNegativeCache::find(const char* name, uint8_t addrType, system_tick_t now) {
+    return findEntry(name, addrType, now) != nullptr;
+}
+
+void DnsNegativeCache::add(const char* name, uint8_t addrType, system_tick_t now) {
+    auto entry = findEntry(name, addrType, now);
+    if (!entry) {
+        // Reuse a free entry or the one that expires first
+        entry = &entries_[0];
+        for (auto& e: entries_) {
+            if (!e.name) {
+                entry = &e;
+                break;
+            }
+            if ((int32_t)(e.expires - entry->expires) < 0) {
+                entry = &e;
+            }
+        }
+        const size_t size = strlen(name) + 1;
+        entry->name.reset(new(std::nothrow) char[size]);
+        if (!entry->name) {
+            return;
+        }
+        memcpy(entry->name.get(), name, size);
+        entry->addrType = addrType;
+    }
+    entry->expires = now + TTL;
+}
+
+bool DnsNegativeCache::addFailed(const char* name, uint8_t addrType, system_tick_t started, system_tick_t now) {
+    if (now - started >= MIN_QUERY_TIMEOUT) {
+        // The query may have timed out, which says nothing about the hostname
+        return false;
+    }
+    add(name, addrType, now);
+    return true;
+}
+
+void DnsNegativeCache::clear() {
+    for (auto& e: entries_) {
+        e.name.reset();
+    }
+}
+
+DnsNegativeCache::Entry* DnsNegativeCache::findEntry(const char* name, uint8_t addrType, system_tick_t now) {
+    for (auto& e: entries_) {
+        if (!e.name) {
+            continue;
+        }
+        if ((int32_t)(e.expires - now) <= 0) {
+            e.name.reset();
+            continue;
+        }
+        // Hostnames are case-insensitive (RFC 4343)
+        if (e.addrType == addrType && strcasecmp(e.name.get(), name) == 0) {
+            return &e;
+        }
+    }
+    return nullptr;
+}
+
+} // particle::net
+
+} // particle
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "system_tick_hal.h"
+
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+namespace particle {
+
+namespace net {
+
+/**
+ * Bounded list of hostnames that couldn't be resolved.
+ *
+ * The list doesn't synchronize access, see `DnsCache`.
+ */
+class DnsNegativeCache {
+public:
+    /**
+     * Maximum number of failed lookups that are remembered.
+     */
+    static const size_t MAX_ENTRIES = 8;
+    /**
+     * Time in milliseconds for which a failed lookup is remembered.
+     *
+     * LwIP doesn't pass the SOA record of a negative response to its clients, so a fixed value
+     * is used instead of its TTL (RFC 2308, 5).
+     */
+    static const system_tick_t TTL = 30000;
+    /**
+     * Shortest time in milliseconds after which LwIP gives up on an unanswered query.
+     *
+     * LwIP reports a negative answer and a query that timed out in the same way. A query only
+     * times out after it has been retransmitted several times (DNS_MAX_RETRIES), so a failure
+     * that is reported sooner is an answer from the server.
+     */
+    static const system_tick_t MIN_QUERY_TIMEOUT = 5000;
+
+    /**
+     * Returns `true` if a recent lookup of the hostname failed.
+     */
+    bool find(const char* name, uint8_t addrType, system_tick_t now);
+    /**
+     * Remembers that a hostname doesn't exist or has no address of the given type.
+     */
+    void add(const char* name, uint8_t addrType, system_tick_t now);
+    /**
+     * Remembers a failed lookup that was started at the given time, unless it may have
+     * timed out rather than been answered by the server.
+     *
+     * @return `true` if the failure was an answer from the server.
+     */
+    bool addFailed(const char* name, uint8_t addrType, system_tick_t started, system_tick_t now);
+    /**
+     * Forgets all failed lookups.
+     */
+    void clear();
+
+private:
+    struct Entry {
+        std::unique_ptr<char[]> name;
+        system_tick_t expires;
+        uint8_t addrType;
+    };
+
+    Entry entries_[MAX_ENTRIES];
+
+    Entry* findEntry(const char* name, uint8_t addrType, system_tick_t now);
+};
+
+} // particle::net
+
+} // particle
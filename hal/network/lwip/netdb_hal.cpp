@@ -26,6 +26,49 @@
 #include <lwip/sockets.h>
 #include <errno.h>
 #include <algorithm>
+#include "dns_cache.h"
+#include "system_error.h"
+
+using namespace particle::net;
+
+namespace {
+
+/* Resolves the hostname through the DNS cache and lets LwIP build the result from the address */
+int getaddrinfo_family(const char* hostname, const char* servname,
+                       const struct addrinfo* hints, int family, struct addrinfo** res) {
+    struct addrinfo h = {};
+    if (hints) {
+        h = *hints;
+    }
+    h.ai_family = family;
+
+    uint8_t addrType = LWIP_DNS_ADDRTYPE_IPV4;
+    if (family == AF_INET6) {
+        addrType = (h.ai_flags & AI_V4MAPPED) ? LWIP_DNS_ADDRTYPE_IPV6_IPV4 : LWIP_DNS_ADDRTYPE_IPV6;
+    } else if (family != AF_INET) {
+        return EAI_FAMILY;
+    }
+
+    ip_addr_t addr = {};
+    const int r = DnsCache::instance()->resolve(hostname, addrType, &addr);
+    if (r == SYSTEM_ERROR_NOT_FOUND) {
+        return EAI_NONAME;
+    } else if (r == SYSTEM_ERROR_NO_MEMORY) {
+        return EAI_MEMORY;
+    } else if (r < 0) {
+        return EAI_FAIL;
+    }
+
+    /* NOTE: ai_canonname of the result holds the numeric address rather than the hostname */
+    char str[IPADDR_STRLEN_MAX] = {};
+    if (ipaddr_ntoa_r(&addr, str, sizeof(str)) == nullptr) {
+        return EAI_FAIL;
+    }
+    h.ai_flags |= AI_NUMERICHOST;
+    return lwip_getaddrinfo(str, servname, &h, res);
+}
+
+} /* anonymous */
 
 struct hostent* netdb_gethostbyname(const char *name) {
     return lwip_gethostbyname(name);
@@ -42,18 +85,27 @@ void netdb_freeaddrinfo(struct addrinfo* ai) {
 
 int netdb_getaddrinfo(const char* hostname, const char* servname,
                       const struct addrinfo* hints, struct addrinfo** res) {
-    /* Change the behavior when AF_UNSPEC is used */
-    if (hints && hints->ai_family == AF_UNSPEC) {
-        struct addrinfo h = *hints;
+    ip_addr_t addr = {};
+    if (hostname == nullptr || (hints && (hints->ai_flags & AI_NUMERICHOST)) || ipaddr_aton(hostname, &addr)) {
+        return lwip_getaddrinfo(hostname, servname, hints, res);
+    }
 
+    if (res == nullptr) {
+        return EAI_FAIL;
+    }
+    *res = nullptr;
+
+    /* Change the behavior when AF_UNSPEC is used */
+    if (hints == nullptr || hints->ai_family == AF_UNSPEC) {
         /* First perform a lookup with AF_INET6 */
-        h.ai_family = AF_INET6;
-        int rinet6 = lwip_getaddrinfo(hostname, servname, &h, res);
+        int rinet6 = getaddrinfo_family(hostname, servname, hints, AF_INET6, res);
 
-        /* Next perform a lookup with AF_INET */
-        h.ai_family = AF_INET;
-        /* FIXME: expects that there is either 1 or 0 results from the previous call */
-        int rinet = lwip_getaddrinfo(hostname, servname, &h, rinet6 == 0 && *res ? &((*res)->ai_next) : res);
+        /* Next perform a lookup with AF_INET, appending to the results of the previous one */
+        struct addrinfo** tail = res;
+        while (*tail) {
+            tail = &((*tail)->ai_next);
+        }
+        int rinet = getaddrinfo_family(hostname, servname, hints, AF_INET, tail);
 
         if (rinet6 == 0 || rinet == 0) {
             return 0;
@@ -61,7 +113,7 @@ int netdb_getaddrinfo(const char* hostname, const char* servname,
 
         return std::max(rinet, rinet6);
     }
-    return lwip_getaddrinfo(hostname, servname, hints, res);
+    return getaddrinfo_family(hostname, servname, hints, hints->ai_family, res);
 }
 
 int netdb_getnameinfo(const struct sockaddr* sa, socklen_t salen, char* host,
@@ -18,6 +18,7 @@
 #include "resolvapi.h"
 #include "lwiplock.h"
 #include "ipsockaddr.h"
+#include "dns_cache.h"
 #include <lwip/dns.h>
 #include "logging.h"
 
@@ -188,8 +189,20 @@ int resolv_event_handler_del(resolv_event_handler_cookie_t cookie) {
     return -1;
 }
 
+int resolv_get_cache_stats(struct resolv_cache_stats* stats, void* reserved) {
+    if (!stats || stats->size < sizeof(resolv_cache_stats)) {
+        return -1;
+    }
+
+    DnsCache::instance()->getStats(stats);
+
+    return 0;
+}
+
 void dns_list_change_callback_handler(u8_t numdns, const ip_addr_t *dnsserver) {
     LOG(INFO, "DNS server list changed");
+    /* Lookups that failed with the previous servers may succeed with the new ones */
+    DnsCache::instance()->clear();
     for (EventHandlerList* h = s_eventHandlerList; h != nullptr; h = h->next) {
         if (h->handler) {
             /* FIXME */
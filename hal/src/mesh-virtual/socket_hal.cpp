@@ -82,6 +82,37 @@ ssize_t sock_sendto(int s, const void* dataptr, size_t size, int flags,
   return lwip_sendto(s, dataptr, size, flags, to, tolen);
 }
 
+int sock_recvmmsg(int s, struct sock_mmsghdr* msgvec, unsigned int vlen, int flags) {
+  unsigned int count = 0;
+  for (; count < vlen; count++) {
+    const ssize_t ret = lwip_recvmsg(s, &msgvec[count].msg_hdr, flags);
+    if (ret < 0) {
+      /* The error is reported by the next call if some messages have been received */
+      return count > 0 ? (int)count : -1;
+    }
+    msgvec[count].msg_len = ret;
+    /* Don't wait for the remaining messages */
+    flags |= MSG_DONTWAIT;
+  }
+  return count;
+}
+
+int sock_sendmmsg(int s, struct sock_mmsghdr* msgvec, unsigned int vlen, int flags) {
+  unsigned int count = 0;
+  for (; count < vlen; count++) {
+    const ssize_t ret = lwip_sendmsg(s, &msgvec[count].msg_hdr, flags);
+    if (ret < 0) {
+      return count > 0 ? (int)count : -1;
+    }
+    msgvec[count].msg_len = ret;
+  }
+  return count;
+}
+
 int sock_socket(int domain, int type, int protocol) {
   return lwip_socket(domain, type, protocol);
 }
+
+int sock_poll(struct pollfd* fds, nfds_t nfds, int timeout) {
+  return lwip_poll(fds, nfds, timeout);
+}
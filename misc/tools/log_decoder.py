@@ -0,0 +1,222 @@
+#!/usr/bin/env python3
+#
+# Decodes logging output generated by spark::BinaryStreamLogHandler.
+#
+# Format strings, category names and other strings referenced by the frames are read from the
+# ELF files of the firmware modules that generated the output. The decoded messages are printed
+# in the format used by spark::StreamLogHandler.
+#
+# Usage: log_decoder.py [-i input] firmware.elf [firmware.elf ...]
+#
+# The input defaults to stdin and can be a file or a serial device, e.g.:
+#   stty -F /dev/ttyACM0 raw && log_decoder.py -i /dev/ttyACM0 system-part1.elf user-part.elf
+
+import argparse
+import re
+import struct
+import sys
+
+FRAME_MAGIC = 0xb7
+HEADER_SIZE = 5
+
+FRAME_FORMAT = 1
+FRAME_MESSAGE = 2
+FRAME_WRITE = 3
+
+FLAG_FILE = 0x01
+FLAG_LINE = 0x02
+FLAG_FUNCTION = 0x04
+FLAG_CODE = 0x10
+FLAG_DETAILS = 0x20
+FLAG_TRUNCATED = 0x80
+
+LEVEL_NAMES = ["TRACE", "TRACE", "TRACE", "INFO", "WARN", "ERROR", "PANIC"]
+
+CONVERSION_RE = re.compile(r"%([-+ #0']*)(\*|\d+)?(?:\.(\*|\d*))?(hh|h|ll|l|j|z|t|L|q)?([diuoxXcfFeEgGaAspn%])")
+
+
+class ElfFile:
+    """Reads strings from the allocated sections of an ELF file."""
+
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.data = f.read()
+        if self.data[:4] != b"\x7fELF":
+            raise ValueError("%s is not an ELF file" % path)
+        self.is64 = self.data[4] == 2
+        self.endian = "<" if self.data[5] == 1 else ">"
+        if self.is64:
+            shoff, = struct.unpack_from(self.endian + "Q", self.data, 0x28)
+            shentsize, shnum = struct.unpack_from(self.endian + "HH", self.data, 0x3a)
+            shdr = "IIQQQQIIQQ"
+        else:
+            shoff, = struct.unpack_from(self.endian + "I", self.data, 0x20)
+            shentsize, shnum = struct.unpack_from(self.endian + "HH", self.data, 0x2e)
+            shdr = "IIIIIIIIII"
+        self.sections = []
+        for i in range(shnum):
+            fields = struct.unpack_from(self.endian + shdr, self.data, shoff + i * shentsize)
+            sh_type, addr, offset, size = fields[1], fields[3], fields[4], fields[5]
+            if addr and sh_type != 8: # SHT_NOBITS
+                self.sections.append((addr, offset, size))
+
+    def string(self, addr):
+        for start, offset, size in self.sections:
+            if start <= addr < start + size:
+                pos = offset + addr - start
+                end = self.data.find(b"\0", pos, offset + size)
+                if end < 0:
+                    end = offset + size
+                return self.data[pos:end].decode("utf-8", "replace")
+        return None
+
+
+class Decoder:
+    def __init__(self, elfs):
+        self.elfs = elfs
+        # Type sizes of the target platform
+        self.ptr = "Q" if elfs and elfs[0].is64 else "I"
+        self.long = self.ptr # LP64 or ILP32
+
+    def string_at(self, addr):
+        if not addr:
+            return None
+        for elf in self.elfs:
+            s = elf.string(addr)
+            if s is not None:
+                return s
+        return "<0x%x>" % addr
+
+    def decode(self, type, level, payload):
+        if type == FRAME_WRITE:
+            return payload.decode("utf-8", "replace")
+        r = Reader(payload)
+        time = r.value("I")
+        fmt = self.string_at(r.value(self.ptr)) if type == FRAME_FORMAT else None
+        category = self.string_at(r.value(self.ptr))
+        flags = r.value("B")
+        file = self.string_at(r.value(self.ptr)) if flags & FLAG_FILE else None
+        line = r.value("i") if flags & FLAG_LINE else None
+        function = self.string_at(r.value(self.ptr)) if flags & FLAG_FUNCTION else None
+        code = r.value("i") if flags & FLAG_CODE else None
+        details = r.string() if flags & FLAG_DETAILS else None
+        if type == FRAME_FORMAT:
+            msg = self.format(fmt, r)
+        else:
+            msg = r.rest().decode("utf-8", "replace")
+        if flags & FLAG_TRUNCATED:
+            msg += "~"
+        out = "%010u " % time
+        if category:
+            out += "[%s] " % category
+        if file:
+            out += file.rsplit("/", 1)[-1]
+            if line is not None:
+                out += ":%d" % line
+            out += ", " if function else ": "
+        if function:
+            # Strip argument and return types
+            name = function.split("(", 1)[0].rsplit(" ", 1)[-1]
+            out += "%s(): " % name
+        out += "%s: %s" % (LEVEL_NAMES[max(0, min(level // 10, len(LEVEL_NAMES) - 1))], msg)
+        if code is not None or details is not None:
+            attrs = []
+            if code is not None:
+                attrs.append("code = %d" % code)
+            if details is not None:
+                attrs.append("details = %s" % details)
+            out += " [%s]" % ", ".join(attrs)
+        return out + "\r\n"
+
+    def format(self, fmt, r):
+        def convert(m):
+            flags, width, precision, length, conv = m.groups()
+            if conv == "%":
+                return "%"
+            if width == "*":
+                width = str(r.value("i"))
+            if precision == "*":
+                val = r.value("i")
+                precision = str(val) if val >= 0 else None  # A negative precision is taken as if it were omitted
+            spec = "%" + flags.replace("'", "") + (width or "") + ("." + precision if precision is not None else "")
+            if conv in "diuoxXc":
+                size = {"l": self.long, "ll": "Q", "q": "Q", "j": "Q", "z": self.ptr, "t": self.ptr}.get(length, "I")
+                val = r.value(size.lower() if conv in "di" else size)
+                if conv == "c":
+                    return (spec + "c") % chr(val & 0xff)
+                return (spec + ("d" if conv in "iu" else conv)) % val
+            if conv in "fFeEgG":
+                return (spec + conv) % r.value("d")
+            if conv in "aA":
+                s = float.hex(r.value("d"))
+                return s.upper() if conv == "A" else s
+            if conv == "s":
+                return (spec + "s") % r.string()
+            if conv == "p":
+                return "0x%x" % r.value(self.ptr)
+            return ""
+        try:
+            return CONVERSION_RE.sub(convert, fmt)
+        except (struct.error, IndexError):
+            return fmt # Frame is truncated
+
+
+class Reader:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def value(self, fmt):
+        val, = struct.unpack_from("<" + fmt, self.data, self.pos)
+        self.pos += struct.calcsize(fmt)
+        return val
+
+    def string(self):
+        n = self.value("B")
+        s = self.data[self.pos:self.pos + n].decode("utf-8", "replace")
+        self.pos += n
+        return s
+
+    def rest(self):
+        return self.data[self.pos:]
+
+
+def frames(stream):
+    buf = b""
+    while True:
+        chunk = stream.read1(4096) if hasattr(stream, "read1") else stream.read(4096)
+        if not chunk:
+            return
+        buf += chunk
+        while True:
+            start = buf.find(bytes([FRAME_MAGIC]))
+            if start < 0:
+                buf = b""
+                break
+            buf = buf[start:] # Skip garbage
+            if len(buf) < HEADER_SIZE:
+                break
+            type, level, size = struct.unpack_from("<BBH", buf, 1)
+            if type not in (FRAME_FORMAT, FRAME_MESSAGE, FRAME_WRITE):
+                buf = buf[1:]
+                continue
+            if len(buf) < HEADER_SIZE + size:
+                break
+            yield type, level, buf[HEADER_SIZE:HEADER_SIZE + size]
+            buf = buf[HEADER_SIZE + size:]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decodes binary logging output.")
+    parser.add_argument("-i", "--input", help="input file (default: stdin)")
+    parser.add_argument("elf", nargs="+", help="firmware ELF files")
+    args = parser.parse_args()
+    decoder = Decoder([ElfFile(path) for path in args.elf])
+    stream = open(args.input, "rb", buffering=0) if args.input else sys.stdin.buffer
+    for type, level, payload in frames(stream):
+        sys.stdout.write(decoder.decode(type, level, payload))
+        sys.stdout.flush()
+
+
+if __name__ == "__main__":
+    main()
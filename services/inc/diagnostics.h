@@ -52,6 +52,11 @@
 #define DIAG_NAME_CLOUD_REPEATED_MESSAGES "coap:resend"
 #define DIAG_NAME_CLOUD_UNACKNOWLEDGED_MESSAGES "coap:unack"
 #define DIAG_NAME_CLOUD_RATE_LIMITED_EVENTS "pub:limit"
+#define DIAG_NAME_CLOUD_QUEUED_EVENTS "pub:queued"
+#define DIAG_NAME_CLOUD_DROPPED_QUEUED_EVENTS "pub:qdrop"
+#define DIAG_NAME_CLOUD_SENT_QUEUED_EVENTS "pub:qsent"
+#define DIAG_NAME_CLOUD_THROTTLED_EVENTS "pub:thrq"
+#define DIAG_NAME_CLOUD_DROPPED_THROTTLED_EVENTS "pub:thrdrop"
 #define DIAG_NAME_SYSTEM_TOTAL_RAM "sys:tram"
 #define DIAG_NAME_SYSTEM_USED_RAM "sys:uram"
 
@@ -93,6 +98,11 @@ typedef enum diag_id {
     DIAG_ID_CLOUD_REPEATED_MESSAGES = 21, // coap:resend
     DIAG_ID_CLOUD_UNACKNOWLEDGED_MESSAGES = 22, // coap:unack
     DIAG_ID_CLOUD_RATE_LIMITED_EVENTS = 20, // pub:throttle
+    DIAG_ID_CLOUD_QUEUED_EVENTS = 38, // pub:queued
+    DIAG_ID_CLOUD_DROPPED_QUEUED_EVENTS = 39, // pub:qdrop
+    DIAG_ID_CLOUD_SENT_QUEUED_EVENTS = 40, // pub:qsent
+    DIAG_ID_CLOUD_THROTTLED_EVENTS = 41, // pub:thrq
+    DIAG_ID_CLOUD_DROPPED_THROTTLED_EVENTS = 42, // pub:thrdrop
     DIAG_ID_SYSTEM_TOTAL_RAM = 25, // sys:tram
     DIAG_ID_SYSTEM_USED_RAM = 26, // sys:uram
     DIAG_ID_USER = 32768 // Base value for application-specific source IDs
@@ -193,6 +193,130 @@ public:
     	return lfs_remove(lfs(), path_);
     }
 
+    /**
+     * Determine the number of active entries in the queue.
+     *
+     * @param activeBytes	When not null, receives the number of bytes occupied by active entries, including their headers.
+     * @return the number of active entries, or <0 for an error condition.
+     */
+    int count(size_t* activeBytes = nullptr) {
+        FsLock lk(fs_);
+        _open();
+        size_t bytes = 0;
+        int count = 0;
+        int ret = lfs_file_open(lfs(), &read_file_, path_, LFS_O_RDONLY);
+        if (ret==LFS_ERR_NOENT) {
+            ret = 0;
+        } else if (!ret) {
+            QueueEntry entry;
+            while ((ret = lfs_file_read(lfs(), &read_file_, &entry, sizeof(entry)))==sizeof(entry)) {
+                if (entry.flags & QueueEntry::ACTIVE) {
+                    count++;
+                    bytes += entry.size;
+                }
+                ret = lfs_file_seek(lfs(), &read_file_, entry.size-sizeof(entry), LFS_SEEK_CUR);
+                if (ret<0) {
+                    break;
+                }
+            }
+            if (ret>0) {
+                ret = LFS_ERR_IO;    // truncated header
+            }
+            ret = preserve_error(lfs_file_close(lfs(), &read_file_), ret);
+        }
+        if (activeBytes) {
+            *activeBytes = bytes;
+        }
+        return ret<0 ? ret : count;
+    }
+
+    /**
+     * Retrieve the size of the queue file in bytes, including entries that have been removed
+     * but not yet reclaimed.
+     */
+    int fileSize() {
+        FsLock lk(fs_);
+        struct lfs_info info = {};
+        int ret = lfs_stat(lfs(), path_, &info);
+        if (ret==LFS_ERR_NOENT) {
+            return 0;
+        }
+        return ret<0 ? ret : int(info.size);
+    }
+
+    /**
+     * Reclaim the space used by entries that have been removed from the front of the queue.
+     * The active entries are copied one at a time to a temporary file which then replaces the queue file,
+     * so that only a single file is open at any time.
+     *
+     * @param buffer	Scratch buffer that is large enough to hold the largest entry in the queue.
+     * @param length	The length of the buffer.
+     */
+    int compact(void* buffer, uint16_t length) {
+        FsLock lk(fs_);
+        char tmpPath[LFS_NAME_MAX + 1];
+        snprintf(tmpPath, sizeof(tmpPath), "%s~", path_);
+        lfs_remove(lfs(), tmpPath);
+
+        lfs_soff_t offset = 0;
+        int copied = 0;
+        int ret = 0;
+        for (;;) {
+            ret = lfs_file_open(lfs(), &read_file_, path_, LFS_O_RDONLY);
+            if (ret==LFS_ERR_NOENT && !offset) {
+                return 0;	// nothing to compact
+            } else if (ret) {
+                break;
+            }
+            QueueEntry entry;
+            int remaining = 0;
+            ret = lfs_file_seek(lfs(), &read_file_, offset, LFS_SEEK_SET);
+            if (ret>=0) {
+                ret = lfs_file_read(lfs(), &read_file_, &entry, sizeof(entry));
+                if (ret==sizeof(entry)) {
+                    ret = 0;
+                    remaining = entry.size-sizeof(entry);
+                    if (!(entry.flags & QueueEntry::ACTIVE)) {
+                        remaining = 0;
+                    } else if (remaining>length) {
+                        ret = LFS_ERR_INVAL;
+                    } else if (lfs_file_read(lfs(), &read_file_, buffer, remaining)!=remaining) {
+                        ret = LFS_ERR_IO;
+                    }
+                } else if (ret>0) {
+                    ret = LFS_ERR_IO;	// truncated header
+                } else {
+                    ret = preserve_error(ret, 1);	// end of file
+                }
+            }
+            ret = preserve_error(lfs_file_close(lfs(), &read_file_), ret);
+            if (ret) {
+                break;
+            }
+            offset += entry.size;
+            if (entry.flags & QueueEntry::ACTIVE) {
+                ret = lfs_file_open(lfs(), &write_file_, tmpPath, LFS_O_WRONLY | LFS_O_APPEND | LFS_O_CREAT);
+                if (ret>=0) {
+                    ret = file_write(&write_file_, &entry, sizeof(entry));
+                    ret = preserve_error(ret, file_write(&write_file_, buffer, remaining));
+                    ret = preserve_error(lfs_file_close(lfs(), &write_file_), ret);
+                }
+                if (ret<0) {
+                    break;
+                }
+                copied++;
+            }
+        }
+        if (ret<0) {
+            LOG(ERROR, "Unable to compact file queue %s, error %d", path_, ret);
+            lfs_remove(lfs(), tmpPath);
+            return ret;
+        }
+        ret = copied ? lfs_rename(lfs(), tmpPath, path_) : clear();
+        LOG(INFO, "Compacted file queue %s, %d entries retained, result %d", path_, copied, ret);
+        return ret;
+    }
+
 private:
 
     int file_write(lfs_file* file, void* data, uint16_t size) {
@@ -95,6 +95,11 @@
     LOG_DUMP_C(level, category, data, size)
     LOG_ENABLED_C(level, category)
 
+    Category names are expected to be string literals, or strings that are never changed or freed:
+    the log manager caches the levels of categories by the address of their names, and the binary
+    log handler refers to the names by their address. A name generated at run time must not be
+    stored at the address of another name that was used for logging.
+
     Every logging macro has its debugging counterpart which is compiled only in debug builds:
 
         LOG(INFO, "User name: %s", user);
@@ -193,6 +198,15 @@ typedef void (*log_write_callback_type)(const char *data, size_t size, int level
 // Callback invoked to check whether logging is enabled for particular level and category (used by log_enabled())
 typedef int (*log_enabled_callback_type)(int level, const char *category, void *reserved);
 
+// Callback receiving the format string and arguments of a message before it's formatted (used by log_message()).
+// Returns 0 if the message doesn't need to be formatted and passed to the message callback
+typedef int (*log_format_callback_type)(const char *fmt, va_list args, int level, const char *category,
+        const LogAttributes *attr, void *reserved);
+
+// Callback invoked to write out buffered output synchronously (used by log_flush()). It may be called with
+// interrupts disabled
+typedef void (*log_flush_callback_type)(void *reserved);
+
 // Generates log message
 void log_message(int level, const char *category, LogAttributes *attr, void *reserved, const char *fmt, ...);
 
@@ -222,6 +236,15 @@ const char* log_level_name(int level, void *reserved);
 void log_set_callbacks(log_message_callback_type log_msg, log_write_callback_type log_write,
         log_enabled_callback_type log_enabled, void *reserved);
 
+// Sets callback for messages with deferred formatting
+void log_set_format_callback(log_format_callback_type log_format, void *reserved);
+
+// Sets callback for writing out buffered output
+void log_set_flush_callback(log_flush_callback_type log_flush, void *reserved);
+
+// Writes out buffered output, if any. This function is called by the system before it enters the panic mode
+void log_flush(void *reserved);
+
 extern void HAL_Delay_Microseconds(uint32_t delay);
 
 #ifdef __cplusplus
@@ -19,6 +19,9 @@
 #define SERVICES_RINGBUFFER_H
 
 #include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <algorithm>
 #include "system_error.h"
 #include "check.h"
 
@@ -361,6 +364,440 @@ inline void RingBuffer<T>::updateCurSize() {
     }
 }
 
+namespace detail {
+
+/**
+ * Common part of the lock-free ring buffers.
+ *
+ * Positions are kept in the range [0, 2 * size), which allows to distinguish a full buffer from
+ * an empty one without a separate flag. The consumer side is implemented here; `DerivedT::readHead()`
+ * returns the position up to which the elements can be consumed.
+ */
+template <typename T, typename DerivedT>
+class AtomicRingBufferBase {
+public:
+    size_t size() const;
+
+    bool empty() const;
+    bool full() const;
+
+    size_t space() const;
+    size_t data() const;
+
+    // Consumer
+    ssize_t get(T* v);
+    ssize_t get(T* v, size_t size);
+    ssize_t peek(T* v, size_t size) const;
+
+    size_t consumable() const;
+    T* consume(size_t size);
+    ssize_t consumeCommit(size_t size);
+
+protected:
+    T* buffer_ = nullptr;
+    size_t size_ = 0;
+    std::atomic<size_t> tail_;
+
+    AtomicRingBufferBase();
+
+    void init(T* buffer, size_t size);
+
+    size_t index(size_t pos) const {
+        return pos < size_ ? pos : pos - size_;
+    }
+
+    size_t advance(size_t pos, size_t n) const {
+        pos += n;
+        return pos < 2 * size_ ? pos : pos - 2 * size_;
+    }
+
+    size_t distance(size_t from, size_t to) const {
+        return to >= from ? to - from : to + 2 * size_ - from;
+    }
+
+    // Returns the number of elements that can be written if the head is at the specified position
+    size_t spaceAt(size_t head) const {
+        return size_ - distance(tail_.load(std::memory_order_acquire), head);
+    }
+
+    // Copies the elements in at most two contiguous blocks
+    void copyIn(size_t pos, const T* v, size_t size) {
+        const size_t i = index(pos);
+        const size_t n = std::min(size, size_ - i);
+        std::copy(v, v + n, buffer_ + i);
+        std::copy(v + n, v + size, buffer_);
+    }
+
+    void copyOut(size_t pos, T* v, size_t size) const {
+        const size_t i = index(pos);
+        const size_t n = std::min(size, size_ - i);
+        std::copy(buffer_ + i, buffer_ + i + n, v);
+        std::copy(buffer_, buffer_ + size - n, v + n);
+    }
+
+private:
+    size_t head() const {
+        return static_cast<const DerivedT*>(this)->readHead();
+    }
+};
+
+} // detail
+
+/**
+ * Lock-free single-producer single-consumer ring buffer.
+ *
+ * The producer and the consumer can run in different threads or interrupt handlers without any
+ * locking. The producer publishes new elements with release semantics and the consumer frees
+ * the space with release semantics, so the elements themselves don't need to be atomic.
+ *
+ * `acquire()` and `consume()` provide direct access to contiguous spans of the buffer, which
+ * can be used for DMA transfers.
+ */
+template <typename T>
+class SpscRingBuffer: public detail::AtomicRingBufferBase<T, SpscRingBuffer<T>> {
+public:
+    SpscRingBuffer();
+    SpscRingBuffer(T* buffer, size_t size);
+
+    // These methods are not thread-safe
+    void init(T* buffer, size_t size);
+    void reset();
+
+    // Producer
+    ssize_t put(const T& v);
+    ssize_t put(const T* v, size_t size);
+
+    size_t acquirable() const;
+    T* acquire(size_t size);
+    ssize_t acquireCommit(size_t size);
+
+private:
+    typedef detail::AtomicRingBufferBase<T, SpscRingBuffer<T>> Base;
+
+    std::atomic<size_t> head_;
+
+    size_t readHead() const {
+        return head_.load(std::memory_order_acquire);
+    }
+
+    friend Base;
+};
+
+/**
+ * Lock-free multiple-producer single-consumer ring buffer.
+ *
+ * Producers reserve space by updating a shared state word with a compare-and-swap, so they never
+ * wait for each other and can run in interrupt handlers. The state word contains both the
+ * reserved head position and the number of writes in progress. Elements become visible to the
+ * consumer once there are no writes in progress.
+ *
+ * A span obtained with `acquire()` must be committed in full before the producer acquires
+ * another one: its space is already reserved and may be followed by the reservations of other
+ * producers, so it can't be shrunk. `acquireCommit()` therefore takes the acquired size and
+ * rejects any other size. `data()`, `empty()` and the methods that read elements can only be
+ * called by the consumer.
+ */
+template <typename T>
+class MpscRingBuffer: public detail::AtomicRingBufferBase<T, MpscRingBuffer<T>> {
+public:
+    /**
+     * Maximum number of concurrent writes.
+     */
+    static const size_t MAX_WRITERS = 0xff;
+    /**
+     * Maximum buffer size. Head positions range up to twice the size and share the state word
+     * with the number of writes in progress.
+     */
+    static const size_t MAX_SIZE = (SIZE_MAX / (MAX_WRITERS + 1) + 1) / 2;
+
+    MpscRingBuffer();
+    MpscRingBuffer(T* buffer, size_t size);
+
+    // These methods are not thread-safe
+    int init(T* buffer, size_t size);
+    void reset();
+
+    // Producer
+    size_t space() const;
+    bool full() const;
+
+    ssize_t put(const T& v);
+    ssize_t put(const T* v, size_t size);
+
+    T* acquire(size_t size);
+    ssize_t acquireCommit(size_t size, size_t acquired);
+
+private:
+    typedef detail::AtomicRingBufferBase<T, MpscRingBuffer<T>> Base;
+
+    static const unsigned WRITERS_BITS = 8;
+
+    std::atomic<size_t> state_; // Reserved head position and the number of writes in progress
+    mutable size_t head_; // Last head position with no writes in progress (consumer only)
+
+    ssize_t reserve(size_t size, bool contiguous, size_t* pos);
+    void release();
+
+    size_t readHead() const {
+        const size_t state = state_.load(std::memory_order_acquire);
+        if ((state & MAX_WRITERS) == 0) {
+            head_ = state >> WRITERS_BITS;
+        }
+        return head_;
+    }
+
+    friend Base;
+};
+
+// detail::AtomicRingBufferBase
+template <typename T, typename DerivedT>
+inline detail::AtomicRingBufferBase<T, DerivedT>::AtomicRingBufferBase()
+        : tail_(0) {
+}
+
+template <typename T, typename DerivedT>
+inline void detail::AtomicRingBufferBase<T, DerivedT>::init(T* buffer, size_t size) {
+    buffer_ = buffer;
+    size_ = size;
+    tail_.store(0, std::memory_order_relaxed);
+}
+
+template <typename T, typename DerivedT>
+inline size_t detail::AtomicRingBufferBase<T, DerivedT>::size() const {
+    return size_;
+}
+
+template <typename T, typename DerivedT>
+inline bool detail::AtomicRingBufferBase<T, DerivedT>::empty() const {
+    return data() == 0;
+}
+
+template <typename T, typename DerivedT>
+inline bool detail::AtomicRingBufferBase<T, DerivedT>::full() const {
+    return space() == 0;
+}
+
+template <typename T, typename DerivedT>
+inline size_t detail::AtomicRingBufferBase<T, DerivedT>::space() const {
+    return size_ - data();
+}
+
+template <typename T, typename DerivedT>
+inline size_t detail::AtomicRingBufferBase<T, DerivedT>::data() const {
+    return distance(tail_.load(std::memory_order_relaxed), head());
+}
+
+template <typename T, typename DerivedT>
+inline ssize_t detail::AtomicRingBufferBase<T, DerivedT>::get(T* v) {
+    return get(v, 1);
+}
+
+template <typename T, typename DerivedT>
+inline ssize_t detail::AtomicRingBufferBase<T, DerivedT>::get(T* v, size_t size) {
+    if (size == 0) {
+        return 0;
+    }
+    CHECK_TRUE(data() >= size, SYSTEM_ERROR_TOO_LARGE);
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (v) {
+        copyOut(tail, v, size);
+    }
+    tail_.store(advance(tail, size), std::memory_order_release);
+    return size;
+}
+
+template <typename T, typename DerivedT>
+inline ssize_t detail::AtomicRingBufferBase<T, DerivedT>::peek(T* v, size_t size) const {
+    if (size == 0) {
+        return 0;
+    }
+    CHECK_TRUE(data() >= size, SYSTEM_ERROR_TOO_LARGE);
+    CHECK_TRUE(v, SYSTEM_ERROR_INVALID_ARGUMENT);
+    copyOut(tail_.load(std::memory_order_relaxed), v, size);
+    return size;
+}
+
+template <typename T, typename DerivedT>
+inline size_t detail::AtomicRingBufferBase<T, DerivedT>::consumable() const {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    return std::min(distance(tail, head()), size_ - index(tail));
+}
+
+template <typename T, typename DerivedT>
+inline T* detail::AtomicRingBufferBase<T, DerivedT>::consume(size_t size) {
+    if (consumable() < size) {
+        return nullptr;
+    }
+    return buffer_ + index(tail_.load(std::memory_order_relaxed));
+}
+
+template <typename T, typename DerivedT>
+inline ssize_t detail::AtomicRingBufferBase<T, DerivedT>::consumeCommit(size_t size) {
+    CHECK_TRUE(consumable() >= size, SYSTEM_ERROR_TOO_LARGE);
+    tail_.store(advance(tail_.load(std::memory_order_relaxed), size), std::memory_order_release);
+    return size;
+}
+
+// SpscRingBuffer
+template <typename T>
+inline SpscRingBuffer<T>::SpscRingBuffer()
+        : head_(0) {
+}
+
+template <typename T>
+inline SpscRingBuffer<T>::SpscRingBuffer(T* buffer, size_t size)
+        : SpscRingBuffer() {
+    init(buffer, size);
+}
+
+template <typename T>
+inline void SpscRingBuffer<T>::init(T* buffer, size_t size) {
+    Base::init(buffer, size);
+    head_.store(0, std::memory_order_relaxed);
+}
+
+template <typename T>
+inline void SpscRingBuffer<T>::reset() {
+    init(this->buffer_, this->size_);
+}
+
+template <typename T>
+inline ssize_t SpscRingBuffer<T>::put(const T& v) {
+    return put(&v, 1);
+}
+
+template <typename T>
+inline ssize_t SpscRingBuffer<T>::put(const T* v, size_t size) {
+    if (size == 0) {
+        return 0;
+    }
+    CHECK_TRUE(v, SYSTEM_ERROR_INVALID_ARGUMENT);
+    const size_t head = head_.load(std::memory_order_relaxed);
+    CHECK_TRUE(this->spaceAt(head) >= size, SYSTEM_ERROR_TOO_LARGE);
+    this->copyIn(head, v, size);
+    head_.store(this->advance(head, size), std::memory_order_release);
+    return size;
+}
+
+template <typename T>
+inline size_t SpscRingBuffer<T>::acquirable() const {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    return std::min(this->spaceAt(head), this->size_ - this->index(head));
+}
+
+template <typename T>
+inline T* SpscRingBuffer<T>::acquire(size_t size) {
+    if (acquirable() < size) {
+        return nullptr;
+    }
+    return this->buffer_ + this->index(head_.load(std::memory_order_relaxed));
+}
+
+template <typename T>
+inline ssize_t SpscRingBuffer<T>::acquireCommit(size_t size) {
+    CHECK_TRUE(acquirable() >= size, SYSTEM_ERROR_TOO_LARGE);
+    head_.store(this->advance(head_.load(std::memory_order_relaxed), size), std::memory_order_release);
+    return size;
+}
+
+// MpscRingBuffer
+template <typename T>
+inline MpscRingBuffer<T>::MpscRingBuffer()
+        : state_(0),
+          head_(0) {
+}
+
+template <typename T>
+inline MpscRingBuffer<T>::MpscRingBuffer(T* buffer, size_t size)
+        : MpscRingBuffer() {
+    init(buffer, size);
+}
+
+template <typename T>
+inline int MpscRingBuffer<T>::init(T* buffer, size_t size) {
+    if (size > MAX_SIZE) {
+        // The head position wouldn't fit in the state word. The buffer is left with no space
+        size = 0;
+    }
+    Base::init(buffer, size);
+    state_.store(0, std::memory_order_relaxed);
+    head_ = 0;
+    return size ? 0 : SYSTEM_ERROR_TOO_LARGE;
+}
+
+template <typename T>
+inline void MpscRingBuffer<T>::reset() {
+    init(this->buffer_, this->size_);
+}
+
+template <typename T>
+inline size_t MpscRingBuffer<T>::space() const {
+    return this->spaceAt(state_.load(std::memory_order_relaxed) >> WRITERS_BITS);
+}
+
+template <typename T>
+inline bool MpscRingBuffer<T>::full() const {
+    return space() == 0;
+}
+
+template <typename T>
+inline ssize_t MpscRingBuffer<T>::put(const T& v) {
+    return put(&v, 1);
+}
+
+template <typename T>
+inline ssize_t MpscRingBuffer<T>::put(const T* v, size_t size) {
+    if (size == 0) {
+        return 0;
+    }
+    CHECK_TRUE(v, SYSTEM_ERROR_INVALID_ARGUMENT);
+    size_t head = 0;
+    CHECK(reserve(size, false /* contiguous */, &head));
+    this->copyIn(head, v, size);
+    release();
+    return size;
+}
+
+template <typename T>
+inline T* MpscRingBuffer<T>::acquire(size_t size) {
+    size_t head = 0;
+    if (size == 0 || reserve(size, true /* contiguous */, &head) < 0) {
+        return nullptr;
+    }
+    return this->buffer_ + this->index(head);
+}
+
+template <typename T>
+inline ssize_t MpscRingBuffer<T>::acquireCommit(size_t size, size_t acquired) {
+    // The span stays reserved, so that it can still be committed with the acquired size
+    CHECK_TRUE(size == acquired, SYSTEM_ERROR_INVALID_ARGUMENT);
+    release();
+    return size;
+}
+
+template <typename T>
+inline ssize_t MpscRingBuffer<T>::reserve(size_t size, bool contiguous, size_t* pos) {
+    size_t state = state_.load(std::memory_order_relaxed);
+    size_t head = 0;
+    do {
+        head = state >> WRITERS_BITS;
+        CHECK_TRUE(this->spaceAt(head) >= size, SYSTEM_ERROR_TOO_LARGE);
+        if (contiguous) {
+            CHECK_TRUE(this->size_ - this->index(head) >= size, SYSTEM_ERROR_TOO_LARGE);
+        }
+        CHECK_TRUE((state & MAX_WRITERS) != MAX_WRITERS, SYSTEM_ERROR_BUSY);
+    } while (!state_.compare_exchange_weak(state, (this->advance(head, size) << WRITERS_BITS) | ((state & MAX_WRITERS) + 1),
+            std::memory_order_acquire, std::memory_order_relaxed));
+    *pos = head;
+    return size;
+}
+
+template <typename T>
+inline void MpscRingBuffer<T>::release() {
+    // Publishes the elements written by this producer, once no other writes are in progress
+    state_.fetch_sub(1, std::memory_order_release);
+}
+
 } // services
 } // particle
 
@@ -110,6 +110,10 @@ DYNALIB_FN(55, services, pb_encode_varint, bool(pb_ostream_t*, pb_uint64_t))
 # define BASE_IDX 40
 #endif
 
+DYNALIB_FN(BASE_IDX + 0, services, log_set_format_callback, void(log_format_callback_type, void*))
+DYNALIB_FN(BASE_IDX + 1, services, log_set_flush_callback, void(log_flush_callback_type, void*))
+DYNALIB_FN(BASE_IDX + 2, services, log_flush, void(void*))
+
 DYNALIB_END(services)
 
 #endif	/* SERVICES_DYNALIB_H */
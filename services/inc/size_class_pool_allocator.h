@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <new>
+#include <cstdint>
+#include <cstddef>
+
+#include "allocator.h"
+#include "system_error.h"
+
+namespace particle {
+
+/**
+ * Lock-free pool allocator with segregated size classes.
+ *
+ * Each size class is a fixed number of equally sized blocks. Free blocks of a class are kept in
+ * a LIFO list whose head is updated with a compare-and-swap, so `alloc()` and `free()` take
+ * constant time and can be called from an ISR without disabling interrupts. An allocation is
+ * served from the smallest size class that fits the requested size, or from a larger class if
+ * the smallest one has no free blocks.
+ *
+ * The head of a free list contains a modification counter in addition to the index of the first
+ * free block, which protects the list from the ABA problem.
+ */
+class SizeClassPool: public SimpleAllocator {
+public:
+    struct SizeClass {
+        size_t blockSize; // Block size
+        size_t blockCount; // Number of blocks
+    };
+
+    struct Stats {
+        size_t blockSize; // Block size
+        size_t blockCount; // Number of blocks
+        size_t used; // Number of allocated blocks
+        size_t highWater; // Maximum number of blocks that have been allocated at the same time
+        size_t failures; // Number of allocations that couldn't be served from this size class
+    };
+
+    /**
+     * Maximum number of blocks in a size class.
+     */
+    static const size_t MAX_BLOCK_COUNT = 0xfffe;
+
+    SizeClassPool();
+    SizeClassPool(const SizeClass* classes, size_t count);
+
+    /**
+     * Initializes the pool. This method is not thread-safe.
+     *
+     * Size classes need to be sorted by block size in ascending order. Block sizes are rounded up
+     * to a multiple of `sizeof(uintptr_t)`.
+     */
+    int init(const SizeClass* classes, size_t count);
+
+    virtual void* alloc(size_t size) override;
+    virtual void free(void* ptr) override;
+
+    size_t classCount() const;
+    int stats(size_t index, Stats* stats) const;
+
+private:
+    struct Class {
+        uint8_t* data;
+        size_t blockSize;
+        size_t blockCount;
+        std::atomic<uint32_t> freeList; // Modification counter and index of the first free block
+        std::atomic<size_t> used;
+        std::atomic<size_t> highWater;
+        std::atomic<size_t> failures;
+    };
+
+    static const uint32_t INDEX_MASK = 0xffff;
+    static const uint32_t NO_BLOCK = 0xffff;
+    static const uint32_t COUNTER_INC = 0x10000;
+
+    std::unique_ptr<Class[]> classes_;
+    std::unique_ptr<uint8_t[]> data_;
+    size_t count_;
+
+    void* take(Class* c);
+    void put(Class* c, uint8_t* block);
+
+    static size_t alignedBlockSize(size_t size) {
+        // Free blocks need to be large enough to store the index of the next free block
+        return size ? (size + sizeof(uintptr_t) - 1) / sizeof(uintptr_t) * sizeof(uintptr_t) : sizeof(uintptr_t);
+    }
+
+    static uint32_t nextBlock(const uint8_t* block) {
+        return *reinterpret_cast<const uint16_t*>(block);
+    }
+
+    static uint32_t freeListHead(uint32_t prevHead, uint32_t index) {
+        return ((prevHead & ~INDEX_MASK) + COUNTER_INC) | index;
+    }
+};
+
+inline SizeClassPool::SizeClassPool() :
+        count_(0) {
+}
+
+inline SizeClassPool::SizeClassPool(const SizeClass* classes, size_t count) :
+        SizeClassPool() {
+    init(classes, count);
+}
+
+inline int SizeClassPool::init(const SizeClass* classes, size_t count) {
+    classes_.reset();
+    data_.reset();
+    count_ = 0;
+    if (!classes || count == 0) {
+        return SYSTEM_ERROR_INVALID_ARGUMENT;
+    }
+    size_t dataSize = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (classes[i].blockCount == 0 || classes[i].blockCount > MAX_BLOCK_COUNT ||
+                (i > 0 && classes[i].blockSize < classes[i - 1].blockSize)) {
+            return SYSTEM_ERROR_INVALID_ARGUMENT;
+        }
+        dataSize += alignedBlockSize(classes[i].blockSize) * classes[i].blockCount;
+    }
+    std::unique_ptr<Class[]> cls(new(std::nothrow) Class[count]);
+    std::unique_ptr<uint8_t[]> data(new(std::nothrow) uint8_t[dataSize]);
+    if (!cls || !data) {
+        return SYSTEM_ERROR_NO_MEMORY;
+    }
+    uint8_t* p = data.get();
+    for (size_t i = 0; i < count; ++i) {
+        Class& c = cls[i];
+        c.data = p;
+        c.blockSize = alignedBlockSize(classes[i].blockSize);
+        c.blockCount = classes[i].blockCount;
+        for (size_t j = 0; j < c.blockCount; ++j) {
+            *reinterpret_cast<uint16_t*>(c.data + j * c.blockSize) = (j + 1 < c.blockCount) ? j + 1 : NO_BLOCK;
+        }
+        c.freeList.store(0, std::memory_order_relaxed);
+        c.used.store(0, std::memory_order_relaxed);
+        c.highWater.store(0, std::memory_order_relaxed);
+        c.failures.store(0, std::memory_order_relaxed);
+        p += c.blockSize * c.blockCount;
+    }
+    classes_ = std::move(cls);
+    data_ = std::move(data);
+    count_ = count;
+    return 0;
+}
+
+inline void* SizeClassPool::alloc(size_t size) {
+    if (count_ == 0) {
+        return nullptr;
+    }
+    size_t i = 0;
+    while (i < count_ && classes_[i].blockSize < size) {
+        ++i;
+    }
+    if (i == count_) {
+        // Oversized allocations are accounted to the largest size class
+        classes_[count_ - 1].failures.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    void* p = take(&classes_[i]);
+    if (!p) {
+        classes_[i].failures.fetch_add(1, std::memory_order_relaxed);
+        // Try larger size classes
+        for (size_t j = i + 1; j < count_ && !p; ++j) {
+            p = take(&classes_[j]);
+        }
+    }
+    return p;
+}
+
+inline void SizeClassPool::free(void* ptr) {
+    if (!ptr) {
+        return;
+    }
+    const auto p = static_cast<uint8_t*>(ptr);
+    for (size_t i = 0; i < count_; ++i) {
+        Class& c = classes_[i];
+        if (p >= c.data && p < c.data + c.blockSize * c.blockCount) {
+            put(&c, p);
+            return;
+        }
+    }
+}
+
+inline size_t SizeClassPool::classCount() const {
+    return count_;
+}
+
+inline int SizeClassPool::stats(size_t index, Stats* stats) const {
+    if (index >= count_) {
+        return SYSTEM_ERROR_NOT_FOUND;
+    }
+    const Class& c = classes_[index];
+    stats->blockSize = c.blockSize;
+    stats->blockCount = c.blockCount;
+    stats->used = c.used.load(std::memory_order_relaxed);
+    stats->highWater = c.highWater.load(std::memory_order_relaxed);
+    stats->failures = c.failures.load(std::memory_order_relaxed);
+    return 0;
+}
+
+inline void* SizeClassPool::take(Class* c) {
+    uint32_t head = c->freeList.load(std::memory_order_acquire);
+    uint8_t* block = nullptr;
+    do {
+        const uint32_t index = head & INDEX_MASK;
+        if (index == NO_BLOCK) {
+            return nullptr;
+        }
+        block = c->data + index * c->blockSize;
+        // The block may be taken by another context before the CAS below, in which case the CAS
+        // fails because the modification counter has changed
+    } while (!c->freeList.compare_exchange_weak(head, freeListHead(head, nextBlock(block)),
+            std::memory_order_acquire, std::memory_order_acquire));
+    const size_t used = c->used.fetch_add(1, std::memory_order_relaxed) + 1;
+    size_t highWater = c->highWater.load(std::memory_order_relaxed);
+    while (used > highWater && !c->highWater.compare_exchange_weak(highWater, used, std::memory_order_relaxed)) {
+    }
+    return block;
+}
+
+inline void SizeClassPool::put(Class* c, uint8_t* block) {
+    const uint32_t index = (block - c->data) / c->blockSize;
+    c->used.fetch_sub(1, std::memory_order_relaxed);
+    uint32_t head = c->freeList.load(std::memory_order_relaxed);
+    do {
+        *reinterpret_cast<uint16_t*>(block) = head & INDEX_MASK;
+    } while (!c->freeList.compare_exchange_weak(head, freeListHead(head, index),
+            std::memory_order_release, std::memory_order_relaxed));
+}
+
+} // particle
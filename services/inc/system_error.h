@@ -39,6 +39,7 @@
         (INVALID_STATE, "Invalid state", -210), \
         (IO, "IO error", -220), \
         (WOULD_BLOCK, "Would block", -221), \
+        (QUEUED, "Stored for later delivery", -222), \
         (FILE, "File error", -225), \
         (NETWORK, "Network error", -230), \
         (PROTOCOL, "Protocol error", -240), \
@@ -67,6 +67,14 @@ namespace {
 volatile log_message_callback_type log_msg_callback = 0;
 volatile log_write_callback_type log_write_callback = 0;
 volatile log_enabled_callback_type log_enabled_callback = 0;
+volatile log_format_callback_type log_format_callback = 0;
+volatile log_flush_callback_type log_flush_callback = 0;
+
+// Returns false if the output would be discarded by the backend logger, so that it's not formatted needlessly
+inline bool is_enabled(int level, const char *category) {
+    const log_enabled_callback_type enabled_callback = log_enabled_callback;
+    return !enabled_callback || enabled_callback(level, category, 0);
+}
 
 } // namespace
 
@@ -77,15 +85,43 @@ void log_set_callbacks(log_message_callback_type log_msg, log_write_callback_typ
     log_enabled_callback = log_enabled;
 }
 
+void log_set_format_callback(log_format_callback_type log_format, void *reserved) {
+    log_format_callback = log_format;
+}
+
+void log_set_flush_callback(log_flush_callback_type log_flush, void *reserved) {
+    log_flush_callback = log_flush;
+}
+
+void log_flush(void *reserved) {
+    const log_flush_callback_type flush_callback = log_flush_callback;
+    if (flush_callback) {
+        flush_callback(0);
+    }
+}
+
 void log_message_v(int level, const char *category, LogAttributes *attr, void *reserved, const char *fmt, va_list args) {
     const log_message_callback_type msg_callback = log_msg_callback;
-    if (!msg_callback && (!log_compat_callback || level < log_compat_level)) {
+    const log_format_callback_type format_callback = log_format_callback;
+    if (!msg_callback && !format_callback && (!log_compat_callback || level < log_compat_level)) {
+        return;
+    }
+    if (!is_enabled(level, category)) {
         return;
     }
     // Set default attributes
     if (!attr->has_time) {
         LOG_ATTR_SET(*attr, time, HAL_Timer_Get_Milli_Seconds());
     }
+    if (format_callback) {
+        va_list format_args;
+        va_copy(format_args, args);
+        const int ret = format_callback(fmt, format_args, level, category, attr, 0);
+        va_end(format_args);
+        if (!ret || !msg_callback) {
+            return;
+        }
+    }
     char buf[LOG_MAX_STRING_LENGTH];
     if (msg_callback) {
         const int n = vsnprintf(buf, sizeof(buf), fmt, args);
@@ -158,6 +194,9 @@ void log_printf_v(int level, const char *category, void *reserved, const char *f
     if (!write_callback && (!log_compat_callback || level < log_compat_level)) {
         return;
     }
+    if (!is_enabled(level, category)) {
+        return;
+    }
     char buf[LOG_MAX_STRING_LENGTH];
     int n = vsnprintf(buf, sizeof(buf), fmt, args);
     if (n > (int)sizeof(buf) - 1) {
@@ -183,6 +222,9 @@ void log_dump(int level, const char *category, const void *data, size_t size, in
     if (!size || (!write_callback && (!log_compat_callback || level < log_compat_level))) {
         return;
     }
+    if (!is_enabled(level, category)) {
+        return;
+    }
     static const char hex[] = "0123456789abcdef";
     char buf[LOG_MAX_STRING_LENGTH / 2 * 2 + 1]; // Hex data is flushed in chunks
     buf[sizeof(buf) - 1] = 0; // Compatibility callback expects null-terminated strings
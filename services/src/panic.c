@@ -39,6 +39,8 @@ static const flash_codes_t flash_codes[] = {
 
 void panic_(ePanicCode code, void* extraInfo, void (*HAL_Delay_Microseconds)(uint32_t))
 {
+        // Write out buffered log output while the output streams can still be serviced by interrupts
+        log_flush(NULL);
 
 #if HAL_PLATFORM_CORE_ENTER_PANIC_MODE
         HAL_Core_Enter_Panic_Mode(NULL);
@@ -0,0 +1,145 @@
+/**
+  Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, see <http://www.gnu.org/licenses/>.
+  ******************************************************************************
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+/**
+ * An append-only list of elements keyed by a name stored in the element. Elements are kept in
+ * the order they were added and are found by name through an open-addressing hash table of
+ * element indices, so a lookup hashes the name once and compares it against the candidates
+ * with the same hash only. Like the keys, the hash is limited to the first KeyLength characters.
+ *
+ * Storage grows in steps of `block` elements and is never released. Lookups don't allocate.
+ */
+template <typename T, size_t KeyLength, char (T::*Key)[KeyLength+1]> class hashed_list
+{
+    T* store;
+    uint32_t* hashes;
+    /**
+     * The hash table. A slot holds the index of an element plus one, or 0 if the slot is empty.
+     * There are at least twice as many slots as elements, and the number of slots is a power of 2.
+     */
+    uint8_t* slots;
+    uint16_t slot_count;
+    uint8_t count;
+    uint8_t capacity;
+    uint8_t block_size;
+
+    bool expand(unsigned capacity) {
+        if (capacity>MAX_SIZE)
+            return false;
+        unsigned slot_count = 4;
+        while (slot_count<capacity*2)
+            slot_count *= 2;
+        T* new_store = (T*)realloc(store, sizeof(T)*capacity);
+        if (new_store) {
+            store = new_store;
+        }
+        uint32_t* new_hashes = (uint32_t*)realloc(hashes, sizeof(uint32_t)*capacity);
+        if (new_hashes) {
+            hashes = new_hashes;
+        }
+        uint8_t* new_slots = (uint8_t*)malloc(slot_count);
+        if (!new_store || !new_hashes || !new_slots) {
+            free(new_slots);
+            return false;
+        }
+        free(slots);
+        slots = new_slots;
+        this->slot_count = slot_count;
+        this->capacity = capacity;
+        rehash();
+        return true;
+    }
+
+    void rehash() {
+        memset(slots, 0, slot_count);
+        for (unsigned i=0; i<count; i++) {
+            slots[free_slot(hashes[i])] = i+1;
+        }
+    }
+
+    unsigned free_slot(uint32_t hash) const {
+        unsigned i = hash & (slot_count-1);
+        while (slots[i]) {
+            i = (i+1) & (slot_count-1);
+        }
+        return i;
+    }
+
+public:
+    static const unsigned MAX_SIZE = 255;
+
+    hashed_list(unsigned block=5) : store(nullptr), hashes(nullptr), slots(nullptr), slot_count(0), count(0), capacity(0), block_size(block) {}
+
+    /**
+     * Computes the hash of a key (32-bit FNV-1a).
+     */
+    static uint32_t hash(const char* key) {
+        uint32_t h = 2166136261u;
+        for (size_t i=0; i<KeyLength && key[i]; i++) {
+            h = (h ^ (uint8_t)key[i]) * 16777619u;
+        }
+        return h;
+    }
+
+    T* find(const char* key) const {
+        if (!count) {
+            return nullptr;
+        }
+        const uint32_t h = hash(key);
+        for (unsigned i = h & (slot_count-1); slots[i]; i = (i+1) & (slot_count-1)) {
+            const unsigned index = slots[i]-1;
+            if (hashes[index]==h && !strncmp(store[index].*Key, key, KeyLength)) {
+                return store + index;
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * Adds an element. The caller ensures that there is no element with the same key.
+     */
+    T* add(const T& item) {
+        const unsigned grow = (count+block_size<MAX_SIZE) ? count+block_size : MAX_SIZE;
+        bool space = (count<capacity || (count<MAX_SIZE && expand(grow)));
+        T* result = nullptr;
+        if (space) {
+            result = store + count;
+            store[count] = item;
+            hashes[count] = hash(item.*Key);
+            slots[free_slot(hashes[count])] = count+1;
+            count++;
+        }
+        return result;
+    }
+
+    void removeLast() {
+        if (count) {
+            count--;
+            rehash();
+        }
+    }
+
+    T& operator[](unsigned index) { return store[index]; }
+    unsigned size() const { return count; }
+};
@@ -115,8 +115,12 @@ const uint32_t PUBLISH_EVENT_FLAG_PUBLIC = 0x0;
 const uint32_t PUBLISH_EVENT_FLAG_PRIVATE = 0x1;
 const uint32_t PUBLISH_EVENT_FLAG_NO_ACK = 0x2;
 const uint32_t PUBLISH_EVENT_FLAG_WITH_ACK = 0x8;
+const uint32_t PUBLISH_EVENT_FLAG_PRIORITY_HIGH = 0x10;
+const uint32_t PUBLISH_EVENT_FLAG_PRIORITY_LOW = 0x80;
 
 PARTICLE_STATIC_ASSERT(publish_no_ack_flag_matches, PUBLISH_EVENT_FLAG_NO_ACK==EventType::NO_ACK);
+PARTICLE_STATIC_ASSERT(publish_priority_high_flag_matches, PUBLISH_EVENT_FLAG_PRIORITY_HIGH==EventType::PRIORITY_HIGH);
+PARTICLE_STATIC_ASSERT(publish_priority_low_flag_matches, PUBLISH_EVENT_FLAG_PRIORITY_LOW==EventType::PRIORITY_LOW);
 
 typedef void (*EventHandler)(const char* name, const char* data);
 
@@ -126,14 +130,26 @@ typedef enum
   ALL_DEVICES
 } Spark_Subscription_Scope_TypeDef;
 
+/**
+ * A cloud function. When the function is registered with `CLOUD_FUNCTION_FLAG_ASYNC`, `reserved`
+ * is the handle of the call, which is passed to `spark_function_complete()`.
+ */
 typedef int (*cloud_function_t)(void* data, const char* param, void* reserved);
 
+typedef enum cloud_function_flag {
+    /**
+     * The function is acknowledged to the cloud as soon as it's called, and reports its result
+     * later via `spark_function_complete()`. The value returned by the function is ignored.
+     */
+    CLOUD_FUNCTION_FLAG_ASYNC = 0x01
+} cloud_function_flag;
+
 typedef int (user_function_int_str_t)(String paramString);
 typedef user_function_int_str_t* p_user_function_int_str_t;
 
 struct  cloud_function_descriptor {
     uint16_t size;
-    uint16_t padding;
+    uint16_t flags; // cloud_function_flag
     const char *funcKey;
     cloud_function_t fn;
     void* data;
@@ -150,6 +166,12 @@ typedef struct spark_variable_t
 {
     uint16_t size;
     const void* (*update)(const char* nane, Spark_Data_TypeDef type, const void* var, void* reserved);
+    /**
+     * Reads part of the value of a string variable that is generated when it's requested. The value
+     * is sent in blocks, so it can be larger than a single message. Returns the number of bytes
+     * read, which is less than `size` only at the end of the value, or a negative error code.
+     */
+    int (*read)(const char* name, const void* var, size_t offset, char* data, size_t size, void* reserved);
 } spark_variable_t;
 
 /**
@@ -159,6 +181,7 @@ typedef struct spark_variable_t
  * @param userVarType	The type of the variable.
  * @param extra		Additional registration details.
  * 		update	A function used to case a variable value to be computed. If defined, this is called when the variable's value is retrieved.
+ * 		read	A function used to read the value in parts. If defined, `update` isn't used and `userVar` is passed to it.
  */
 bool spark_variable(const char *varKey, const void *userVar, Spark_Data_TypeDef userVarType, spark_variable_t* extra);
 
@@ -170,6 +193,20 @@ bool spark_variable(const char *varKey, const void *userVar, Spark_Data_TypeDef
  */
 bool spark_function(const char *funcKey, p_user_function_int_str_t pFunc, void* reserved);
 
+/**
+ * Completes a call to a function registered with `CLOUD_FUNCTION_FLAG_ASYNC`. Several calls can
+ * be pending at the same time, and they can be completed in any order and from any thread.
+ * If the cloud connection was lost or re-established since the call was received, the result
+ * is discarded.
+ *
+ * @param call      The handle passed to the function. It's released by this function and
+ *      mustn't be used afterwards.
+ * @param result    The result reported to the cloud.
+ * @param reserved  For future expansion, set to NULL.
+ * @return 0 on success, or a negative error code.
+ */
+int spark_function_complete(void* call, int result, void* reserved);
+
 // Additional parameters for spark_send_event()
 typedef struct {
     size_t size;
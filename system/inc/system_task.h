@@ -105,6 +105,26 @@ void* system_pool_alloc(size_t size, void* reserved);
  */
 void system_pool_free(void* ptr, void* reserved);
 
+typedef struct system_pool_stats {
+    uint16_t size; // Size of this structure
+    uint16_t block_size; // Block size
+    uint16_t block_count; // Number of blocks
+    uint16_t used; // Number of allocated blocks
+    uint16_t high_water; // Maximum number of blocks that have been allocated at the same time
+    uint16_t reserved; // Reserved
+    uint32_t failures; // Number of allocations that couldn't be served from this size class
+} system_pool_stats;
+
+/**
+ * Gets usage statistics of a size class of the pool used by system_pool_alloc().
+ *
+ * @param index Index of the size class. Size classes are sorted by block size in ascending order.
+ * @param stats Statistics. The `size` field should be set to the size of the structure.
+ * @param reserved Reserved argument. Should be set to `NULL`.
+ * @return Number of size classes, or a negative result code in case of an error.
+ */
+int system_pool_get_stats(unsigned index, system_pool_stats* stats, void* reserved);
+
 int system_invoke_event_handler(uint16_t handlerInfoSize, FilteringEventHandler* handlerInfo,
                 const char* event_name, const char* event_data, void* reserved);
 
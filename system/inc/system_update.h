@@ -59,11 +59,23 @@ typedef enum {
  *
  * @param file
  * @param flags bit 0 set (1) means it's a dry run to check parameters. bit 0 cleared means it's the real thing.
- * @param reserved NULL
+ *      bit 1 set (2) means an interrupted transfer is resumed, and the data already stored is kept.
+ * @param reserved NULL, or a FileTransfer::Patch when the file is sent as a delta patch against
+ *      an installed module. The module is then available via Spark_Read_Firmware().
  * @return 0 on success.
  */
 int Spark_Prepare_For_Firmware_Update(FileTransfer::Descriptor& file, uint32_t flags, void* reserved);
 
+/**
+ * Reads the installed module selected for a delta update by Spark_Prepare_For_Firmware_Update().
+ * @param offset    The offset in the module.
+ * @param data      The buffer receiving the data.
+ * @param length    The number of bytes to read.
+ * @param reserved  NULL
+ * @return 0 on success.
+ */
+int Spark_Read_Firmware(uint32_t offset, uint8_t* data, size_t length, void* reserved);
+
 /**
  *
  * @param file
@@ -160,6 +160,13 @@ bool spark_function(const char *funcKey, p_user_function_int_str_t pFunc, void*
     return result;
 }
 
+int spark_function_complete(void* call, int result, void* reserved)
+{
+    // the response is sent on the system thread
+    SYSTEM_THREAD_CONTEXT_ASYNC_RESULT(spark_function_complete(call, result, reserved), 0);
+    return userFuncComplete(call, result);
+}
+
 #endif
 
 bool spark_cloud_flag_connected(void)
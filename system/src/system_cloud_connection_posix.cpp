@@ -20,235 +20,584 @@
 #if HAL_USE_SOCKET_HAL_POSIX
 #include "system_cloud_connection.h"
 #include "system_cloud_internal.h"
+#include "system_cloud_server_addresses.h"
 #include "system_error.h"
 #include "inet_hal.h"
 #include "netdb_hal.h"
 #include "system_string_interpolate.h"
 #include "spark_wiring_ticks.h"
+#include "core_hal.h"
+#include "rtc_hal.h"
 #include <arpa/inet.h>
+#include <algorithm>
 #include "spark_wiring_cloud.h"
 
+using namespace particle::system::cloud;
+
 namespace {
 
 enum CloudServerAddressType {
     CLOUD_SERVER_ADDRESS_TYPE_NONE            = 0,
     CLOUD_SERVER_ADDRESS_TYPE_CACHED          = 1,
     CLOUD_SERVER_ADDRESS_TYPE_CACHED_ADDRINFO = 2,
-    CLOUD_SERVER_ADDRESS_TYPE_NEW_ADDRINFO    = 3
+    CLOUD_SERVER_ADDRESS_TYPE_NEW_ADDRINFO    = 3,
+    CLOUD_SERVER_ADDRESS_TYPE_PERSISTED       = 4
 };
 
 struct SystemCloudState {
     int socket = -1;
-    struct addrinfo* addr = nullptr;
-    struct addrinfo* next = nullptr;
+    CloudServerAddresses addrs = {};
+    /* The next address to try if the application layer fails to establish the connection */
+    uint8_t next = 0;
+    /* Set once the saved addresses have been tried, so that a stale entry is only tried once */
+    bool persistedTried = false;
 };
 
 SystemCloudState s_state;
 
 const unsigned CLOUD_SOCKET_HALF_CLOSED_WAIT_TIMEOUT = 5000;
 
-} /* anonymous */
+/* The delay before the next connection attempt is started while the previous one is still
+ * in progress (RFC 8305, section 5) */
+const system_tick_t CLOUD_CONNECTION_ATTEMPT_DELAY = 250;
+
+/* The time given to all the connection attempts of a TCP connection */
+const system_tick_t CLOUD_CONNECT_TIMEOUT = 30000;
+
+/* The time given to the servers to answer the probes of a UDP connection. If none answers, the
+ * first address that can be connected is used */
+const system_tick_t CLOUD_PROBE_TIMEOUT = 3000;
+
+/* A DTLS 1.2 ClientHello without a cookie, which the server answers with a HelloVerifyRequest
+ * without keeping any state (RFC 6347, section 4.2.1) */
+const uint8_t DTLS_HELLO_PROBE[] = {
+    0x16, 0xfe, 0xfd,                           /* handshake record, DTLS 1.2 */
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, /* epoch and sequence number */
+    0x00, 0x36,                                 /* record length */
+    0x01, 0x00, 0x00, 0x2a,                     /* ClientHello and its length */
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x2a, /* message sequence, fragment offset and length */
+    0xfe, 0xfd,                                 /* client version */
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, /* random */
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00,                                       /* no session ID */
+    0x00,                                       /* no cookie */
+    0x00, 0x02, 0xc0, 0xae,                     /* TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8 */
+    0x01, 0x00                                  /* no compression */
+};
 
-int system_cloud_connect(int protocol, const ServerAddress* address, sockaddr* saddrCache)
-{
-    struct addrinfo* info = nullptr;
-    CloudServerAddressType type = CLOUD_SERVER_ADDRESS_TYPE_NONE;
-    bool clean = true;
+socklen_t address_length(const sockaddr* addr) {
+    return addr->sa_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+}
 
-    if (saddrCache && /* protocol == IPPROTO_UDP && */ saddrCache->sa_family != AF_UNSPEC) {
-        char tmphost[INET6_ADDRSTRLEN] = {};
-        char tmpserv[8] = {};
-        if (!netdb_getnameinfo(saddrCache, saddrCache->sa_len, tmphost, sizeof(tmphost),
-                               tmpserv, sizeof(tmpserv), AI_NUMERICHOST | AI_NUMERICSERV)) {
-            /* There is a cached address, use it, but still pass it to getaddrinfo */
+uint32_t server_address_checksum(const ServerAddress* address) {
+    return HAL_Core_Compute_CRC32((const uint8_t*)address, sizeof(*address));
+}
+
+/* Returns the Unix time, or 0 if it isn't known */
+uint32_t unix_time() {
+    return HAL_RTC_Time_Is_Valid(nullptr) ? (uint32_t)HAL_RTC_Get_UnixTime() : 0;
+}
+
+int resolve_server_address(int protocol, const ServerAddress* address, CloudServerAddresses& addrs) {
+    struct addrinfo* info = nullptr;
+    switch (address->addr_type) {
+        case IP_ADDRESS: {
             struct addrinfo hints = {};
             hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV | AI_ADDRCONFIG;
-            hints.ai_family = saddrCache->sa_family;
+            /* XXX: IPv4-only */
+            hints.ai_family = AF_INET;
             hints.ai_protocol = protocol;
             /* FIXME: */
             hints.ai_socktype = hints.ai_protocol == IPPROTO_UDP ? SOCK_DGRAM : SOCK_STREAM;
 
-            if (!netdb_getaddrinfo(tmphost, tmpserv, &hints, &info)) {
-                type = CLOUD_SERVER_ADDRESS_TYPE_CACHED;
+            char tmphost[INET_ADDRSTRLEN] = {};
+            char tmpserv[8] = {};
+
+            struct in_addr in = {};
+            in.s_addr = htonl(address->ip);
+            if (inet_inet_ntop(AF_INET, &in, tmphost, sizeof(tmphost))) {
+                snprintf(tmpserv, sizeof(tmpserv), "%u", address->port);
+
+                netdb_getaddrinfo(tmphost, tmpserv, &hints, &info);
             }
+            break;
         }
-    }
 
-    if (type == CLOUD_SERVER_ADDRESS_TYPE_NONE) {
-        /* Check if we have another address to try from the cached addrinfo list */
-        if (s_state.addr && s_state.next) {
-            info = s_state.next;
-            type = CLOUD_SERVER_ADDRESS_TYPE_CACHED_ADDRINFO;
+        case DOMAIN_NAME: {
+            struct addrinfo hints = {};
+            hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+            hints.ai_protocol = protocol;
+            /* FIXME: */
+            hints.ai_socktype = hints.ai_protocol == IPPROTO_UDP ? SOCK_DGRAM : SOCK_STREAM;
+
+            char tmphost[sizeof(address->domain) + 32] = {};
+            char tmpserv[8] = {};
+            /* FIXME: this should probably be moved into system_cloud_internal */
+            system_string_interpolate(address->domain, tmphost, sizeof(tmphost), system_interpolate_cloud_server_hostname);
+            snprintf(tmpserv, sizeof(tmpserv), "%u", address->port);
+            LOG(TRACE, "Resolving %s#%s", tmphost, tmpserv);
+            netdb_getaddrinfo(tmphost, tmpserv, &hints, &info);
+            break;
         }
     }
+    interleave_addresses(info, addrs);
+    netdb_freeaddrinfo(info);
+    return addrs.count ? 0 : SYSTEM_ERROR_NOT_FOUND;
+}
 
-    if ((type == CLOUD_SERVER_ADDRESS_TYPE_NONE) && address) {
-        /* Use passed ServerAddress */
-        switch (address->addr_type) {
-            case IP_ADDRESS: {
-                struct addrinfo hints = {};
-                hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV | AI_ADDRCONFIG;
-                /* XXX: IPv4-only */
-                hints.ai_family = AF_INET;
-                hints.ai_protocol = protocol;
-                /* FIXME: */
-                hints.ai_socktype = hints.ai_protocol == IPPROTO_UDP ? SOCK_DGRAM : SOCK_STREAM;
-
-                char tmphost[INET_ADDRSTRLEN] = {};
-                char tmpserv[8] = {};
-
-                struct in_addr in = {};
-                in.s_addr = htonl(address->ip);
-                if (inet_inet_ntop(AF_INET, &in, tmphost, sizeof(tmphost))) {
-                    snprintf(tmpserv, sizeof(tmpserv), "%u", address->port);
-
-                    netdb_getaddrinfo(tmphost, tmpserv, &hints, &info);
-                    type = CLOUD_SERVER_ADDRESS_TYPE_NEW_ADDRINFO;
-                }
-                break;
-            }
+bool restore_server_addresses(int protocol, const ServerAddress* address, CloudServerAddresses& addrs) {
+    CloudServerAddresses persisted = {};
+    const int r = Spark_Restore(&persisted, sizeof(persisted), SparkCallbacks::PERSIST_SERVER_ADDRESS, nullptr);
+    /* Without a valid time the addresses are tried anyway, and resolved again if they don't work */
+    if (r != sizeof(persisted) || !server_addresses_usable(persisted, protocol, server_address_checksum(address), unix_time())) {
+        return false;
+    }
+    addrs = persisted;
+    return true;
+}
 
-            case DOMAIN_NAME: {
-                struct addrinfo hints = {};
-                hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
-                hints.ai_protocol = protocol;
-                /* FIXME: */
-                hints.ai_socktype = hints.ai_protocol == IPPROTO_UDP ? SOCK_DGRAM : SOCK_STREAM;
-
-                char tmphost[sizeof(address->domain) + 32] = {};
-                char tmpserv[8] = {};
-                /* FIXME: this should probably be moved into system_cloud_internal */
-                system_string_interpolate(address->domain, tmphost, sizeof(tmphost), system_interpolate_cloud_server_hostname);
-                snprintf(tmpserv, sizeof(tmpserv), "%u", address->port);
-                LOG(TRACE, "Resolving %s#%s", tmphost, tmpserv);
-                netdb_getaddrinfo(tmphost, tmpserv, &hints, &info);
-                type = CLOUD_SERVER_ADDRESS_TYPE_NEW_ADDRINFO;
-                break;
-            }
-        }
+void save_server_addresses(int protocol, const ServerAddress* address, CloudServerAddresses& addrs) {
+    const uint32_t now = unix_time();
+    addrs.size = sizeof(addrs);
+    addrs.protocol = protocol;
+    addrs.server = server_address_checksum(address);
+    addrs.expires = now ? now + CLOUD_SERVER_ADDRESS_TTL : 0;
+    /* The server resolves to the same addresses most of the time, which doesn't need a write */
+    CloudServerAddresses saved = {};
+    const int r = Spark_Restore(&saved, sizeof(saved), SparkCallbacks::PERSIST_SERVER_ADDRESS, nullptr);
+    if (r == sizeof(saved) && !server_addresses_need_saving(saved, addrs, now)) {
+        addrs.expires = saved.expires;
+        return;
     }
+    Spark_Save(&addrs, sizeof(addrs), SparkCallbacks::PERSIST_SERVER_ADDRESS, nullptr);
+}
 
-    int r = SYSTEM_ERROR_NETWORK;
+int open_cloud_socket(const sockaddr* addr, int protocol) {
+    const int type = protocol == IPPROTO_UDP ? SOCK_DGRAM : SOCK_STREAM;
+    int s = sock_socket(addr->sa_family, type, protocol);
+    if (s < 0) {
+        LOG(ERROR, "Cloud socket failed, family=%d, type=%d, protocol=%d, errno=%d", addr->sa_family, type, protocol, errno);
+        return -1;
+    }
 
-    if (info == nullptr) {
-        LOG(ERROR, "Failed to determine server address");
+    LOG(TRACE, "Cloud socket=%d, family=%d, type=%d, protocol=%d", s, addr->sa_family, type, protocol);
+
+    char serverHost[INET6_ADDRSTRLEN] = {};
+    uint16_t serverPort = 0;
+    switch (addr->sa_family) {
+        case AF_INET: {
+            inet_inet_ntop(addr->sa_family, &((const sockaddr_in*)addr)->sin_addr, serverHost, sizeof(serverHost));
+            serverPort = ntohs(((const sockaddr_in*)addr)->sin_port);
+            break;
+        }
+        case AF_INET6: {
+            inet_inet_ntop(addr->sa_family, &((const sockaddr_in6*)addr)->sin6_addr, serverHost, sizeof(serverHost));
+            serverPort = ntohs(((const sockaddr_in6*)addr)->sin6_port);
+            break;
+        }
     }
+    LOG(INFO, "Cloud socket=%d, connecting to %s#%u", s, serverHost, serverPort);
 
-    LOG(TRACE, "Address type: %d", type);
+    /* We are using fixed source port only for IPv6 connections */
+    if (protocol == IPPROTO_UDP && addr->sa_family == AF_INET6) {
+        struct sockaddr_storage saddr = {};
+        saddr.s2_len = sizeof(saddr);
+        saddr.ss_family = addr->sa_family;
+
+        /* NOTE: Always binding to 5684 by default */
+        ((sockaddr_in6*)&saddr)->sin6_port = htons(PORT_COAPS);
+
+        const int one = 1;
+        if (sock_setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one))) {
+            LOG(ERROR, "Cloud socket=%d, failed to set SO_REUSEADDR, errno=%d", s, errno);
+            sock_close(s);
+            return -1;
+        }
 
-    for (struct addrinfo* a = info; a != nullptr; a = a->ai_next) {
-        /* Iterate over all the addresses and attempt to connect */
+        /* Bind socket */
+        if (sock_bind(s, (const struct sockaddr*)&saddr, sizeof(saddr))) {
+            LOG(ERROR, "Cloud socket=%d, failed to bind, errno=%d", s, errno);
+            sock_close(s);
+            return -1;
+        }
+    }
+    return s;
+}
 
-        int s = sock_socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+/* Connects a UDP socket to the first address that can be reached. This doesn't involve the server,
+ * so it completes or fails straight away. Returns the index of the address. */
+int connect_first_address(const CloudServerAddresses& addrs, size_t first, int protocol, int* socket) {
+    for (size_t i = first; i < addrs.count; ++i) {
+        const sockaddr* addr = (const sockaddr*)&addrs.addr[i];
+        const int s = open_cloud_socket(addr, protocol);
         if (s < 0) {
-            LOG(ERROR, "Cloud socket failed, family=%d, type=%d, protocol=%d, errno=%d", a->ai_family, a->ai_socktype, a->ai_protocol, errno);
             continue;
         }
+        /* NOTE: we do this for UDP sockets as well in order to automagically filter
+         * on source address and port */
+        if (sock_connect(s, addr, address_length(addr))) {
+            LOG(ERROR, "Cloud socket=%d, failed to connect, errno=%d", s, errno);
+            sock_close(s);
+            continue;
+        }
+        *socket = s;
+        return i;
+    }
+    return -1;
+}
+
+/* Starts a non-blocking connection attempt. Returns the socket, or -1 if the attempt failed. */
+int start_connection_attempt(const sockaddr* addr, int protocol) {
+    const int s = open_cloud_socket(addr, protocol);
+    if (s < 0) {
+        return -1;
+    }
+    const int flags = sock_fcntl(s, F_GETFL, 0);
+    if (flags < 0 || sock_fcntl(s, F_SETFL, flags | O_NONBLOCK) < 0 ||
+            (sock_connect(s, addr, address_length(addr)) && errno != EINPROGRESS)) {
+        LOG(ERROR, "Cloud socket=%d, failed to connect, errno=%d", s, errno);
+        sock_close(s);
+        return -1;
+    }
+    return s;
+}
 
-        LOG(TRACE, "Cloud socket=%d, family=%d, type=%d, protocol=%d", s, a->ai_family, a->ai_socktype, a->ai_protocol);
+/* Returns 1 if the connection is established, 0 if it's still in progress, or -1 if it failed. */
+int poll_connection_attempt(int s, const sockaddr* addr) {
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (sock_getsockopt(s, SOL_SOCKET, SO_ERROR, &error, &len) ||
+            (error && error != EINPROGRESS && error != EALREADY)) {
+        LOG(ERROR, "Cloud socket=%d, failed to connect, errno=%d", s, error);
+        return -1;
+    }
+    /* Connecting again reports whether the connection is established */
+    if (!sock_connect(s, addr, address_length(addr)) || errno == EISCONN) {
+        return 1;
+    }
+    return (errno == EINPROGRESS || errno == EALREADY) ? 0 : -1;
+}
 
-        char serverHost[INET6_ADDRSTRLEN] = {};
-        uint16_t serverPort = 0;
-        switch (a->ai_family) {
-            case AF_INET: {
-                inet_inet_ntop(a->ai_family, &((sockaddr_in*)a->ai_addr)->sin_addr, serverHost, sizeof(serverHost));
-                serverPort = ntohs(((sockaddr_in*)a->ai_addr)->sin_port);
-                break;
+/* Races TCP connection attempts to the addresses, starting the next attempt when the previous one
+ * fails or hasn't completed within CLOUD_CONNECTION_ATTEMPT_DELAY (RFC 8305). The first connection
+ * established is kept and the other attempts are abandoned. Returns the index of the address. */
+int race_connection_attempts(const CloudServerAddresses& addrs, size_t first, int protocol, int* socket) {
+    int sockets[MAX_CLOUD_SERVER_ADDRESSES];
+    for (size_t i = 0; i < MAX_CLOUD_SERVER_ADDRESSES; ++i) {
+        sockets[i] = -1;
+    }
+    const system_tick_t start = millis();
+    system_tick_t lastAttempt = start;
+    size_t started = first;
+    bool startNext = true;
+    int connected = -1;
+    for (;;) {
+        const system_tick_t now = millis();
+        if (now - start >= CLOUD_CONNECT_TIMEOUT) {
+            break;
+        }
+        if (started < addrs.count && (startNext || now - lastAttempt >= CLOUD_CONNECTION_ATTEMPT_DELAY)) {
+            sockets[started] = start_connection_attempt((const sockaddr*)&addrs.addr[started], protocol);
+            startNext = sockets[started] < 0;
+            ++started;
+            lastAttempt = now;
+            continue;
+        }
+        pollfd fds[MAX_CLOUD_SERVER_ADDRESSES] = {};
+        size_t index[MAX_CLOUD_SERVER_ADDRESSES] = {};
+        nfds_t nfds = 0;
+        for (size_t i = first; i < started; ++i) {
+            if (sockets[i] >= 0) {
+                fds[nfds].fd = sockets[i];
+                fds[nfds].events = POLLOUT;
+                index[nfds++] = i;
+            }
+        }
+        if (!nfds) {
+            /* All the attempts have failed */
+            break;
+        }
+        /* A socket becomes writable when its connection is established or fails. Wake up in time
+         * to start the next attempt. */
+        system_tick_t timeout = CLOUD_CONNECT_TIMEOUT - (now - start);
+        if (started < addrs.count) {
+            timeout = std::min(timeout, CLOUD_CONNECTION_ATTEMPT_DELAY - (now - lastAttempt));
+        }
+        const int r = sock_poll(fds, nfds, timeout);
+        if (r < 0) {
+            LOG(ERROR, "Cloud socket poll failed, errno=%d", errno);
+            break;
+        }
+        for (nfds_t k = 0; k < nfds && connected < 0; ++k) {
+            if (!fds[k].revents) {
+                continue;
             }
-            case AF_INET6: {
-                inet_inet_ntop(a->ai_family, &((sockaddr_in6*)a->ai_addr)->sin6_addr, serverHost, sizeof(serverHost));
-                serverPort = ntohs(((sockaddr_in6*)a->ai_addr)->sin6_port);
-                break;
+            const size_t i = index[k];
+            const int state = poll_connection_attempt(sockets[i], (const sockaddr*)&addrs.addr[i]);
+            if (state > 0) {
+                connected = i;
+            } else if (state < 0) {
+                sock_close(sockets[i]);
+                sockets[i] = -1;
+                startNext = true;
             }
         }
-        LOG(INFO, "Cloud socket=%d, connecting to %s#%u", s, serverHost, serverPort);
+        if (connected >= 0) {
+            break;
+        }
+    }
+    for (size_t i = first; i < started; ++i) {
+        if (sockets[i] >= 0 && (int)i != connected) {
+            sock_close(sockets[i]);
+        }
+    }
+    if (connected >= 0) {
+        const int s = sockets[connected];
+        const int flags = sock_fcntl(s, F_GETFL, 0);
+        sock_fcntl(s, F_SETFL, flags & ~O_NONBLOCK);
+        *socket = s;
+    }
+    return connected;
+}
 
-        /* We are using fixed source port only for IPv6 connections */
-        if (protocol == IPPROTO_UDP && a->ai_family == AF_INET6) {
-            struct sockaddr_storage saddr = {};
-            saddr.s2_len = sizeof(saddr);
-            saddr.ss_family = a->ai_family;
+/* Opens a UDP socket to the address and sends it a DTLS hello probe. Returns the socket, or -1 if
+ * the probe couldn't be sent. */
+int start_hello_probe(const sockaddr* addr, int protocol) {
+    const int s = open_cloud_socket(addr, protocol);
+    if (s < 0) {
+        return -1;
+    }
+    if (sock_connect(s, addr, address_length(addr)) ||
+            sock_send(s, DTLS_HELLO_PROBE, sizeof(DTLS_HELLO_PROBE), 0) < 0) {
+        LOG(ERROR, "Cloud socket=%d, failed to send probe, errno=%d", s, errno);
+        sock_close(s);
+        return -1;
+    }
+    return s;
+}
 
-            /* NOTE: Always binding to 5684 by default */
-            switch (a->ai_family) {
-                case AF_INET: {
-                    ((sockaddr_in*)&saddr)->sin_port = htons(PORT_COAPS);
-                    break;
-                }
-                case AF_INET6: {
-                    ((sockaddr_in6*)&saddr)->sin6_port = htons(PORT_COAPS);
-                    break;
-                }
+/* Races UDP connection attempts to the addresses by sending each a DTLS hello probe, starting the
+ * next one when the previous fails or hasn't been answered within CLOUD_CONNECTION_ATTEMPT_DELAY.
+ * The socket of the first address that answers is kept, with the answer discarded, so that the DTLS
+ * handshake starts afresh. Returns the index of the address, or -1 if none answered in time. */
+int race_hello_probes(const CloudServerAddresses& addrs, size_t first, int protocol, int* socket) {
+    int sockets[MAX_CLOUD_SERVER_ADDRESSES];
+    for (size_t i = 0; i < MAX_CLOUD_SERVER_ADDRESSES; ++i) {
+        sockets[i] = -1;
+    }
+    const system_tick_t start = millis();
+    system_tick_t lastAttempt = start;
+    size_t started = first;
+    bool startNext = true;
+    int answered = -1;
+    for (;;) {
+        const system_tick_t now = millis();
+        if (now - start >= CLOUD_PROBE_TIMEOUT) {
+            break;
+        }
+        if (started < addrs.count && (startNext || now - lastAttempt >= CLOUD_CONNECTION_ATTEMPT_DELAY)) {
+            sockets[started] = start_hello_probe((const sockaddr*)&addrs.addr[started], protocol);
+            startNext = sockets[started] < 0;
+            ++started;
+            lastAttempt = now;
+            continue;
+        }
+        pollfd fds[MAX_CLOUD_SERVER_ADDRESSES] = {};
+        size_t index[MAX_CLOUD_SERVER_ADDRESSES] = {};
+        nfds_t nfds = 0;
+        for (size_t i = first; i < started; ++i) {
+            if (sockets[i] >= 0) {
+                fds[nfds].fd = sockets[i];
+                fds[nfds].events = POLLIN;
+                index[nfds++] = i;
             }
-
-            const int one = 1;
-            if (sock_setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one))) {
-                LOG(ERROR, "Cloud socket=%d, failed to set SO_REUSEADDR, errno=%d", s, errno);
-                sock_close(s);
+        }
+        if (!nfds) {
+            break;
+        }
+        system_tick_t timeout = CLOUD_PROBE_TIMEOUT - (now - start);
+        if (started < addrs.count) {
+            timeout = std::min(timeout, CLOUD_CONNECTION_ATTEMPT_DELAY - (now - lastAttempt));
+        }
+        const int r = sock_poll(fds, nfds, timeout);
+        if (r < 0) {
+            LOG(ERROR, "Cloud socket poll failed, errno=%d", errno);
+            break;
+        }
+        for (nfds_t k = 0; k < nfds && answered < 0; ++k) {
+            if (!fds[k].revents) {
                 continue;
             }
+            const size_t i = index[k];
+            /* Any answer will do, even an alert. An unreachable port is reported as an error */
+            uint8_t answer[64];
+            if (sock_recv(sockets[i], answer, sizeof(answer), MSG_DONTWAIT) >= 0) {
+                answered = i;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                LOG(ERROR, "Cloud socket=%d, probe failed, errno=%d", sockets[i], errno);
+                sock_close(sockets[i]);
+                sockets[i] = -1;
+                startNext = true;
+            }
+        }
+        if (answered >= 0) {
+            break;
+        }
+    }
+    for (size_t i = first; i < started; ++i) {
+        if (sockets[i] >= 0 && (int)i != answered) {
+            sock_close(sockets[i]);
+        }
+    }
+    if (answered >= 0) {
+        *socket = sockets[answered];
+    }
+    return answered;
+}
 
-            /* Bind socket */
-            if (sock_bind(s, (const struct sockaddr*)&saddr, sizeof(saddr))) {
-                LOG(ERROR, "Cloud socket=%d, failed to bind, errno=%d");
-                sock_close(s);
-                continue;
+#if !defined(SPARK_NO_CLOUD) && HAL_PLATFORM_CLOUD_UDP
+
+/* Identifies the network behind the local address of the cloud socket, so that the keepalive
+ * interval learned for one network isn't applied to another. Only the network prefix is used,
+ * as the host part may change with each lease. */
+uint32_t cloud_network_id(int s) {
+    sockaddr_storage local = {};
+    socklen_t len = sizeof(local);
+    if (sock_getsockname(s, (sockaddr*)&local, &len)) {
+        return 0;
+    }
+    const uint8_t* prefix = nullptr;
+    size_t prefixLen = 0;
+    if (local.ss_family == AF_INET) {
+        prefix = (const uint8_t*)&((const sockaddr_in*)&local)->sin_addr;
+        prefixLen = 2; /* /16 */
+    } else if (local.ss_family == AF_INET6) {
+        prefix = (const uint8_t*)&((const sockaddr_in6*)&local)->sin6_addr;
+        prefixLen = 8; /* /64 */
+    } else {
+        return 0;
+    }
+    /* FNV-1a */
+    uint32_t h = 2166136261u;
+    h = (h ^ local.ss_family) * 16777619u;
+    for (size_t i = 0; i < prefixLen; ++i) {
+        h = (h ^ prefix[i]) * 16777619u;
+    }
+    return h;
+}
+
+#endif // !defined(SPARK_NO_CLOUD) && HAL_PLATFORM_CLOUD_UDP
+
+} /* anonymous */
+
+int system_cloud_connect(int protocol, const ServerAddress* address, sockaddr* saddrCache)
+{
+    CloudServerAddressType type = CLOUD_SERVER_ADDRESS_TYPE_NONE;
+    CloudServerAddresses cached = {};
+    const CloudServerAddresses* addrs = &s_state.addrs;
+    size_t first = s_state.next;
+
+    if (saddrCache && /* protocol == IPPROTO_UDP && */ saddrCache->sa_family != AF_UNSPEC) {
+        char tmphost[INET6_ADDRSTRLEN] = {};
+        char tmpserv[8] = {};
+        if (!netdb_getnameinfo(saddrCache, saddrCache->sa_len, tmphost, sizeof(tmphost),
+                               tmpserv, sizeof(tmpserv), AI_NUMERICHOST | AI_NUMERICSERV)) {
+            /* There is a cached address, use it, but still pass it to getaddrinfo */
+            struct addrinfo hints = {};
+            hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV | AI_ADDRCONFIG;
+            hints.ai_family = saddrCache->sa_family;
+            hints.ai_protocol = protocol;
+            /* FIXME: */
+            hints.ai_socktype = hints.ai_protocol == IPPROTO_UDP ? SOCK_DGRAM : SOCK_STREAM;
+
+            struct addrinfo* info = nullptr;
+            if (!netdb_getaddrinfo(tmphost, tmpserv, &hints, &info)) {
+                interleave_addresses(info, cached);
+                if (cached.count) {
+                    addrs = &cached;
+                    first = 0;
+                    type = CLOUD_SERVER_ADDRESS_TYPE_CACHED;
+                }
             }
+            netdb_freeaddrinfo(info);
         }
+    }
 
-        /* FIXME: timeout for TCP */
-        /* NOTE: we do this for UDP sockets as well in order to automagically filter
-         * on source address and port */
-        r = sock_connect(s, a->ai_addr, a->ai_addrlen);
-        if (r) {
-            LOG(ERROR, "Cloud socket=%d, failed to connect to %s#%u, errno=%d", s, serverHost, serverPort, errno);
-            sock_close(s);
-            continue;
+    if (type == CLOUD_SERVER_ADDRESS_TYPE_NONE && s_state.next < s_state.addrs.count) {
+        /* Try the next address from the addresses resolved previously */
+        type = CLOUD_SERVER_ADDRESS_TYPE_CACHED_ADDRINFO;
+    }
+
+    if ((type == CLOUD_SERVER_ADDRESS_TYPE_NONE) && address) {
+        s_state.next = first = 0;
+        /* After a reset, use the addresses saved when the server was last resolved */
+        if (address->addr_type == DOMAIN_NAME && !s_state.persistedTried) {
+            s_state.persistedTried = true;
+            if (restore_server_addresses(protocol, address, s_state.addrs)) {
+                type = CLOUD_SERVER_ADDRESS_TYPE_PERSISTED;
+            }
         }
-        LOG(TRACE, "Cloud socket=%d, connected to %s#%u", s, serverHost, serverPort);
-
-        /* If we got here, we are most likely connected, however keep track of current addrinfo list
-         * in order to try the next address if application layer fails to establish the connection
-         */
-        if (protocol == IPPROTO_UDP &&
-            (type == CLOUD_SERVER_ADDRESS_TYPE_NEW_ADDRINFO ||
-             type == CLOUD_SERVER_ADDRESS_TYPE_CACHED_ADDRINFO)) {
-            if (s_state.addr) {
-                /* We are already iterating over a cached addrinfo list */
-                s_state.next = a->ai_next;
-                if (a->ai_next) {
-                    s_state.next = a->ai_next;
-                    clean = false;
-                } else {
-                    info = s_state.addr;
-                    s_state.addr = s_state.next = nullptr;
-                }
-            } else {
-                if (a->ai_next) {
-                    s_state.addr = info;
-                    s_state.next = a->ai_next;
-                    clean = false;
-                }
+        if (type == CLOUD_SERVER_ADDRESS_TYPE_NONE && !resolve_server_address(protocol, address, s_state.addrs)) {
+            type = CLOUD_SERVER_ADDRESS_TYPE_NEW_ADDRINFO;
+            if (address->addr_type == DOMAIN_NAME) {
+                save_server_addresses(protocol, address, s_state.addrs);
             }
         }
+    }
+
+    if (type == CLOUD_SERVER_ADDRESS_TYPE_NONE) {
+        LOG(ERROR, "Failed to determine server address");
+        return SYSTEM_ERROR_NETWORK;
+    }
+
+    LOG(TRACE, "Address type: %d", type);
 
-        s_state.socket = s;
-        if (saddrCache) {
-            memcpy(saddrCache, a->ai_addr, a->ai_addrlen);
+    int s = -1;
+    int index = -1;
+    if (protocol == IPPROTO_UDP) {
+        if (addrs->count - first > 1) {
+            index = race_hello_probes(*addrs, first, protocol, &s);
         }
+        if (index < 0) {
+            index = connect_first_address(*addrs, first, protocol, &s);
+        }
+    } else {
+        index = race_connection_attempts(*addrs, first, protocol, &s);
+    }
+    if (type != CLOUD_SERVER_ADDRESS_TYPE_CACHED) {
+        /* If we got a connection, we are most likely connected, however keep track of the remaining
+         * addresses in order to try the next one if application layer fails to establish the connection.
+         * TCP connections are already established, so the next attempt starts over. */
+        s_state.next = (index >= 0 && protocol == IPPROTO_UDP) ? index + 1 : s_state.addrs.count;
+    }
+    if (index < 0) {
+        return SYSTEM_ERROR_NETWORK;
+    }
 
-        unsigned int keepalive = 0;
-        system_cloud_get_inet_family_keepalive(a->ai_family, &keepalive);
-        system_cloud_set_inet_family_keepalive(a->ai_family, keepalive, 1);
+    const sockaddr* addr = (const sockaddr*)&addrs->addr[index];
+    LOG(TRACE, "Cloud socket=%d, connected", s);
 
-        break;
+    s_state.socket = s;
+    if (saddrCache) {
+        memcpy(saddrCache, addr, address_length(addr));
     }
 
-    if (clean) {
-        netdb_freeaddrinfo(info);
+    unsigned int keepalive = 0;
+    system_cloud_get_inet_family_keepalive(addr->sa_family, &keepalive);
+    system_cloud_set_inet_family_keepalive(addr->sa_family, keepalive, 1);
+
+#if !defined(SPARK_NO_CLOUD) && HAL_PLATFORM_CLOUD_UDP
+    if (protocol == IPPROTO_UDP) {
+        particle::protocol::connection_properties_t conn_prop = {};
+        conn_prop.size = sizeof(conn_prop);
+        spark_set_connection_property(particle::protocol::Connection::KEEPALIVE_NETWORK,
+                cloud_network_id(s), &conn_prop, nullptr);
     }
+#endif // !defined(SPARK_NO_CLOUD) && HAL_PLATFORM_CLOUD_UDP
 
-    return r;
+    return 0;
 }
 
 int system_cloud_disconnect(int flags)
@@ -31,7 +31,7 @@
 #include "system_user.h"
 #include "spark_wiring_string.h"
 #include "spark_protocol_functions.h"
-#include "append_list.h"
+#include "hashed_list.h"
 #include "core_hal.h"
 #include "deviceid_hal.h"
 #include "ota_flash_hal.h"
@@ -49,8 +49,17 @@
 #include "system_event.h"
 #include "system_cloud_connection.h"
 
+#if HAL_PLATFORM_FILESYSTEM
+#include "filesystem.h"
+#include "file_util.h"
+#include "scope_guard.h"
+#include "check.h"
+#endif
+
 #include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <new>
 
 using particle::CloudDiagnostics;
 
@@ -68,6 +77,7 @@ using particle::LEDStatus;
 
 int userVarType(const char *varKey);
 const void *getUserVar(const char *varKey);
+int readUserVar(const char* varKey, size_t offset, char* data, size_t size, void* reserved);
 int userFuncSchedule(const char *funcKey, const char *paramString, SparkDescriptor::FunctionResultCallback callback, void* reserved);
 
 static int finish_ota_firmware_update(FileTransfer::Descriptor& file, uint32_t flags, void* module);
@@ -91,22 +101,19 @@ ProtocolFacade* system_cloud_protocol_instance(void)
     return sp;
 }
 
-static append_list<User_Var_Lookup_Table_t> vars(5);
-static append_list<User_Func_Lookup_Table_t> funcs(5);
+/**
+ * Variables and functions are looked up by name whenever the cloud requests them, so they're
+ * kept in hashed lists. Room for the first 16 of each is allocated with the first registration.
+ */
+static hashed_list<User_Var_Lookup_Table_t, USER_VAR_KEY_LENGTH, &User_Var_Lookup_Table_t::userVarKey> vars(16);
+static hashed_list<User_Func_Lookup_Table_t, USER_FUNC_KEY_LENGTH, &User_Func_Lookup_Table_t::userFuncKey> funcs(16);
 
 User_Var_Lookup_Table_t* find_var_by_key(const char* varKey)
 {
-    for (int i = vars.size(); i-->0; )
-    {
-        if (0 == strncmp(vars[i].userVarKey, varKey, USER_VAR_KEY_LENGTH))
-        {
-            return &vars[i];
-        }
-    }
-    return NULL;
+    return vars.find(varKey);
 }
 
-template<typename T> T* add_if_sufficient_describe(append_list<T>& list, const char* name, const char* itemType, const T& value) {
+template<typename L, typename T> T* add_if_sufficient_describe(L& list, const char* name, const char* itemType, const T& value) {
 	T* result = list.add(value);
 	if (result) {
 		spark_protocol_describe_data data;
@@ -114,7 +121,7 @@ template<typename T> T* add_if_sufficient_describe(append_list<T>& list, const c
 		data.flags = particle::protocol::DESCRIBE_APPLICATION;
 		if (!spark_protocol_get_describe_data(spark_protocol_instance(), &data, nullptr)) {
 			if (data.maximum_size<data.current_size) {
-				list.removeAt(list.size()-1);
+				list.removeLast();
 				result = nullptr;
 			}
 		}
@@ -133,6 +140,10 @@ User_Var_Lookup_Table_t* find_var_by_key_or_add(const char* varKey, const void*
 	User_Var_Lookup_Table_t item = { .userVar = userVar, .userVarType = userVarType, 0, 0};
 	if (extra) {
 		item.update = extra->update;
+		// older applications pass a smaller structure
+		if (extra->size >= offsetof(spark_variable_t, read) + sizeof(extra->read)) {
+			item.read = extra->read;
+		}
 	}
 	memcpy(item.userVarKey, varKey, USER_VAR_KEY_LENGTH);
 
@@ -149,14 +160,7 @@ User_Var_Lookup_Table_t* find_var_by_key_or_add(const char* varKey, const void*
 
 User_Func_Lookup_Table_t* find_func_by_key(const char* funcKey)
 {
-    for (int i = funcs.size(); i-->0; )
-    {
-        if (0 == strncmp(funcs[i].userFuncKey, funcKey, USER_FUNC_KEY_LENGTH))
-        {
-            return &funcs[i];
-        }
-    }
-    return NULL;
+    return funcs.find(funcKey);
 }
 
 User_Func_Lookup_Table_t* find_func_by_key_or_add(const char* funcKey, const cloud_function_descriptor* desc)
@@ -164,6 +168,7 @@ User_Func_Lookup_Table_t* find_func_by_key_or_add(const char* funcKey, const clo
 	User_Func_Lookup_Table_t item = {0};
 	item.pUserFunc = desc->fn;
 	item.pUserFuncData = desc->data;
+	item.flags = desc->flags;
     memcpy(item.userFuncKey, desc->funcKey, USER_FUNC_KEY_LENGTH);
 
     User_Func_Lookup_Table_t* result = find_func_by_key(funcKey);
@@ -397,8 +402,81 @@ void SystemEvents(const char* name, const char* data)
 using particle::protocol::SessionPersistOpaque;
 using particle::protocol::SessionPersistData;
 
+#if HAL_PLATFORM_FILESYSTEM
+
+namespace {
+
+const auto TRANSFER_STATE_FILE = "/sys/ota_transfer.bin";
+const auto KEEPALIVE_STATE_FILE = "/sys/keepalive.bin";
+const auto SERVER_ADDRESS_FILE = "/sys/cloud_addr.bin";
+
+const char* state_file_path(uint8_t type)
+{
+	switch (type)
+	{
+	case SparkCallbacks::PERSIST_TRANSFER:
+		return TRANSFER_STATE_FILE;
+	case SparkCallbacks::PERSIST_KEEPALIVE:
+		return KEEPALIVE_STATE_FILE;
+	case SparkCallbacks::PERSIST_SERVER_ADDRESS:
+		return SERVER_ADDRESS_FILE;
+	default:
+		return nullptr;
+	}
+}
+
+int save_state_file(const char* path, const void* buffer, size_t length)
+{
+	const auto fs = filesystem_get_instance(nullptr);
+	CHECK_TRUE(fs, SYSTEM_ERROR_FILE);
+	particle::fs::FsLock lock(fs);
+	CHECK(filesystem_mount(fs));
+	if (!length)
+	{
+		lfs_remove(&fs->instance, path);
+		return 0;
+	}
+	lfs_file_t file = {};
+	CHECK(particle::openFile(&file, path, LFS_O_WRONLY));
+	SCOPE_GUARD({
+		lfs_file_close(&fs->instance, &file);
+	});
+	int r = lfs_file_truncate(&fs->instance, &file, 0);
+	CHECK_TRUE(r == LFS_ERR_OK, SYSTEM_ERROR_FILE);
+	r = lfs_file_write(&fs->instance, &file, buffer, length);
+	CHECK_TRUE(r == (int)length, SYSTEM_ERROR_FILE);
+	return 0;
+}
+
+int restore_state_file(const char* path, void* buffer, size_t max_length)
+{
+	const auto fs = filesystem_get_instance(nullptr);
+	CHECK_TRUE(fs, SYSTEM_ERROR_FILE);
+	particle::fs::FsLock lock(fs);
+	CHECK(filesystem_mount(fs));
+	lfs_file_t file = {};
+	CHECK(particle::openFile(&file, path, LFS_O_RDONLY));
+	SCOPE_GUARD({
+		lfs_file_close(&fs->instance, &file);
+	});
+	const int r = lfs_file_read(&fs->instance, &file, buffer, max_length);
+	CHECK_TRUE(r >= 0, SYSTEM_ERROR_FILE);
+	return r;
+}
+
+} // namespace
+
+#endif // HAL_PLATFORM_FILESYSTEM
+
 int Spark_Save(const void* buffer, size_t length, uint8_t type, void* reserved)
 {
+#if HAL_PLATFORM_FILESYSTEM
+	const char* path = state_file_path(type);
+	if (path)
+	{
+		return save_state_file(path, buffer, length);
+	}
+#endif
 	if (type==SparkCallbacks::PERSIST_SESSION)
 	{
 		static_assert(sizeof(SessionPersistOpaque::connection)>=sizeof(g_system_cloud_session_data),"connection space in session is not large enough");
@@ -416,6 +494,15 @@ int Spark_Save(const void* buffer, size_t length, uint8_t type, void* reserved)
 
 int Spark_Restore(void* buffer, size_t max_length, uint8_t type, void* reserved)
 {
+	if (type!=SparkCallbacks::PERSIST_SESSION)
+	{
+#if HAL_PLATFORM_FILESYSTEM
+		const char* path = state_file_path(type);
+		return path ? restore_state_file(path, buffer, max_length) : 0;
+#else
+		return 0;
+#endif
+	}
 	size_t length = 0;
 	int error = HAL_System_Backup_Restore(0, buffer, max_length, &length, nullptr);
 	if (error)
@@ -550,7 +637,9 @@ const void *getUserVar(const char *varKey)
     User_Var_Lookup_Table_t* item = find_var_by_key(varKey);
     const void* result = nullptr;
     if (item) {
-    	if (item->update)
+    	if (item->read)
+            result = "";        // the value is only available in parts, see readUserVar()
+    	else if (item->update)
             result = item->update(item->userVarKey, item->userVarType, item->userVar, nullptr);
     	else
             result = item->userVar;
@@ -558,11 +647,46 @@ const void *getUserVar(const char *varKey)
     return result;
 }
 
-void userFuncScheduleImpl(User_Func_Lookup_Table_t* item, const char* paramString, bool freeParamString, SparkDescriptor::FunctionResultCallback callback)
+int readUserVar(const char* varKey, size_t offset, char* data, size_t size, void* reserved)
+{
+    User_Var_Lookup_Table_t* item = find_var_by_key(varKey);
+    if (!item || !item->read)
+        return -1;
+    return item->read(item->userVarKey, item->userVar, offset, data, size, nullptr);
+}
+
+/**
+ * Counts the sessions with the cloud, so that the result of an asynchronous function call is only
+ * sent in the session the call was received in.
+ */
+static volatile uint32_t cloudSessionCount = 0;
+
+/**
+ * An asynchronous function call waiting for the function's result.
+ */
+struct AsyncFunctionCall
+{
+    SparkDescriptor::FunctionResultCallback callback;
+    uint32_t session;
+};
+
+void userFuncScheduleImpl(User_Func_Lookup_Table_t* item, const char* paramString, bool freeParamString, SparkDescriptor::FunctionResultCallback callback, uint32_t session)
 {
-    int result = item->pUserFunc(item->pUserFuncData, paramString, NULL);
+    int result = SYSTEM_ERROR_NO_MEMORY;
+    AsyncFunctionCall* call = nullptr;
+    if (item->flags & CLOUD_FUNCTION_FLAG_ASYNC) {
+        // the request has been acknowledged already, the result is sent in a separate response
+        // once the function calls spark_function_complete() with this handle
+        call = new(std::nothrow) AsyncFunctionCall{callback, session};
+        if (call)
+            item->pUserFunc(item->pUserFuncData, paramString, call);
+    }
+    else
+        result = item->pUserFunc(item->pUserFuncData, paramString, NULL);
     if (freeParamString)
         delete paramString;
+    if (call)
+        return;
     // run the cloud return on the system thread again
     SYSTEM_THREAD_CONTEXT_ASYNC(callback((const void*)long(result), SparkReturnType::INT));
     callback((const void*)long(result), SparkReturnType::INT);
@@ -575,16 +699,29 @@ int userFuncSchedule(const char *funcKey, const char *paramString, SparkDescript
     if (!item)
         return -1;
 
+    const uint32_t session = cloudSessionCount;
 #if PLATFORM_THREADING
     paramString = strdup(paramString);      // ensure we have a copy since the oriignal isn't guaranteed to be available once this function returns.
-    APPLICATION_THREAD_CONTEXT_ASYNC_RESULT(userFuncScheduleImpl(item, paramString, true, callback), 0);
-    userFuncScheduleImpl(item, paramString, true, callback);
+    APPLICATION_THREAD_CONTEXT_ASYNC_RESULT(userFuncScheduleImpl(item, paramString, true, callback, session), 0);
+    userFuncScheduleImpl(item, paramString, true, callback, session);
 #else
-    userFuncScheduleImpl(item, paramString, false, callback);
+    userFuncScheduleImpl(item, paramString, false, callback, session);
 #endif
     return 0;
 }
 
+int userFuncComplete(void* call, int result)
+{
+    auto asyncCall = static_cast<AsyncFunctionCall*>(call);
+    if (!asyncCall)
+        return SYSTEM_ERROR_INVALID_ARGUMENT;
+    // the response can only be sent in the session the call was received in
+    if (spark_cloud_flag_connected() && asyncCall->session == cloudSessionCount)
+        asyncCall->callback((const void*)long(result), SparkReturnType::INT);
+    delete asyncCall;
+    return 0;
+}
+
 int formatOtaUpdateStatusEventData(uint32_t flags, int result, hal_module_t* module, uint8_t *buf, size_t size)
 {
     int res = 1;
@@ -784,6 +921,7 @@ void Spark_Protocol_Init(void)
         callbacks.finish_firmware_update = finish_ota_firmware_update;
         callbacks.calculate_crc = HAL_Core_Compute_CRC32;
         callbacks.save_firmware_chunk = Spark_Save_Firmware_Chunk;
+        callbacks.read_firmware = Spark_Read_Firmware;
         callbacks.signal = Spark_Signal;
         callbacks.millis = HAL_Timer_Get_Milli_Seconds;
         callbacks.set_time = system_set_time;
@@ -798,6 +936,7 @@ void Spark_Protocol_Init(void)
         descriptor.get_variable_key = getUserVariableKey;
         descriptor.variable_type = wrapVarTypeInEnum;
         descriptor.get_variable = getUserVar;
+        descriptor.read_variable = readUserVar;
         descriptor.was_ota_upgrade_successful = HAL_OTA_Flashed_GetStatus;
         descriptor.ota_upgrade_status_sent = HAL_OTA_Flashed_ResetStatus;
         descriptor.append_system_info = system_module_info;
@@ -853,11 +992,19 @@ void Spark_Protocol_Init(void)
     }
 }
 
-int Spark_Handshake(bool presence_announce)
+int Spark_Handshake(bool presence_announce, bool start)
 {
-    cloud_socket_aborted = false; // Clear cancellation flag for socket operations
-    LOG(INFO,"Starting handshake: presense_announce=%d", presence_announce);
+    if (start)
+    {
+        ++cloudSessionCount; // calls received in the previous session can no longer be completed
+        cloud_socket_aborted = false; // Clear cancellation flag for socket operations
+        LOG(INFO,"Starting handshake: presense_announce=%d", presence_announce);
+    }
     int err = spark_protocol_handshake(sp);
+    if (err == particle::protocol::HANDSHAKE_IN_PROGRESS)
+    {
+        return err;
+    }
     if (!err)
     {
         char buf[CLAIM_CODE_SIZE + 1];
@@ -33,7 +33,12 @@ int Spark_Save(const void* buffer, size_t length, uint8_t type, void* reserved);
 int Spark_Restore(void* buffer, size_t max_length, uint8_t type, void* reserved);
 
 void Spark_Protocol_Init(void);
-int Spark_Handshake(bool presence_announce);
+/**
+ * Runs the cloud handshake as far as it can go without waiting for the server.
+ * @param start true to start a new handshake, false to continue the one in progress.
+ * @return particle::protocol::HANDSHAKE_IN_PROGRESS if the handshake continues on the next call.
+ */
+int Spark_Handshake(bool presence_announce, bool start);
 bool Spark_Communication_Loop(void);
 void Spark_Process_Events();
 
@@ -43,6 +48,7 @@ String bytes2hex(const uint8_t* buf, unsigned len);
 
 bool spark_function_internal(const cloud_function_descriptor* desc, void* reserved);
 int call_raw_user_function(void* data, const char* param, void* reserved);
+int userFuncComplete(void* call, int result);
 
 String spark_deviceID();
 
@@ -53,6 +59,7 @@ struct User_Var_Lookup_Table_t
     char userVarKey[USER_VAR_KEY_LENGTH+1];
 
     const void* (*update)(const char* name, Spark_Data_TypeDef varType, const void* var, void* reserved);
+    int (*read)(const char* name, const void* var, size_t offset, char* data, size_t size, void* reserved);
 };
 
 
@@ -60,6 +67,7 @@ struct User_Func_Lookup_Table_t
 {
     void* pUserFuncData;
     cloud_function_t pUserFunc;
+    uint16_t flags;
     char userFuncKey[USER_FUNC_KEY_LENGTH+1];
 };
 
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifndef UNIT_TEST
+#include "netdb_hal.h"
+#else
+#include <netdb.h>
+#include <sys/socket.h>
+#endif // defined(UNIT_TEST)
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace particle { namespace system { namespace cloud {
+
+const size_t MAX_CLOUD_SERVER_ADDRESSES = 4;
+
+/* netdb_getaddrinfo() doesn't report the TTL of the records, so the saved addresses are kept
+ * for a fixed time */
+const uint32_t CLOUD_SERVER_ADDRESS_TTL = 24 * 60 * 60;
+
+/* The resolved addresses of the cloud server in the order they are tried. They are also saved to
+ * persistent storage, so that the server doesn't need to be resolved again after a reset. */
+struct CloudServerAddresses {
+    uint16_t size;
+    uint8_t count;
+    uint8_t protocol;
+    /* The checksum of the ServerAddress the addresses were resolved from */
+    uint32_t server;
+    /* The Unix time the addresses expire, or 0 if the time wasn't known when they were resolved */
+    uint32_t expires;
+    sockaddr_storage addr[MAX_CLOUD_SERVER_ADDRESSES];
+};
+
+/* Takes the addresses from the list alternating between the address families, as recommended by
+ * RFC 8305, so that a family that can't reach the server doesn't hold up the connection. */
+inline void interleave_addresses(const struct addrinfo* info, CloudServerAddresses& addrs) {
+    const struct addrinfo* preferred[MAX_CLOUD_SERVER_ADDRESSES] = {};
+    const struct addrinfo* other[MAX_CLOUD_SERVER_ADDRESSES] = {};
+    size_t preferredCount = 0;
+    size_t otherCount = 0;
+    for (const struct addrinfo* a = info; a != nullptr; a = a->ai_next) {
+        if (a->ai_family != AF_INET && a->ai_family != AF_INET6) {
+            continue;
+        }
+        if (a->ai_family == info->ai_family) {
+            if (preferredCount < MAX_CLOUD_SERVER_ADDRESSES) {
+                preferred[preferredCount++] = a;
+            }
+        } else if (otherCount < MAX_CLOUD_SERVER_ADDRESSES) {
+            other[otherCount++] = a;
+        }
+    }
+    memset(&addrs, 0, sizeof(addrs));
+    for (size_t i = 0; i < MAX_CLOUD_SERVER_ADDRESSES && addrs.count < MAX_CLOUD_SERVER_ADDRESSES; ++i) {
+        if (i < preferredCount) {
+            memcpy(&addrs.addr[addrs.count++], preferred[i]->ai_addr, preferred[i]->ai_addrlen);
+        }
+        if (i < otherCount && addrs.count < MAX_CLOUD_SERVER_ADDRESSES) {
+            memcpy(&addrs.addr[addrs.count++], other[i]->ai_addr, other[i]->ai_addrlen);
+        }
+    }
+}
+
+/* Returns true if the saved addresses were resolved from the same server and can still be used.
+ * `now` is the Unix time, or 0 if it isn't known, in which case the addresses are used anyway. */
+inline bool server_addresses_usable(const CloudServerAddresses& saved, int protocol, uint32_t server, uint32_t now) {
+    if (saved.size != sizeof(saved) || !saved.count || saved.count > MAX_CLOUD_SERVER_ADDRESSES ||
+            saved.protocol != protocol || saved.server != server) {
+        return false;
+    }
+    return !saved.expires || !now || now < saved.expires;
+}
+
+/* Returns true if the addresses are in the same order as the saved ones */
+inline bool same_server_addresses(const CloudServerAddresses& saved, const CloudServerAddresses& addrs) {
+    return saved.size == addrs.size && saved.protocol == addrs.protocol && saved.server == addrs.server &&
+            saved.count == addrs.count && saved.count <= MAX_CLOUD_SERVER_ADDRESSES &&
+            !memcmp(saved.addr, addrs.addr, saved.count * sizeof(saved.addr[0]));
+}
+
+/* Returns true if the addresses need to be written to persistent storage, which is when they
+ * differ from the saved ones or the saved ones are past half their lifetime. */
+inline bool server_addresses_need_saving(const CloudServerAddresses& saved, const CloudServerAddresses& addrs, uint32_t now) {
+    if (!same_server_addresses(saved, addrs)) {
+        return true;
+    }
+    return now && (!saved.expires || saved.expires <= now + CLOUD_SERVER_ADDRESS_TTL / 2);
+}
+
+} } } /* particle::system::cloud */
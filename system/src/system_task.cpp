@@ -39,7 +39,8 @@
 #include "service_debug.h"
 #include "cellular_hal.h"
 #include "system_power.h"
-#include "simple_pool_allocator.h"
+#include "size_class_pool_allocator.h"
+#include "check.h"
 
 #include "spark_wiring_network.h"
 #include "spark_wiring_constants.h"
@@ -49,6 +50,8 @@
 #include "spark_wiring_led.h"
 #include "system_commands.h"
 
+#include <algorithm>
+
 #if HAL_PLATFORM_BLE
 #include "ble_hal.h"
 #include "system_control_internal.h"
@@ -334,12 +337,18 @@ void establish_cloud_connection()
     }
 }
 
+/**
+ * Set while the handshake is waiting for the server between passes of the system loop.
+ */
+static bool cloud_handshake_pending = false;
+
 int cloud_handshake()
 {
 	bool udp = HAL_Feature_Get(FEATURE_CLOUD_UDP);
     feature_cloud_udp = (uint8_t)udp;
 	bool presence_announce = !udp;
-	int err = Spark_Handshake(presence_announce);
+	int err = Spark_Handshake(presence_announce, !cloud_handshake_pending);
+	cloud_handshake_pending = (err == particle::protocol::HANDSHAKE_IN_PROGRESS);
 	return err;
 }
 
@@ -355,6 +364,11 @@ void handle_cloud_connection(bool force_events)
         {
             LED_SIGNAL_START(CLOUD_HANDSHAKE, NORMAL);
             int err = cloud_handshake();
+            if (err == particle::protocol::HANDSHAKE_IN_PROGRESS)
+            {
+                // continued on the next pass, so buttons, LEDs and the application keep running
+                return;
+            }
             if (err)
             {
                 if (!SPARK_WLAN_RESET && !network_listening(0, 0, 0))
@@ -588,6 +602,12 @@ void cloud_disconnect(bool closeSocket, bool graceful, cloud_disconnect_reason r
         SPARK_FLASH_UPDATE = 0;
         SPARK_CLOUD_CONNECTED = 0;
         SPARK_CLOUD_SOCKETED = 0;
+        // the protocol keeps its handshake state across sockets, so a pending handshake is
+        // cancelled explicitly rather than resumed on the next connection
+        if (cloud_handshake_pending) {
+            spark_protocol_command(system_cloud_protocol_instance(), ProtocolCommands::CANCEL_HANDSHAKE, 0, nullptr);
+            cloud_handshake_pending = false;
+        }
 
         LED_SIGNAL_STOP(CLOUD_CONNECTED);
         LED_SIGNAL_STOP(CLOUD_HANDSHAKE);
@@ -639,25 +659,48 @@ void cancel_connection()
     Spark_Abort();
 }
 
+#ifndef SYSTEM_POOL_SIZE_CLASSES
+// Block size and number of blocks of each size class of the system pool. The smaller class is sized
+// for system event tasks. Each of the USB_REQUEST_MAX_ACTIVE_COUNT (4) active USB control requests
+// needs a block for its Request structure (about 64 bytes on ARM) and another one for its data, which
+// is allocated from the pool if it's not larger than USB_REQUEST_MAX_POOLED_BUFFER_SIZE (64), hence
+// 8 blocks of the larger class
+#define SYSTEM_POOL_SIZE_CLASSES { 8 * sizeof(uintptr_t), 8 }, { 16 * sizeof(uintptr_t), 8 }
+#endif
+
 namespace {
 
+const particle::SizeClassPool::SizeClass g_memPoolClasses[] = { SYSTEM_POOL_SIZE_CLASSES };
+
 // Memory pool for small and short-lived allocations
-SimpleAllocedPool g_memPool(512);
+particle::SizeClassPool g_memPool(g_memPoolClasses, arraySize(g_memPoolClasses));
 
 } // namespace
 
 void* system_pool_alloc(size_t size, void* reserved) {
-    void *ptr = nullptr;
-    ATOMIC_BLOCK() {
-        ptr = g_memPool.allocate(size);
-    }
-    return ptr;
+    return g_memPool.alloc(size);
 }
 
 void system_pool_free(void* ptr, void* reserved) {
-    ATOMIC_BLOCK() {
-        g_memPool.deallocate(ptr);
-    }
+    g_memPool.free(ptr);
+}
+
+int system_pool_get_stats(unsigned index, system_pool_stats* stats, void* reserved) {
+    CHECK_TRUE(stats && stats->size >= sizeof(system_pool_stats), SYSTEM_ERROR_INVALID_ARGUMENT);
+    particle::SizeClassPool::Stats s = {};
+    CHECK(g_memPool.stats(index, &s));
+    // The counters are saturated rather than truncated to the size of the fields
+    const auto sat16 = [](size_t val) {
+        return (uint16_t)std::min<size_t>(val, UINT16_MAX);
+    };
+    stats->size = sizeof(system_pool_stats);
+    stats->block_size = sat16(s.blockSize);
+    stats->block_count = sat16(s.blockCount);
+    stats->used = sat16(s.used);
+    stats->high_water = sat16(s.highWater);
+    stats->reserved = 0;
+    stats->failures = (uint32_t)std::min<size_t>(s.failures, UINT32_MAX);
+    return g_memPool.classCount();
 }
 
 int system_invoke_event_handler(uint16_t handlerInfoSize, FilteringEventHandler* handlerInfo,
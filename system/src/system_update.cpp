@@ -237,8 +237,60 @@ void set_flag(void* flag)
 	*p = true;
 }
 
+/**
+ * The installed module that a delta update is applied to.
+ */
+static const uint8_t* delta_source_address = nullptr;
+static uint32_t delta_source_length = 0;
+
+/**
+ * Finds the installed module that a patch applies to, by its length and CRC.
+ */
+static int select_delta_source(const FileTransfer::Patch& patch)
+{
+    delta_source_address = nullptr;
+    delta_source_length = 0;
+    hal_system_info_t info = {};
+    info.size = sizeof(info);
+    HAL_System_Info(&info, true, nullptr);
+    for (unsigned i = 0; i < info.module_count; i++) {
+        const hal_module_t& module = info.modules[i];
+        if (!module.info || !module.crc || !(module.validity_result & MODULE_VALIDATION_INTEGRITY)) {
+            continue;
+        }
+        // the CRC is stored big-endian at the end of the module
+        const uint8_t* crc = (const uint8_t*)module.crc;
+        const uint32_t crc32 = uint32_t(crc[0]) << 24 | uint32_t(crc[1]) << 16 | uint32_t(crc[2]) << 8 | crc[3];
+        const uint32_t length = module_length(module.info) + sizeof(module_info_crc_t);
+        if (length == patch.source_length && crc32 == patch.source_crc) {
+            delta_source_address = (const uint8_t*)module.info->module_start_address;
+            delta_source_length = length;
+            break;
+        }
+    }
+    HAL_System_Info(&info, false, nullptr);
+    return delta_source_address ? 0 : SYSTEM_ERROR_NOT_FOUND;
+}
+
+int Spark_Read_Firmware(uint32_t offset, uint8_t* data, size_t length, void* reserved)
+{
+    if (!delta_source_address) {
+        return SYSTEM_ERROR_INVALID_STATE;
+    }
+    if (offset > delta_source_length || length > delta_source_length - offset) {
+        return SYSTEM_ERROR_OUT_OF_RANGE;
+    }
+    memcpy(data, delta_source_address + offset, length);
+    return 0;
+}
+
 int Spark_Prepare_For_Firmware_Update(FileTransfer::Descriptor& file, uint32_t flags, void* reserved)
 {
+    const FileTransfer::Patch* patch = (const FileTransfer::Patch*)reserved;
+    if (patch && (file.store != FileTransfer::Store::FIRMWARE || select_delta_source(*patch) != 0)) {
+        // the server sends the complete image instead
+        return 1;
+    }
     if (file.store==FileTransfer::Store::FIRMWARE)
     {
         // address is relative to the OTA region. Normally will be 0.
@@ -255,6 +307,8 @@ int Spark_Prepare_For_Firmware_Update(FileTransfer::Descriptor& file, uint32_t f
         // only check address
     }
     else {
+        // a resumed transfer keeps the data already written
+        const bool resume = (flags & 2);
         uint32_t start = HAL_Timer_Milliseconds();
         system_set_flag(SYSTEM_FLAG_OTA_UPDATE_PENDING, 1, nullptr);
 
@@ -273,7 +327,12 @@ int Spark_Prepare_For_Firmware_Update(FileTransfer::Descriptor& file, uint32_t f
             SPARK_FLASH_UPDATE = 1;
             TimingFlashUpdateTimeout = 0;
             system_notify_event(firmware_update, firmware_update_begin, &file);
-            HAL_FLASH_Begin(file.file_address, file.file_length, NULL);
+            if (resume) {
+                // keep the data already written, but the status of a previous update is no longer valid
+                HAL_OTA_Flashed_ResetStatus();
+            } else {
+                HAL_FLASH_Begin(file.file_address, file.file_length, NULL);
+            }
         }
         else
         {
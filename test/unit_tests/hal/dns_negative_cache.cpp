@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "dns_negative_cache.h"
+#include "catch.h"
+
+#include <string>
+
+using namespace particle::net;
+
+namespace {
+
+const uint8_t IPV4 = 0;
+const uint8_t IPV6 = 1;
+
+} // namespace
+
+TEST_CASE("DnsNegativeCache") {
+    DnsNegativeCache cache;
+    const system_tick_t now = 1000;
+
+    SECTION("a failed lookup is remembered for the hostname and address type") {
+        cache.add("example.com", IPV6, now);
+        CHECK(cache.find("example.com", IPV6, now));
+        CHECK_FALSE(cache.find("example.com", IPV4, now));
+        CHECK_FALSE(cache.find("example.org", IPV6, now));
+    }
+    SECTION("hostnames are compared case-insensitively") {
+        cache.add("Example.COM", IPV4, now);
+        CHECK(cache.find("example.com", IPV4, now));
+    }
+    SECTION("entries expire") {
+        cache.add("example.com", IPV4, now);
+        CHECK(cache.find("example.com", IPV4, now + DnsNegativeCache::TTL - 1));
+        CHECK_FALSE(cache.find("example.com", IPV4, now + DnsNegativeCache::TTL));
+    }
+    SECTION("entries expire across a wraparound of the tick counter") {
+        const system_tick_t t = 0xffffffff - 10;
+        cache.add("example.com", IPV4, t);
+        CHECK(cache.find("example.com", IPV4, t + 100));
+        CHECK_FALSE(cache.find("example.com", IPV4, t + DnsNegativeCache::TTL));
+    }
+    SECTION("adding a hostname again extends its lifetime") {
+        cache.add("example.com", IPV4, now);
+        cache.add("example.com", IPV4, now + 1000);
+        CHECK(cache.find("example.com", IPV4, now + DnsNegativeCache::TTL));
+    }
+    SECTION("the entry that expires first is replaced when the cache is full") {
+        for (size_t i = 0; i < DnsNegativeCache::MAX_ENTRIES; ++i) {
+            cache.add(("host" + std::to_string(i)).c_str(), IPV4, now + i);
+        }
+        cache.add("other", IPV4, now + 100);
+        CHECK(cache.find("other", IPV4, now + 100));
+        CHECK_FALSE(cache.find("host0", IPV4, now + 100));
+        for (size_t i = 1; i < DnsNegativeCache::MAX_ENTRIES; ++i) {
+            CHECK(cache.find(("host" + std::to_string(i)).c_str(), IPV4, now + 100));
+        }
+    }
+    SECTION("clear() forgets all entries") {
+        cache.add("example.com", IPV4, now);
+        cache.add("example.org", IPV6, now);
+        cache.clear();
+        CHECK_FALSE(cache.find("example.com", IPV4, now));
+        CHECK_FALSE(cache.find("example.org", IPV6, now));
+    }
+    SECTION("a failure reported before the query could time out is remembered") {
+        CHECK(cache.addFailed("example.com", IPV6, now, now + 200));
+        CHECK(cache.find("example.com", IPV6, now + 200));
+    }
+    SECTION("a failure that may be a timeout isn't remembered") {
+        CHECK_FALSE(cache.addFailed("example.com", IPV6, now, now + DnsNegativeCache::MIN_QUERY_TIMEOUT));
+        CHECK_FALSE(cache.find("example.com", IPV6, now + DnsNegativeCache::MIN_QUERY_TIMEOUT));
+    }
+}
@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ringbuffer.h"
+#include "catch.h"
+
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <cstdint>
+
+using namespace particle::services;
+
+namespace {
+
+const size_t BUFFER_SIZE = 10;
+
+} // namespace
+
+TEST_CASE("SpscRingBuffer") {
+    uint8_t buf[BUFFER_SIZE] = {};
+    SpscRingBuffer<uint8_t> rb(buf, sizeof(buf));
+
+    SECTION("is empty after initialization") {
+        CHECK(rb.size() == BUFFER_SIZE);
+        CHECK(rb.empty());
+        CHECK_FALSE(rb.full());
+        CHECK(rb.data() == 0);
+        CHECK(rb.space() == BUFFER_SIZE);
+        uint8_t v = 0;
+        CHECK(rb.get(&v) == SYSTEM_ERROR_TOO_LARGE);
+    }
+    SECTION("elements are read in the order they were written") {
+        const uint8_t in[] = { 1, 2, 3, 4 };
+        CHECK(rb.put(in, sizeof(in)) == sizeof(in));
+        CHECK(rb.put(5) == 1);
+        CHECK(rb.data() == 5);
+        uint8_t out[5] = {};
+        CHECK(rb.peek(out, 2) == 2);
+        CHECK((out[0] == 1 && out[1] == 2));
+        CHECK(rb.get(out, sizeof(out)) == sizeof(out));
+        CHECK((out[0] == 1 && out[3] == 4 && out[4] == 5));
+        CHECK(rb.empty());
+    }
+    SECTION("can be filled up completely") {
+        const uint8_t in[BUFFER_SIZE] = {};
+        CHECK(rb.put(in, sizeof(in)) == sizeof(in));
+        CHECK(rb.full());
+        CHECK(rb.space() == 0);
+        CHECK(rb.put(1) == SYSTEM_ERROR_TOO_LARGE);
+        CHECK(rb.get(nullptr, 1) == 1); // Skips an element
+        CHECK(rb.space() == 1);
+    }
+    SECTION("writes wrap around the end of the buffer") {
+        uint8_t out[BUFFER_SIZE] = {};
+        for (unsigned i = 0; i < 5 * BUFFER_SIZE; i += 7) {
+            uint8_t in[7];
+            for (unsigned j = 0; j < sizeof(in); ++j) {
+                in[j] = i + j;
+            }
+            REQUIRE(rb.put(in, sizeof(in)) == sizeof(in));
+            REQUIRE(rb.get(out, sizeof(in)) == sizeof(in));
+            REQUIRE(memcmp(in, out, sizeof(in)) == 0);
+        }
+    }
+    SECTION("spans don't wrap around the end of the buffer") {
+        const uint8_t in[7] = {};
+        rb.put(in, sizeof(in));
+        rb.get(nullptr, 5);
+        // Free space: 3 elements at the end of the buffer and 5 at the beginning
+        CHECK(rb.acquirable() == 3);
+        CHECK(rb.acquire(4) == nullptr);
+        uint8_t* p = rb.acquire(3);
+        CHECK(p == buf + 7);
+        p[0] = 7; p[1] = 8; p[2] = 9;
+        CHECK(rb.acquireCommit(3) == 3);
+        CHECK(rb.acquirable() == 5);
+        CHECK(rb.acquire(5) == buf);
+        CHECK(rb.acquireCommit(2) == 2);
+        // Data: 5 elements at the end of the buffer and 2 at the beginning
+        CHECK(rb.data() == 7);
+        CHECK(rb.consumable() == 5);
+        const uint8_t* c = rb.consume(5);
+        CHECK(c == buf + 5);
+        CHECK((c[2] == 7 && c[4] == 9));
+        CHECK(rb.consumeCommit(5) == 5);
+        CHECK(rb.consumable() == 2);
+        CHECK(rb.consume(3) == nullptr);
+        CHECK(rb.consumeCommit(3) == SYSTEM_ERROR_TOO_LARGE);
+    }
+    SECTION("can be reset") {
+        rb.put(1);
+        rb.reset();
+        CHECK(rb.empty());
+    }
+}
+
+TEST_CASE("SpscRingBuffer with concurrent producer and consumer") {
+    const uint32_t count = 100000;
+    uint32_t buf[64];
+    SpscRingBuffer<uint32_t> rb(buf, 64);
+    std::atomic<bool> stop(false);
+    std::thread producer([&rb, &stop]() {
+        for (uint32_t i = 0; i < count && !stop;) {
+            size_t n = std::min<size_t>(rb.acquirable(), count - i);
+            uint32_t* p = rb.acquire(n);
+            for (size_t j = 0; p && j < n; ++j) {
+                p[j] = i++;
+            }
+            if (p) {
+                rb.acquireCommit(n);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    });
+    bool ok = true;
+    for (uint32_t i = 0; i < count && ok;) {
+        uint32_t v = 0;
+        if (rb.get(&v) == 1) {
+            ok = (v == i++);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    stop = true; // In case of an error
+    producer.join();
+    CHECK(ok);
+    CHECK(rb.empty());
+}
+
+TEST_CASE("MpscRingBuffer") {
+    uint8_t buf[BUFFER_SIZE] = {};
+    MpscRingBuffer<uint8_t> rb(buf, sizeof(buf));
+
+    SECTION("elements are read in the order they were written") {
+        const uint8_t in[] = { 1, 2, 3 };
+        CHECK(rb.put(in, sizeof(in)) == sizeof(in));
+        CHECK(rb.put(4) == 1);
+        CHECK(rb.data() == 4);
+        CHECK(rb.space() == BUFFER_SIZE - 4);
+        uint8_t out[4] = {};
+        CHECK(rb.get(out, sizeof(out)) == sizeof(out));
+        CHECK((out[0] == 1 && out[3] == 4));
+        CHECK(rb.empty());
+    }
+    SECTION("can be filled up completely") {
+        const uint8_t in[BUFFER_SIZE] = {};
+        CHECK(rb.put(in, sizeof(in)) == sizeof(in));
+        CHECK(rb.full());
+        CHECK(rb.put(1) == SYSTEM_ERROR_TOO_LARGE);
+        CHECK(rb.acquire(1) == nullptr);
+    }
+    SECTION("elements are not visible to the consumer while a write is in progress") {
+        uint8_t* p = rb.acquire(2);
+        REQUIRE(p == buf);
+        CHECK(rb.put(3) == 1); // Another producer
+        CHECK(rb.space() == BUFFER_SIZE - 3);
+        CHECK(rb.empty());
+        p[0] = 1; p[1] = 2;
+        CHECK(rb.acquireCommit(2, 2) == 2);
+        CHECK(rb.data() == 3);
+        uint8_t out[3] = {};
+        CHECK(rb.get(out, sizeof(out)) == sizeof(out));
+        CHECK((out[0] == 1 && out[1] == 2 && out[2] == 3));
+    }
+    SECTION("acquired spans are contiguous") {
+        const uint8_t in[8] = {};
+        rb.put(in, sizeof(in));
+        rb.get(nullptr, sizeof(in));
+        CHECK(rb.acquire(3) == nullptr);
+        CHECK(rb.acquire(2) == buf + 8);
+        rb.acquireCommit(2, 2);
+        CHECK(rb.put(in, 3) == 3); // Copying wraps around
+        CHECK(rb.consumable() == 2);
+        CHECK(rb.data() == 5);
+    }
+    SECTION("spans are committed with the acquired size only") {
+        uint8_t* p = rb.acquire(4);
+        REQUIRE(p == buf);
+        CHECK(rb.acquireCommit(2, 4) == SYSTEM_ERROR_INVALID_ARGUMENT);
+        CHECK(rb.acquireCommit(5, 4) == SYSTEM_ERROR_INVALID_ARGUMENT);
+        CHECK(rb.empty()); // Still in progress
+        CHECK(rb.acquireCommit(4, 4) == 4);
+        CHECK(rb.data() == 4);
+    }
+    SECTION("sizes that don't fit in the state word are rejected") {
+        CHECK(rb.init(buf, MpscRingBuffer<uint8_t>::MAX_SIZE + 1) == SYSTEM_ERROR_TOO_LARGE);
+        CHECK(rb.size() == 0);
+        CHECK(rb.put(1) == SYSTEM_ERROR_TOO_LARGE);
+        CHECK(rb.init(buf, sizeof(buf)) == 0);
+        CHECK(rb.put(1) == 1);
+    }
+}
+
+TEST_CASE("MpscRingBuffer with concurrent producers") {
+    const unsigned producerCount = 4;
+    const uint32_t count = 25000; // Per producer
+    uint32_t buf[64];
+    MpscRingBuffer<uint32_t> rb(buf, 64);
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> producers;
+    for (unsigned id = 0; id < producerCount; ++id) {
+        producers.emplace_back([&rb, &stop, id]() {
+            for (uint32_t i = 0; i < count && !stop;) {
+                // Element: producer ID in the upper bits, sequence number in the lower bits
+                const uint32_t v[2] = { (id << 24) | i, (id << 24) | (i + 1) };
+                if (rb.put(v, 2) == 2) {
+                    i += 2;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    uint32_t next[producerCount] = {};
+    bool ok = true;
+    for (uint32_t total = 0; total < producerCount * count && ok;) {
+        uint32_t v = 0;
+        if (rb.get(&v) == 1) {
+            const unsigned id = v >> 24;
+            ok = (id < producerCount && (v & 0xffffff) == next[id]++);
+            ++total;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    stop = true;
+    for (auto& t: producers) {
+        t.join();
+    }
+    CHECK(ok);
+    CHECK(rb.empty());
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Throughput of the ring buffers with a producer and a consumer running in separate threads.
+ * The locked variant emulates the critical sections that callers of RingBuffer need. These
+ * test cases are hidden, run them with:
+ *
+ * ./services "[benchmark]"
+ */
+
+#include "ringbuffer.h"
+#include "catch.h"
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace particle::services;
+
+namespace {
+
+const size_t BUFFER_SIZE = 1024;
+const size_t CHUNK_SIZE = 64;
+const size_t TOTAL_SIZE = 64 * 1024 * 1024;
+
+struct LockedRingBuffer {
+    RingBuffer<uint8_t> rb;
+    std::mutex mutex;
+
+    LockedRingBuffer(uint8_t* buf, size_t size) :
+            rb(buf, size) {
+    }
+
+    ssize_t put(const uint8_t* data, size_t size) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return rb.put(data, size);
+    }
+
+    ssize_t get(uint8_t* data, size_t size) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return rb.get(data, size);
+    }
+};
+
+template<typename RingBufferT>
+void benchmark(const char* name, RingBufferT& rb, unsigned producerCount) {
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> producers;
+    for (unsigned i = 0; i < producerCount; ++i) {
+        producers.emplace_back([&rb, producerCount]() {
+            uint8_t chunk[CHUNK_SIZE] = {};
+            for (size_t n = 0; n < TOTAL_SIZE / producerCount;) {
+                if (rb.put(chunk, sizeof(chunk)) > 0) {
+                    n += sizeof(chunk);
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    uint8_t chunk[CHUNK_SIZE] = {};
+    for (size_t n = 0; n < TOTAL_SIZE;) {
+        if (rb.get(chunk, sizeof(chunk)) > 0) {
+            n += sizeof(chunk);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    for (auto& t: producers) {
+        t.join();
+    }
+    const std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+    std::cout << name << ": " << (unsigned)(TOTAL_SIZE / time.count() / (1024 * 1024)) << " MB/s" << std::endl;
+}
+
+} // namespace
+
+TEST_CASE("Ring buffer throughput", "[.benchmark]") {
+    std::unique_ptr<uint8_t[]> buf(new uint8_t[BUFFER_SIZE]);
+    SECTION("RingBuffer with a mutex, 1 producer") {
+        LockedRingBuffer rb(buf.get(), BUFFER_SIZE);
+        benchmark("RingBuffer with a mutex, 1 producer", rb, 1);
+    }
+    SECTION("SpscRingBuffer") {
+        SpscRingBuffer<uint8_t> rb(buf.get(), BUFFER_SIZE);
+        benchmark("SpscRingBuffer", rb, 1);
+    }
+    SECTION("RingBuffer with a mutex, 4 producers") {
+        LockedRingBuffer rb(buf.get(), BUFFER_SIZE);
+        benchmark("RingBuffer with a mutex, 4 producers", rb, 4);
+    }
+    SECTION("MpscRingBuffer, 4 producers") {
+        MpscRingBuffer<uint8_t> rb(buf.get(), BUFFER_SIZE);
+        benchmark("MpscRingBuffer, 4 producers", rb, 4);
+    }
+}
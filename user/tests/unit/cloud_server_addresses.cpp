@@ -0,0 +1,182 @@
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include "tools/catch.h"
+#include "system_cloud_server_addresses.h"
+
+using namespace particle::system::cloud;
+
+namespace {
+
+// A list of resolved addresses in the order getaddrinfo() returned them
+class AddrInfoList {
+public:
+    AddrInfoList& add(int family, const char* host) {
+        Entry e = {};
+        e.info.ai_family = family;
+        if (family == AF_INET) {
+            auto a = (sockaddr_in*)&e.addr;
+            a->sin_family = AF_INET;
+            inet_pton(AF_INET, host, &a->sin_addr);
+            e.info.ai_addrlen = sizeof(sockaddr_in);
+        } else if (family == AF_INET6) {
+            auto a = (sockaddr_in6*)&e.addr;
+            a->sin6_family = AF_INET6;
+            inet_pton(AF_INET6, host, &a->sin6_addr);
+            e.info.ai_addrlen = sizeof(sockaddr_in6);
+        }
+        entries_.push_back(e);
+        return *this;
+    }
+
+    const addrinfo* get() {
+        for (size_t i = 0; i < entries_.size(); ++i) {
+            entries_[i].info.ai_addr = (sockaddr*)&entries_[i].addr;
+            entries_[i].info.ai_next = (i + 1 < entries_.size()) ? &entries_[i + 1].info : nullptr;
+        }
+        return entries_.empty() ? nullptr : &entries_[0].info;
+    }
+
+private:
+    struct Entry {
+        addrinfo info;
+        sockaddr_storage addr;
+    };
+
+    std::vector<Entry> entries_;
+};
+
+std::string host(const sockaddr_storage& addr) {
+    char buf[INET6_ADDRSTRLEN] = {};
+    if (addr.ss_family == AF_INET) {
+        inet_ntop(AF_INET, &((const sockaddr_in*)&addr)->sin_addr, buf, sizeof(buf));
+    } else if (addr.ss_family == AF_INET6) {
+        inet_ntop(AF_INET6, &((const sockaddr_in6*)&addr)->sin6_addr, buf, sizeof(buf));
+    }
+    return buf;
+}
+
+std::vector<std::string> hosts(const CloudServerAddresses& addrs) {
+    std::vector<std::string> result;
+    for (size_t i = 0; i < addrs.count; ++i) {
+        result.push_back(host(addrs.addr[i]));
+    }
+    return result;
+}
+
+CloudServerAddresses resolved(AddrInfoList& list, uint32_t expires = 0) {
+    CloudServerAddresses addrs = {};
+    interleave_addresses(list.get(), addrs);
+    addrs.size = sizeof(addrs);
+    addrs.protocol = IPPROTO_TCP;
+    addrs.server = 0x1234;
+    addrs.expires = expires;
+    return addrs;
+}
+
+} // namespace
+
+TEST_CASE("cloud server addresses are ordered") {
+    CloudServerAddresses addrs = {};
+
+    SECTION("address families alternate, starting with the first one resolved") {
+        AddrInfoList list;
+        list.add(AF_INET, "10.0.0.1").add(AF_INET, "10.0.0.2").add(AF_INET6, "2001:db8::1").add(AF_INET6, "2001:db8::2");
+        interleave_addresses(list.get(), addrs);
+        CHECK(hosts(addrs) == std::vector<std::string>({ "10.0.0.1", "2001:db8::1", "10.0.0.2", "2001:db8::2" }));
+
+        AddrInfoList list6;
+        list6.add(AF_INET6, "2001:db8::1").add(AF_INET, "10.0.0.1").add(AF_INET, "10.0.0.2");
+        interleave_addresses(list6.get(), addrs);
+        CHECK(hosts(addrs) == std::vector<std::string>({ "2001:db8::1", "10.0.0.1", "10.0.0.2" }));
+    }
+
+    SECTION("the remaining addresses of one family follow when the other runs out") {
+        AddrInfoList list;
+        list.add(AF_INET, "10.0.0.1").add(AF_INET, "10.0.0.2").add(AF_INET, "10.0.0.3").add(AF_INET6, "2001:db8::1");
+        interleave_addresses(list.get(), addrs);
+        CHECK(hosts(addrs) == std::vector<std::string>({ "10.0.0.1", "2001:db8::1", "10.0.0.2", "10.0.0.3" }));
+    }
+
+    SECTION("at most MAX_CLOUD_SERVER_ADDRESSES addresses are kept") {
+        AddrInfoList list;
+        for (int i = 1; i <= 6; ++i) {
+            list.add(AF_INET, ("10.0.0." + std::to_string(i)).c_str());
+        }
+        interleave_addresses(list.get(), addrs);
+        CHECK(hosts(addrs) == std::vector<std::string>({ "10.0.0.1", "10.0.0.2", "10.0.0.3", "10.0.0.4" }));
+    }
+
+    SECTION("addresses of other families are skipped") {
+        AddrInfoList list;
+        list.add(AF_INET, "10.0.0.1").add(AF_UNIX, "").add(AF_INET, "10.0.0.2");
+        interleave_addresses(list.get(), addrs);
+        CHECK(hosts(addrs) == std::vector<std::string>({ "10.0.0.1", "10.0.0.2" }));
+    }
+
+    SECTION("an empty list gives no addresses") {
+        interleave_addresses(nullptr, addrs);
+        CHECK(addrs.count == 0);
+    }
+}
+
+TEST_CASE("cloud server addresses are persisted") {
+    const uint32_t now = 1500000000;
+    AddrInfoList list;
+    list.add(AF_INET, "10.0.0.1").add(AF_INET6, "2001:db8::1");
+    const CloudServerAddresses saved = resolved(list, now + CLOUD_SERVER_ADDRESS_TTL);
+
+    SECTION("saved addresses are used for the same server until they expire") {
+        CHECK(server_addresses_usable(saved, IPPROTO_TCP, 0x1234, now));
+        CHECK(server_addresses_usable(saved, IPPROTO_TCP, 0x1234, 0));
+        CHECK_FALSE(server_addresses_usable(saved, IPPROTO_UDP, 0x1234, now));
+        CHECK_FALSE(server_addresses_usable(saved, IPPROTO_TCP, 0x4321, now));
+        CHECK_FALSE(server_addresses_usable(saved, IPPROTO_TCP, 0x1234, now + CLOUD_SERVER_ADDRESS_TTL));
+    }
+
+    SECTION("addresses saved without a valid time don't expire") {
+        CloudServerAddresses untimed = saved;
+        untimed.expires = 0;
+        CHECK(server_addresses_usable(untimed, IPPROTO_TCP, 0x1234, now + 10 * CLOUD_SERVER_ADDRESS_TTL));
+    }
+
+    SECTION("invalid saved data isn't used") {
+        CloudServerAddresses invalid = saved;
+        invalid.size = 0;
+        CHECK_FALSE(server_addresses_usable(invalid, IPPROTO_TCP, 0x1234, now));
+        invalid = saved;
+        invalid.count = 0;
+        CHECK_FALSE(server_addresses_usable(invalid, IPPROTO_TCP, 0x1234, now));
+        invalid.count = MAX_CLOUD_SERVER_ADDRESSES + 1;
+        CHECK_FALSE(server_addresses_usable(invalid, IPPROTO_TCP, 0x1234, now));
+    }
+
+    SECTION("the same addresses aren't written again") {
+        CHECK_FALSE(server_addresses_need_saving(saved, resolved(list, now + 60 + CLOUD_SERVER_ADDRESS_TTL), now + 60));
+        // the expiry time is only known now
+        CHECK_FALSE(server_addresses_need_saving(saved, resolved(list), 0));
+    }
+
+    SECTION("changed addresses are written") {
+        AddrInfoList reordered;
+        reordered.add(AF_INET6, "2001:db8::1").add(AF_INET, "10.0.0.1");
+        CHECK(server_addresses_need_saving(saved, resolved(reordered, now + CLOUD_SERVER_ADDRESS_TTL), now));
+        AddrInfoList other;
+        other.add(AF_INET, "10.0.0.2").add(AF_INET6, "2001:db8::1");
+        CHECK(server_addresses_need_saving(saved, resolved(other, now + CLOUD_SERVER_ADDRESS_TTL), now));
+        AddrInfoList fewer;
+        fewer.add(AF_INET, "10.0.0.1");
+        CHECK(server_addresses_need_saving(saved, resolved(fewer, now + CLOUD_SERVER_ADDRESS_TTL), now));
+        CloudServerAddresses otherServer = resolved(list, now + CLOUD_SERVER_ADDRESS_TTL);
+        otherServer.server = 0x4321;
+        CHECK(server_addresses_need_saving(saved, otherServer, now));
+    }
+
+    SECTION("the same addresses are written again once half their lifetime has passed") {
+        const uint32_t later = now + CLOUD_SERVER_ADDRESS_TTL / 2;
+        CHECK(server_addresses_need_saving(saved, resolved(list, later + CLOUD_SERVER_ADDRESS_TTL), later));
+        CloudServerAddresses untimed = saved;
+        untimed.expires = 0;
+        CHECK(server_addresses_need_saving(untimed, resolved(list, now + CLOUD_SERVER_ADDRESS_TTL), now));
+    }
+}
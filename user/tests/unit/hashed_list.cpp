@@ -0,0 +1,139 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "tools/catch.h"
+#include "hashed_list.h"
+
+namespace {
+
+struct Item {
+    char key[4 + 1];
+    int value;
+};
+
+typedef hashed_list<Item, 4, &Item::key> ItemList;
+
+Item item(const char* key, int value = 0) {
+    Item item = {};
+    strncpy(item.key, key, sizeof(item.key) - 1);
+    item.value = value;
+    return item;
+}
+
+std::string key(int i) {
+    char buf[8];
+    snprintf(buf, sizeof(buf), "k%d", i);
+    return buf;
+}
+
+// Finds keys whose hashes map to the same slot of a table with the given number of slots
+std::vector<std::string> collidingKeys(size_t count, unsigned slotCount) {
+    std::vector<std::string> keys;
+    const uint32_t slot = ItemList::hash("k0") & (slotCount - 1);
+    for (int i = 0; keys.size() < count; ++i) {
+        const std::string k = key(i);
+        if ((ItemList::hash(k.c_str()) & (slotCount - 1)) == slot) {
+            keys.push_back(k);
+        }
+    }
+    return keys;
+}
+
+} // namespace
+
+TEST_CASE("hashed_list") {
+    ItemList list;
+
+    SECTION("an empty list has no elements") {
+        CHECK(list.size() == 0);
+        CHECK(list.find("a") == nullptr);
+    }
+
+    SECTION("elements are found by key") {
+        REQUIRE(list.add(item("a", 1)) != nullptr);
+        REQUIRE(list.add(item("b", 2)) != nullptr);
+        REQUIRE(list.find("a") != nullptr);
+        CHECK(list.find("a")->value == 1);
+        REQUIRE(list.find("b") != nullptr);
+        CHECK(list.find("b")->value == 2);
+        CHECK(list.find("c") == nullptr);
+    }
+
+    SECTION("keys are compared up to the key length") {
+        REQUIRE(list.add(item("abcd", 1)) != nullptr);
+        REQUIRE(list.find("abcdef") != nullptr);
+        CHECK(list.find("abcdef")->value == 1);
+        CHECK(list.find("abc") == nullptr);
+    }
+
+    SECTION("elements that hash to the same slot are all found") {
+        // a list with room for 5 elements has 16 slots
+        const auto keys = collidingKeys(4, 16);
+        for (size_t i = 0; i < keys.size(); ++i) {
+            REQUIRE(list.add(item(keys[i].c_str(), i)) != nullptr);
+        }
+        for (size_t i = 0; i < keys.size(); ++i) {
+            const Item* found = list.find(keys[i].c_str());
+            REQUIRE(found != nullptr);
+            CHECK(found->value == (int)i);
+        }
+        CHECK(list.find(collidingKeys(5, 16).back().c_str()) == nullptr);
+    }
+
+    SECTION("elements are kept in the order they were added") {
+        for (int i = 0; i < 20; ++i) {
+            REQUIRE(list.add(item(key(i).c_str(), i)) != nullptr);
+        }
+        REQUIRE(list.size() == 20);
+        for (int i = 0; i < 20; ++i) {
+            CHECK(std::string(list[i].key) == key(i));
+            CHECK(list[i].value == i);
+        }
+    }
+
+    SECTION("elements are found after the table is rehashed") {
+        // the storage grows in steps of 5 elements, rehashing the table each time
+        for (int i = 0; i < 100; ++i) {
+            REQUIRE(list.add(item(key(i).c_str(), i)) != nullptr);
+            for (int j = 0; j <= i; ++j) {
+                const Item* found = list.find(key(j).c_str());
+                REQUIRE(found != nullptr);
+                REQUIRE(found->value == j);
+            }
+        }
+    }
+
+    SECTION("the last element can be removed") {
+        const auto keys = collidingKeys(3, 16);
+        for (size_t i = 0; i < keys.size(); ++i) {
+            REQUIRE(list.add(item(keys[i].c_str(), i)) != nullptr);
+        }
+        list.removeLast();
+        CHECK(list.size() == 2);
+        CHECK(list.find(keys[2].c_str()) == nullptr);
+        REQUIRE(list.find(keys[0].c_str()) != nullptr);
+        REQUIRE(list.find(keys[1].c_str()) != nullptr);
+        // the removed element's slot can be reused
+        REQUIRE(list.add(item("new", 3)) != nullptr);
+        REQUIRE(list.find("new") != nullptr);
+        CHECK(list.find("new")->value == 3);
+        CHECK(std::string(list[2].key) == "new");
+    }
+
+    SECTION("removing the last element of an empty list has no effect") {
+        list.removeLast();
+        CHECK(list.size() == 0);
+        REQUIRE(list.add(item("a", 1)) != nullptr);
+        CHECK(list.find("a") != nullptr);
+    }
+
+    SECTION("the number of elements is limited") {
+        const unsigned maxSize = ItemList::MAX_SIZE;
+        for (unsigned i = 0; i < maxSize; ++i) {
+            REQUIRE(list.add(item(key(i).c_str(), i)) != nullptr);
+        }
+        CHECK(list.add(item("x")) == nullptr);
+        CHECK(list.size() == maxSize);
+        REQUIRE(list.find(key(maxSize - 1).c_str()) != nullptr);
+    }
+}
@@ -451,6 +451,39 @@ private:
     test::SystemControl ctrl_;
 };
 
+// Reads values from a frame generated by BinaryStreamLogHandler
+struct BinaryFrameReader {
+    std::string s;
+    size_t pos;
+
+    template<typename T>
+    T value() {
+        T val = T();
+        REQUIRE((pos + sizeof(T)) <= s.size());
+        memcpy(&val, s.data() + pos, sizeof(T));
+        pos += sizeof(T);
+        return val;
+    }
+
+    std::string string() {
+        const size_t len = value<uint8_t>();
+        REQUIRE((pos + len) <= s.size());
+        const std::string str = s.substr(pos, len);
+        pos += len;
+        return str;
+    }
+
+    // Checks the frame header and returns the payload size
+    size_t header(uint8_t type, uint8_t level) {
+        REQUIRE(value<uint8_t>() == BinaryStreamLogHandler::FRAME_MAGIC);
+        REQUIRE(value<uint8_t>() == type);
+        REQUIRE(value<uint8_t>() == level);
+        const size_t size = value<uint16_t>();
+        REQUIRE((pos + size) <= s.size());
+        return size;
+    }
+};
+
 std::string fileName(const std::string &path) {
     const size_t pos = path.rfind('/');
     if (pos != std::string::npos) {
@@ -514,6 +547,12 @@ TEST_CASE("Message logging") {
         ERROR("error"); // Alias for LOG(ERROR, ...)
         log.checkNext().messageEquals("error").levelEquals(LOG_LEVEL_ERROR);
     }
+    SECTION("panic level output is forwarded once") {
+        LOG(PANIC, "panic");
+        log_flush(nullptr); // Called by the system before it enters the panic mode
+        LogManager::instance()->flush();
+        log.checkNext().messageEquals("panic").levelEquals(LOG_LEVEL_PANIC).checkAtEnd();
+    }
 }
 /*
 TEST_CASE("Message logging (compatibility callback)") {
@@ -828,6 +867,56 @@ TEST_CASE("Category filtering") {
     }
 }
 
+TEST_CASE("Category filtering (multiple handlers)") {
+    DefaultLogHandler log1(LOG_LEVEL_WARN, {
+        { "a", LOG_LEVEL_ERROR },
+        { "a.b", LOG_LEVEL_TRACE }
+    });
+    std::unique_ptr<DefaultLogHandler> log2(new DefaultLogHandler(LOG_LEVEL_ERROR, {
+        { "a", LOG_LEVEL_INFO },
+        { "c", LOG_LEVEL_TRACE }
+    }));
+    // The lowest level enabled by any of the handlers is enabled for every category
+    CHECK((!LOG_ENABLED_C(INFO, "x") && LOG_ENABLED_C(WARN, "x")));
+    CHECK((!LOG_ENABLED_C(TRACE, "a") && LOG_ENABLED_C(INFO, "a")));
+    CHECK((!LOG_ENABLED_C(TRACE, "a.x") && LOG_ENABLED_C(INFO, "a.x")));
+    CHECK(LOG_ENABLED_C(TRACE, "a.b"));
+    CHECK(LOG_ENABLED_C(TRACE, "c.x"));
+    CHECK((!LOG_ENABLED_C(INFO, nullptr) && LOG_ENABLED_C(WARN, nullptr)));
+    // Messages are still filtered by each handler
+    LOG_C(INFO, "a", "");
+    CHECK(!log1.hasNext());
+    log2->checkNext().levelEquals(LOG_LEVEL_INFO);
+    SECTION("cached levels are updated when a handler is removed") {
+        static const char category[] = "c";
+        CHECK(LOG_ENABLED_C(TRACE, category));
+        CHECK(LOG_ENABLED_C(TRACE, category)); // Cached
+        log2.reset();
+        CHECK((!LOG_ENABLED_C(INFO, category) && LOG_ENABLED_C(WARN, category)));
+        CHECK((!LOG_ENABLED_C(INFO, "a") && LOG_ENABLED_C(ERROR, "a")));
+        CHECK(LOG_ENABLED_C(TRACE, "a.b"));
+    }
+    SECTION("cached levels of different categories don't get mixed up") {
+        // More names than there are entries in the level cache, so that some of them share an entry
+        static const struct {
+            const char* name;
+            LogLevel level;
+        } categories[] = { { "a", LOG_LEVEL_INFO }, { "a.b", LOG_LEVEL_TRACE }, { "a.c", LOG_LEVEL_INFO },
+                { "c", LOG_LEVEL_TRACE }, { "c.d", LOG_LEVEL_TRACE }, { "b", LOG_LEVEL_WARN }, { "d", LOG_LEVEL_WARN },
+                { "e", LOG_LEVEL_WARN }, { "f", LOG_LEVEL_WARN }, { "g", LOG_LEVEL_WARN }, { "h", LOG_LEVEL_WARN },
+                { "i", LOG_LEVEL_WARN }, { "j", LOG_LEVEL_WARN }, { "k", LOG_LEVEL_WARN }, { "l", LOG_LEVEL_WARN },
+                { "m", LOG_LEVEL_WARN }, { "a.n", LOG_LEVEL_INFO }, { "a.b.o", LOG_LEVEL_TRACE }, { "c.p", LOG_LEVEL_TRACE } };
+        for (int i = 0; i < 2; ++i) { // Second pass checks the cached levels
+            for (const auto& c: categories) {
+                CHECK(log_enabled(c.level, c.name, nullptr));
+                if (c.level > LOG_LEVEL_TRACE) {
+                    CHECK(!log_enabled(c.level - 1, c.name, nullptr));
+                }
+            }
+        }
+    }
+}
+
 TEST_CASE("Malformed category name") {
     DefaultLogHandler log(LOG_LEVEL_ERROR, {
         { "a", LOG_LEVEL_WARN },
@@ -1238,3 +1327,121 @@ TEST_CASE("Configuration requests") {
     CHECK(NamedOutputStream::instanceCount() == 0);
     CHECK(NamedLogHandler::instanceCount() == 0);
 }
+
+TEST_CASE("Binary formatting") {
+    test::OutputStream stream;
+    ScopedLogHandler<BinaryStreamLogHandler> handler(stream, LOG_LEVEL_ALL);
+    static const char category[] = "binary";
+
+    SECTION("messages are encoded without formatting") {
+        static const char fmt[] = "%d %5.*f %s %llx %c %p %%";
+        LogAttributes attr = {};
+        attr.size = sizeof(LogAttributes);
+        LOG_ATTR_SET(attr, time, 1234);
+        LOG_ATTR_SET(attr, line, 56);
+        LOG_ATTR_SET(attr, code, -7);
+        LOG_ATTR_SET(attr, details, "details");
+        log_message(LOG_LEVEL_WARN, category, &attr, nullptr, fmt, -1, 2, 0.5, "abc", 0x123456789abcULL, 'x', &attr);
+        BinaryFrameReader r = { std::string(stream), 0 };
+        const size_t size = r.header(BinaryStreamLogHandler::FORMAT, LOG_LEVEL_WARN);
+        CHECK(r.value<uint32_t>() == 1234);
+        CHECK(r.value<const char*>() == fmt);
+        CHECK(r.value<const char*>() == category);
+        CHECK(r.value<uint8_t>() == 0x32); // has_line, has_code, has_details
+        CHECK(r.value<int32_t>() == 56);
+        CHECK(r.value<int32_t>() == -7);
+        CHECK(r.string() == "details");
+        CHECK(r.value<int>() == -1);
+        CHECK(r.value<int32_t>() == 2); // Precision
+        CHECK(r.value<double>() == 0.5);
+        CHECK(r.string() == "abc");
+        CHECK(r.value<unsigned long long>() == 0x123456789abcULL);
+        CHECK(r.value<int>() == 'x');
+        CHECK(r.value<const void*>() == &attr);
+        CHECK(r.pos == size + 5);
+    }
+    SECTION("formatted messages are passed to other handlers") {
+        DefaultLogHandler log(LOG_LEVEL_ALL);
+        LOG(INFO, "%d", 123);
+        log.checkNext().messageEquals("123").levelEquals(LOG_LEVEL_INFO);
+        BinaryFrameReader r = { std::string(stream), 0 };
+        r.header(BinaryStreamLogHandler::FORMAT, LOG_LEVEL_INFO);
+    }
+    SECTION("long strings are truncated") {
+        const std::string str = test::randomString(LOG_MAX_STRING_LENGTH * 2);
+        LogAttributes attr = {};
+        attr.size = sizeof(LogAttributes);
+        log_message(LOG_LEVEL_INFO, category, &attr, nullptr, "%s %d", str.c_str(), 1);
+        BinaryFrameReader r = { std::string(stream), 0 };
+        const size_t size = r.header(BinaryStreamLogHandler::FORMAT, LOG_LEVEL_INFO);
+        CHECK((size + 5) == LOG_MAX_STRING_LENGTH);
+        r.value<uint32_t>();
+        r.value<const char*>();
+        r.value<const char*>();
+        CHECK((r.value<uint8_t>() & BinaryStreamLogHandler::FLAG_TRUNCATED) != 0);
+        CHECK(str.find(r.string()) == 0);
+    }
+    SECTION("string arguments are limited by the precision") {
+        const char buf[3] = { 'a', 'b', 'c' }; // Not null-terminated
+        LogAttributes attr = {};
+        attr.size = sizeof(LogAttributes);
+        log_message(LOG_LEVEL_INFO, category, &attr, nullptr, "%.2s %.*s %.*s", buf, 3, buf, -1, "abcd");
+        BinaryFrameReader r = { std::string(stream), 0 };
+        const size_t size = r.header(BinaryStreamLogHandler::FORMAT, LOG_LEVEL_INFO);
+        r.value<uint32_t>();
+        r.value<const char*>();
+        r.value<const char*>();
+        CHECK(r.value<uint8_t>() == 0);
+        CHECK(r.string() == "ab");
+        CHECK(r.value<int32_t>() == 3);
+        CHECK(r.string() == "abc");
+        CHECK(r.value<int32_t>() == -1);
+        CHECK(r.string() == "abcd");
+        CHECK(r.pos == size + 5);
+    }
+    SECTION("direct output") {
+        LOG_WRITE(INFO, "abc", 3);
+        BinaryFrameReader r = { std::string(stream), 0 };
+        CHECK(r.header(BinaryStreamLogHandler::WRITE, LOG_LEVEL_NONE) == 3);
+        CHECK(r.s.substr(r.pos) == "abc");
+    }
+}
+
+// Asynchronous mode can't be disabled, so this test case should go last
+TEST_CASE("Asynchronous logging") {
+    REQUIRE(LogManager::instance()->enableAsync(64 * 1024));
+    REQUIRE(LogManager::instance()->enableAsync()); // Already enabled
+    DefaultLogHandler log(LOG_LEVEL_ALL);
+    SECTION("messages are forwarded with their attributes") {
+        char details[] = "details";
+        LOG_ATTR(WARN, (code = -1, details = details), "warn");
+        strcpy(details, "changed");
+        log.checkNext().messageEquals("warn").levelEquals(LOG_LEVEL_WARN).categoryEquals(LOG_THIS_CATEGORY()).fileEquals(SOURCE_FILE)
+                .codeEquals(-1).detailsEquals("details");
+        LOG(INFO, "info");
+        log.checkNext().messageEquals("info").levelEquals(LOG_LEVEL_INFO).hasCode(false).hasDetails(false);
+    }
+    SECTION("direct output is forwarded") {
+        std::string s = test::randomString(1, 100);
+        LOG_WRITE(WARN, s.c_str(), s.size());
+        check(log.stream()).endsWith(s);
+        s = test::randomString(LOG_MAX_STRING_LENGTH / 2);
+        LOG_PRINTF(INFO, "%s", s.c_str());
+        check(log.stream()).endsWith(s);
+    }
+    SECTION("output that doesn't fit in the buffer is dropped and counted") {
+        const unsigned dropped = LogManager::instance()->droppedCount();
+        const std::string s = test::randomString(64 * 1024);
+        LOG_WRITE(WARN, s.c_str(), s.size());
+        check(log.stream()).isEmpty();
+        CHECK(LogManager::instance()->droppedCount() == dropped + 1);
+        LOG(INFO, "info");
+        log.checkNext().messageEquals("info");
+    }
+    SECTION("buffered output can be flushed") {
+        LogManager::instance()->flush();
+        LOG(ERROR, "error");
+        LogManager::instance()->flush();
+        log.checkNext().messageEquals("error").levelEquals(LOG_LEVEL_ERROR);
+    }
+}
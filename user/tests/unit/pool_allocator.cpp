@@ -3,6 +3,7 @@
 #include "tools/catch.h"
 #include "hippomocks.h"
 #include "simple_pool_allocator.h"
+#include "size_class_pool_allocator.h"
 
 static const size_t DEFAULT_POOL_SIZE = 1024;
 
@@ -259,3 +260,86 @@ TEST_CASE("SimpleStaticPool") {
 
     testPool<TestSimpleStaticPool>(buf.data(), buf.size());
 }
+
+TEST_CASE("SizeClassPool") {
+    using particle::SizeClassPool;
+
+    const SizeClassPool::SizeClass classes[] = { { 16, 4 }, { 30, 2 } };
+    SizeClassPool pool(classes, 2);
+    REQUIRE(pool.classCount() == 2);
+
+    SECTION("Block sizes are aligned") {
+        SizeClassPool::Stats stats = {};
+        REQUIRE(pool.stats(1, &stats) == 0);
+        CHECK((stats.blockSize % sizeof(uintptr_t)) == 0);
+        CHECK(stats.blockSize >= 30);
+        CHECK(stats.blockCount == 2);
+        CHECK(pool.stats(2, &stats) == SYSTEM_ERROR_NOT_FOUND);
+    }
+
+    SECTION("Allocations are served from the smallest size class that fits") {
+        std::vector<void*> blocks;
+        for (int i = 0; i < 4; ++i) {
+            void* p = pool.alloc(16);
+            REQUIRE(p != nullptr);
+            CHECK(((reinterpret_cast<uintptr_t>(p)) % sizeof(uintptr_t)) == 0);
+            blocks.push_back(p);
+        }
+        SizeClassPool::Stats stats = {};
+        pool.stats(0, &stats);
+        CHECK(stats.used == 4);
+        pool.stats(1, &stats);
+        CHECK(stats.used == 0);
+        for (auto p: blocks) {
+            pool.free(p);
+        }
+        pool.stats(0, &stats);
+        CHECK(stats.used == 0);
+        CHECK(stats.highWater == 4);
+        CHECK(stats.failures == 0);
+    }
+
+    SECTION("Larger size classes are used when a size class is exhausted") {
+        for (int i = 0; i < 6; ++i) {
+            CHECK(pool.alloc(1) != nullptr);
+        }
+        CHECK(pool.alloc(1) == nullptr);
+        SizeClassPool::Stats stats = {};
+        pool.stats(0, &stats);
+        CHECK(stats.used == 4);
+        CHECK(stats.failures == 3);
+        pool.stats(1, &stats);
+        CHECK(stats.used == 2);
+        CHECK(stats.failures == 0);
+    }
+
+    SECTION("Oversized allocations fail") {
+        CHECK(pool.alloc(100) == nullptr);
+        SizeClassPool::Stats stats = {};
+        pool.stats(1, &stats);
+        CHECK(stats.failures == 1);
+    }
+
+    SECTION("Freed blocks are reused") {
+        void* p1 = pool.alloc(20);
+        void* p2 = pool.alloc(20);
+        REQUIRE((p1 != nullptr && p2 != nullptr));
+        CHECK(pool.alloc(20) == nullptr);
+        pool.free(p1);
+        CHECK(pool.alloc(20) == p1);
+        pool.free(p2);
+        CHECK(pool.alloc(20) == p2);
+        SizeClassPool::Stats stats = {};
+        pool.stats(1, &stats);
+        CHECK(stats.highWater == 2);
+    }
+
+    SECTION("Invalid size classes are rejected") {
+        const SizeClassPool::SizeClass unsorted[] = { { 32, 1 }, { 16, 1 } };
+        CHECK(pool.init(unsorted, 2) == SYSTEM_ERROR_INVALID_ARGUMENT);
+        CHECK(pool.classCount() == 0);
+        CHECK(pool.alloc(1) == nullptr);
+        const SizeClassPool::SizeClass empty[] = { { 16, 0 } };
+        CHECK(pool.init(empty, 1) == SYSTEM_ERROR_INVALID_ARGUMENT);
+    }
+}
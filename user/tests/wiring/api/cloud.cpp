@@ -70,6 +70,15 @@ test(api_spark_variable) {
 
 }
 
+test(api_spark_variable_reader) {
+    API_COMPILE(Particle.variable("dump", [](size_t offset, char* data, size_t size) -> size_t {
+        return 0;
+    }, STRING));
+
+    user_std_variable_reader_t reader;
+    API_COMPILE(Particle.variable("dump", reader, STRING));
+}
+
 test(api_spark_function) {
     int (*handler)(String) = NULL;
 
@@ -90,6 +99,25 @@ test(api_spark_function) {
     API_COMPILE(Particle.function("name", &MyClass::handler, &myObj));
 }
 
+test(api_spark_function_async) {
+    void (*handler)(String, CloudFunctionCall) = NULL;
+
+    API_COMPILE(Particle.function("name", handler));
+
+    CloudFunctionCall pending;
+    API_COMPILE(Particle.function("name", [&](String arg, CloudFunctionCall call) {
+        pending = std::move(call);
+    }));
+    API_COMPILE(pending.complete(0));
+    API_COMPILE(pending.isPending());
+
+    class MyClass {
+      public:
+        void handler(String arg, CloudFunctionCall call) { call.complete(0); }
+    } myObj;
+    API_COMPILE(Particle.function("name", &MyClass::handler, &myObj));
+}
+
 test(api_spark_publish) {
     // Particle.publish(const char*, const char*, ...)
     API_COMPILE(Particle.publish("event"));
@@ -64,6 +64,28 @@ test(api_udp_direct) {
     API_COMPILE(udp.receivePacket(new uint8_t[5], 5));
 }
 
+test(api_udp_batch) {
+    UDP udp;
+    uint8_t buf[50];
+    UDP::Packet packets[2] = {};
+    packets[0].buffer = buf;
+    packets[0].size = sizeof(buf);
+    packets[0].remoteIP = IPAddress(1,2,3,4);
+    packets[0].remotePort = 50;
+    packets[1] = packets[0];
+    API_COMPILE(udp.sendPackets(packets, 2));
+    API_COMPILE(udp.receivePackets(packets, 2));
+    API_COMPILE(udp.receivePackets(packets, 2, 1000));
+
+    static UDPPacketRing<4, 64> ring;
+    API_COMPILE(ring.receive(udp));
+    API_COMPILE(ring.receive(udp, 1000));
+    UDP::Packet* p = nullptr;
+    API_COMPILE(p = ring.front());
+    API_COMPILE(ring.pop());
+    (void)p;
+}
+
 test(api_tcpserver_write_timeout) {
     TCPServer server(1000);
     API_COMPILE(server.write(0xff, 123456));
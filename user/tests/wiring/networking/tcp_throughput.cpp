@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "application.h"
+#include "unit-test/unit-test.h"
+
+namespace {
+
+// Size of the downloaded content. This is the maximum supported by httpbin.org/bytes
+const size_t DOWNLOAD_SIZE = 100 * 1024;
+
+const system_tick_t DOWNLOAD_TIMEOUT = 120000;
+
+enum ReadMode {
+    READ_BYTE, // read()
+    READ_SMALL, // read(buf, n) with the default receive buffer
+    READ_BULK // read(buf, n) with a large destination and receive buffer
+};
+
+// Downloads the content and returns the number of bytes received, including the response headers
+size_t download(ReadMode mode, system_tick_t* time) {
+    TCPClient c;
+    if (mode == READ_BULK && !c.setBufferSize(1024)) {
+        return 0;
+    }
+    if (!c.connect("httpbin.org", 80)) {
+        return 0;
+    }
+    char path[32] = {};
+    snprintf(path, sizeof(path), "/bytes/%u?seed=0", (unsigned)DOWNLOAD_SIZE);
+    static const char get[] = "GET ";
+    static const char headers[] = " HTTP/1.1\r\n"
+            "Host: httpbin.org\r\n"
+            "Connection: close\r\n"
+            "\r\n";
+    const TCPClient::Segment request[] = {
+        { (const uint8_t*)get, sizeof(get) - 1 },
+        { (const uint8_t*)path, strlen(path) },
+        { (const uint8_t*)headers, sizeof(headers) - 1 }
+    };
+    const size_t requestSize = request[0].size + request[1].size + request[2].size;
+    if (c.write(request, 3) != requestSize) {
+        return 0;
+    }
+    std::unique_ptr<uint8_t[]> buf(new uint8_t[4096]);
+    const size_t bufSize = (mode == READ_BULK) ? 4096 : 128;
+    size_t total = 0;
+    const system_tick_t start = millis();
+    while (millis() - start < DOWNLOAD_TIMEOUT) {
+        int n = 0;
+        if (mode == READ_BYTE) {
+            while (c.read() >= 0) {
+                ++n;
+            }
+        } else {
+            n = c.read(buf.get(), bufSize);
+        }
+        if (n > 0) {
+            total += n;
+        } else if (!c.connected()) {
+            break;
+        }
+    }
+    *time = millis() - start;
+    c.stop();
+    return total;
+}
+
+void testDownload(ReadMode mode, const char* name) {
+    system_tick_t time = 0;
+    const size_t size = download(mode, &time);
+    const unsigned rate = size * 1000ull / (time ? time : 1);
+    Serial.printlnf("%s: %u bytes in %u ms, %u bytes/s", name, (unsigned)size, (unsigned)time, rate);
+    assertMoreOrEqual(size, DOWNLOAD_SIZE);
+}
+
+} // namespace
+
+test(TCP_01_throughput_read_byte) {
+    testDownload(READ_BYTE, "read()");
+}
+
+test(TCP_02_throughput_read_small) {
+    testDownload(READ_SMALL, "read(buf, 128)");
+}
+
+test(TCP_03_throughput_read_bulk) {
+    testDownload(READ_BULK, "read(buf, 4096)");
+}
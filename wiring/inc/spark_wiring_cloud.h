@@ -34,6 +34,7 @@
 #include "spark_wiring_global.h"
 #include "interrupts_hal.h"
 #include "system_mode.h"
+#include "system_error.h"
 #include <functional>
 
 #define PARTICLE_DEPRECATED_API_DEFAULT_PUBLISH_SCOPE \
@@ -45,6 +46,59 @@
 typedef std::function<user_function_int_str_t> user_std_function_int_str_t;
 typedef std::function<void (const char*, const char*)> wiring_event_handler_t;
 
+/**
+ * A pending call of an asynchronous cloud function.
+ *
+ * The cloud request is acknowledged before the function is called, and the result is sent once
+ * `complete()` is called, which can happen after the function has returned. The object can be
+ * moved but not copied. A call that is destroyed without being completed is completed with
+ * `SYSTEM_ERROR_CANCELLED`.
+ */
+class CloudFunctionCall {
+public:
+    CloudFunctionCall() :
+            call_(nullptr) {
+    }
+
+    explicit CloudFunctionCall(void* call) :
+            call_(call) {
+    }
+
+    CloudFunctionCall(CloudFunctionCall&& call) :
+            call_(call.call_) {
+        call.call_ = nullptr;
+    }
+
+    ~CloudFunctionCall();
+
+    /**
+     * Sends the result of the call to the cloud.
+     *
+     * @return `false` if the call has been completed already or the result couldn't be sent.
+     */
+    bool complete(int result);
+
+    bool isPending() const {
+        return call_;
+    }
+
+    CloudFunctionCall& operator=(CloudFunctionCall&& call);
+
+    CloudFunctionCall(const CloudFunctionCall&) = delete;
+    CloudFunctionCall& operator=(const CloudFunctionCall&) = delete;
+
+private:
+    void* call_;
+};
+
+typedef std::function<void (String, CloudFunctionCall)> user_std_async_function_t;
+
+/**
+ * Reads `size` bytes of a variable value starting at `offset` and returns the number of bytes
+ * read, which is less than `size` only at the end of the value.
+ */
+typedef std::function<size_t (size_t offset, char* data, size_t size)> user_std_variable_reader_t;
+
 #ifdef SPARK_NO_CLOUD
 #define CLOUD_FN(x,y) (y)
 #else
@@ -64,6 +118,8 @@ const PublishFlag PUBLIC(PUBLISH_EVENT_FLAG_PUBLIC);
 const PublishFlag PRIVATE(PUBLISH_EVENT_FLAG_PRIVATE);
 const PublishFlag NO_ACK(PUBLISH_EVENT_FLAG_NO_ACK);
 const PublishFlag WITH_ACK(PUBLISH_EVENT_FLAG_WITH_ACK);
+const PublishFlag PRIORITY_HIGH(PUBLISH_EVENT_FLAG_PRIORITY_HIGH);
+const PublishFlag PRIORITY_LOW(PUBLISH_EVENT_FLAG_PRIORITY_LOW);
 
 // Test if the paramater a regular C "string" literal
 template <typename T>
@@ -172,12 +228,37 @@ public:
     template<typename T>
     static inline bool _variable(const T *varKey, const String *userVar, const CloudVariableTypeString& userVarType)
     {
-        spark_variable_t extra;
+        spark_variable_t extra = {};
         extra.size = sizeof(extra);
         extra.update = update_string_variable;
         return CLOUD_FN(spark_variable(varKey, userVar, CloudVariableTypeString::value(), &extra), false);
     }
 
+    // The value is generated in parts when the cloud requests it, so it can be larger than a single
+    // message and needn't be kept in memory. The reader is called on the system thread.
+    static bool _variable(const char* varKey, user_std_variable_reader_t reader, const CloudVariableTypeString& userVarType)
+    {
+#ifdef SPARK_NO_CLOUD
+        return false;
+#else
+        bool success = false;
+        if (reader)
+        {
+            auto wrapper = new user_std_variable_reader_t(reader);
+            if (wrapper) {
+                spark_variable_t extra = {};
+                extra.size = sizeof(extra);
+                extra.read = read_variable;
+                success = spark_variable(varKey, wrapper, CloudVariableTypeString::value(), &extra);
+                if (!success) {
+                    delete wrapper;
+                }
+            }
+        }
+        return success;
+#endif
+    }
+
     template<typename T>
     static inline bool _variable(const T *varKey, const String &userVar, const CloudVariableTypeString& userVarType)
     {
@@ -219,7 +300,31 @@ public:
     template <typename T>
     static bool _function(const char *funcKey, int (T::*func)(String), T *instance) {
       using namespace std::placeholders;
-      return _function(funcKey, std::bind(func, instance, _1));
+      return _function(funcKey, user_std_function_int_str_t(std::bind(func, instance, _1)));
+    }
+
+    // Asynchronous functions take ownership of the call and complete it when the result is known
+    static bool _function(const char *funcKey, user_std_async_function_t func)
+    {
+#ifdef SPARK_NO_CLOUD
+        return false;
+#else
+        bool success = false;
+        if (func)
+        {
+            auto wrapper = new user_std_async_function_t(func);
+            if (wrapper) {
+                success = register_function(call_std_async_user_function, wrapper, funcKey, CLOUD_FUNCTION_FLAG_ASYNC);
+            }
+        }
+        return success;
+#endif
+    }
+
+    template <typename T>
+    static bool _function(const char *funcKey, void (T::*func)(String, CloudFunctionCall), T *instance) {
+      using namespace std::placeholders;
+      return _function(funcKey, user_std_async_function_t(std::bind(func, instance, _1, _2)));
     }
 
     inline particle::Future<bool> publish(const char *eventName, PublishFlags flags1, PublishFlags flags2 = PublishFlags())
@@ -343,13 +448,95 @@ public:
                                                sec * 1000, &conn_prop, nullptr),
                  (void)0);
     }
+
+    /**
+     * Enables adaptive keepalive. Starting from the interval set with keepAlive(), the device
+     * probes longer intervals between pings until it finds the longest one after which the
+     * cloud can still reach it through the network's NAT. What was learned is kept for each
+     * recently used network, across resets on platforms with a filesystem.
+     * @param maxSec The longest interval to probe in seconds. 0 disables adaptive keepalive.
+     */
+    static bool keepAliveAdaptive(unsigned maxSec)
+    {
+        particle::protocol::connection_properties_t conn_prop = {0};
+        conn_prop.size = sizeof(conn_prop);
+        return CLOUD_FN(spark_set_connection_property(particle::protocol::Connection::ADAPTIVE_KEEPALIVE,
+                                                      maxSec * 1000, &conn_prop, nullptr), -1) == 0;
+    }
+
+    /**
+     * Sets the rate limit for published events. Events that exceed the limit are held back and
+     * sent as the rate allows, events published with PRIORITY_HIGH first and PRIORITY_LOW last.
+     * @param intervalMs The average time in milliseconds between events. 0 disables the limit.
+     * @param burst The number of events that may be published back to back.
+     * @param maxHeld The maximum number of events held back. When it's reached, an event replaces
+     *                the most recent event of a lower priority, or fails. 0 makes events that
+     *                exceed the limit fail.
+     */
+    static bool publishRateLimit(unsigned intervalMs, unsigned burst, unsigned maxHeld = 8)
+    {
+        particle::protocol::connection_properties_t conn_prop = {0};
+        conn_prop.size = sizeof(conn_prop);
+        if (CLOUD_FN(spark_set_connection_property(particle::protocol::Connection::PUBLISH_RATE_BURST,
+                                                   burst, &conn_prop, nullptr), -1) != 0 ||
+            CLOUD_FN(spark_set_connection_property(particle::protocol::Connection::PUBLISH_RATE_INTERVAL,
+                                                   intervalMs, &conn_prop, nullptr), -1) != 0) {
+            return false;
+        }
+        return CLOUD_FN(spark_set_connection_property(particle::protocol::Connection::PUBLISH_THROTTLE,
+                                                      maxHeld, &conn_prop, nullptr), -1) == 0;
+    }
+#endif
+
+    /**
+     * Enables event batching. Events published within the linger period are sent to the cloud
+     * together in a single message, which reduces the per-event overhead. Completion of each
+     * event is still reported individually.
+     * @param maxBytes The maximum size of a batch. A batch is sent as soon as it's full.
+     *                 0 disables batching.
+     * @param lingerMs The time in milliseconds an event waits for other events to be batched with it.
+     * @return true on success, false on platforms that don't support batching or on error.
+     */
+    static bool publishBatching(size_t maxBytes, unsigned lingerMs = 1000)
+    {
+#if HAL_PLATFORM_CLOUD_UDP
+        particle::protocol::connection_properties_t conn_prop = {0};
+        conn_prop.size = sizeof(conn_prop);
+        if (CLOUD_FN(spark_set_connection_property(particle::protocol::Connection::EVENT_BATCH_LINGER,
+                                                   lingerMs, &conn_prop, nullptr), -1) != 0) {
+            return false;
+        }
+        return CLOUD_FN(spark_set_connection_property(particle::protocol::Connection::EVENT_BATCH_SIZE,
+                                                      maxBytes, &conn_prop, nullptr), -1) == 0;
+#else
+        return false;
+#endif
+    }
+
+#if HAL_PLATFORM_FILESYSTEM
+    /**
+     * Enables the persistent publish queue. Events that cannot be sent while the cloud is unreachable
+     * are stored on the filesystem and published once the connection is restored. The result of a
+     * stored event's publish() is known once the event is sent. If the device resets first, the event
+     * is still sent but its result is lost; it's reported as SYSTEM_ERROR_QUEUED where possible.
+     * @param maxBytes The maximum space used by the queue. The oldest events are dropped when it's full.
+     *                 0 disables the queue.
+     */
+    static bool publishQueue(size_t maxBytes)
+    {
+        particle::protocol::connection_properties_t conn_prop = {0};
+        conn_prop.size = sizeof(conn_prop);
+        return CLOUD_FN(spark_set_connection_property(particle::protocol::Connection::PUBLISH_QUEUE,
+                                                      maxBytes, &conn_prop, nullptr), -1) == 0;
+    }
 #endif
 
 private:
 
-    static bool register_function(cloud_function_t fn, void* data, const char* funcKey);
+    static bool register_function(cloud_function_t fn, void* data, const char* funcKey, uint16_t flags = 0);
     static int call_raw_user_function(void* data, const char* param, void* reserved);
     static int call_std_user_function(void* data, const char* param, void* reserved);
+    static int call_std_async_user_function(void* data, const char* param, void* reserved);
 
     static void call_wiring_event_handler(const void* param, const char *event_name, const char *data);
 
@@ -377,6 +564,8 @@ private:
 #endif
     }
 
+    static int read_variable(const char* name, const void* var, size_t offset, char* data, size_t size, void* reserved);
+
     static const void* update_string_variable(const char* name, Spark_Data_TypeDef type, const void* var, void* reserved)
     {
         const String* s = (const String*)var;
@@ -20,6 +20,8 @@
 
 #include <cstring>
 #include <cstdarg>
+#include <atomic>
+#include <memory>
 
 #include "logging.h"
 
@@ -52,6 +54,8 @@ public:
     LogLevel level() const;
     LogLevel level(const char *category) const;
 
+    const Vector<String>& categories() const;
+
     // This class in non-copyable
     LogFilter(const LogFilter&) = delete;
     LogFilter& operator=(const LogFilter&) = delete;
@@ -122,9 +126,17 @@ public:
     */
     static const char* levelName(LogLevel level);
 
+    /*!
+        \brief Returns `true` if this handler processes messages before they're formatted.
+
+        \see deferFormatting()
+    */
+    bool defersFormatting() const;
+
     // These methods are called by the LogManager
     void message(const char *msg, LogLevel level, const char *category, const LogAttributes &attr);
     void write(const char *data, size_t size, LogLevel level, const char *category);
+    void format(const char *fmt, va_list args, LogLevel level, const char *category, const LogAttributes &attr);
 
     // This class is non-copyable
     LogHandler(const LogHandler&) = delete;
@@ -149,9 +161,34 @@ protected:
         Default implementation does nothing.
     */
     virtual void write(const char *data, size_t size);
+    /*!
+        \brief Performs processing of a log message that hasn't been formatted yet.
+        \param fmt Format string.
+        \param args Format arguments.
+        \param level Logging level.
+        \param category Category name (can be null).
+        \param attr Message attributes.
+
+        This method is called instead of `logMessage()` if deferred formatting is enabled for
+        this handler. Default implementation does nothing.
+    */
+    virtual void logFormat(const char *fmt, va_list args, LogLevel level, const char *category, const LogAttributes &attr);
+    /*!
+        \brief Enables deferred formatting for this handler.
+
+        Messages are passed to `logFormat()` with their format string and arguments, so the cost
+        of formatting is avoided if no other handler needs the message text. Messages are still
+        passed to `logMessage()` in asynchronous mode, see `LogManager::enableAsync()`.
+
+        This method should be called by the constructor of a subclass.
+    */
+    void deferFormatting();
 
 private:
     detail::LogFilter filter_;
+    bool deferred_;
+
+    friend class LogManager;
 };
 
 /*!
@@ -227,6 +264,65 @@ protected:
     virtual void write(const char *data, size_t size) override;
 };
 
+/*!
+    \brief Stream-based log handler generating compact binary frames.
+
+    Messages are not formatted on the device. Instead, the handler records the address of the
+    format string, the address of the category name, the timestamp and other attributes, and the
+    raw values of the format arguments. The frames can be decoded on the host using the firmware
+    ELF files, see `misc/tools/log_decoder.py`.
+
+    Each frame starts with the \ref FRAME_MAGIC byte followed by the frame type, the logging level,
+    and the size of the payload (16 bits, little endian). All fields of the payload are little
+    endian, and addresses are encoded with the native pointer size:
+
+    - \ref FORMAT: `time (32 bits), format, category, flags (8 bits), [file], [line (32 bits)],
+      [function], [code (32 bits)], [details], arguments`. Arguments are encoded with the
+      native size of their type; strings are encoded as a length byte followed by the characters.
+    - \ref MESSAGE: same as \ref FORMAT, without the format string address, followed by the text
+      of a message that was formatted by the system (e.g. in asynchronous mode).
+    - \ref WRITE: data passed to the handler directly.
+
+    The flags are the attribute flags of `LogAttributes`, except for bit 7 which is set if the
+    frame was truncated.
+*/
+class BinaryStreamLogHandler: public StreamLogHandler {
+public:
+    /*!
+        \brief First byte of a frame.
+    */
+    static const uint8_t FRAME_MAGIC = 0xb7;
+    /*!
+        \brief Flag set in truncated frames.
+    */
+    static const uint8_t FLAG_TRUNCATED = 0x80;
+
+    /*!
+        \brief Frame type.
+    */
+    enum FrameType {
+        FORMAT = 1, ///< Message with deferred formatting.
+        MESSAGE = 2, ///< Formatted message.
+        WRITE = 3 ///< Direct output.
+    };
+
+    /*!
+        \brief Constructor.
+        \param stream Output stream.
+        \param level Default logging level.
+        \param filters Category filters.
+    */
+    explicit BinaryStreamLogHandler(Print &stream, LogLevel level = LOG_LEVEL_INFO, LogCategoryFilters filters = {});
+
+protected:
+    virtual void logMessage(const char *msg, LogLevel level, const char *category, const LogAttributes &attr) override;
+    virtual void logFormat(const char *fmt, va_list args, LogLevel level, const char *category, const LogAttributes &attr) override;
+    virtual void write(const char *data, size_t size) override;
+
+private:
+    class Frame;
+};
+
 class AttributedLogger;
 
 /*!
@@ -249,6 +345,9 @@ public:
         \param name Category name.
 
         Default-constructed logger uses category name specified at module level (typically, "app").
+
+        \note The name is not copied, and levels of categories are cached by the address of their
+        names, so the name should be a string literal, see also the notes in logging.h.
     */
     explicit Logger(const char *name = LOG_MODULE_CATEGORY);
     /*!
@@ -494,6 +593,11 @@ private:
 */
 class LogManager {
 public:
+    /*!
+        \brief Default size of the buffer used for asynchronous logging.
+    */
+    static const size_t DEFAULT_ASYNC_BUFFER_SIZE = 2048;
+
     /*!
         \brief Destructor.
     */
@@ -513,6 +617,33 @@ public:
         \param handler Handler instance.
     */
     void removeHandler(LogHandler *handler);
+    /*!
+        \brief Enables asynchronous logging.
+
+        \param bufferSize Size of the buffer for pending log records, in bytes.
+        \return `false` in case of error.
+
+        Logging output is copied to a buffer and forwarded to the handlers by a low priority thread,
+        so the caller isn't delayed by slow outputs, and output generated in interrupt handlers
+        is no longer dropped. When the buffer is full, new output is dropped and counted (see
+        `droppedCount()`). Output at the `LOG_LEVEL_PANIC` level, including output generated in
+        an interrupt handler, flushes the buffer and is forwarded immediately; records that are
+        still being filled in by other producers are waited for briefly, or skipped and forwarded
+        later. The buffer is also flushed before the system enters the panic mode. On platforms
+        without threading, buffered output is forwarded whenever new output is generated outside
+        of an interrupt handler.
+
+        \note Asynchronous logging can't be disabled once it's enabled.
+    */
+    bool enableAsync(size_t bufferSize = DEFAULT_ASYNC_BUFFER_SIZE);
+    /*!
+        \brief Forwards all buffered logging output to the handlers in the calling thread.
+    */
+    void flush();
+    /*!
+        \brief Returns the number of log records dropped because the buffer was full.
+    */
+    unsigned droppedCount() const;
 
 #if Wiring_LogConfig
 
@@ -574,8 +705,22 @@ public:
 
 private:
     struct FactoryHandler;
+    struct AsyncBuffer;
+
+    // Cached logging level of a category
+    struct CachedLevel {
+        std::atomic<const char*> category;
+        std::atomic<int> level;
+    };
+
+    static const size_t LEVEL_CACHE_SIZE = 16; // Power of two
 
     Vector<LogHandler*> activeHandlers_;
+    std::atomic<AsyncBuffer*> async_;
+
+    std::unique_ptr<detail::LogFilter> filter_; // Combined filter of all active handlers
+    CachedLevel levelCache_[LEVEL_CACHE_SIZE]; // Direct-mapped cache indexed by category name address
+    std::atomic<int> defaultLevel_; // Level of messages without category (-1 if unknown)
 
     bool outputActive_;
 
@@ -587,6 +732,7 @@ private:
 
 #if PLATFORM_THREADING
     RecursiveMutex mutex_; // TODO: Use read-write lock?
+    RecursiveMutex filterMutex_; // Guards the combined filter, never held while output is generated
 #endif
 
     // This class can be instantiated only via instance() method
@@ -603,10 +749,23 @@ private:
     // System callbacks
     static void logMessage(const char *msg, int level, const char *category, const LogAttributes *attr, void *reserved);
     static void logWrite(const char *data, size_t size, int level, const char *category, void *reserved);
+    static int logFormat(const char *fmt, va_list args, int level, const char *category, const LogAttributes *attr,
+            void *reserved);
     static int logEnabled(int level, const char *category, void *reserved);
+    static void logFlush(void *reserved);
 
     bool isActive() const;
     void setActive(bool output_active);
+    bool isReentrant();
+    void updateFormatCallback();
+    void updateFilter();
+
+    bool cachedLevel(const char *category, int *level) const;
+    int categoryLevel(const char *category);
+
+    void writeBuffered(AsyncBuffer* async);
+    static void writeBuffered(void* data);
+    void drainBuffered(AsyncBuffer* async, bool wait);
 };
 
 #if Wiring_LogConfig
@@ -632,6 +791,10 @@ inline LogLevel spark::detail::LogFilter::level() const {
     return level_;
 }
 
+inline const spark::Vector<String>& spark::detail::LogFilter::categories() const {
+    return cats_;
+}
+
 // spark::LogCategoryFilter
 inline spark::LogCategoryFilter::LogCategoryFilter(String category, LogLevel level) :
         cat_(category),
@@ -658,11 +821,21 @@ inline LogLevel spark::LogCategoryFilter::level() const {
 
 // spark::LogHandler
 inline spark::LogHandler::LogHandler(LogLevel level) :
-        filter_(level) {
+        filter_(level),
+        deferred_(false) {
 }
 
 inline spark::LogHandler::LogHandler(LogLevel level, LogCategoryFilters filters) :
-        filter_(level, filters) {
+        filter_(level, filters),
+        deferred_(false) {
+}
+
+inline bool spark::LogHandler::defersFormatting() const {
+    return deferred_;
+}
+
+inline void spark::LogHandler::deferFormatting() {
+    deferred_ = true;
 }
 
 inline LogLevel spark::LogHandler::level() const {
@@ -689,10 +862,22 @@ inline void spark::LogHandler::write(const char *data, size_t size, LogLevel lev
     }
 }
 
+inline void spark::LogHandler::format(const char *fmt, va_list args, LogLevel level, const char *category,
+        const LogAttributes &attr) {
+    if (level >= filter_.level(category)) {
+        logFormat(fmt, args, level, category, attr);
+    }
+}
+
 inline void spark::LogHandler::write(const char *data, size_t size) {
     // Default implementation does nothing
 }
 
+inline void spark::LogHandler::logFormat(const char *fmt, va_list args, LogLevel level, const char *category,
+        const LogAttributes &attr) {
+    // Default implementation does nothing
+}
+
 // spark::StreamLogHandler
 inline spark::StreamLogHandler::StreamLogHandler(Print &stream, LogLevel level, LogCategoryFilters filters) :
         LogHandler(level, filters),
@@ -725,6 +910,12 @@ inline void spark::JSONStreamLogHandler::write(const char *data, size_t size) {
     // This handler doesn't support direct logging
 }
 
+// spark::BinaryStreamLogHandler
+inline spark::BinaryStreamLogHandler::BinaryStreamLogHandler(Print &stream, LogLevel level, LogCategoryFilters filters) :
+        StreamLogHandler(stream, level, std::move(filters)) {
+    deferFormatting();
+}
+
 // spark::Logger
 inline spark::Logger::Logger(const char *name) :
         name_(name) {
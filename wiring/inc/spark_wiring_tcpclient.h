@@ -34,6 +34,7 @@
 
 #include <memory>
 
+/* Default size of the receive buffer, see TCPClient::setBufferSize() */
 #define TCPCLIENT_BUF_MAX_SIZE  128
 /* 30 seconds */
 #define SPARK_WIRING_TCPCLIENT_DEFAULT_SEND_TIMEOUT (30000)
@@ -41,6 +42,14 @@
 class TCPClient : public Client {
 
 public:
+    /**
+     * A part of the data sent with write(const Segment*, size_t).
+     */
+    struct Segment {
+        const uint8_t* data;
+        size_t size;
+    };
+
     TCPClient();
     TCPClient(sock_handle_t sock);
     virtual ~TCPClient() {};
@@ -52,12 +61,38 @@ public:
     virtual size_t write(const uint8_t *buffer, size_t size);
     virtual size_t write(uint8_t, system_tick_t timeout);
     virtual size_t write(const uint8_t *buffer, size_t size, system_tick_t timeout);
+    /**
+     * Sends the segments one after another, letting the network stack coalesce them into
+     * as few packets as possible.
+     *
+     * @return the number of bytes sent.
+     */
+    size_t write(const Segment* segments, size_t count);
+    size_t write(const Segment* segments, size_t count, system_tick_t timeout);
     virtual int available();
     virtual int read();
+    /**
+     * Reads the buffered data, if any. Data that doesn't fit into the receive buffer is read
+     * directly from the socket into the destination buffer.
+     *
+     * @return the number of bytes read, or -1 if no data is available.
+     */
     virtual int read(uint8_t *buffer, size_t size);
+    /**
+     * Same as Stream::readBytes(), but reads as much data at a time as is available.
+     */
+    size_t readBytes(char *buffer, size_t length);
     virtual int peek();
     virtual void flush();
     void flush_buffer();
+    /**
+     * Sets the size of the receive buffer. Larger buffers take fewer socket reads to receive
+     * the same amount of data. The buffered data is kept.
+     *
+     * @return false if the buffered data doesn't fit or there is not enough memory.
+     */
+    bool setBufferSize(size_t size);
+    size_t getBufferSize() const;
     virtual void stop();
     virtual uint8_t connected();
     virtual operator bool();
@@ -74,9 +109,10 @@ protected:
 private:
     struct Data {
         sock_handle_t sock;
-        uint8_t buffer[TCPCLIENT_BUF_MAX_SIZE];
-        uint16_t offset;
-        uint16_t total;
+        std::unique_ptr<uint8_t[]> buffer; // Allocated on first use
+        size_t bufferSize;
+        size_t offset;
+        size_t total;
         IPAddress remoteIP;
 
         explicit Data(sock_handle_t sock);
@@ -86,6 +122,7 @@ private:
     std::shared_ptr<Data> d_;
 
     inline int bufferCount();
+    int receive(uint8_t* buffer, size_t size);
 };
 
 #endif
@@ -91,6 +91,29 @@ private:
 
 
 public:
+    /**
+     * A packet sent with {@link #sendPackets} or received with {@link #receivePackets}.
+     */
+    struct Packet {
+        /**
+         * The packet data, or the buffer to receive the packet to.
+         */
+        uint8_t* buffer;
+        /**
+         * The size of the packet data, or of the receive buffer.
+         */
+        size_t size;
+        /**
+         * The number of bytes sent or received.
+         */
+        size_t length;
+        /**
+         * The destination or source of the packet.
+         */
+        IPAddress remoteIP;
+        uint16_t remotePort;
+    };
+
     UDP();
     virtual ~UDP() { stop(); releaseBuffer(); }
     /**
@@ -153,6 +176,29 @@ public:
         return receivePacket((uint8_t*)buffer, buf_size, timeout);
     }
 
+    /**
+     * Sends several packets in one pass. This does not require the UDP instance to have an
+     * allocated buffer.
+     *
+     * @param packets       The packets to send. The length of each sent packet is updated.
+     * @param count         The number of packets
+     * @return The number of packets sent, or a negative value on error.
+     */
+    int sendPackets(Packet* packets, size_t count);
+
+    /**
+     * Retrieves the packets that have been received, waiting only for the first one. This does
+     * not require the UDP instance to have an allocated buffer. If a buffer is not large enough
+     * for its packet, the remainder that doesn't fit is discarded.
+     *
+     * @param packets       The receive buffers. The length, source address and port of each
+     *                      received packet are updated.
+     * @param count         The number of buffers
+     * @param timeout       How long to wait for the first packet
+     * @return The number of packets received, or a negative value on error.
+     */
+    int receivePackets(Packet* packets, size_t count, system_tick_t timeout = 0);
+
     /**
      * Begin writing a packet to the given destination.
      * @param ip        The IP address of the destination peer.
@@ -244,4 +290,79 @@ public:
     using Print::write;
 };
 
+/**
+ * A ring of preallocated packet buffers that UDP::receivePackets() receives to and the
+ * application consumes from.
+ *
+ * @tparam N            The number of packets
+ * @tparam PacketSize   The maximum size of a packet
+ */
+template<size_t N, size_t PacketSize>
+class UDPPacketRing {
+public:
+    UDPPacketRing() :
+            head_(0),
+            count_(0) {
+    }
+
+    /**
+     * Receives packets to the free buffers.
+     *
+     * @return The number of packets received, or a negative value on error.
+     */
+    int receive(UDP& udp, system_tick_t timeout = 0) {
+        // Only the free buffers up to the end of the ring are contiguous
+        const size_t tail = (head_ + count_) % N;
+        const size_t n = (N - count_ < N - tail) ? N - count_ : N - tail;
+        if (n == 0) {
+            return 0;
+        }
+        for (size_t i = tail; i < tail + n; ++i) {
+            packets_[i].buffer = data_[i];
+            packets_[i].size = PacketSize;
+            packets_[i].length = 0;
+        }
+        const int ret = udp.receivePackets(&packets_[tail], n, timeout);
+        if (ret > 0) {
+            count_ += ret;
+        }
+        return ret;
+    }
+
+    /**
+     * The oldest received packet, or nullptr if the ring is empty.
+     */
+    UDP::Packet* front() {
+        return count_ ? &packets_[head_] : nullptr;
+    }
+
+    /**
+     * Releases the oldest received packet.
+     */
+    void pop() {
+        if (count_) {
+            head_ = (head_ + 1) % N;
+            --count_;
+        }
+    }
+
+    size_t size() const {
+        return count_;
+    }
+
+    bool empty() const {
+        return count_ == 0;
+    }
+
+    bool full() const {
+        return count_ == N;
+    }
+
+private:
+    UDP::Packet packets_[N];
+    uint8_t data_[N][PacketSize];
+    size_t head_;
+    size_t count_;
+};
+
 #endif
@@ -1,4 +1,5 @@
 #include "spark_wiring_cloud.h"
+#include "system_error.h"
 
 namespace {
 
@@ -29,17 +30,31 @@ int CloudClass::call_std_user_function(void* data, const char* param, void* rese
     return (*fn)(String(param));
 }
 
+int CloudClass::call_std_async_user_function(void* data, const char* param, void* reserved)
+{
+    user_std_async_function_t* fn = (user_std_async_function_t*)(data);
+    (*fn)(String(param), CloudFunctionCall(reserved));
+    return 0;
+}
+
+int CloudClass::read_variable(const char* name, const void* var, size_t offset, char* data, size_t size, void* reserved)
+{
+    const user_std_variable_reader_t* fn = (const user_std_variable_reader_t*)(var);
+    return (*fn)(offset, data, size);
+}
+
 void CloudClass::call_wiring_event_handler(const void* handler_data, const char *event_name, const char *data)
 {
     wiring_event_handler_t* fn = (wiring_event_handler_t*)(handler_data);
     (*fn)(event_name, data);
 }
 
-bool CloudClass::register_function(cloud_function_t fn, void* data, const char* funcKey)
+bool CloudClass::register_function(cloud_function_t fn, void* data, const char* funcKey, uint16_t flags)
 {
     cloud_function_descriptor desc;
     memset(&desc, 0, sizeof(desc));
     desc.size = sizeof(desc);
+    desc.flags = flags;
     desc.fn = fn;
     desc.data = (void*)data;
     desc.funcKey = funcKey;
@@ -66,3 +81,28 @@ Future<bool> CloudClass::publish_event(const char *eventName, const char *eventD
     return Future<bool>(Error::NOT_SUPPORTED);
 #endif
 }
+
+CloudFunctionCall::~CloudFunctionCall()
+{
+    complete(SYSTEM_ERROR_CANCELLED);
+}
+
+bool CloudFunctionCall::complete(int result)
+{
+    if (!call_) {
+        return false;
+    }
+    void* call = call_;
+    call_ = nullptr;
+    return CLOUD_FN(spark_function_complete(call, result, nullptr), -1) == 0;
+}
+
+CloudFunctionCall& CloudFunctionCall::operator=(CloudFunctionCall&& call)
+{
+    if (this != &call) {
+        complete(SYSTEM_ERROR_CANCELLED);
+        call_ = call.call_;
+        call.call_ = nullptr;
+    }
+    return *this;
+}
@@ -25,12 +25,15 @@
 #include <algorithm>
 #include <cinttypes>
 #include <memory>
+#include <new>
 
 #include "spark_wiring_usbserial.h"
 #include "spark_wiring_usartserial.h"
 
 #include "spark_wiring_interrupts.h"
 
+#include "delay_hal.h"
+
 // Uncomment to enable logging in interrupt handlers
 // #define LOG_FROM_ISR
 
@@ -345,6 +348,13 @@ const char* extractFuncName(const char *s, size_t *size) {
     return s1;
 }
 
+// Returns index of the level cache entry for a category name
+inline size_t levelCacheIndex(const char *category, size_t cacheSize) {
+    // Category names are expected to be string literals, so their addresses are used as keys (see logging.h)
+    const uint32_t h = (uint32_t)(uintptr_t)category * 2654435761u;
+    return (h >> 16) % cacheSize;
+}
+
 } // namespace
 
 // Default logger instance. This code is compiled as part of the wiring library which has its own
@@ -579,6 +589,235 @@ void spark::JSONStreamLogHandler::logMessage(const char *msg, LogLevel level, co
     this->stream()->write((const uint8_t*)"\r\n", 2);
 }
 
+// spark::BinaryStreamLogHandler
+const uint8_t spark::BinaryStreamLogHandler::FRAME_MAGIC;
+const uint8_t spark::BinaryStreamLogHandler::FLAG_TRUNCATED;
+
+class spark::BinaryStreamLogHandler::Frame {
+public:
+    Frame(FrameType type, LogLevel level) :
+            size_(HEADER_SIZE),
+            flags_(0),
+            truncated_(false) {
+        buf_[0] = FRAME_MAGIC;
+        buf_[1] = type;
+        buf_[2] = level;
+    }
+
+    // Writes the timestamp, format string, category name and attributes
+    void header(const char *fmt, const char *category, const LogAttributes &attr) {
+        value((uint32_t)attr.time);
+        if (fmt) {
+            value(fmt);
+        }
+        value(category);
+        flags_ = size_;
+        value((uint8_t)(attr.flags & (FILE_FLAG | LINE_FLAG | FUNCTION_FLAG | CODE_FLAG | DETAILS_FLAG)));
+        if (attr.has_file) {
+            value(attr.file);
+        }
+        if (attr.has_line) {
+            value((int32_t)attr.line);
+        }
+        if (attr.has_function) {
+            value(attr.function);
+        }
+        if (attr.has_code) {
+            value((int32_t)attr.code);
+        }
+        if (attr.has_details) {
+            string(attr.details);
+        }
+    }
+
+    // Writes the format arguments. The format string is only parsed to get the argument types
+    void args(const char *fmt, va_list args) {
+        for (const char *s = fmt; (s = strchr(s, '%')) && !truncated_;) {
+            ++s;
+            if (*s == '%') {
+                ++s;
+                continue;
+            }
+            s += strspn(s, "-+ #0'"); // Flags
+            if (*s == '*') { // Width
+                value((int32_t)va_arg(args, int));
+                ++s;
+            } else {
+                s += strspn(s, "0123456789");
+            }
+            int prec = -1;
+            if (*s == '.') { // Precision
+                ++s;
+                if (*s == '*') {
+                    prec = va_arg(args, int); // A negative precision is taken as if it were omitted
+                    value((int32_t)prec);
+                    ++s;
+                } else {
+                    prec = 0;
+                    for (; *s >= '0' && *s <= '9'; ++s) {
+                        prec = prec * 10 + (*s - '0');
+                    }
+                }
+            }
+            char len = 0; // Length modifier
+            if (*s && strchr("hljztLq", *s)) {
+                len = *s++;
+                if ((len == 'h' || len == 'l') && *s == len) {
+                    len = (len == 'h') ? 'H' : 'q';
+                    ++s;
+                }
+            }
+            switch (*s++) {
+            case 'd':
+            case 'i':
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+            case 'c':
+                // va_list can't be passed to a helper function portably, as it may be an array type
+                if (len == 'l') {
+                    value(va_arg(args, long));
+                } else if (len == 'q') {
+                    value(va_arg(args, long long));
+                } else if (len == 'j') {
+                    value(va_arg(args, intmax_t));
+                } else if (len == 'z') {
+                    value(va_arg(args, size_t));
+                } else if (len == 't') {
+                    value(va_arg(args, ptrdiff_t));
+                } else {
+                    value(va_arg(args, int)); // Smaller types are promoted to int
+                }
+                break;
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'F':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+                if (len == 'L') {
+                    value((double)va_arg(args, long double));
+                } else {
+                    value(va_arg(args, double));
+                }
+                break;
+            case 's':
+                // The precision limits the number of characters read, the string may be not null-terminated
+                string(va_arg(args, const char*), prec);
+                break;
+            case 'p':
+                value(va_arg(args, const void*));
+                break;
+            case 'n':
+                (void)va_arg(args, void*); // Not supported
+                break;
+            default: // Invalid or unsupported conversion
+                truncated_ = true;
+                break;
+            }
+        }
+    }
+
+    // Writes raw data
+    void data(const char *data, size_t size) {
+        if (size > sizeof(buf_) - size_) {
+            size = sizeof(buf_) - size_;
+            truncated_ = true;
+        }
+        memcpy(buf_ + size_, data, size);
+        size_ += size;
+    }
+
+    void send(Print *stream) {
+        if (truncated_ && flags_) {
+            buf_[flags_] |= FLAG_TRUNCATED;
+        }
+        const size_t payloadSize = size_ - HEADER_SIZE;
+        buf_[3] = payloadSize & 0xff;
+        buf_[4] = (payloadSize >> 8) & 0xff;
+        stream->write(buf_, size_);
+    }
+
+private:
+    enum AttributeFlag {
+        FILE_FLAG = 0x01,
+        LINE_FLAG = 0x02,
+        FUNCTION_FLAG = 0x04,
+        CODE_FLAG = 0x10,
+        DETAILS_FLAG = 0x20
+    };
+
+    static const size_t HEADER_SIZE = 5;
+
+    uint8_t buf_[LOG_MAX_STRING_LENGTH];
+    size_t size_;
+    size_t flags_; // Offset of the flags field
+    bool truncated_;
+
+    template<typename T>
+    void value(T val) {
+        if (sizeof(T) > sizeof(buf_) - size_) {
+            truncated_ = true;
+            return;
+        }
+        // All supported platforms are little endian
+        memcpy(buf_ + size_, &val, sizeof(T));
+        size_ += sizeof(T);
+    }
+
+    void string(const char *str, int maxLen = -1) {
+        if (!str) {
+            str = "(null)";
+        }
+        size_t len = (maxLen >= 0) ? strnlen(str, maxLen) : strlen(str);
+        if (len > 255) { // The length is stored in a single byte
+            len = 255;
+            truncated_ = true;
+        }
+        if (len + 1 > sizeof(buf_) - size_) {
+            if (size_ == sizeof(buf_)) {
+                truncated_ = true;
+                return;
+            }
+            len = sizeof(buf_) - size_ - 1;
+            truncated_ = true;
+        }
+        buf_[size_++] = len;
+        memcpy(buf_ + size_, str, len);
+        size_ += len;
+    }
+};
+
+void spark::BinaryStreamLogHandler::logFormat(const char *fmt, va_list args, LogLevel level, const char *category,
+        const LogAttributes &attr) {
+    Frame f(FORMAT, level);
+    f.header(fmt, category, attr);
+    f.args(fmt, args);
+    f.send(stream());
+}
+
+void spark::BinaryStreamLogHandler::logMessage(const char *msg, LogLevel level, const char *category, const LogAttributes &attr) {
+    Frame f(MESSAGE, level);
+    f.header(nullptr, category, attr);
+    f.data(msg, strlen(msg));
+    f.send(stream());
+}
+
+void spark::BinaryStreamLogHandler::write(const char *data, size_t size) {
+    // Large buffers are split into several frames
+    do {
+        Frame f(WRITE, LOG_LEVEL_NONE);
+        const size_t n = std::min<size_t>(size, LOG_MAX_STRING_LENGTH - 5);
+        f.data(data, n);
+        f.send(stream());
+        data += n;
+        size -= n;
+    } while (size);
+}
+
 #if Wiring_LogConfig
 
 // spark::DefaultLogHandlerFactory
@@ -594,6 +833,11 @@ LogHandler* spark::DefaultLogHandlerFactory::createHandler(const char *type, Log
             return nullptr;
         }
         return new(std::nothrow) StreamLogHandler(*stream, level, std::move(filters));
+    } else if (strcmp(type, "BinaryStreamLogHandler") == 0) {
+        if (!stream) {
+            return nullptr;
+        }
+        return new(std::nothrow) BinaryStreamLogHandler(*stream, level, std::move(filters));
     }
     return nullptr; // Unknown handler type
 }
@@ -669,7 +913,253 @@ struct spark::LogManager::FactoryHandler {
 
 #endif // Wiring_LogConfig
 
-spark::LogManager::LogManager() {
+/*
+    Buffer of log records pending output in asynchronous mode.
+
+    Any number of producers, including interrupt handlers, add records without locking: space is
+    reserved by advancing the head counter with a compare-and-swap, the record's size is published
+    by marking it as reserved, the record is filled in, and then it's marked as ready. Records are
+    consumed in order, and consumption stops at the first record that isn't ready yet. A record
+    that doesn't fit before the end of the buffer is preceded by a padding mark that makes the
+    consumer skip to the beginning of the buffer. Consumed space is zeroed, so the space of a record
+    that is still being filled in never looks ready.
+
+    There can be only one consumer at a time, which is ensured by the log manager's lock. Panic
+    level output is forwarded by draining the buffer instead (see drain()), which may happen in an
+    interrupt handler, while the consumer is preempted. Whoever forwards a record first marks it as
+    done with a compare-and-swap, so that it's never forwarded twice; the consumer then only
+    discards it.
+*/
+struct spark::LogManager::AsyncBuffer {
+    enum State: uint8_t {
+        FREE = 0,
+        READY = 1,
+        PADDING = 2,
+        RESERVED = 3, // The record is being filled in, its size is known
+        DONE = 4 // The record has been forwarded, but not consumed yet
+    };
+
+    // Maximum time in milliseconds drain() waits for a record to be filled in
+    static const unsigned DRAIN_WAIT_TIMEOUT = 10;
+
+    enum Type: uint8_t {
+        MESSAGE = 0,
+        WRITE = 1
+    };
+
+    struct Record {
+        uint8_t state;
+        uint8_t type;
+        uint16_t detailsSize; // Size of the details string (message records only)
+        uint32_t size; // Size of the record, including this header
+        int level;
+        const char *category;
+        LogAttributes attr; // Message records only
+        uint32_t dataSize; // Size of the message or data
+        // Followed by the message or data and the details string, each null-terminated
+        char* data() {
+            return (char*)(this + 1);
+        }
+    };
+
+    std::unique_ptr<uint8_t[]> buf;
+    uint32_t size; // Power of two
+    std::atomic<uint32_t> head; // Total size of the reserved records
+    std::atomic<uint32_t> tail; // Total size of the consumed records
+    std::atomic<unsigned> dropped;
+    std::atomic<bool> draining;
+    LogManager* manager;
+
+#if PLATFORM_THREADING
+    Thread writer;
+    os_semaphore_t sem;
+    volatile bool stop;
+#endif
+
+    AsyncBuffer() :
+            size(0),
+            head(0),
+            tail(0),
+            dropped(0),
+            draining(false),
+            manager(nullptr) {
+#if PLATFORM_THREADING
+        sem = nullptr;
+        stop = false;
+#endif
+    }
+
+    ~AsyncBuffer() {
+#if PLATFORM_THREADING
+        if (writer.isValid()) {
+            stop = true;
+            os_semaphore_give(sem, false);
+            writer.join();
+        }
+        if (sem) {
+            os_semaphore_destroy(sem);
+        }
+#endif
+    }
+
+    bool init(size_t bufferSize) {
+        size = alignof(Record);
+        while (size * 2 <= bufferSize) {
+            size *= 2;
+        }
+        buf.reset(new(std::nothrow) uint8_t[size]);
+        if (!buf) {
+            return false;
+        }
+        memset(buf.get(), 0, size);
+#if PLATFORM_THREADING
+        if (os_semaphore_create(&sem, 1, 0) != 0) {
+            sem = nullptr;
+            return false;
+        }
+#endif
+        return true;
+    }
+
+    // Called by producers
+    bool push(Type type, int level, const char *category, const LogAttributes *attr, const char *data, size_t dataSize) {
+        size_t detailsSize = 0;
+        if (attr && attr->has_details && attr->details) {
+            detailsSize = strlen(attr->details);
+        }
+        const size_t alignment = alignof(Record);
+        const size_t n = (sizeof(Record) + dataSize + 1 + detailsSize + 1 + alignment - 1) / alignment * alignment;
+        if (n > size || detailsSize > 0xffff) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        uint32_t h = head.load(std::memory_order_relaxed);
+        uint32_t pos = 0;
+        uint32_t reserved = 0;
+        do {
+            pos = h & (size - 1);
+            reserved = n;
+            if (pos + n > size) {
+                reserved += size - pos; // Skip the rest of the buffer
+            }
+            if (h + reserved - tail.load(std::memory_order_acquire) > size) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        } while (!head.compare_exchange_weak(h, h + reserved, std::memory_order_acquire, std::memory_order_relaxed));
+        if (reserved != n) {
+            __atomic_store_n(&buf[pos], (uint8_t)PADDING, __ATOMIC_RELEASE);
+            pos = 0;
+        }
+        Record* r = (Record*)(buf.get() + pos);
+        r->size = n;
+        __atomic_store_n(&r->state, (uint8_t)RESERVED, __ATOMIC_RELEASE);
+        r->type = type;
+        r->level = level;
+        r->category = category;
+        if (attr) {
+            memcpy(&r->attr, attr, std::min(attr->size, sizeof(LogAttributes)));
+            r->attr.size = sizeof(LogAttributes);
+        }
+        r->dataSize = dataSize;
+        memcpy(r->data(), data, dataSize);
+        r->detailsSize = detailsSize;
+        if (detailsSize) {
+            char* const details = r->data() + dataSize + 1;
+            memcpy(details, attr->details, detailsSize);
+            r->attr.details = details;
+        }
+        __atomic_store_n(&r->state, (uint8_t)READY, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    // Returns the oldest record, or null if there are no ready records
+    Record* front() {
+        for (;;) {
+            const uint32_t t = tail.load(std::memory_order_relaxed);
+            if (t == head.load(std::memory_order_acquire)) {
+                return nullptr;
+            }
+            const uint32_t pos = t & (size - 1);
+            const uint8_t state = __atomic_load_n(&buf[pos], __ATOMIC_ACQUIRE);
+            if (state == PADDING) {
+                memset(buf.get() + pos, 0, size - pos);
+                tail.store(t + size - pos, std::memory_order_release);
+                continue;
+            }
+            if (state != READY && state != DONE) {
+                return nullptr; // The record is being filled in
+            }
+            return (Record*)(buf.get() + pos);
+        }
+    }
+
+    // Marks a ready record as done. Returns false if the record has been forwarded already
+    bool claim(Record* r) {
+        uint8_t state = READY;
+        return __atomic_compare_exchange_n(&r->state, &state, (uint8_t)DONE, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+    }
+
+    void pop(Record* r) {
+        const uint32_t n = r->size;
+        // The header is cleared last, so that drain() can still skip the record if it preempts this method
+        memset(r + 1, 0, n - sizeof(Record));
+        memset(r, 0, sizeof(Record));
+        tail.store(tail.load(std::memory_order_relaxed) + n, std::memory_order_release);
+    }
+
+    // Claims all ready records and forwards them to the handlers, without consuming them. Unlike
+    // the consumer, this method doesn't stop at a record that is being filled in: if `wait` is set,
+    // the record is waited for for a short time, and then it's skipped
+    void drain(bool wait) {
+        uint32_t t = tail.load(std::memory_order_acquire);
+        while (t != head.load(std::memory_order_acquire)) {
+            const uint32_t pos = t & (size - 1);
+            uint8_t state = __atomic_load_n(&buf[pos], __ATOMIC_ACQUIRE);
+            for (unsigned i = 0; wait && (state == FREE || state == RESERVED) && i < DRAIN_WAIT_TIMEOUT; ++i) {
+                HAL_Delay_Milliseconds(1);
+                state = __atomic_load_n(&buf[pos], __ATOMIC_ACQUIRE);
+            }
+            if (state == FREE) {
+                break; // The size of the record isn't known yet
+            }
+            if (state == PADDING) {
+                t += size - pos;
+                continue;
+            }
+            Record* const r = (Record*)(buf.get() + pos);
+            if (state == READY && claim(r)) {
+                forward(r);
+            }
+            t += r->size;
+        }
+    }
+
+    // Passes a record to the log handlers
+    void forward(Record* r) {
+        for (LogHandler *handler: manager->activeHandlers_) {
+            if (r->type == MESSAGE) {
+                handler->message(r->data(), (LogLevel)r->level, r->category, r->attr);
+            } else {
+                handler->write(r->data(), r->dataSize, (LogLevel)r->level, r->category);
+            }
+        }
+    }
+
+    void notify() {
+#if PLATFORM_THREADING
+        os_semaphore_give(sem, false);
+#endif
+    }
+};
+
+spark::LogManager::LogManager() :
+        async_(nullptr),
+        defaultLevel_(LOG_LEVEL_NONE) { // No handlers
+    for (CachedLevel &entry: levelCache_) {
+        entry.category = nullptr;
+        entry.level = LOG_LEVEL_NONE;
+    }
 #if Wiring_LogConfig
     handlerFactory_ = DefaultLogHandlerFactory::instance();
     streamFactory_ = DefaultOutputStreamFactory::instance();
@@ -679,6 +1169,7 @@ spark::LogManager::LogManager() {
 
 spark::LogManager::~LogManager() {
     resetSystemCallbacks();
+    delete async_.exchange(nullptr);
 #if Wiring_LogConfig
     LOG_WITH_LOCK(mutex_) {
          destroyFactoryHandlers();
@@ -694,6 +1185,8 @@ bool spark::LogManager::addHandler(LogHandler *handler) {
         if (activeHandlers_.size() == 1) {
             setSystemCallbacks();
         }
+        updateFilter();
+        updateFormatCallback();
     }
     return true;
 }
@@ -703,9 +1196,47 @@ void spark::LogManager::removeHandler(LogHandler *handler) {
         if (activeHandlers_.removeOne(handler) && activeHandlers_.isEmpty()) {
             resetSystemCallbacks();
         }
+        updateFilter();
+        updateFormatCallback();
+    }
+}
+
+bool spark::LogManager::enableAsync(size_t bufferSize) {
+    LOG_WITH_LOCK(mutex_) {
+        if (async_.load()) {
+            return true;
+        }
+        std::unique_ptr<AsyncBuffer> async(new(std::nothrow) AsyncBuffer);
+        if (!async || !async->init(bufferSize)) {
+            return false;
+        }
+        async->manager = this;
+#if PLATFORM_THREADING
+        // The writer runs below the priority of the application thread. It's given the buffer,
+        // as it may start running before the buffer is published below
+        async->writer = Thread("log", writeBuffered, async.get(), OS_THREAD_PRIORITY_DEFAULT - 1);
+        if (!async->writer.isValid()) {
+            return false;
+        }
+#endif
+        async_.store(async.release());
+        updateFormatCallback();
+    }
+    return true;
+}
+
+void spark::LogManager::flush() {
+    AsyncBuffer* const async = async_.load();
+    if (async) {
+        writeBuffered(async);
     }
 }
 
+unsigned spark::LogManager::droppedCount() const {
+    const AsyncBuffer* const async = async_.load();
+    return async ? async->dropped.load(std::memory_order_relaxed) : 0;
+}
+
 spark::LogManager* spark::LogManager::instance() {
     static LogManager mgr;
     return &mgr;
@@ -752,6 +1283,8 @@ bool spark::LogManager::addFactoryHandler(const char *id, const char *handlerTyp
         if (activeHandlers_.size() == 1) {
             setSystemCallbacks();
         }
+        updateFilter();
+        updateFormatCallback();
         handler.release(); // Release scope guard pointers
         stream.release();
     }
@@ -803,6 +1336,8 @@ void spark::LogManager::destroyFactoryHandler(const char *id) {
                 streamFactory_->destroyStream(h.stream);
             }
             factoryHandlers_.removeAt(i);
+            updateFilter();
+            updateFormatCallback();
             break;
         }
     }
@@ -820,25 +1355,62 @@ void spark::LogManager::destroyFactoryHandlers() {
         }
     }
     factoryHandlers_.clear();
+    updateFilter();
+    updateFormatCallback();
 }
 
 #endif // Wiring_LogConfig
 
 void spark::LogManager::setSystemCallbacks() {
     log_set_callbacks(logMessage, logWrite, logEnabled, nullptr);
+    log_set_flush_callback(logFlush, nullptr);
 }
 
 void spark::LogManager::resetSystemCallbacks() {
     log_set_callbacks(nullptr, nullptr, nullptr, nullptr);
+    log_set_format_callback(nullptr, nullptr);
+    log_set_flush_callback(nullptr, nullptr);
+}
+
+void spark::LogManager::updateFormatCallback() {
+    // Messages can't be buffered in asynchronous mode before they're formatted
+    bool deferred = false;
+    if (!async_.load()) {
+        for (LogHandler *handler: activeHandlers_) {
+            if (handler->defersFormatting()) {
+                deferred = true;
+                break;
+            }
+        }
+    }
+    log_set_format_callback(deferred ? logFormat : nullptr, nullptr);
 }
 
 void spark::LogManager::logMessage(const char *msg, int level, const char *category, const LogAttributes *attr, void *reserved) {
+    LogManager *that = instance();
+    AsyncBuffer* const async = that->async_.load();
+    if (async) {
+        if (that->isReentrant()) {
+            return;
+        }
+        async->push(AsyncBuffer::MESSAGE, level, category, attr, msg, strlen(msg));
+        if (level >= LOG_LEVEL_PANIC) {
+            that->drainBuffered(async, !HAL_IsISR());
+        }
+#if PLATFORM_THREADING
+        async->notify();
+#else
+        if (!HAL_IsISR()) {
+            that->writeBuffered(async);
+        }
+#endif
+        return;
+    }
 #ifndef LOG_FROM_ISR
     if (HAL_IsISR()) {
         return;
     }
 #endif
-    LogManager *that = instance();
     LOG_WITH_LOCK(that->mutex_) {
         // prevent re-entry
         if (that->isActive()) {
@@ -846,19 +1418,69 @@ void spark::LogManager::logMessage(const char *msg, int level, const char *categ
         }
         that->setActive(true);
         for (LogHandler *handler: that->activeHandlers_) {
-            handler->message(msg, (LogLevel)level, category, *attr);
+            if (!handler->defersFormatting()) { // See logFormat()
+                handler->message(msg, (LogLevel)level, category, *attr);
+            }
+        }
+        that->setActive(false);
+    }
+}
+
+int spark::LogManager::logFormat(const char *fmt, va_list args, int level, const char *category, const LogAttributes *attr,
+        void *reserved) {
+#ifndef LOG_FROM_ISR
+    if (HAL_IsISR()) {
+        return 0;
+    }
+#endif
+    LogManager *that = instance();
+    int formatted = 0; // Set if some of the handlers need a formatted message
+    LOG_WITH_LOCK(that->mutex_) {
+        // prevent re-entry
+        if (that->isActive()) {
+            return 0;
+        }
+        that->setActive(true);
+        for (LogHandler *handler: that->activeHandlers_) {
+            if (handler->defersFormatting()) {
+                va_list handlerArgs;
+                va_copy(handlerArgs, args);
+                handler->format(fmt, handlerArgs, (LogLevel)level, category, *attr);
+                va_end(handlerArgs);
+            } else if (!formatted && level >= handler->level(category)) {
+                formatted = 1;
+            }
         }
         that->setActive(false);
     }
+    return formatted;
 }
 
 void spark::LogManager::logWrite(const char *data, size_t size, int level, const char *category, void *reserved) {
+    LogManager *that = instance();
+    AsyncBuffer* const async = that->async_.load();
+    if (async) {
+        if (that->isReentrant()) {
+            return;
+        }
+        async->push(AsyncBuffer::WRITE, level, category, nullptr, data, size);
+        if (level >= LOG_LEVEL_PANIC) {
+            that->drainBuffered(async, !HAL_IsISR());
+        }
+#if PLATFORM_THREADING
+        async->notify();
+#else
+        if (!HAL_IsISR()) {
+            that->writeBuffered(async);
+        }
+#endif
+        return;
+    }
 #ifndef LOG_FROM_ISR
     if (HAL_IsISR()) {
         return;
     }
 #endif
-    LogManager *that = instance();
     LOG_WITH_LOCK(that->mutex_) {
         // prevent re-entry
         if (that->isActive()) {
@@ -873,22 +1495,178 @@ void spark::LogManager::logWrite(const char *data, size_t size, int level, const
 }
 
 int spark::LogManager::logEnabled(int level, const char *category, void *reserved) {
-#ifndef LOG_FROM_ISR
+    LogManager *that = instance();
+    int minLevel = LOG_LEVEL_NONE;
+    if (that->cachedLevel(category, &minLevel)) {
+        return (level >= minLevel);
+    }
     if (HAL_IsISR()) {
+        // The handler list can't be locked in an interrupt handler. In asynchronous mode, the
+        // output is filtered by the handlers when it's forwarded to them
+        if (that->async_.load()) {
+            return 1;
+        }
+#ifndef LOG_FROM_ISR
         return 0;
-    }
 #endif
+    }
+    // The filter has its own lock, so that a check isn't held up by the output of another thread
+    LOG_WITH_LOCK(that->filterMutex_) {
+        minLevel = that->categoryLevel(category);
+    }
+    return (level >= minLevel);
+}
+
+void spark::LogManager::logFlush(void *reserved) {
     LogManager *that = instance();
-    int minLevel = LOG_LEVEL_NONE;
-    LOG_WITH_LOCK(that->mutex_) {
-        for (LogHandler *handler: that->activeHandlers_) {
-            const int level = handler->level(category);
-            if (level < minLevel) {
-                minLevel = level;
+    AsyncBuffer* const async = that->async_.load();
+    if (async) {
+        // The system is about to enter the panic mode, don't wait for the records being filled in
+        that->drainBuffered(async, false);
+    }
+}
+
+// Returns the cached level of a category. This method doesn't need to be called with the lock held
+bool spark::LogManager::cachedLevel(const char *category, int *level) const {
+    if (!category) {
+        *level = defaultLevel_.load(std::memory_order_relaxed);
+        return (*level >= 0);
+    }
+    const CachedLevel &entry = levelCache_[levelCacheIndex(category, LEVEL_CACHE_SIZE)];
+    if (entry.category.load(std::memory_order_acquire) != category) {
+        return false;
+    }
+    *level = entry.level.load(std::memory_order_relaxed);
+    // Make sure the entry wasn't replaced while its level was being read
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return (entry.category.load(std::memory_order_relaxed) == category);
+}
+
+// Looks up the level of a category and caches it. This method should be called with the filter lock held
+int spark::LogManager::categoryLevel(const char *category) {
+    if (!filter_) {
+        // The combined filter couldn't be allocated. The handler list can't be accessed with
+        // the filter lock, so all output is enabled and the handlers filter it themselves
+        return LOG_LEVEL_ALL;
+    }
+    const int minLevel = filter_->level(category);
+    if (category) {
+        CachedLevel &entry = levelCache_[levelCacheIndex(category, LEVEL_CACHE_SIZE)];
+        entry.category.store(nullptr, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        entry.level.store(minLevel, std::memory_order_relaxed);
+        entry.category.store(category, std::memory_order_release);
+    }
+    return minLevel;
+}
+
+/*
+    Combines the category filters of all active handlers into a single filter, so that a category
+    needs to be looked up only once regardless of the number of handlers. For every category filter
+    string of every handler, the combined filter contains the lowest level enabled for that category
+    by any of the handlers. Given that the level of a category is determined by the longest matching
+    filter string, this makes the combined filter enable the lowest level enabled by any of the
+    handlers for any category. This method should be called with the lock held, it takes the filter lock itself.
+*/
+void spark::LogManager::updateFilter() {
+    LOG_WITH_LOCK(filterMutex_) {
+        // Invalidate cached levels
+        defaultLevel_.store(-1, std::memory_order_relaxed);
+        for (CachedLevel &entry: levelCache_) {
+            entry.category.store(nullptr, std::memory_order_relaxed);
+        }
+        filter_.reset();
+        LogLevel defaultLevel = LOG_LEVEL_NONE;
+        LogCategoryFilters filters;
+        for (LogHandler *handler: activeHandlers_) {
+            defaultLevel = std::min(defaultLevel, handler->level());
+            for (const String &category: handler->filter_.categories()) {
+                const bool found = std::any_of(filters.begin(), filters.end(), [&category](const LogCategoryFilter &filter) {
+                    return category == filter.category();
+                });
+                if (found) {
+                    continue;
+                }
+                LogLevel level = LOG_LEVEL_NONE;
+                for (LogHandler *h: activeHandlers_) {
+                    level = std::min(level, h->level(category.c_str()));
+                }
+                if (!filters.append(LogCategoryFilter(category, level))) {
+                    return; // See categoryLevel()
+                }
             }
         }
+        filter_.reset(new(std::nothrow) detail::LogFilter(defaultLevel, std::move(filters)));
+        if (filter_) {
+            defaultLevel_.store(defaultLevel, std::memory_order_relaxed);
+        }
     }
-    return (level >= minLevel);
+}
+
+void spark::LogManager::writeBuffered(AsyncBuffer* async) {
+    for (;;) {
+        LOG_WITH_LOCK(mutex_) {
+            AsyncBuffer::Record* const r = async->front();
+            if (!r) {
+                return;
+            }
+            if (async->claim(r)) { // The record may have been forwarded by drainBuffered()
+                setActive(true);
+                async->forward(r);
+                setActive(false);
+            }
+            async->pop(r);
+        }
+    }
+}
+
+// Forwards the buffered output synchronously, see AsyncBuffer::drain()
+void spark::LogManager::drainBuffered(AsyncBuffer* async, bool wait) {
+    if (async->draining.exchange(true, std::memory_order_acquire)) {
+        return; // Prevent re-entry
+    }
+    if (HAL_IsISR()) {
+        // The lock can't be acquired in an interrupt handler, so the handlers are called as is.
+        // This may interfere with the output of the preempted thread, which is acceptable at this level
+        const bool active = isActive();
+        setActive(true);
+        async->drain(false);
+        setActive(active);
+    } else {
+        LOG_WITH_LOCK(mutex_) {
+            setActive(true);
+            async->drain(wait);
+            setActive(false);
+        }
+    }
+    async->draining.store(false, std::memory_order_release);
+}
+
+void spark::LogManager::writeBuffered(void* data) {
+#if PLATFORM_THREADING
+    const auto async = static_cast<AsyncBuffer*>(data);
+    while (!async->stop) {
+        os_semaphore_take(async->sem, CONCURRENT_WAIT_FOREVER, false);
+        async->manager->writeBuffered(async);
+    }
+#endif
+}
+
+// Returns true if the output is generated by a handler while the output is being forwarded
+bool spark::LogManager::isReentrant() {
+    if (HAL_IsISR()) {
+        return false; // Output is never forwarded in an interrupt handler
+    }
+#if PLATFORM_THREADING
+    if (!mutex_.trylock()) {
+        return false; // Another thread is forwarding the output
+    }
+    const bool active = isActive();
+    mutex_.unlock();
+    return active;
+#else
+    return isActive();
+#endif
 }
 
 inline bool spark::LogManager::isActive() const {
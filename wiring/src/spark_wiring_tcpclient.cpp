@@ -35,6 +35,8 @@
 #include "socket_hal.h"
 #include "inet_hal.h"
 #include "spark_macros.h"
+#include "spark_wiring_ticks.h"
+#include <algorithm>
 
 using namespace spark;
 
@@ -140,11 +142,47 @@ size_t TCPClient::write(const uint8_t *buffer, size_t size, system_tick_t timeou
     return ret;
 }
 
+size_t TCPClient::write(const Segment* segments, size_t count)
+{
+    return write(segments, count, SPARK_WIRING_TCPCLIENT_DEFAULT_SEND_TIMEOUT);
+}
+
+size_t TCPClient::write(const Segment* segments, size_t count, system_tick_t timeout)
+{
+    // The socket HAL has no vectored send, so the segments are sent one by one
+    size_t sent = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        int ret = (int)write(segments[i].data, segments[i].size, timeout);
+        if (ret < 0)
+        {
+            break;
+        }
+        sent += ret;
+        if ((size_t)ret < segments[i].size)
+        {
+            break;
+        }
+    }
+    return sent;
+}
+
 int TCPClient::bufferCount()
 {
   return d_->total - d_->offset;
 }
 
+int TCPClient::receive(uint8_t* buffer, size_t size)
+{
+    int ret = socket_receive(d_->sock, buffer, size, 0);
+    if (ret > 0)
+    {
+        DEBUG("recv(=%d)",ret);
+        return ret;
+    }
+    return 0;
+}
+
 int TCPClient::available()
 {
     int avail = 0;
@@ -155,15 +193,19 @@ int TCPClient::available()
         flush_buffer();
     }
 
-    if(Network.from(nif).ready() && isOpen(d_->sock))
+    if (!d_->buffer)
+    {
+        d_->buffer.reset(new (std::nothrow) uint8_t[d_->bufferSize]);
+    }
+
+    if(Network.from(nif).ready() && isOpen(d_->sock) && d_->buffer)
     {
         // Have room
-        if ( d_->total < arraySize(d_->buffer))
+        if ( d_->total < d_->bufferSize)
         {
-            int ret = socket_receive(d_->sock, d_->buffer + d_->total , arraySize(d_->buffer)-d_->total, 0);
+            int ret = receive(d_->buffer.get() + d_->total, d_->bufferSize - d_->total);
             if (ret > 0)
             {
-                DEBUG("recv(=%d)",ret);
                 if (d_->total == 0) d_->offset = 0;
                 d_->total += ret;
             }
@@ -180,14 +222,45 @@ int TCPClient::read()
 
 int TCPClient::read(uint8_t *buffer, size_t size)
 {
-        int read = -1;
-        if (bufferCount() || available())
+        size_t read = std::min(size, (size_t)bufferCount());
+        if (read > 0)
+        {
+          memcpy(buffer, &d_->buffer[d_->offset], read);
+          d_->offset += read;
+        }
+        if (size - read >= d_->bufferSize)
+        {
+          // Bypass the receive buffer
+          if (Network.from(nif).ready() && isOpen(d_->sock))
+            read += receive(buffer + read, size - read);
+        }
+        else if (read == 0 && available())
         {
-          read = (size > (size_t) bufferCount()) ? bufferCount() : size;
+          read = std::min(size, (size_t)bufferCount());
           memcpy(buffer, &d_->buffer[d_->offset], read);
           d_->offset += read;
         }
-        return read;
+        return read > 0 ? read : -1;
+}
+
+size_t TCPClient::readBytes(char *buffer, size_t length)
+{
+  size_t count = 0;
+  _startMillis = millis();
+  while (count < length)
+  {
+    const int ret = read((uint8_t*)buffer + count, length - count);
+    if (ret > 0)
+    {
+      count += ret;
+      _startMillis = millis();
+    }
+    else if (millis() - _startMillis >= _timeout)
+    {
+      break;
+    }
+  }
+  return count;
 }
 
 int TCPClient::peek()
@@ -205,6 +278,34 @@ void TCPClient::flush()
 {
 }
 
+bool TCPClient::setBufferSize(size_t size)
+{
+  const size_t count = bufferCount();
+  if (size == 0 || size < count)
+  {
+    return false;
+  }
+  std::unique_ptr<uint8_t[]> buffer(new (std::nothrow) uint8_t[size]);
+  if (!buffer)
+  {
+    return false;
+  }
+  if (count > 0)
+  {
+    memcpy(buffer.get(), &d_->buffer[d_->offset], count);
+  }
+  d_->buffer = std::move(buffer);
+  d_->bufferSize = size;
+  d_->offset = 0;
+  d_->total = count;
+  return true;
+}
+
+size_t TCPClient::getBufferSize() const
+{
+  return d_->bufferSize;
+}
+
 
 void TCPClient::stop()
 {
@@ -251,6 +352,7 @@ IPAddress TCPClient::remoteIP()
 
 TCPClient::Data::Data(sock_handle_t sock)
         : sock(sock),
+          bufferSize(TCPCLIENT_BUF_MAX_SIZE),
           offset(0),
           total(0) {
 }
@@ -33,6 +33,8 @@
 #include <arpa/inet.h>
 #include "spark_wiring_constants.h"
 #include "spark_wiring_posix_common.h"
+#include "spark_wiring_ticks.h"
+#include <algorithm>
 
 using namespace spark;
 
@@ -129,6 +131,15 @@ size_t TCPClient::write(uint8_t b, system_tick_t timeout) {
 }
 
 size_t TCPClient::write(const uint8_t *buffer, size_t size, system_tick_t timeout) {
+    const Segment segment = { buffer, size };
+    return write(&segment, 1, timeout);
+}
+
+size_t TCPClient::write(const Segment* segments, size_t count) {
+    return write(segments, count, SOCKET_WAIT_FOREVER);
+}
+
+size_t TCPClient::write(const Segment* segments, size_t count, system_tick_t timeout) {
     clearWriteError();
     struct timeval tv = {};
     if (timeout != SOCKET_WAIT_FOREVER) {
@@ -141,19 +152,47 @@ size_t TCPClient::write(const uint8_t *buffer, size_t size, system_tick_t timeou
         return 0;
     }
 
-    ret = sock_send(d_->sock, buffer, size, 0);
-    if (ret < 0) {
-        setWriteError(errno);
-        return 0;
+    size_t sent = 0;
+    for (size_t i = 0; i < count; i++) {
+        int flags = 0;
+#ifdef MSG_MORE
+        // Don't push the data out until the last segment is queued
+        if (i + 1 < count) {
+            flags |= MSG_MORE;
+        }
+#endif // MSG_MORE
+        ret = sock_send(d_->sock, segments[i].data, segments[i].size, flags);
+        if (ret < 0) {
+            setWriteError(errno);
+            break;
+        }
+        sent += ret;
+        if ((size_t)ret < segments[i].size) {
+            // Timed out
+            break;
+        }
     }
 
-    return ret;
+    return sent;
 }
 
 int TCPClient::bufferCount() {
     return d_->total - d_->offset;
 }
 
+int TCPClient::receive(uint8_t* buffer, size_t size) {
+    int ret = sock_recv(d_->sock, buffer, size, MSG_DONTWAIT);
+    if (ret < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            LOG(ERROR, "recv error = %d", errno);
+            sock_close(d_->sock);
+            d_->sock = -1;
+        }
+        ret = 0;
+    }
+    return ret;
+}
+
 int TCPClient::available()
 {
     int avail = 0;
@@ -163,21 +202,19 @@ int TCPClient::available()
         flush_buffer();
     }
 
-    if (isOpen(d_->sock)) {
+    if (!d_->buffer) {
+        d_->buffer.reset(new (std::nothrow) uint8_t[d_->bufferSize]);
+    }
+
+    if (isOpen(d_->sock) && d_->buffer) {
         // Have room
-        if (d_->total < arraySize(d_->buffer)) {
-            int ret = sock_recv(d_->sock, d_->buffer + d_->total, arraySize(d_->buffer) - d_->total, MSG_DONTWAIT);
+        if (d_->total < d_->bufferSize) {
+            int ret = receive(d_->buffer.get() + d_->total, d_->bufferSize - d_->total);
             if (ret > 0) {
                 if (d_->total == 0) {
                     d_->offset = 0;
                 }
                 d_->total += ret;
-            } else {
-                if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                    LOG(ERROR, "recv error = %d", errno);
-                    sock_close(d_->sock);
-                    d_->sock = -1;
-                }
             }
         } // Have Space
     } // isOpen(d_->sock)
@@ -190,13 +227,37 @@ int TCPClient::read() {
 }
 
 int TCPClient::read(uint8_t *buffer, size_t size) {
-    int read = -1;
-    if (bufferCount() || available()) {
-        read = (size > (size_t) bufferCount()) ? bufferCount() : size;
+    size_t read = std::min(size, (size_t)bufferCount());
+    if (read > 0) {
         memcpy(buffer, &d_->buffer[d_->offset], read);
         d_->offset += read;
     }
-    return read;
+    if (size - read >= d_->bufferSize) {
+        // Bypass the receive buffer
+        if (isOpen(d_->sock)) {
+            read += receive(buffer + read, size - read);
+        }
+    } else if (read == 0 && available()) {
+        read = std::min(size, (size_t)bufferCount());
+        memcpy(buffer, &d_->buffer[d_->offset], read);
+        d_->offset += read;
+    }
+    return read > 0 ? read : -1;
+}
+
+size_t TCPClient::readBytes(char *buffer, size_t length) {
+    size_t count = 0;
+    _startMillis = millis();
+    while (count < length) {
+        const int ret = read((uint8_t*)buffer + count, length - count);
+        if (ret > 0) {
+            count += ret;
+            _startMillis = millis();
+        } else if (millis() - _startMillis >= _timeout) {
+            break;
+        }
+    }
+    return count;
 }
 
 int TCPClient::peek() {
@@ -211,6 +272,29 @@ void TCPClient::flush_buffer() {
 void TCPClient::flush() {
 }
 
+bool TCPClient::setBufferSize(size_t size) {
+    const size_t count = bufferCount();
+    if (size == 0 || size < count) {
+        return false;
+    }
+    std::unique_ptr<uint8_t[]> buffer(new (std::nothrow) uint8_t[size]);
+    if (!buffer) {
+        return false;
+    }
+    if (count > 0) {
+        memcpy(buffer.get(), &d_->buffer[d_->offset], count);
+    }
+    d_->buffer = std::move(buffer);
+    d_->bufferSize = size;
+    d_->offset = 0;
+    d_->total = count;
+    return true;
+}
+
+size_t TCPClient::getBufferSize() const {
+    return d_->bufferSize;
+}
+
 void TCPClient::stop() {
     if (isOpen(d_->sock)) {
         sock_close(d_->sock);
@@ -245,6 +329,7 @@ IPAddress TCPClient::remoteIP() {
 
 TCPClient::Data::Data(sock_handle_t sock)
         : sock(sock),
+          bufferSize(TCPCLIENT_BUF_MAX_SIZE),
           offset(0),
           total(0) {
 }
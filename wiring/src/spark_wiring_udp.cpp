@@ -216,6 +216,37 @@ int UDP::receivePacket(uint8_t* buffer, size_t size, system_tick_t timeout)
     return ret;
 }
 
+int UDP::sendPackets(Packet* packets, size_t count)
+{
+    // The socket HAL has no batched send, so the packets are sent one by one
+    size_t sent = 0;
+    for (; sent < count; sent++)
+    {
+        Packet& p = packets[sent];
+        int ret = sendPacket(p.buffer, p.size, p.remoteIP, p.remotePort);
+        if (ret < 0)
+            return sent ? (int)sent : ret;
+        p.length = ret;
+    }
+    return sent;
+}
+
+int UDP::receivePackets(Packet* packets, size_t count, system_tick_t timeout)
+{
+    size_t received = 0;
+    for (; received < count; received++)
+    {
+        Packet& p = packets[received];
+        int ret = receivePacket(p.buffer, p.size, received ? 0 : timeout);
+        if (ret <= 0)
+            return received ? (int)received : ret;
+        p.length = ret;
+        p.remoteIP = _remoteIP;
+        p.remotePort = _remotePort;
+    }
+    return received;
+}
+
 int UDP::read()
 {
   return available() ? _buffer[_offset++] : -1;
@@ -33,15 +33,31 @@
 #include <arpa/inet.h>
 #include "spark_wiring_constants.h"
 #include "spark_wiring_posix_common.h"
+#include <algorithm>
 
 using namespace spark;
 
 namespace {
 
+// Maximum number of packets passed to the socket HAL in one call
+const size_t MAX_PACKETS_PER_CALL = 8;
+
 inline bool isOpen(sock_handle_t sd) {
     return socket_handle_valid(sd);
 }
 
+// Returns the receive flags for the given timeout, setting the socket timeout if needed
+int receiveFlags(int sock, system_tick_t timeout) {
+    if (timeout == 0) {
+        return MSG_DONTWAIT;
+    }
+    struct timeval tv = {};
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
+    CHECK(sock_setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)));
+    return 0;
+}
+
 int joinLeaveMulticast(int sock, const IPAddress& addr, uint8_t ifindex, bool join) {
     sockaddr_storage s = {};
     detail::ipAddressPortToSockaddr(addr, 0, (struct sockaddr*)&s);
@@ -281,17 +297,9 @@ int UDP::receivePacket(uint8_t* buffer, size_t size, system_tick_t timeout) {
     if (isOpen(_sock) && buffer) {
         sockaddr_storage saddr = {};
         socklen_t slen = sizeof(saddr);
-        int flags = 0;
-        if (timeout == 0) {
-            flags = MSG_DONTWAIT;
-        } else {
-            struct timeval tv = {};
-            tv.tv_sec = timeout / 1000;
-            tv.tv_usec = (timeout % 1000) * 1000;
-            ret = sock_setsockopt(_sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
-            if (ret) {
-                return ret;
-            }
+        const int flags = receiveFlags(_sock, timeout);
+        if (flags < 0) {
+            return flags;
         }
         ret = sock_recvfrom(_sock, buffer, size, flags, (struct sockaddr*)&saddr, &slen);
         if (ret >= 0) {
@@ -302,6 +310,95 @@ int UDP::receivePacket(uint8_t* buffer, size_t size, system_tick_t timeout) {
     return ret;
 }
 
+int UDP::sendPackets(Packet* packets, size_t count) {
+    if (!isOpen(_sock) || !packets) {
+        return -1;
+    }
+    sockaddr_storage addrs[MAX_PACKETS_PER_CALL];
+    struct iovec iov[MAX_PACKETS_PER_CALL];
+    sock_mmsghdr msgs[MAX_PACKETS_PER_CALL];
+    size_t sent = 0;
+    while (sent < count) {
+        size_t n = std::min(count - sent, MAX_PACKETS_PER_CALL);
+        for (size_t i = 0; i < n; ++i) {
+            Packet& p = packets[sent + i];
+            addrs[i] = {};
+            detail::ipAddressPortToSockaddr(p.remoteIP, p.remotePort, (struct sockaddr*)&addrs[i]);
+            if (addrs[i].ss_family == AF_UNSPEC) {
+                // Send the packets before the invalid one
+                n = i;
+                break;
+            }
+            iov[i].iov_base = p.buffer;
+            iov[i].iov_len = p.size;
+            msgs[i] = {};
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        const int ret = (n > 0) ? sock_sendmmsg(_sock, msgs, n, 0) : -1;
+        if (ret < 0) {
+            return (sent > 0) ? (int)sent : ret;
+        }
+        for (int i = 0; i < ret; ++i) {
+            packets[sent + i].length = msgs[i].msg_len;
+        }
+        sent += ret;
+        if ((size_t)ret < n) {
+            break;
+        }
+    }
+    LOG_DEBUG(TRACE, "sent %u of %u packets", (unsigned)sent, (unsigned)count);
+    return sent;
+}
+
+int UDP::receivePackets(Packet* packets, size_t count, system_tick_t timeout) {
+    if (!isOpen(_sock) || !packets) {
+        return -1;
+    }
+    int flags = receiveFlags(_sock, timeout);
+    if (flags < 0) {
+        return flags;
+    }
+    sockaddr_storage addrs[MAX_PACKETS_PER_CALL];
+    struct iovec iov[MAX_PACKETS_PER_CALL];
+    sock_mmsghdr msgs[MAX_PACKETS_PER_CALL];
+    size_t received = 0;
+    while (received < count) {
+        const size_t n = std::min(count - received, MAX_PACKETS_PER_CALL);
+        for (size_t i = 0; i < n; ++i) {
+            Packet& p = packets[received + i];
+            iov[i].iov_base = p.buffer;
+            iov[i].iov_len = p.size;
+            msgs[i] = {};
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        const int ret = sock_recvmmsg(_sock, msgs, n, flags);
+        if (ret < 0) {
+            if (received > 0 || errno == EWOULDBLOCK || errno == EAGAIN) {
+                break;
+            }
+            return ret;
+        }
+        for (int i = 0; i < ret; ++i) {
+            Packet& p = packets[received + i];
+            p.length = msgs[i].msg_len;
+            detail::sockaddrToIpAddressPort((const struct sockaddr*)&addrs[i], p.remoteIP, &p.remotePort);
+        }
+        received += ret;
+        if ((size_t)ret < n) {
+            break;
+        }
+        // Only the first packet is waited for
+        flags |= MSG_DONTWAIT;
+    }
+    return received;
+}
+
 int UDP::read() {
     return available() ? _buffer[_offset++] : -1;
 }